@@ -13,9 +13,62 @@ struct aos_dc_ringbuffer
     char *buffer;
 };
 
+#define AOS_DC_PIPE_MAGIC 0x45504950 // "PIPE"
+
+/// frame size for pipes between processes, holds one ring per direction
+#define AOS_DC_PIPE_FRAME_SIZE (64 * 1024)
+
+/// messages the receive endpoint of an LMP channel holds by default
+#define AOS_DC_LMP_DEPTH 16
+
+/// messages the endpoint an LMP sender gets its credits on holds
+#define AOS_DC_LMP_CREDIT_DEPTH 4
+
+/**
+ * \brief one direction of a pipe, lives in the shared frame
+ *
+ * head and tail count all bytes ever written and read. Each side only writes
+ * its own counter, they are on separate cache lines.
+ */
+struct aos_dc_pipe_ring
+{
+    volatile size_t head __attribute__((aligned(64)));
+    volatile uint32_t closed;   ///< set by the writer after its last byte
+
+    volatile size_t tail __attribute__((aligned(64)));
+};
+
+/**
+ * \brief control block at the start of a pipe frame, data follows it
+ */
+struct aos_dc_pipe_ctl
+{
+    uint32_t magic;
+    uint32_t ring_size;         ///< data bytes per direction
+
+    struct aos_dc_pipe_ring ring[2];
+};
+
+/**
+ * \brief local end of a pipe
+ */
+struct aos_dc_pipe
+{
+    struct aos_dc_pipe_ring *send;
+    char *send_data;
+    struct aos_dc_pipe_ring *recv;
+    char *recv_data;
+    size_t size;
+
+    /// the receive side is polled by the waitset like a UMP channel
+    struct waitset_chanstate waitset_state;
+};
+
 /**
  * \brief channel with a receive buffer
  * 
+ * Pipe channels (backend AOS_DC_PIPE) copy straight between the shared frame
+ * and the caller, they don't use the receive buffer.
  */
 struct aos_datachan
 {
@@ -24,6 +77,7 @@ struct aos_datachan
     union {
         struct lmp_chan lmp;
         struct ump_chan ump;
+        struct aos_dc_pipe pipe;
     } channel;
 
     bool is_closed;
@@ -43,7 +97,14 @@ size_t aos_dc_bytes_available(struct aos_dc_ringbuffer *buf);
 
 
 errval_t aos_dc_init_lmp(struct aos_datachan *dc, size_t buffer_length);
+errval_t aos_dc_create_lmp_endpoint(struct aos_datachan *dc, uint32_t depth, struct capref *ret_ep);
 errval_t aos_dc_init_ump(struct aos_datachan *dc, size_t buffer_length, lvaddr_t ump_page, size_t ump_page_size, bool first_half);
+errval_t aos_dc_init_pipe(struct aos_datachan *dc, lvaddr_t frame, size_t frame_size, bool first_half);
+errval_t aos_dc_init_frame(struct aos_datachan *dc, size_t buffer_length, lvaddr_t frame, size_t frame_size, bool first_half);
+
+void aos_dc_pipe_format(lvaddr_t frame, size_t frame_size);
+bool aos_dc_pipe_is_formatted(lvaddr_t frame);
+bool aos_dc_pipe_can_receive(struct aos_dc_pipe *pipe);
 errval_t aos_dc_free(struct aos_datachan *dc);
 
 
@@ -83,6 +144,17 @@ errval_t aos_dc_receive(struct aos_datachan *dc, size_t bytes, char *data, size_
 
 errval_t aos_dc_receive_all(struct aos_datachan *dc, size_t bytes, char *data);
 
+/**
+ * \brief send what can be received on `from` without blocking over `to`
+ *
+ * Pipes hand their ring memory to aos_dc_send() directly, other channels go
+ * through a bounce buffer.
+ *
+ * \param max upper bound of bytes to move
+ * \param forwarded set to the number of bytes sent
+ */
+errval_t aos_dc_forward(struct aos_datachan *to, struct aos_datachan *from, size_t max, size_t *forwarded);
+
 /**
  * \brief register a handler to be notified whenever somethin can be received on this channel
  */
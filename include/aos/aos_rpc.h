@@ -31,6 +31,7 @@
 enum aos_rpc_backend {
     AOS_RPC_LMP = 1,
     AOS_RPC_UMP = 2,
+    AOS_DC_PIPE = 3,    ///< aos_datachan only, see aos_dc_init_pipe()
 };
 
 /**
@@ -174,6 +175,10 @@ errval_t aos_rpc_serial_putchar(struct aos_rpc *chan, char c);
 errval_t aos_rpc_process_spawn(struct aos_rpc *chan, char *cmdline,
                                coreid_t core, domainid_t *newpid);
 
+errval_t aos_rpc_process_spawn_clone(struct aos_rpc *chan, char *cmdline,
+                                     coreid_t core, struct capref state,
+                                     domainid_t *newpid);
+
 errval_t aos_rpc_process_get_name(struct aos_rpc *chan, domainid_t pid,
                                   char **name);
 
@@ -193,6 +198,17 @@ struct aos_rpc *aos_rpc_get_serial_channel(void);
 
 errval_t aos_rpc_request_foreign_ram(struct aos_rpc * rpc, size_t size,struct capref *ret_cap,size_t * ret_size);
 
+/// Most caps in one batch, the packed caps must fit the 4K varbytes scratch of a UMP server
+#define AOS_RPC_CAP_BATCH_MAX 128
+
+errval_t aos_rpc_cap_batch_pack(struct capref *caps, size_t n,
+                                struct aos_rpc_varbytes *out);
+errval_t aos_rpc_cap_batch_forge(struct aos_rpc_varbytes in, struct capref *caps,
+                                 size_t *n);
+errval_t aos_rpc_request_foreign_ram_batch(struct aos_rpc *rpc, size_t chunk_size,
+                                           size_t n_chunks, struct capref *caps,
+                                           size_t *n_ret);
+
 void aos_rpc_set_timeout(struct aos_rpc * rpc, uint64_t timeout);
 
 
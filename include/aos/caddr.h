@@ -105,7 +105,7 @@ extern struct cnoderef cnode_root, cnode_task, cnode_base, cnode_super,
 extern struct capref cap_root, cap_monitorep, cap_irq, cap_io, cap_dispatcher,
                      cap_selfep, cap_mmep, cap_kernel, cap_initep, cap_perfmon, cap_dispframe,
                      cap_sessionid, cap_ipi, cap_vroot, cap_argcn, cap_procmng,
-                     cap_domainid, cap_bootinfo, cap_mmstrings;
+                     cap_domainid, cap_bootinfo, cap_mmstrings, cap_tracebuf;
 
 /**
  * \brief Returns the depth in the CSpace address of a cap
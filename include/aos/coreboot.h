@@ -19,6 +19,16 @@
 
 __BEGIN_DECLS
 
+/**
+ * \brief Map the boot modules and look up their entry points once
+ *
+ * Called by coreboot() as well, calling it up front keeps the first core
+ * from paying for it.
+ */
+errval_t coreboot_prepare_images(const char *boot_driver,
+                                 const char *cpu_driver,
+                                 const char *init);
+
 /**
  * \brief Boot a core
  *
@@ -29,7 +29,8 @@
 #define TASKCN_SLOT_STDOUT_CAP  (TASKCN_SLOTS_USER+4)   ///< stdout endpoint
 #define TASKCN_SLOT_STDIN_CAP   (TASKCN_SLOTS_USER+5)   ///< stdin capability
 // #define TASKCN_SLOT_NAMESERVER (TASKCN_SLOTS_USER+5)    ///< nameserver endpoint
-#define TASKCN_SLOTS_FREE       (TASKCN_SLOTS_USER+6)   ///< first free slot in taskcn
+#define TASKCN_SLOT_CLONE_STATE (TASKCN_SLOTS_USER+6)   ///< state frame passed by spawn_clone()
+#define TASKCN_SLOTS_FREE       (TASKCN_SLOTS_USER+7)   ///< first free slot in taskcn
 
 // taskcn appears at the beginning of cspace, so the cptrs match the slot numbers
 #define CPTR_ROOTCN     TASKCN_SLOT_ROOTCN      ///< Cptr to init's root CNode
@@ -28,6 +28,8 @@ enum {
     INIT_MULTI_HOP_CON,
     INIT_BINDING_REQUEST,
     INIT_IFACE_GET_ALL_MODULES,
+    INIT_IFACE_GET_RAM_BATCH,       ///< ram chunks for another core, see aos_rpc_cap_batch_pack()
+    INIT_IFACE_SPAWN_CLONE,         ///< spawn with a copy-on-write state frame, see spawn_clone()
     INIT_IFACE_N_FUNCTIONS, // <- count -- must be last
 };
 
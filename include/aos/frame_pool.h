@@ -0,0 +1,37 @@
+/**
+ * \file
+ * \brief Pool of ready base page frames, kept filled by a background thread
+ */
+
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef LIBBARRELFISH_FRAME_POOL_H
+#define LIBBARRELFISH_FRAME_POOL_H
+
+#include <aos/aos.h>
+
+/// Most frames the pool can hold
+#define FRAME_POOL_MAX_FRAMES 256
+
+struct frame_pool_tunables {
+    size_t target;      ///< frames the pool is topped up to, 0 disables it
+    size_t low_water;   ///< the refill thread wakes up below this many frames
+    size_t batch;       ///< frames the refill thread allocates before it yields
+};
+
+errval_t frame_pool_init(void);
+errval_t frame_pool_alloc(struct capref *frame);
+errval_t frame_pool_alloc_lazy(struct capref *frame);
+size_t frame_pool_count(void);
+
+void frame_pool_get_tunables(struct frame_pool_tunables *tunables);
+void frame_pool_set_tunables(const struct frame_pool_tunables *tunables);
+
+#endif // LIBBARRELFISH_FRAME_POOL_H
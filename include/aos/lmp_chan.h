@@ -42,7 +42,12 @@ struct lmp_chan {
 
     size_t buflen_words;    ///< requested LMP buffer length, in words
 
-    
+    /// credit based flow control of a one-way stream, see lmp_chan_fc_init()
+    struct {
+        uint32_t credits;   ///< messages we may send before the peer grants more
+        uint32_t window;    ///< messages our endpoint holds, granted to the peer
+        uint32_t consumed;  ///< messages received but not yet granted back
+    } fc;
 };
 
 void lmp_chan_init(struct lmp_chan *lc);
@@ -55,6 +60,19 @@ errval_t lmp_chan_deregister_send(struct lmp_chan *lc);
 void lmp_chan_migrate_send(struct lmp_chan *lc, struct waitset *ws);
 errval_t lmp_chan_alloc_recv_slot(struct lmp_chan *lc);
 void lmp_channels_retry_send_disabled(dispatcher_handle_t handle);
+errval_t lmp_chan_send_wait(struct lmp_chan *lc, lmp_send_flags_t flags,
+                            struct capref send_cap, uint8_t length_words,
+                            uintptr_t arg1, uintptr_t arg2,
+                            uintptr_t arg3, uintptr_t arg4);
+errval_t lmp_chan_send_long_wait(struct lmp_chan *lc, lmp_send_flags_t flags,
+                                 struct capref send_cap, uint8_t length_words,
+                                 const uintptr_t *words);
+void lmp_chan_fc_init(struct lmp_chan *lc, uint32_t window);
+errval_t lmp_chan_fc_send(struct lmp_chan *lc, lmp_send_flags_t flags,
+                          struct capref send_cap, uintptr_t arg1,
+                          uintptr_t arg2, uintptr_t arg3, uintptr_t arg4);
+errval_t lmp_chan_fc_grant(struct lmp_chan *lc, struct capref peer_ep);
+errval_t lmp_chan_fc_consumed(struct lmp_chan *lc);
 
 /**
  * \brief Register an event handler to be notified when messages can be received
@@ -115,6 +133,20 @@ static inline errval_t lmp_chan_recv(struct lmp_chan *lc,
     return lmp_endpoint_recv(lc->endpoint, &msg->buf, cap);
 }
 
+/**
+ * \brief Receive a message of up to #LMP_LONG_MSG_LENGTH words, if possible
+ *
+ * Same as lmp_chan_recv(), msg->buf.msglen is set to the words received.
+ */
+static inline errval_t lmp_chan_recv_long(struct lmp_chan *lc,
+                                          struct lmp_recv_long_msg *msg,
+                                          struct capref *cap)
+{
+    assert(msg != NULL);
+    assert(msg->buf.buflen == LMP_LONG_MSG_LENGTH);
+    return lmp_endpoint_recv(lc->endpoint, &msg->buf, cap);
+}
+
 /**
  * \brief Check if a channel has data to receive
  */
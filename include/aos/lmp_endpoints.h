@@ -24,11 +24,18 @@
 
 __BEGIN_DECLS
 
-/// In-endpoint size of a maximum-sized LMP message plus header
-#define LMP_RECV_LENGTH         (LMP_MSG_LENGTH + LMP_RECV_HEADER_LENGTH)
+/// In-endpoint size of a maximum-sized (long) LMP message plus header
+#define LMP_RECV_LENGTH         (LMP_LONG_MSG_LENGTH + LMP_RECV_HEADER_LENGTH)
+
+/// Endpoint buffer size (in words) that holds n maximum-sized messages, the
+/// kernel always leaves one word free
+#define LMP_BUF_WORDS(n)        ((n) * LMP_RECV_LENGTH + 1)
+
+/// Default number of messages an LMP endpoint buffer holds
+#define DEFAULT_LMP_BUF_DEPTH           8
 
 /// Default size of LMP endpoint buffer (in words), must be >= LMP_RECV_LENGTH
-#define DEFAULT_LMP_BUF_WORDS           (LMP_RECV_LENGTH * 2)
+#define DEFAULT_LMP_BUF_WORDS           LMP_BUF_WORDS(DEFAULT_LMP_BUF_DEPTH)
 
 /// LMP endpoint structure (including data accessed only by user code)
 struct lmp_endpoint {
@@ -67,6 +74,15 @@ struct lmp_recv_msg {
 /// Static initialiser for lmp_recv_msg
 #define LMP_RECV_MSG_INIT (struct lmp_recv_msg) { .buf.buflen = LMP_MSG_LENGTH };
 
+/// Fixed-length buffer for messages of up to #LMP_LONG_MSG_LENGTH words
+struct lmp_recv_long_msg {
+    struct lmp_recv_buf buf;
+    uintptr_t words[LMP_LONG_MSG_LENGTH]; ///< Payload (fixed length)
+};
+
+/// Static initialiser for lmp_recv_long_msg
+#define LMP_RECV_LONG_MSG_INIT (struct lmp_recv_long_msg) { .buf.buflen = LMP_LONG_MSG_LENGTH }
+
 errval_t lmp_endpoint_alloc(size_t buflen, struct lmp_endpoint **retep);
 void lmp_endpoint_free(struct lmp_endpoint *ep);
 errval_t lmp_endpoint_create_in_slot(size_t buflen, struct capref dest,
@@ -0,0 +1,66 @@
+/**
+ * \file
+ * \brief Tap of the software NIC of the enet driver
+ *
+ * When the enet driver runs on its software NIC (`enet soft`), one domain can
+ * attach to the wire. It shares a frame with the driver that holds two rings
+ * of Ethernet frames: to_nic carries frames into the driver as if they were
+ * received from the network, from_nic carries the frames the driver
+ * transmits. Without a tap, the software NIC loops transmitted frames back.
+ *
+ * Ring indices run freely and are reduced modulo NET_TAP_SLOTS, the producer
+ * advances head and the consumer advances tail.
+ */
+
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef INCLUDE_AOS_NET_TAP_H_
+#define INCLUDE_AOS_NET_TAP_H_
+
+#include <aos/aos.h>
+
+// not direct, the attach request carries the shared frame
+#define NET_TAP_SERVICE_NAME    "/ethernet/tap"
+
+#define NET_TAP_SLOTS           256
+#define NET_TAP_SLOT_SIZE       2048
+
+enum net_tap_cmd {
+    NET_TAP_ATTACH,     ///< the frame comes along as capability
+    NET_TAP_DETACH
+};
+
+struct net_tap_ring {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t dropped;      ///< frames the producer had no room for
+    uint16_t len[NET_TAP_SLOTS];
+};
+
+struct net_tap_shm {
+    struct net_tap_ring to_nic;
+    struct net_tap_ring from_nic;
+};
+
+#define NET_TAP_TO_NIC_BUFS     BASE_PAGE_SIZE
+#define NET_TAP_FROM_NIC_BUFS   (NET_TAP_TO_NIC_BUFS + NET_TAP_SLOTS * NET_TAP_SLOT_SIZE)
+#define NET_TAP_SIZE            (NET_TAP_FROM_NIC_BUFS + NET_TAP_SLOTS * NET_TAP_SLOT_SIZE)
+
+static inline char *net_tap_to_nic_buf(struct net_tap_shm *shm, uint32_t idx)
+{
+    return (char *) shm + NET_TAP_TO_NIC_BUFS + (idx % NET_TAP_SLOTS) * NET_TAP_SLOT_SIZE;
+}
+
+static inline char *net_tap_from_nic_buf(struct net_tap_shm *shm, uint32_t idx)
+{
+    return (char *) shm + NET_TAP_FROM_NIC_BUFS + (idx % NET_TAP_SLOTS) * NET_TAP_SLOT_SIZE;
+}
+
+#endif /* INCLUDE_AOS_NET_TAP_H_ */
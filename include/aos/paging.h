@@ -112,6 +112,21 @@ errval_t paging_spt_find(struct paging_state *st, int level,
 errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
                                struct capref frame, size_t bytes, int flags);
 
+/**
+ * Copy-on-write mappings. The frame cap is owned by the mapping afterwards,
+ * hand copies of it to other domains to share the frame with them.
+ */
+/// Map user provided frame copy-on-write while allocating VA space for it
+errval_t paging_map_frame_cow(struct paging_state *st, void **buf,
+                              size_t bytes, struct capref frame);
+
+/// Turn the writable mapping of the whole frame at buf into a copy-on-write one
+errval_t paging_protect_cow(struct paging_state *st, void *buf,
+                            struct capref frame);
+
+/// Map the state this domain was started with by spawn_clone(), copy-on-write
+errval_t paging_map_clone_state(void **buf, size_t *bytes);
+
 /**
  * refill slab allocator without causing a page fault
  * 
@@ -127,6 +142,9 @@ errval_t slab_refill_no_pagefault(struct slab_allocator *slabs,
  */
 errval_t paging_unmap(struct paging_state *st, const void *region);
 
+/// Unmap a frame that was mapped at buf with one of the paging_map_frame functions
+errval_t paging_unmap_frame(struct paging_state *st, void *buf, size_t bytes);
+
 
 /// Map user provided frame while allocating VA space for it
 static inline errval_t paging_map_frame(struct paging_state *st, void **buf,
@@ -97,6 +97,22 @@ struct mapping_table
 };
 
 
+/**
+ * \brief a frame mapped copy-on-write
+ *
+ * Every page of the range is mapped read-only on its own, the first write to
+ * a page replaces it with a private copy.
+ */
+struct paging_cow_range {
+    lvaddr_t base;
+    size_t bytes;
+    struct capref frame;            ///< shared frame, deleted once no page maps it
+    size_t shared_pages;            ///< pages that still map the shared frame
+    struct paging_cow_range *next;
+    uint8_t copied[];               ///< one bit per page that has its own copy
+};
+
+
 // struct to store the paging status of a process
 struct paging_state {
     struct thread_mutex mutex;
@@ -115,6 +131,8 @@ struct paging_state {
     struct paging_region heap_region;   // Heap region
     struct paging_region meta_region;   // Meta region
     struct paging_region stack_region;  // Stack region
+
+    struct paging_cow_range *cow_ranges;    // Frames mapped copy-on-write
 };
 
 
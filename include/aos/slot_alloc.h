@@ -57,12 +57,28 @@ struct multi_slot_allocator {
 
     struct slot_allocator_list *head; ///< List of single slot allocators
     struct slot_allocator_list *reserve; ///< One single allocator in reserve
+    struct thread *grower;           ///< Thread growing the allocator, or NULL
 
     struct slab_allocator slab;      ///< Slab backing the slot_allocator_list
 
     struct paging_region region;
 };
 
+/// Slots a thread takes from the default allocator at once, see slot_alloc()
+#define SLOT_MAGAZINE_SIZE 32
+
+/**
+ * \brief Run of free slots owned by a single thread
+ *
+ * Only the owning thread touches it, so it needs no lock.
+ */
+struct slot_magazine {
+    struct cnoderef cnode;  ///< L2 CNode of the run
+    cslot_t next;           ///< First slot of the run
+    cslot_t count;          ///< Slots left in the run
+    bool busy;              ///< Being refilled, nested calls bypass it
+};
+
 struct range_slot_allocator {
     struct capref cnode_cap;     ///< capref for the L1 cnode
     struct cnoderef cnode;       ///< cnoderef for the cnode to allocate from
@@ -98,6 +114,7 @@ errval_t two_level_slot_alloc_init_raw(struct multi_slot_allocator *ret,
 errval_t slot_alloc_init(void);
 struct slot_allocator *get_default_slot_allocator(void);
 errval_t slot_alloc(struct capref *ret);
+errval_t slot_alloc_n(cslot_t n, struct capref *ret);
 
 /// Root slot allocator functions
 errval_t slot_alloc_root(struct capref *ret);
@@ -105,6 +122,8 @@ typedef errval_t (*cn_ram_alloc_func_t)(void *st, size_t reqbits, struct capref
 errval_t root_slot_allocator_refill(cn_ram_alloc_func_t myalloc, void *allocst);
 
 errval_t slot_free(struct capref ret);
+errval_t slot_free_n(struct capref first, cslot_t n);
+void slot_magazine_drain(struct slot_magazine *mag);
 
 // additional slot freeing function for possible mm
 extern errval_t (*slot_free_other)(struct capref ret);
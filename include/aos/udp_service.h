@@ -1,4 +1,9 @@
+#ifndef INCLUDE_AOS_UDP_SERVICE_H_
+#define INCLUDE_AOS_UDP_SERVICE_H_
+
 #define ENET_SERVICE_NAME "/ethernet"
+// not direct, used to hand the socket rings to the driver
+#define ENET_SHM_SERVICE_NAME "/ethernet/shm"
 #define MAX_PAYLOAD_LEN 1494
 #include <aos/nameserver.h>
 
@@ -10,11 +15,14 @@ enum udp_service_messagetype {
     DESTROY,
     ARP_TBL,
     ICMP_PING_SEND,
-    ICMP_PING_RECV
+    ICMP_PING_RECV,
+    TX_KICK,
+    RX_NOTIFY
 };
 
 struct udp_socket_create_info {
     uint16_t f_port;
+    uint16_t rx_depth;  ///< RX slots the driver may fill, 0 for all
     uint32_t ip_dest;
 };
 
@@ -27,13 +35,108 @@ struct udp_service_message {
     char data[0];
 } __attribute__((__packed__));
 
+/*
+ * Every socket is backed by one frame shared between the application and the
+ * driver, which holds an RX and a TX descriptor ring and the packet buffers of
+ * both. The driver registers the frame with its TX devq, so the NIC sends
+ * straight out of the application's TX buffers, and it writes received
+ * payloads directly into the RX buffers. Only the TX doorbell (TX_KICK)
+ * crosses IPC.
+ *
+ * Ring indices run freely and are reduced modulo UDP_RING_SLOTS. RX: the
+ * driver produces at head, the application consumes at tail. TX: the
+ * application produces at head, the driver consumes at tail, and slots before
+ * done have been sent and may be refilled. The driver queues at most the RX
+ * depth given at CREATE and counts what it has to drop in rx.dropped.
+ *
+ * An application that runs out of packets can park instead of polling: it
+ * sets rx.wait and blocks on an LMP endpoint it handed to the driver with
+ * RX_NOTIFY. The driver clears rx.wait and signals the endpoint the next time
+ * it fills the RX ring.
+ */
+#define UDP_RING_SLOTS          64
+#define UDP_RING_SLOT_SIZE      2048
+/// room for the ETH/IP/UDP headers in front of a TX payload
+#define UDP_RING_HEADROOM       64
+#define UDP_RING_MAX_PAYLOAD    MAX_PAYLOAD_LEN
+
+struct udp_ring_desc {
+    uint32_t ip;        ///< peer address
+    uint16_t port;      ///< peer port
+    uint16_t len;       ///< payload length
+};
+
+struct udp_ring {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t done;         ///< TX only
+    volatile uint32_t dropped;      ///< ring full (RX) or not sendable (TX)
+    volatile uint32_t wait;         ///< RX only, the application is parked
+    struct udp_ring_desc desc[UDP_RING_SLOTS];
+};
+
+struct udp_shm {
+    struct udp_ring rx;
+    struct udp_ring tx;
+};
+
+#define UDP_SHM_RX_BUFS     BASE_PAGE_SIZE
+#define UDP_SHM_TX_BUFS     (UDP_SHM_RX_BUFS + UDP_RING_SLOTS * UDP_RING_SLOT_SIZE)
+#define UDP_SHM_SIZE        (UDP_SHM_TX_BUFS + UDP_RING_SLOTS * UDP_RING_SLOT_SIZE)
+
+/// offset of the buffer of an RX slot from the start of the shared frame
+static inline size_t udp_shm_rx_offset(uint32_t idx)
+{
+    return UDP_SHM_RX_BUFS + (idx % UDP_RING_SLOTS) * UDP_RING_SLOT_SIZE;
+}
+
+/// offset of the buffer of a TX slot, the payload starts UDP_RING_HEADROOM in
+static inline size_t udp_shm_tx_offset(uint32_t idx)
+{
+    return UDP_SHM_TX_BUFS + (idx % UDP_RING_SLOTS) * UDP_RING_SLOT_SIZE;
+}
+
+/// wake up a parked receiver this often, in case a notification got lost
+#define UDP_RX_WAIT_RECHECK_US  10000
+
 struct aos_socket {
     uint16_t f_port;  // foreign port
     uint16_t l_port;  // local port
     uint32_t ip_dest;
     nameservice_chan_t _nschan;
+    nameservice_chan_t _shmchan;
+
+    struct udp_shm *shm;        ///< rings shared with the driver
+    struct capref shm_frame;
+    uint32_t tx_next;           ///< next TX slot handed out by aos_socket_tx_get
+
+    // blocking receive, set up on the first aos_socket_rx_wait()
+    struct waitset rx_ws;
+    struct lmp_endpoint *rx_ep;
+    struct capref rx_ep_cap;
+    bool rx_armed;              ///< rx_ep is registered on rx_ws
 };
 
+/// A packet buffer in the rings of a socket
+struct aos_socket_buf {
+    uint32_t ip;
+    uint16_t port;
+    uint16_t len;
+    char *data;
+    uint32_t idx;
+};
+
+/// One datagram of a batched receive or send
+struct aos_socket_mmsg {
+    uint32_t ip;
+    uint16_t port;
+    uint16_t len;       ///< payload length, buffer size on receive
+    void *data;
+};
+
+/// Flags for aos_socket_recvmmsg()
+#define AOS_SOCKET_WAIT     0x1     ///< block until at least one datagram arrived
+
 struct aos_ping_socket {
     uint32_t ip;
     nameservice_chan_t _nschan;
@@ -47,6 +150,9 @@ struct udp_msg {
 } __attribute__((__packed__));
 
 errval_t aos_socket_initialize(struct aos_socket *sockref, uint32_t ip_dest, uint16_t f_port, uint16_t l_port);
+errval_t aos_socket_initialize_depth(struct aos_socket *sockref, uint32_t ip_dest,
+                                     uint16_t f_port, uint16_t l_port,
+                                     uint16_t rx_depth);
 
 errval_t aos_socket_send(struct aos_socket *sockref, void *data, uint16_t len);
 
@@ -56,6 +162,24 @@ errval_t aos_socket_receive(struct aos_socket *sockref, struct udp_msg *retptr);
 
 errval_t aos_socket_teardown(struct aos_socket *sockref);
 
+errval_t aos_socket_rx_next(struct aos_socket *sockref, struct aos_socket_buf *buf);
+
+void aos_socket_rx_release(struct aos_socket *sockref, struct aos_socket_buf *buf);
+
+errval_t aos_socket_tx_get(struct aos_socket *sockref, struct aos_socket_buf *buf);
+
+void aos_socket_tx_put(struct aos_socket *sockref, struct aos_socket_buf *buf);
+
+errval_t aos_socket_tx_kick(struct aos_socket *sockref);
+
+errval_t aos_socket_rx_wait(struct aos_socket *sockref);
+
+errval_t aos_socket_recvmmsg(struct aos_socket *sockref, struct aos_socket_mmsg *msgs,
+                             size_t n, int flags, size_t *ret_n);
+
+errval_t aos_socket_sendmmsg(struct aos_socket *sockref, struct aos_socket_mmsg *msgs,
+                             size_t n, size_t *ret_n);
+
 void aos_arp_table_get(char *rtptr);
 
 errval_t aos_ping_init(struct aos_ping_socket *s, uint32_t ip);
@@ -63,3 +187,5 @@ errval_t aos_ping_init(struct aos_ping_socket *s, uint32_t ip);
 errval_t aos_ping_send(struct aos_ping_socket *s);
 
 uint16_t aos_ping_recv(struct aos_ping_socket *s);
+
+#endif /* INCLUDE_AOS_UDP_SERVICE_H_ */
@@ -49,6 +49,7 @@ enum ws_chantype {
     CHANTYPE_LMP_IN,
     CHANTYPE_LMP_OUT,
     CHANTYPE_UMP_IN,
+    CHANTYPE_DC_PIPE_IN, ///< Shared memory pipe of an aos_datachan
     CHANTYPE_DEFERRED, ///< Timer events
     CHANTYPE_EVENT_QUEUE,
     CHANTYPE_OTHER
@@ -61,6 +62,7 @@ inline bool ws_chantype_is_polled(enum ws_chantype t)
 {
     switch (t) {
         case CHANTYPE_UMP_IN:
+        case CHANTYPE_DC_PIPE_IN:
             return true;
         default:
             return false;
@@ -53,12 +53,50 @@ lmp_ep_send(
 
     assert(length_words <= LMP_MSG_LENGTH);
 
-    return syscall7((length_words << 28) | ((flags & 0xf) << 24) |
+    return syscall7(((uintptr_t)length_words << 32) | ((flags & 0xff) << 24) |
                     (invoke_level << 16) | (send_level << 8) | SYSCALL_INVOKE,
                     invoke_cptr, send_cptr,
                     arg1, arg2, arg3, arg4).error;
 }
 
+/**
+ * \brief Send a long message on the given LMP channel, if possible
+ *
+ * Same as lmp_ep_send(), but carries up to #LMP_LONG_MSG_LENGTH words in
+ * one system call. The receiver's endpoint has to have room for a message
+ * of this length, and receive it into a big enough buffer.
+ *
+ * \param words Message payload, #LMP_LONG_MSG_LENGTH words are read
+ */
+static inline errval_t
+lmp_ep_send_long(
+    struct capref ep,
+    lmp_send_flags_t flags,
+    struct capref send_cap,
+    uint8_t length_words,
+    const uintptr_t *words
+    )
+{
+    if (length_words <= LMP_MSG_LENGTH) {
+        return lmp_ep_send(ep, flags, send_cap, length_words,
+                           words[0], words[1], words[2], words[3]);
+    }
+
+    uint8_t invoke_level = get_cap_level(ep);
+    capaddr_t invoke_cptr = get_cap_addr(ep);
+
+    uint8_t send_level = get_cap_level(send_cap);
+    capaddr_t send_cptr = get_cap_addr(send_cap);
+
+    assert(length_words <= LMP_LONG_MSG_LENGTH);
+
+    return syscall12(((uintptr_t)length_words << 32) | ((flags & 0xff) << 24) |
+                     (invoke_level << 16) | (send_level << 8) | SYSCALL_INVOKE,
+                     invoke_cptr, send_cptr,
+                     words[0], words[1], words[2], words[3], words[4],
+                     words[5], words[6], words[7], words[8]).error;
+}
+
 #define lmp_ep_send4(ep, flags, send_cap, a, b, c, d) \
   lmp_ep_send((ep), (flags), (send_cap), 4, (a), (b), (c), (d))
 #define lmp_ep_send3(ep, flags, send_cap, a, b, c) \
@@ -73,6 +111,9 @@ lmp_ep_send(
 #define lmp_chan_send(lc, flags, send_cap, len, a, b, c, d) \
   lmp_ep_send((lc)->remote_cap, (flags), (send_cap), (len), (a), (b), (c), (d))
 
+#define lmp_chan_send_long(lc, flags, send_cap, len, words) \
+  lmp_ep_send_long((lc)->remote_cap, (flags), (send_cap), (len), (words))
+
 #define lmp_chan_send4(lc, flags, send_cap, a, b, c, d) \
   lmp_ep_send4((lc)->remote_cap, (flags), (send_cap), (a), (b), (c), (d))
 #define lmp_chan_send3(lc, flags, send_cap, a, b, c) \
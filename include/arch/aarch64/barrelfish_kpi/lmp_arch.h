@@ -24,4 +24,12 @@
 #define LMP_MSG_LENGTH          4
 #define LRPC_MSG_LENGTH         0
 
+/**
+ * \brief Maximum payload of a long LMP message
+ *
+ * Long messages continue the payload in x7-x11, the remaining syscall
+ * argument registers, which the kernel saves to the trap frame on entry.
+ */
+#define LMP_LONG_MSG_LENGTH     9
+
 #endif // ARCH_AARCH64_BARRELFISH_KPI_LMP_H
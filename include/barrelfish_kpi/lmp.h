@@ -38,10 +38,14 @@ typedef enum lmp_send_flag {
     LMP_FLAG_YIELD      = 1 << 1,
     LMP_FLAG_GIVEAWAY   = 1 << 2,
     LMP_FLAG_IDENTIFY   = 1 << 3,
+    LMP_FLAG_CALL       = 1 << 4,   ///< Switch to receiver, which will reply
+    LMP_FLAG_REPLY      = 1 << 5,   ///< Switch back to a caller waiting for this
 } lmp_send_flags_t;
 
 
 #define LMP_SEND_FLAGS_DEFAULT (LMP_FLAG_SYNC | LMP_FLAG_YIELD)
+#define LMP_SEND_FLAGS_CALL    (LMP_FLAG_CALL | LMP_FLAG_YIELD)
+#define LMP_SEND_FLAGS_REPLY   (LMP_FLAG_REPLY | LMP_FLAG_YIELD)
 
 /**
  * \brief LMP receiver-side header.
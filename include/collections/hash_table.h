@@ -17,17 +17,38 @@
 #include "collections/list.h"
 
 /*
- * a simple hash table. 
+ * An open addressing hash table with Robin Hood linear probing. Keys and data
+ * are stored in the slot array, inserting does not allocate. When the table
+ * fills up, a table twice the size is allocated and the old slots are moved
+ * over a few at a time by the following operations.
  */
 
 typedef void (* collections_hash_data_free)(void *);
 
+/*
+ * Structure of a hash table element.
+ */
+typedef struct	_collections_hash_elem {
+
+	uint64_t	key;
+
+	void	*data;
+
+	// distance from the home slot plus one, 0 if the slot is empty
+	uint32_t	dist;
+} collections_hash_elem;
+
 typedef struct	_collections_hash_table {
-	// number of buckets in the table.
-	int			num_buckets;
+	// number of slots in the table, a power of two.
+	uint32_t	num_slots;
 
-	// pointer to the buckets.
-	collections_listnode	**buckets;
+	// the slots.
+	collections_hash_elem	*slots;
+
+	// table being moved into slots after a resize, NULL otherwise.
+	collections_hash_elem	*old_slots;
+	uint32_t	old_num_slots;
+	uint32_t	old_next;
 
 	// total number of elements in the table.
 	uint32_t	num_elems;
@@ -40,17 +61,8 @@ typedef struct	_collections_hash_table {
 	int32_t		cur_bucket_num;
 } collections_hash_table;
 
-/*
- * Structure of a hash table element.
- */
-typedef struct	_collections_hash_elem {
-
-	uint64_t	key;
-
-	void	*data;
-} collections_hash_elem;
-
-#define NUM_BUCKETS	1013
+// initial number of slots of collections_hash_create()
+#define COLLECTIONS_HASH_MIN_SLOTS	16
 
 #ifdef __cplusplus
 extern "C" {
@@ -10,6 +10,9 @@
 #ifndef ENET_DEVIF_H
 #define ENET_DEVIF_H
 
+/// RX enqueue flag: don't activate the ring, devq_notify() does for a batch
+#define ENET_RXQ_FLAG_BATCH (1ULL << 32)
+
 struct enet_queue;
 struct enet_t;
 
@@ -20,8 +20,14 @@
 
 __BEGIN_DECLS
 
+/// keys up to this length are copied into the entry
+#define HT_INLINE_KEY_LEN 24
+
 /**
- * \brief an entry of a hashtable
+ * \brief a slot of a hashtable
+ *
+ * Short keys live in key_inline, longer ones are referenced through key and
+ * have to stay valid while they are in the table.
  */
 struct _ht_entry {
     const void* key;
@@ -29,21 +35,29 @@ struct _ht_entry {
     void* value;
     struct capref capvalue;
     ENTRY_TYPE type;
-    int hash_value;
-    struct _ht_entry *next;
+    uint32_t dist;          ///< distance from the home slot + 1, 0 if empty
+    uint64_t hash_value;
+    char key_inline[HT_INLINE_KEY_LEN];
 };
 
 /**
  * \brief hashtable
+ *
+ * Open addressing with Robin Hood linear probing. When the table grows, the
+ * previous slot array is kept in old_entries and drained a few slots per
+ * put and remove.
  */
 struct hashtable {
     struct dictionary d;
     int table_length;
     int entry_count;
-    struct _ht_entry **entries;
+    struct _ht_entry *entries;
     int threshold;
     int capacity;
     int load_factor;
+    struct _ht_entry *old_entries;
+    int old_length;
+    int old_next;
 };
 
 /**
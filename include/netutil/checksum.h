@@ -34,6 +34,7 @@
  */
 
 
+#include <stddef.h>
 #include <stdint.h>
 
 /**
@@ -41,4 +42,18 @@
  */
 uint16_t inet_checksum(void *dataptr, uint16_t len);
 
+/*
+ * Checksums over several pieces (e.g. pseudo header, header and payload):
+ * start with 0 or inet_pseudo_sum(), chain inet_checksum_partial() and store
+ * inet_checksum_fold() of the result. A received packet is intact if the fold
+ * over it, checksum field included, is 0.
+ */
+uint32_t inet_checksum_partial(const void *dataptr, size_t len, uint32_t sum);
+uint16_t inet_checksum_fold(uint32_t sum);
+uint32_t inet_pseudo_sum(uint32_t src, uint32_t dest, uint8_t proto,
+                         uint16_t len);
+
+/// byte-serial inet_checksum(), as reference
+uint16_t inet_checksum_ref(void *dataptr, uint16_t len);
+
 #endif
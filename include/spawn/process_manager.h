@@ -7,6 +7,7 @@
 
 
 struct spawninfo *spawn_create_spawninfo(void);
+errval_t spawn_index_pid(struct spawninfo *si);
 struct aos_rpc *get_rpc_from_spawn_info(domainid_t pid);
 struct spawninfo *get_si_from_rpc(struct aos_rpc * rpc);
 // domainid_t spawn_get_new_domainid(void);
@@ -18,6 +18,7 @@
 #include "aos/slot_alloc.h"
 #include "aos/paging.h"
 #include "aos/aos_rpc.h"
+#include "spawn/spawn_template.h"
 
 
 
@@ -45,6 +46,9 @@ struct spawninfo {
     lvaddr_t mapped_elf;
     size_t mapped_elf_size;
 
+    // cached image of the binary, NULL if the ELF has to be loaded from mapped_elf
+    struct spawn_template *template;
+
     bool spawned;
     domainid_t pid;
 
@@ -61,6 +65,9 @@ struct spawninfo {
     struct capref child_stdin_cap;
     struct lmp_endpoint *child_stdout;
 
+    // frame the child maps copy-on-write with paging_map_clone_state()
+    struct capref child_clone_state_cap;
+
     // TODO(M2): Add fields you need to store state
     //           when spawning a new dispatcher,
     //           e.g. references to the child's
@@ -88,6 +95,10 @@ errval_t spawn_setup_dispatcher(int argc, const char *const argv[], struct spawn
                 domainid_t *pid);
 errval_t spawn_invoke_dispatcher(struct spawninfo *si);
 
+// Start a child that shares the state in a frame copy-on-write. Fills in si.
+errval_t spawn_clone(char *cmdline, struct capref state, struct spawninfo *si,
+                     domainid_t *pid);
+
 // Start a child with an explicit command line. Fills in si.
 errval_t spawn_load_argv(int argc, const char *const argv[], struct spawninfo *si,
                          domainid_t *pid);
@@ -0,0 +1,88 @@
+/**
+ * \file
+ * \brief Cache of pre-parsed and pre-loaded process images
+ */
+
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef _SPAWN_TEMPLATE_H_
+#define _SPAWN_TEMPLATE_H_
+
+#include <aos/aos.h>
+#include <aos/paging.h>
+
+#define SPAWN_TEMPLATE_MAX_SEGMENTS 8
+
+/**
+ * \brief CSpace (and top-level VNode) of a not yet created dispatcher
+ *
+ * Building this takes 256 RAM allocations for the base page CNode alone,
+ * so templates keep a spare one around for the next spawn.
+ */
+struct spawn_cspace {
+    struct capref rootcn;
+    struct cnoderef taskcn;
+    struct cnoderef basepagecn;
+    struct cnoderef pagecn;
+    struct cnoderef argcn;
+    struct cnoderef alloc0;
+    struct cnoderef alloc1;
+    struct cnoderef alloc2;
+
+    /// copy of the L0 VNode (which lives in slot 0 of pagecn) in our cspace
+    struct capref l0_vnode;
+};
+
+/**
+ * \brief One loadable segment of a template, already relocated
+ */
+struct spawn_template_segment {
+    genvaddr_t base;        ///< page aligned address in the child's vspace
+    size_t size;            ///< page aligned size of the segment
+    int flags;              ///< VREGION flags of the mapping in the child
+    struct capref frame;    ///< frame containing the loaded segment
+    void *mapped;           ///< where 'frame' is mapped in our vspace
+};
+
+/**
+ * \brief Everything about a binary that does not change between two spawns
+ */
+struct spawn_template {
+    struct spawn_template *next;
+
+    char *name;                 ///< module name as passed to multiboot_find_module
+    const char *opts;           ///< multiboot command line of the module
+
+    lvaddr_t mapped_elf;        ///< the module, mapped once
+    size_t mapped_elf_size;
+
+    genvaddr_t entry;           ///< entry point of the binary
+    lvaddr_t got_base;          ///< .got address in the child's vspace
+
+    size_t n_segments;
+    struct spawn_template_segment segments[SPAWN_TEMPLATE_MAX_SEGMENTS];
+
+    bool has_spare_cspace;      ///< whether 'spare_cspace' may be handed out
+    struct spawn_cspace spare_cspace;
+    struct waitset_chanstate refill_chan; ///< pending refill on the default waitset
+
+    size_t n_spawns;            ///< number of domains cloned from this template
+};
+
+errval_t spawn_cspace_create(struct spawn_cspace *cs);
+
+errval_t spawn_template_get(const char *name, struct spawn_template **ret);
+errval_t spawn_template_clone(struct spawn_template *tmpl, struct paging_state *child_ps);
+
+bool spawn_template_take_cspace(struct spawn_template *tmpl, struct spawn_cspace *ret);
+errval_t spawn_template_refill(struct spawn_template *tmpl);
+errval_t spawn_template_refill_later(struct spawn_template *tmpl);
+
+#endif /* _SPAWN_TEMPLATE_H_ */
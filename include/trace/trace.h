@@ -16,10 +16,27 @@
 #ifndef LIBBARRELFISH_TRACE_H
 #define LIBBARRELFISH_TRACE_H
 
-#if defined(__x86_64__)
+#if defined(__x86_64__) || defined(__aarch64__)
 #define TRACING_EXISTS 1
 #endif
 
+/*
+ * On aarch64 every core has its own trace frame, set up by the init domain
+ * of that core. The frame holds one struct trace_buffer, which is also the
+ * master of that core, followed by the subsystem enable flags. The ring
+ * never blocks writers: head_index counts all events ever written and the
+ * oldest events are overwritten, so readers (which may only have a read-only
+ * mapping) keep their own position and can detect lost events.
+ *
+ * A writer claims a position before it copies the event into the slot, so
+ * every slot has a commit word next to it. The writer clears it before the
+ * copy and sets it to position + 1 afterwards; trace_read_slot() only returns
+ * events whose commit word matches before and after reading them.
+ */
+#if defined(__aarch64__)
+#define TRACE_PERCORE_FRAMES 1
+#endif
+
 
 #ifndef IN_KERNEL
 /* XXX: private includes from libbarrelfish */
@@ -79,9 +96,17 @@
 
 struct trace_buffer;
 
+#ifdef TRACE_PERCORE_FRAMES
+#define TRACE_COREID_LIMIT        1
+#else
 #define TRACE_COREID_LIMIT        32
+#endif
 #define TRACE_EVENT_SIZE          16
+#ifdef TRACE_PERCORE_FRAMES
+#define TRACE_MAX_EVENTS          16384        // power of two, ring is indexed by mask
+#else
 #define TRACE_MAX_EVENTS          20000        // max number of events
+#endif
 #define TRACE_MAX_APPLICATIONS    128
 //#define TRACE_PERCORE_BUF_SIZE    0x1ff00
 #define TRACE_PERCORE_BUF_SIZE    (TRACE_EVENT_SIZE * TRACE_MAX_EVENTS + (sizeof (struct trace_buffer)))
@@ -95,6 +120,13 @@ struct trace_buffer;
 
 #define TRACE_MAX_BOOT_APPLICATIONS 16
 
+/// Index of a core's buffer in the trace frame
+#ifdef TRACE_PERCORE_FRAMES
+#define TRACE_CORE_INDEX(core_id) 0
+#else
+#define TRACE_CORE_INDEX(core_id) (core_id)
+#endif
+
 // A macro to simplify calling of trace_event
 // e.g., do TRACE(BENCH, START, 0)
 // instead of
@@ -143,7 +175,26 @@ static inline bool trace_cas(volatile uintptr_t *address, uintptr_t old,
 }
 
 
-#elif defined(__i386__) || defined(__arm__) || defined(__aarch64__)
+#elif defined(__aarch64__)
+
+static inline bool trace_cas(volatile uintptr_t *address, uintptr_t old,
+                             uintptr_t nw)
+{
+    return __atomic_compare_exchange_n(address, &old, nw, false,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/// Physical counter, the time base of systime_now() in kernel and user space
+static inline uint64_t trace_timestamp(void)
+{
+    uint64_t t;
+    __asm volatile("mrs %0, cntpct_el0" : "=r" (t));
+    return t;
+}
+
+#define TRACE_TIMESTAMP() trace_timestamp()
+
+#elif defined(__i386__) || defined(__arm__)
 
 static inline bool trace_cas(volatile uintptr_t *address, uintptr_t old,
                              uintptr_t nw)
@@ -203,6 +254,10 @@ struct trace_buffer {
 
     // ... events ...
     struct trace_event events[TRACE_MAX_EVENTS];
+#ifdef TRACE_PERCORE_FRAMES
+    /// position + 1 (truncated) of the event in the slot, 0 while it is written
+    volatile uint32_t committed[TRACE_MAX_EVENTS];
+#endif
 
     // ... applications ...
     volatile uint8_t num_applications;
@@ -225,8 +280,7 @@ errval_t trace_disable_domain(void);
 void trace_reset_buffer(void);
 void trace_reset_all(void);
 errval_t trace_setup_on_core(struct capref *retcap);
-errval_t trace_setup_child(struct cnoderef taskcn,
-                           dispatcher_handle_t handle);
+errval_t trace_setup_child(struct cnoderef taskcn);
 errval_t trace_control(uint64_t start_trigger,
                        uint64_t stop_trigger,
                        uint64_t duration);
@@ -248,6 +302,7 @@ errval_t trace_my_setup(void);
 
 errval_t trace_set_subsys_enabled(uint16_t subsys, bool enabled);
 errval_t trace_set_all_subsys_enabled(bool enabled);
+errval_t trace_map_readonly(struct trace_buffer **ret);
 
 
 
@@ -264,10 +319,15 @@ errval_t trace_set_all_subsys_enabled(bool enabled);
  */
 static inline lvaddr_t compute_trace_buf_addr(uint8_t core_id)
 {
+#ifdef TRACE_PERCORE_FRAMES
+    // only the buffer of our own core is mapped
+    return trace_buffer_master;
+#else
     assert(core_id < TRACE_COREID_LIMIT);
     lvaddr_t addr = trace_buffer_master + (core_id * TRACE_PERCORE_BUF_SIZE);
 
     return addr;
+#endif
 }
 
 
@@ -291,9 +351,25 @@ static inline uintptr_t
 trace_reserve_and_fill_slot(struct trace_event *ev,
                             struct trace_buffer *buf)
 {
-    uintptr_t i, nw;
+    uintptr_t i;
     struct trace_event *slot;
 
+#ifdef TRACE_PERCORE_FRAMES
+    STATIC_ASSERT((TRACE_MAX_EVENTS & (TRACE_MAX_EVENTS - 1)) == 0,
+                  "TRACE_MAX_EVENTS must be a power of two");
+    // Overwrite the oldest event when full, readers track their position
+    do {
+        i = buf->head_index;
+    } while (!trace_cas(&buf->head_index, i, i + 1));
+
+    uintptr_t s = i & (TRACE_MAX_EVENTS - 1);
+    slot = &buf->events[s];
+    __atomic_store_n(&buf->committed[s], 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    *slot = *ev;
+    __atomic_store_n(&buf->committed[s], (uint32_t)(i + 1), __ATOMIC_RELEASE);
+#else
+    uintptr_t nw;
     do {
         i = buf->head_index;
 
@@ -310,10 +386,44 @@ trace_reserve_and_fill_slot(struct trace_event *ev,
     // Write the event
     slot = &buf->events[i];
     *slot = *ev;
+#endif
 
     return i;
 }
 
+#ifdef TRACE_PERCORE_FRAMES
+enum trace_slot_state {
+    TRACE_SLOT_OK,          ///< the event was read
+    TRACE_SLOT_PENDING,     ///< the event at this position is still being written
+    TRACE_SLOT_LOST,        ///< the event was overwritten by a later one
+};
+
+/**
+ * \brief Read the event at position 'pos' (in head_index units) of a ring
+ *
+ * Safe against concurrent writers, also through a read-only mapping.
+ */
+static inline enum trace_slot_state
+trace_read_slot(struct trace_buffer *buf, uintptr_t pos, struct trace_event *ev)
+{
+    uintptr_t s = pos & (TRACE_MAX_EVENTS - 1);
+    uint32_t want = (uint32_t)(pos + 1);
+
+    uint32_t c = __atomic_load_n(&buf->committed[s], __ATOMIC_ACQUIRE);
+    if (c != want) {
+        // 0 or an older lap: the writer of 'pos' has not finished yet
+        return (c != 0 && (int32_t)(c - want) > 0) ? TRACE_SLOT_LOST
+                                                   : TRACE_SLOT_PENDING;
+    }
+    *ev = buf->events[s];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&buf->committed[s], __ATOMIC_RELAXED) != want) {
+        return TRACE_SLOT_LOST;
+    }
+    return TRACE_SLOT_OK;
+}
+#endif
+
 /**
  * \brief Write a trace event to the buffer for the current core.
  *
@@ -351,7 +461,7 @@ static inline errval_t trace_write_event(struct trace_event *ev)
 #ifdef TRACING_EXISTS
     struct trace_buffer *master = (struct trace_buffer *)kernel_trace_buf;
 
-    if (kernel_trace_buf == 0 || my_core_id >= TRACE_COREID_LIMIT) {
+    if (kernel_trace_buf == 0 || TRACE_CORE_INDEX(my_core_id) >= TRACE_COREID_LIMIT) {
         return TRACE_ERR_NO_BUFFER;
     }
 
@@ -367,7 +477,7 @@ static inline errval_t trace_write_event(struct trace_event *ev)
         }
     }
     struct trace_buffer *trace_buf = (struct trace_buffer*) (kernel_trace_buf
-            + my_core_id * TRACE_PERCORE_BUF_SIZE);
+            + TRACE_CORE_INDEX(my_core_id) * TRACE_PERCORE_BUF_SIZE);
     (void) trace_reserve_and_fill_slot(ev, trace_buf);
 
     if (ev->u.raw == master->stop_trigger ||
@@ -386,12 +496,12 @@ static inline errval_t trace_new_application(char *new_application_name, uintptr
 {
 #ifdef TRACING_EXISTS
 
-    if (kernel_trace_buf == 0 || my_core_id >= TRACE_COREID_LIMIT) {
+    if (kernel_trace_buf == 0 || TRACE_CORE_INDEX(my_core_id) >= TRACE_COREID_LIMIT) {
         return TRACE_ERR_NO_BUFFER;
     }
 
     struct trace_buffer *trace_buf = (struct trace_buffer*) (kernel_trace_buf
-            + my_core_id * TRACE_PERCORE_BUF_SIZE);
+            + TRACE_CORE_INDEX(my_core_id) * TRACE_PERCORE_BUF_SIZE);
 
     int i;
     int new_value;
@@ -0,0 +1,201 @@
+/**
+ * \file
+ * \brief ARMv8 microbenchmarks of the cpu driver's capability operations
+ *
+ * Every benchmark times its iterations one by one with the cycle counter, so
+ * the generic code can print percentiles next to the average. The capability
+ * benchmarks work on a Frame cap over memory that does not exist, it only
+ * lives in the mapping database while the benchmark runs and no memory is
+ * ever touched or handed out through it.
+ */
+
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <kernel.h>
+#include <string.h>
+#include <capabilities.h>
+#include <paging_kernel_arch.h>
+#include <microbenchmarks.h>
+#include <mdb/mdb.h>
+#include <mdb/mdb_tree.h>
+
+/// number of copies the revoke benchmark revokes every iteration
+#define REVOKE_COPIES 8
+
+/// physical base of the benchmark frame, far above any RAM of the platforms
+#define BENCH_FRAME_BASE (1UL << 40)
+
+static struct cte bench_src;
+static struct cte bench_copies[REVOKE_COPIES];
+
+static inline uint64_t cycles(void)
+{
+    uint64_t c;
+    __asm volatile("isb; mrs %0, pmccntr_el0" : "=r"(c) :: "memory");
+    return c;
+}
+
+static int bench_frame_setup(void)
+{
+    memset(&bench_src, 0, sizeof(bench_src));
+    memset(bench_copies, 0, sizeof(bench_copies));
+
+    bench_src.cap.type = ObjType_Frame;
+    bench_src.cap.rights = CAPRIGHTS_ALLRIGHTS;
+    bench_src.cap.u.frame.base = BENCH_FRAME_BASE;
+    bench_src.cap.u.frame.bytes = BASE_PAGE_SIZE;
+    bench_src.mdbnode.owner = my_core_id;
+
+    errval_t err = mdb_insert(&bench_src);
+    return err_is_ok(err) ? 0 : -1;
+}
+
+static int bench_frame_teardown(void)
+{
+    for (int i = 0; i < REVOKE_COPIES; i++) {
+        if (bench_copies[i].cap.type != ObjType_Null) {
+            caps_delete(&bench_copies[i]);
+        }
+    }
+    errval_t err = mdb_remove(&bench_src);
+    memset(&bench_src, 0, sizeof(bench_src));
+    return err_is_ok(err) ? 0 : -1;
+}
+
+static int cycles_bench(struct microbench *mb)
+{
+    for (int i = 0; i < MICROBENCH_ITERATIONS; i++) {
+        uint64_t start = cycles();
+        uint64_t end = cycles();
+        microbench_record(mb, end - start);
+    }
+    return 0;
+}
+
+static int cap_copy_bench(struct microbench *mb)
+{
+    if (bench_frame_setup() != 0) {
+        return -1;
+    }
+
+    errval_t err = SYS_ERR_OK;
+    for (int i = 0; i < MICROBENCH_ITERATIONS && err_is_ok(err); i++) {
+        uint64_t start = cycles();
+        err = caps_copy_to_cte(&bench_copies[0], &bench_src, false, 0, 0);
+        uint64_t end = cycles();
+        microbench_record(mb, end - start);
+        if (err_is_ok(err)) {
+            err = caps_delete(&bench_copies[0]);
+        }
+    }
+
+    return (bench_frame_teardown() == 0 && err_is_ok(err)) ? 0 : -1;
+}
+
+static int cap_delete_bench(struct microbench *mb)
+{
+    if (bench_frame_setup() != 0) {
+        return -1;
+    }
+
+    errval_t err = SYS_ERR_OK;
+    for (int i = 0; i < MICROBENCH_ITERATIONS && err_is_ok(err); i++) {
+        err = caps_copy_to_cte(&bench_copies[0], &bench_src, false, 0, 0);
+        if (err_is_fail(err)) {
+            break;
+        }
+        uint64_t start = cycles();
+        err = caps_delete(&bench_copies[0]);
+        uint64_t end = cycles();
+        microbench_record(mb, end - start);
+    }
+
+    return (bench_frame_teardown() == 0 && err_is_ok(err)) ? 0 : -1;
+}
+
+static int cap_revoke_bench(struct microbench *mb)
+{
+    if (bench_frame_setup() != 0) {
+        return -1;
+    }
+
+    errval_t err = SYS_ERR_OK;
+    for (int i = 0; i < MICROBENCH_ITERATIONS && err_is_ok(err); i++) {
+        for (int c = 0; c < REVOKE_COPIES && err_is_ok(err); c++) {
+            err = caps_copy_to_cte(&bench_copies[c], &bench_src, false, 0, 0);
+        }
+        if (err_is_fail(err)) {
+            break;
+        }
+        uint64_t start = cycles();
+        err = caps_revoke(&bench_src);
+        uint64_t end = cycles();
+        microbench_record(mb, end - start);
+    }
+
+    return (bench_frame_teardown() == 0 && err_is_ok(err)) ? 0 : -1;
+}
+
+static int has_descendants_bench(struct microbench *mb)
+{
+    if (bench_frame_setup() != 0) {
+        return -1;
+    }
+
+    volatile bool found = false;
+    for (int i = 0; i < MICROBENCH_ITERATIONS; i++) {
+        uint64_t start = cycles();
+        found |= has_descendants(&bench_src);
+        uint64_t end = cycles();
+        microbench_record(mb, end - start);
+    }
+
+    return (bench_frame_teardown() == 0 && !found) ? 0 : -1;
+}
+
+static int tlb_flush_bench(struct microbench *mb)
+{
+    for (int i = 0; i < MICROBENCH_ITERATIONS; i++) {
+        uint64_t start = cycles();
+        do_full_tlb_flush();
+        uint64_t end = cycles();
+        microbench_record(mb, end - start);
+    }
+    return 0;
+}
+
+struct microbench arch_benchmarks[] = {
+    {
+        .name = "cycle counter read",
+        .run_func = cycles_bench
+    },
+    {
+        .name = "cap copy",
+        .run_func = cap_copy_bench
+    },
+    {
+        .name = "cap delete (not last copy)",
+        .run_func = cap_delete_bench
+    },
+    {
+        .name = "cap revoke (8 copies)",
+        .run_func = cap_revoke_bench
+    },
+    {
+        .name = "has_descendants",
+        .run_func = has_descendants_bench
+    },
+    {
+        .name = "full TLB flush",
+        .run_func = tlb_flush_bench
+    },
+};
+
+size_t arch_benchmarks_size = sizeof(arch_benchmarks) / sizeof(struct microbench);
@@ -483,14 +483,14 @@ caps_map_block_l2(struct capability* dest,
             uintptr_t          pte_count,
             struct cte*        mapping_cte)
 {
-    // check offset within frame
-    if ((offset + LARGE_PAGE_SIZE > get_size(src)) ||
+    // check the whole run lies within the frame
+    if ((offset + pte_count * LARGE_PAGE_SIZE > get_size(src)) ||
         (((get_address(src) + offset) % LARGE_PAGE_SIZE) != 0)) {
         return SYS_ERR_FRAME_OFFSET_INVALID;
     }
 
     // check mapping does not overlap leaf page table
-    if (slot + pte_count > VMSAv8_64_PTABLE_NUM_ENTRIES ) {
+    if (pte_count == 0 || slot + pte_count > VMSAv8_64_PTABLE_NUM_ENTRIES ) {
         return SYS_ERR_VM_MAP_SIZE;
     }
 
@@ -499,8 +499,10 @@ caps_map_block_l2(struct capability* dest,
     lvaddr_t dest_lvaddr = local_phys_to_mem(dest_lpaddr);
 
     union armv8_ttable_entry *entry = (union armv8_ttable_entry *)dest_lvaddr + slot;
-    if (entry->block_l2.valid) {
-        return SYS_ERR_VM_ALREADY_MAPPED;
+    for (int i = 0; i < pte_count; i++) {
+        if (entry[i].block_l2.valid) {
+            return SYS_ERR_VM_ALREADY_MAPPED;
+        }
     }
 
     lpaddr_t src_lpaddr = gen_phys_to_local_phys(get_address(src) + offset);
@@ -557,13 +559,8 @@ caps_map_l2(struct capability* dest,
         return SYS_ERR_VNODE_SLOT_INVALID;
     }
 
-    if (pte_count != 1) {
-        debug(SUBSYS_PAGING, "pte_count = %zu\n",(size_t) pte_count);
-        return SYS_ERR_VM_MAP_SIZE;
-    }
-
     if (src->type == ObjType_Frame || src->type == ObjType_DevFrame) {
-        // if src is a frame, we need to map a superpage
+        // if src is a frame, we need to map a (run of) superpage(s)
         return caps_map_block_l2(dest, slot, src, kpi_paging_flags, offset, pte_count, mapping_cte);
     }
     else if (src->type != ObjType_VNode_AARCH64_l3) {
@@ -571,6 +568,11 @@ caps_map_l2(struct capability* dest,
         return SYS_ERR_WRONG_MAPPING;
     }
 
+    if (pte_count != 1) {
+        debug(SUBSYS_PAGING, "pte_count = %zu\n",(size_t) pte_count);
+        return SYS_ERR_VM_MAP_SIZE;
+    }
+
     if (slot > VMSAv8_64_PTABLE_NUM_ENTRIES) {
         debug(SUBSYS_PAGING, "slot = %"PRIuCSLOT"\n",slot);
         return SYS_ERR_VNODE_SLOT_RESERVED;
@@ -632,14 +634,14 @@ caps_map_l3(struct capability* dest,
         return SYS_ERR_WRONG_MAPPING;
     }
 
-    // check offset within frame
-    if ((offset + BASE_PAGE_SIZE > get_size(src)) ||
+    // check the whole run lies within the frame
+    if ((offset + pte_count * BASE_PAGE_SIZE > get_size(src)) ||
         ((offset % BASE_PAGE_SIZE) != 0)) {
         return SYS_ERR_FRAME_OFFSET_INVALID;
     }
 
     // check mapping does not overlap leaf page table
-    if (slot + pte_count > VMSAv8_64_PTABLE_NUM_ENTRIES ) {
+    if (pte_count == 0 || slot + pte_count > VMSAv8_64_PTABLE_NUM_ENTRIES ) {
         return SYS_ERR_VM_MAP_SIZE;
     }
 
@@ -648,8 +650,10 @@ caps_map_l3(struct capability* dest,
     lvaddr_t dest_lvaddr = local_phys_to_mem(dest_lpaddr);
 
     union armv8_ttable_entry *entry = (union armv8_ttable_entry *)dest_lvaddr + slot;
-    if (entry->page.valid) {
-        return SYS_ERR_VM_ALREADY_MAPPED;
+    for (int i = 0; i < pte_count; i++) {
+        if (entry[i].page.valid) {
+            return SYS_ERR_VM_ALREADY_MAPPED;
+        }
     }
 
     lpaddr_t src_lpaddr = gen_phys_to_local_phys(get_address(src) + offset);
@@ -39,6 +39,10 @@
 
 #include <efi.h>
 
+#ifdef CONFIG_MICROBENCHMARKS
+#include <microbenchmarks.h>
+#endif
+
 #define CNODE(cte)              get_address(&(cte)->cap)
 
 #define STARTUP_PROGRESS()      debug(SUBSYS_STARTUP, "%s:%d\n",          \
@@ -750,6 +754,10 @@ void arm_kernel_startup(void)
         memset(kcb_current, 0, sizeof(*kcb_current));
 
         init_dcb = spawn_bsp_init(BSP_INIT_MODULE_NAME);
+
+#ifdef CONFIG_MICROBENCHMARKS
+        microbenchmarks_run_all();
+#endif
     } else {
         MSG("Doing non-BSP related bootup \n");
         
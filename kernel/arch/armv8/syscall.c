@@ -15,6 +15,7 @@
 #include <barrelfish_kpi/sys_debug.h>
 #include <barrelfish_kpi/platform.h>
 #include <mdb/mdb_tree.h>
+#include <cap_predicates.h>
 
 #include <arm_hal.h>
 #include <irq.h>
@@ -35,6 +36,8 @@
 #include <arch/arm/syscall_arm.h>
 #include <arch/armv8/exceptions.h>
 #include <serial.h>
+#include <trace/trace.h>
+#include <trace_definitions/trace_defs.h>
 
 // helper macros  for invocation handler definitions
 #define INVOCATION_HANDLER(func) \
@@ -337,6 +340,7 @@ handle_map(
     cslot_t   mapping_slot     = (word >> 8) & 0xFF;
     cslot_t   slot             = (word >> 16) & 0xFFFF;
 
+    TRACE(KERNEL, SC_MAP, pte_count);
     return sys_map(ptable, slot, source_root_cptr, source_cptr, source_level,
                    flags, offset, pte_count, mcn_root, mcn_addr, mcn_level,
                    mapping_slot);
@@ -716,6 +720,37 @@ INVOCATION_HANDLER(monitor_get_platform)
     return SYSRET(SYS_ERR_OK);
 }
 
+/**
+ * \brief Use a frame of the caller as this core's trace buffer.
+ *
+ * The frame stays mapped in the kernel window, the caller is responsible for
+ * zeroing it and for keeping the cap around while tracing.
+ */
+INVOCATION_HANDLER(handle_trace_setup)
+{
+    INVOCATION_PRELUDE(4);
+    capaddr_t cptr  = sa->arg2;
+    uint8_t   level = sa->arg3;
+
+    struct capability *frame;
+    errval_t err = caps_lookup_cap(&dcb_current->cspace.cap, cptr, level,
+                                   &frame, CAPRIGHTS_READ_WRITE);
+    if (err_is_fail(err)) {
+        return SYSRET(err_push(err, SYS_ERR_SOURCE_CAP_LOOKUP));
+    }
+    if (frame->type != ObjType_Frame) {
+        return SYSRET(SYS_ERR_INVALID_SOURCE_TYPE);
+    }
+    if (frame->u.frame.bytes < TRACE_ALLOC_SIZE) {
+        return SYSRET(SYS_ERR_INVALID_SIZE);
+    }
+
+    kernel_trace_buf = local_phys_to_mem(get_address(frame));
+    trace_copy_boot_applications();
+
+    return SYSRET(SYS_ERR_OK);
+}
+
 INVOCATION_HANDLER(monitor_reclaim_ram)
 {
     INVOCATION_PRELUDE(5);
@@ -1078,8 +1113,7 @@ static invocation_t invocations[ObjType_Num][CAP_MAX_CMD] = {
         [KernelCmd_Revoke_mark_relations] = monitor_handle_revoke_mark_rels,
         [KernelCmd_Revoke_mark_target] = monitor_handle_revoke_mark_tgt,
         [KernelCmd_Set_cap_owner]     = monitor_set_cap_owner,
-        /* XXX - why is this commented out? */
-        //[KernelCmd_Setup_trace]       = handle_trace_setup,
+        [KernelCmd_Setup_trace]       = handle_trace_setup,
         [KernelCmd_Spawn_core]        = monitor_spawn_core,
         [KernelCmd_Unlock_cap]        = monitor_unlock_cap,
         [KernelCmd_Get_platform]        = monitor_get_platform,
@@ -1108,7 +1142,7 @@ handle_invoke(uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3,
     //
     // Must match lib/barrelfish/include/arch/aarch64/arch/invocations.h
     //
-    uint8_t   flags       = FIELD(24,4,a0);
+    uint8_t   flags       = FIELD(24,8,a0);
     uint8_t   invoke_bits = FIELD(16,8,a0);
     capaddr_t invoke_cptr = a1;
 
@@ -1133,11 +1167,11 @@ handle_invoke(uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3,
             assert(listener != NULL);
 
             if (listener->disp) {
-                uint8_t length_words = FIELD(28,8,a0);
+                uint8_t length_words = FIELD(32,8,a0);
                 uint8_t send_bits    = FIELD(8,8,a0);
                 capaddr_t send_cptr = a2;
                 /* limit length of message from buggy/malicious sender */
-                length_words = min(length_words, LMP_MSG_LENGTH);
+                length_words = min(length_words, LMP_LONG_MSG_LENGTH);
 
                 // does the sender want to yield their timeslice on success?
                 bool sync = flags & LMP_FLAG_SYNC;
@@ -1146,22 +1180,50 @@ handle_invoke(uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3,
                 bool yield = flags & LMP_FLAG_YIELD;
                 // is the cap (if present) to be deleted on send?
                 bool give_away = flags & LMP_FLAG_GIVEAWAY;
+                // is this a call the sender waits for a reply to?
+                bool call = flags & LMP_FLAG_CALL;
+                // is this the reply to a call?
+                bool reply = flags & LMP_FLAG_REPLY;
 
                 // Message registers in context are
                 // discontinguous for now so copy message words
                 // to temporary container. This is fixable, but
                 // not in this pass.
-                uintptr_t msg_words[LMP_MSG_LENGTH];
+                uintptr_t msg_words[LMP_LONG_MSG_LENGTH];
                 msg_words[0] = a3;
                 msg_words[1] = a4;
                 msg_words[2] = a5;
                 msg_words[3] = a6;
                 STATIC_ASSERT(LMP_MSG_LENGTH == 4, "Oops");
+                // a long message continues in x7-x11
+                if (length_words > LMP_MSG_LENGTH) {
+                    msg_words[4] = sa->arg7;
+                    msg_words[5] = sa->x8;
+                    msg_words[6] = sa->x9;
+                    msg_words[7] = sa->x10;
+                    msg_words[8] = sa->x11;
+                    STATIC_ASSERT(LMP_LONG_MSG_LENGTH == 9, "Oops");
+                }
 
                 // try to deliver message
                 r.error = lmp_deliver(to, dcb_current, msg_words,
                                       length_words, send_cptr, send_bits, give_away);
 
+                /* Call/reply fast path: a call hands the rest of the
+                 * timeslice to the callee and remembers the caller, the
+                 * matching reply switches straight back to the caller.
+                 * Neither direction goes through schedule(). */
+                if (err_is_ok(r.error)) {
+                    if (call) {
+                        lmp_call_link(dcb_current, listener);
+                        sync = true;
+                    } else if (reply && dcb_current->lmp_reply_to == listener) {
+                        listener->lmp_call_to = NULL;
+                        dcb_current->lmp_reply_to = NULL;
+                        sync = true;
+                    }
+                }
+
                 /* Switch to reciever upon successful delivery
                  * with sync flag, or (some cases of)
                  * unsuccessful delivery with yield flag */
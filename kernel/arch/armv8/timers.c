@@ -66,6 +66,14 @@ void platform_timer_init(int timeslice)
     //pmcr = armv8_PMCR_EL0_N_insert(pmcr, 6);  /* N is RO ? */
     armv8_PMCR_EL0_wr(NULL, pmcr);
 
+#ifdef CONFIG_MICROBENCHMARKS
+    /* count cycles, and let user space read the cycle counter (EN, CR) so the
+     * capability benchmarks measure in the same unit on both sides */
+    __asm volatile("msr pmcntenset_el0, %0" :: "r"(1UL << 31));
+    __asm volatile("msr pmuserenr_el0, %0" :: "r"(0x5UL));
+    __asm volatile("isb");
+#endif
+
     errval_t err;
     err = platform_enable_interrupt(platform_get_timer_interrupt(), 0, 0, 0);
     assert(err_is_ok(err));
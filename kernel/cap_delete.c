@@ -181,6 +181,9 @@ errval_t caps_delete_last(struct cte *cte, struct cte *ret_ram_cap)
         // Remove from wakeup queue
         wakeup_remove(dcb);
 
+        // Nobody may switch to this dcb on an LMP reply any more
+        lmp_call_unlink(dcb);
+
         // Notify monitor
         if (monitor_ep.u.endpointlmp.listener == dcb) {
             printk(LOG_ERR, "monitor terminated; expect badness!\n");
@@ -830,13 +833,98 @@ errval_t caps_delete(struct cte *cte)
     return err;
 }
 
+/// most copies and descendants a revoke deletes without the monitor
+#define CAPS_REVOKE_LOCAL_MAX 64
+
+/**
+ * \brief Check whether a cap in the set of a revoke can be deleted right away
+ *
+ * A cap that is shared with other cores, busy or that contains further ctes
+ * has to go through the delete list, which only the monitor sweeps.
+ */
+static bool caps_revoke_local_cte(struct cte *cte)
+{
+    return !distcap_is_foreign(cte) && !distcap_is_in_delete(cte) &&
+           !cte->mdbnode.locked && !cte->mdbnode.remote_copies &&
+           !cte->mdbnode.remote_ancs && !cte->mdbnode.remote_descs &&
+           cte->cap.type != ObjType_L1CNode &&
+           cte->cap.type != ObjType_L2CNode &&
+           cte->cap.type != ObjType_Dispatcher;
+}
+
+/**
+ * \brief Check whether the mark phase alone completes the revoke of cte
+ *
+ * Holds if there are at most CAPS_REVOKE_LOCAL_MAX other copies and
+ * descendants and every one of them can be deleted right away. Copies come
+ * before and after cte in the mapping database, descendants after its last
+ * copy, so one walk in each direction visits them all.
+ */
+static bool caps_revoke_is_local(struct cte *cte)
+{
+    struct capability *base = &cte->cap;
+    size_t count = 0;
+
+    struct cte *next;
+    for (next = mdb_predecessor(cte); next && is_copy(base, &next->cap);
+         next = mdb_predecessor(next))
+    {
+        if (++count > CAPS_REVOKE_LOCAL_MAX || !caps_revoke_local_cte(next)) {
+            return false;
+        }
+    }
+    for (next = mdb_successor(cte);
+         next && (is_copy(base, &next->cap) || is_ancestor(&next->cap, base));
+         next = mdb_successor(next))
+    {
+        if (++count > CAPS_REVOKE_LOCAL_MAX || !caps_revoke_local_cte(next)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief Revoke a cap whose copies and descendants all live on this core
+ *
+ * If every copy and descendant can be deleted right away, the mark phase
+ * deletes them all and nothing is left for the sweep. Descendants always have
+ * the revoked cap as ancestor, so no memory has to be handed back. All other
+ * revokes, and those of more than CAPS_REVOKE_LOCAL_MAX caps, go through the
+ * monitor untouched, which keeps the time spent in the cpu driver bounded.
+ */
 errval_t caps_revoke(struct cte *cte)
 {
+    errval_t err;
     TRACE_CAP_MSG("revoking", cte);
 
     if (cte->mdbnode.locked) {
         return SYS_ERR_CAP_LOCKED;
     }
 
-    return SYS_ERR_RETRY_THROUGH_MONITOR;
+    // the delete list may belong to a revoke the monitor is sweeping
+    if (distcap_is_foreign(cte) || cte->mdbnode.remote_copies ||
+        cte->mdbnode.remote_descs || delete_head || clear_head ||
+        !caps_revoke_is_local(cte))
+    {
+        return SYS_ERR_RETRY_THROUGH_MONITOR;
+    }
+
+    err = caps_mark_revoke(&cte->cap, cte);
+    if (err_no(err) == SYS_ERR_CAP_NOT_FOUND) {
+        // no copies or descendants, nothing to do
+        return SYS_ERR_OK;
+    }
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (delete_head || clear_head) {
+        // caps_revoke_is_local() missed a cap that needs a delete step, the
+        // lists are complete and consistent and the monitor sweeps them
+        printk(LOG_WARN, "%s: local revoke left caps to sweep\n", __FUNCTION__);
+        return SYS_ERR_RETRY_THROUGH_MONITOR;
+    }
+
+    return SYS_ERR_OK;
 }
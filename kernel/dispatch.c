@@ -336,6 +336,9 @@ errval_t lmp_deliver_payload(struct capability *ep, struct dcb *send,
     // update the delivered pos
     recv_ep->delivered = pos;
 
+    trace_event(TRACE_SUBSYS_KERNEL, TRACE_EVENT_KERNEL_LMP_DELIVER,
+                (uint32_t)(lvaddr_t)recv & 0xFFFFFFFF);
+
     // tell the dispatcher that it has an outstanding message in one of its EPs
     recv_disp->lmp_delivered += payload_len + LMP_RECV_HEADER_LENGTH;
 
@@ -343,6 +346,13 @@ errval_t lmp_deliver_payload(struct capability *ep, struct dcb *send,
     recv_disp->lmp_hint = ep->u.endpointlmp.epoffset;
 
     // Make target runnable
+#ifdef CONFIG_SCHEDULER_MLFQ
+    if (!now) {
+        // a message that wakes up the receiver boosts it as well
+        make_runnable_boost(recv);
+        return SYS_ERR_OK;
+    }
+#endif
     make_runnable(recv);
     if (now)
         schedule_now(recv);
@@ -50,15 +50,25 @@ struct dcb {
     uint64_t            domain_id;      ///< ID of dispatcher's domain
     systime_t           wakeup_time;    ///< Time to wakeup this dispatcher
     struct dcb          *wakeup_prev, *wakeup_next; ///< Next/prev in timeout queue
+    /// Caller blocked in an LMP call to us, switched to directly on reply.
+    /// Always paired with the caller's lmp_call_to, see lmp_call_link().
+    struct dcb          *lmp_reply_to;
+    /// Callee of our outstanding LMP call
+    struct dcb          *lmp_call_to;
 
     struct dcb          *next;          ///< Next DCB in schedule
     struct dcb          *prev;          ///< Previous DCB in schedule
-                                        /// (only valid iff CONFIG_SCHEDULER_RR)
+                                        /// (only valid iff CONFIG_SCHEDULER_RR
+                                        /// or CONFIG_SCHEDULER_MLFQ)
 #if defined(CONFIG_SCHEDULER_RBED)
     systime_t          release_time, etime, last_dispatch;
     systime_t          wcet, period, deadline;
     unsigned short      weight;
     enum task_type      type;
+#elif defined(CONFIG_SCHEDULER_MLFQ)
+    unsigned int        level;          ///< Current MLFQ priority level
+    systime_t           slice_used;     ///< Time used at the current level
+    systime_t           last_dispatch;  ///< When this DCB was last dispatched
 #endif
 };
 
@@ -84,6 +94,36 @@ errval_t lmp_deliver(struct capability *ep, struct dcb *send,
                      uintptr_t *payload, size_t payload_len,
                      capaddr_t send_cptr, uint8_t send_bits, bool give_away);
 
+/// Forget the call 'dcb' is waiting on and the call it has to reply to
+static inline void lmp_call_unlink(struct dcb *dcb)
+{
+    if (dcb->lmp_call_to != NULL) {
+        assert(dcb->lmp_call_to->lmp_reply_to == dcb);
+        dcb->lmp_call_to->lmp_reply_to = NULL;
+        dcb->lmp_call_to = NULL;
+    }
+    if (dcb->lmp_reply_to != NULL) {
+        assert(dcb->lmp_reply_to->lmp_call_to == dcb);
+        dcb->lmp_reply_to->lmp_call_to = NULL;
+        dcb->lmp_reply_to = NULL;
+    }
+}
+
+/// Remember that 'caller' waits for a reply of 'callee'
+static inline void lmp_call_link(struct dcb *caller, struct dcb *callee)
+{
+    // a new call replaces the outstanding call of the caller, and the callee
+    // only switches back to its most recent caller
+    if (caller->lmp_call_to != NULL) {
+        caller->lmp_call_to->lmp_reply_to = NULL;
+    }
+    if (callee->lmp_reply_to != NULL) {
+        callee->lmp_reply_to->lmp_call_to = NULL;
+    }
+    caller->lmp_call_to = callee;
+    callee->lmp_reply_to = caller;
+}
+
 /// Deliver an empty LMP as a notification
 static inline errval_t lmp_deliver_notification(struct capability *ep)
 {
@@ -27,8 +27,12 @@ struct dcb;
 enum sched_state {
     SCHED_RR,
     SCHED_RBED,
+    SCHED_MLFQ,
 };
 
+/// Number of priority levels of the multi-level feedback scheduler
+#define MLFQ_LEVELS 3
+
 /**
  * this is the memory layout of ObjType_KernelControlBlock
  * this struct should contain all the persistent state that belongs to a
@@ -58,6 +62,8 @@ struct kcb {
     /// RBED scheduler state
     struct dcb *queue_head, *queue_tail;
     unsigned int u_hrt, u_srt, w_be, n_be;
+    /// MLFQ scheduler state, one run queue per priority level
+    struct dcb *mlfq_head[MLFQ_LEVELS], *mlfq_tail[MLFQ_LEVELS];
     /// current time since kernel start in timeslices. This is necessary to
     /// make the scheduler work correctly
     /// wakeup queue head
@@ -11,7 +11,7 @@
 #define __MICROBENCHMARKS_H
 
 // The number of times the benchmark should run each instruction
-#define MICROBENCH_ITERATIONS 64
+#define MICROBENCH_ITERATIONS 256
 
 struct microbench; // forward declaration
 
@@ -24,8 +24,20 @@ struct microbench {
     const char * NTS name;
     microbench_run_func run_func;
     uint64_t result;
+    /* cycles of every iteration, for benchmarks that time the iterations one
+     * by one with microbench_record() */
+    uint64_t samples[MICROBENCH_ITERATIONS];
+    size_t nsamples;
 };
 
+static inline void microbench_record(struct microbench *mb, uint64_t cycles)
+{
+    if (mb->nsamples < MICROBENCH_ITERATIONS) {
+        mb->samples[mb->nsamples++] = cycles;
+    }
+    mb->result += cycles;
+}
+
 void microbenchmarks_run_all(void);
 
 extern struct microbench arch_benchmarks[];
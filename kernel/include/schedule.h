@@ -26,6 +26,11 @@ void make_runnable(struct dcb *dcb);
 /* schedule(r) */
 void schedule_now(struct dcb *dcb);
 
+#ifdef CONFIG_SCHEDULER_MLFQ
+/* make_runnable(), and schedule_now() if the DCB was not runnable. */
+void make_runnable_boost(struct dcb *dcb);
+#endif
+
 /**
  * \brief Remove 'dcb' from scheduler ring.
  *
@@ -91,6 +91,16 @@ void kcb_update_core_id(struct kcb *kcb)
             get_dispatcher_shared_generic(d->disp);
         disp->curr_core_id = my_core_id;
     }
+#elif CONFIG_SCHEDULER_MLFQ
+    for (int l = 0; l < MLFQ_LEVELS; l++) {
+        for (struct dcb *d = kcb->mlfq_head[l]; d; d = d->next) {
+            printk(LOG_NOTE, "[sched] updating current core id to %d for %s\n",
+                    my_core_id, get_disp_name(d));
+            struct dispatcher_shared_generic *disp =
+                get_dispatcher_shared_generic(d->disp);
+            disp->curr_core_id = my_core_id;
+        }
+    }
 #elif CONFIG_SCHEDULER_RR
 #error NYI!
 #else
@@ -33,10 +33,33 @@ static uint64_t divide_round(uint64_t quotient, uint64_t divisor)
     }
 }
 
+static void sort_samples(uint64_t *samples, size_t n)
+{
+    // insertion sort, there are only MICROBENCH_ITERATIONS samples
+    for (size_t i = 1; i < n; i++) {
+        uint64_t v = samples[i];
+        size_t j = i;
+        for (; j > 0 && samples[j - 1] > v; j--) {
+            samples[j] = samples[j - 1];
+        }
+        samples[j] = v;
+    }
+}
+
 static int microbench_print(struct microbench *mb, char *buf, size_t len)
 {
-    return snprintf(buf, len, "%" PRIu64 " ticks",
-                    divide_round(mb->result, MICROBENCH_ITERATIONS));
+    if (mb->nsamples == 0) {
+        return snprintf(buf, len, "%" PRIu64 " ticks",
+                        divide_round(mb->result, MICROBENCH_ITERATIONS));
+    }
+
+    size_t n = mb->nsamples;
+    sort_samples(mb->samples, n);
+    return snprintf(buf, len, "avg %" PRIu64 ", p50 %" PRIu64 ", p90 %" PRIu64
+                    ", p99 %" PRIu64 ", max %" PRIu64 " cycles",
+                    divide_round(mb->result, n), mb->samples[n / 2],
+                    mb->samples[n * 90 / 100], mb->samples[n * 99 / 100],
+                    mb->samples[n - 1]);
 }
 
 static int microbenchmarks_run(struct microbench *benchs, size_t nbenchs)
@@ -63,7 +86,7 @@ static int microbenchmarks_print_all(struct microbench *benchs, size_t nbenchs)
 {
     int i, r;
     struct microbench *mb;
-    char buf[64];
+    char buf[128];
 
     for (i = 0; i < nbenchs; i++) {
         mb = &benchs[i];
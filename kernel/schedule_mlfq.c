@@ -0,0 +1,421 @@
+/**
+ * \file
+ * \brief Kernel scheduling policy: multi-level feedback queue (MLFQ)
+ *
+ * Dispatchers are kept in one FIFO run queue per priority level. The
+ * scheduler always runs the head of the highest non-empty level. A
+ * dispatcher that uses up the quantum of its level is demoted one level.
+ * The quantum doubles with every level, so CPU-bound dispatchers end up at
+ * the bottom with long slices while interactive ones (drivers, servers) stay
+ * at the top with short slices.
+ *
+ * schedule_now() boosts a dispatcher to the head of its level. The kernel
+ * calls it from wakeup_check() for timer wakeups and from
+ * lmp_deliver_payload() for notifications, i.e. lmp_deliver_notification()
+ * on device interrupts and IPI notifications. Ordinary LMP messages go
+ * through make_runnable_boost(), which boosts the receiver only if the
+ * message woke it up, so a client's request is served ahead of the CPU-bound
+ * dispatchers of the server's level.
+ */
+
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/**
+ * Implementation Notes
+ *
+ *  The run queues are doubly-linked lists through dcb->next and dcb->prev,
+ *  terminated by NULL (not a ring as in the RR scheduler). A dcb is in the
+ *  schedule iff it is the head of its level or has a predecessor.
+ *
+ *  Time is accounted in schedule(): the dispatcher that ran last is charged
+ *  for the time since its last dispatch. Without CONFIG_ONESHOT_TIMER the
+ *  scheduler only runs on timer ticks, so quanta below kernel_timeslice are
+ *  effectively rounded up to one tick.
+ *
+ *  The used quantum is kept across blocking, so a dispatcher cannot stay at
+ *  a high level by blocking shortly before its quantum expires. Time spent
+ *  blocked is credited back, so dispatchers that run short bursts with
+ *  longer pauses in between (drivers, servers) never get demoted. To avoid
+ *  starvation of the lower levels and to let dispatchers that became
+ *  interactive again move up, all dispatchers are moved back to the top
+ *  level every MLFQ_RESET_PERIOD timeslices.
+ */
+
+#ifndef SCHEDULER_SIMULATOR
+#       include <kernel.h>
+#       include <dispatch.h>
+#       include <trace/trace.h>
+#       include <trace_definitions/trace_defs.h>
+#       include <timer.h> // update_sched_timer
+#       include <kcb.h>
+#include <systime.h>
+#endif
+
+/// Every how many timeslices all dispatchers are reset to the top level
+#define MLFQ_RESET_PERIOD   32
+
+/// Last (currently) scheduled task, for accounting purposes
+static struct dcb *lastdisp = NULL;
+
+/// Time of the last reset of all dispatchers to the top level
+static systime_t last_reset = 0;
+
+/**
+ * \brief Returns the quantum of a priority level.
+ *
+ * The top level is reserved for interactive dispatchers and gets half a
+ * timeslice, every level below gets twice the quantum of the one above.
+ */
+static inline systime_t quantum(unsigned int level)
+{
+    return (kernel_timeslice / 2) << level;
+}
+
+/**
+ * \brief Returns whether dcb is in scheduling queue.
+ * \param dcb   Pointer to DCB to check.
+ * \return True if in queue, false otherwise.
+ */
+static inline bool in_queue(struct dcb *dcb)
+{
+    return dcb->prev != NULL || kcb_current->mlfq_head[dcb->level] == dcb;
+}
+
+static void queue_append(struct dcb *dcb)
+{
+    unsigned int l = dcb->level;
+    assert(l < MLFQ_LEVELS);
+
+    dcb->next = NULL;
+    dcb->prev = kcb_current->mlfq_tail[l];
+    if (dcb->prev != NULL) {
+        dcb->prev->next = dcb;
+    } else {
+        kcb_current->mlfq_head[l] = dcb;
+    }
+    kcb_current->mlfq_tail[l] = dcb;
+}
+
+static void queue_prepend(struct dcb *dcb)
+{
+    unsigned int l = dcb->level;
+    assert(l < MLFQ_LEVELS);
+
+    dcb->prev = NULL;
+    dcb->next = kcb_current->mlfq_head[l];
+    if (dcb->next != NULL) {
+        dcb->next->prev = dcb;
+    } else {
+        kcb_current->mlfq_tail[l] = dcb;
+    }
+    kcb_current->mlfq_head[l] = dcb;
+}
+
+static void queue_remove(struct dcb *dcb)
+{
+    unsigned int l = dcb->level;
+
+    if (dcb->prev != NULL) {
+        dcb->prev->next = dcb->next;
+    } else {
+        kcb_current->mlfq_head[l] = dcb->next;
+    }
+    if (dcb->next != NULL) {
+        dcb->next->prev = dcb->prev;
+    } else {
+        kcb_current->mlfq_tail[l] = dcb->prev;
+    }
+    dcb->next = dcb->prev = NULL;
+}
+
+/**
+ * \brief Move a queued dcb to the tail of level 'level'.
+ */
+static void queue_move(struct dcb *dcb, unsigned int level)
+{
+    queue_remove(dcb);
+    dcb->level = level;
+    dcb->slice_used = 0;
+    queue_append(dcb);
+}
+
+/**
+ * \brief Charge 'dcb' for the time since it was last dispatched.
+ */
+static inline void charge(struct dcb *dcb, systime_t now)
+{
+    assert(dcb->last_dispatch <= now);
+    dcb->slice_used += now - dcb->last_dispatch;
+    dcb->last_dispatch = now;
+}
+
+/**
+ * \brief Move an unqueued dcb one level down, if there is one.
+ */
+static inline void demote(struct dcb *dcb)
+{
+    if (dcb->level + 1 < MLFQ_LEVELS) {
+        dcb->level++;
+    }
+    dcb->slice_used = 0;
+}
+
+/**
+ * \brief Move every dispatcher back to the top level.
+ */
+static void reset_levels(systime_t now)
+{
+    for (unsigned int l = 1; l < MLFQ_LEVELS; l++) {
+        struct dcb *d = kcb_current->mlfq_head[l];
+        while (d != NULL) {
+            struct dcb *next = d->next;
+            queue_move(d, 0);
+            d = next;
+        }
+    }
+    last_reset = now;
+}
+
+/**
+ * \brief Scheduler policy.
+ *
+ * \return Next DCB to schedule or NULL if wait for interrupts.
+ */
+struct dcb *schedule(void)
+{
+    systime_t now = systime_now();
+
+    // Charge the last dispatched task and demote it if its quantum is used up
+    if (lastdisp != NULL && in_queue(lastdisp)) {
+        charge(lastdisp, now);
+        if (lastdisp->slice_used >= quantum(lastdisp->level)) {
+            // requeue at the tail, also when already at the lowest level
+            queue_remove(lastdisp);
+            demote(lastdisp);
+            queue_append(lastdisp);
+            lastdisp = NULL;
+        }
+    }
+
+    if (now - last_reset >= MLFQ_RESET_PERIOD * kernel_timeslice) {
+        reset_levels(now);
+    }
+
+    struct dcb *todisp = NULL;
+    for (unsigned int l = 0; l < MLFQ_LEVELS && todisp == NULL; l++) {
+        todisp = kcb_current->mlfq_head[l];
+    }
+
+    // nothing to dispatch
+    if (todisp == NULL) {
+#ifndef SCHEDULER_SIMULATOR
+        debug(SUBSYS_DISPATCH, "schedule: no dcb runnable\n");
+#endif
+        lastdisp = NULL;
+        return NULL;
+    }
+
+    // The running task stays at the head of its level until its quantum is
+    // used up, so it is only preempted by a higher level or a boosted task.
+    // A preempted task keeps the quantum it has used so far.
+    if (todisp != lastdisp) {
+        todisp->last_dispatch = now;
+        lastdisp = todisp;
+        trace_event(TRACE_SUBSYS_KERNEL, TRACE_EVENT_KERNEL_SCHED_SCHEDULE,
+                    (uint32_t)(lvaddr_t)todisp & 0xFFFFFFFF);
+    }
+
+#ifdef CONFIG_ONESHOT_TIMER
+    update_sched_timer(now + (quantum(todisp->level) - todisp->slice_used));
+#endif
+    return todisp;
+}
+
+/**
+ * \brief Boost 'dcb', which just received a notification or timer wakeup.
+ *
+ * Moves 'dcb' to the head of its level, so it preempts every dispatcher of
+ * the same or a lower level. The level itself is kept: a dispatcher that
+ * blocks often but still uses up its quanta is not promoted by this, only
+ * by the periodic reset.
+ */
+void schedule_now(struct dcb *dcb)
+{
+    if (!in_queue(dcb)) {
+        return;
+    }
+
+    queue_remove(dcb);
+    queue_prepend(dcb);
+}
+
+void make_runnable(struct dcb *dcb)
+{
+    // No-Op if already in schedule
+    if (in_queue(dcb)) {
+        return;
+    }
+
+    trace_event(TRACE_SUBSYS_KERNEL, TRACE_EVENT_KERNEL_SCHED_MAKE_RUNNABLE,
+                (uint32_t)(lvaddr_t)dcb & 0xFFFFFFFF);
+
+    // Level and used quantum are kept across blocking, but the time spent
+    // blocked is credited against the used quantum. last_dispatch is the time
+    // the dispatcher was last charged, i.e. when it blocked.
+    assert(dcb->level < MLFQ_LEVELS);
+    systime_t now = systime_now();
+    systime_t blocked = now > dcb->last_dispatch ? now - dcb->last_dispatch : 0;
+    dcb->slice_used = dcb->slice_used > blocked ? dcb->slice_used - blocked : 0;
+    dcb->last_dispatch = now;
+    queue_append(dcb);
+}
+
+/**
+ * \brief Make 'dcb' runnable and boost it if it was blocked.
+ *
+ * Used for LMP messages. A receiver that is already runnable keeps its place,
+ * otherwise a sender could keep it at the head of its level by sending to it
+ * continuously.
+ */
+void make_runnable_boost(struct dcb *dcb)
+{
+    if (in_queue(dcb)) {
+        return;
+    }
+
+    make_runnable(dcb);
+    schedule_now(dcb);
+}
+
+/**
+ * \brief Remove 'dcb' from scheduler queues.
+ *
+ * Removes dispatcher 'dcb' from the scheduler queues. If it was not in
+ * a queue, this function is a no-op. The postcondition for this
+ * function is that dcb is not in any queue.
+ *
+ * \param dcb   Pointer to DCB to remove.
+ */
+void scheduler_remove(struct dcb *dcb)
+{
+    // No-Op if not in schedule
+    if (!in_queue(dcb)) {
+        return;
+    }
+
+    // Charge a blocking dispatcher, the quantum is kept across blocking
+    if (lastdisp == dcb) {
+        charge(dcb, systime_now());
+        lastdisp = NULL;
+    }
+
+    queue_remove(dcb);
+    if (dcb->slice_used >= quantum(dcb->level)) {
+        demote(dcb);
+    }
+
+    trace_event(TRACE_SUBSYS_KERNEL, TRACE_EVENT_KERNEL_SCHED_REMOVE,
+                (uint32_t)(lvaddr_t)dcb & 0xFFFFFFFF);
+}
+
+/**
+ * \brief Yield 'dcb' for the rest of the current timeslice.
+ *
+ * Moves 'dcb' to the tail of its priority level. A dispatcher that yields
+ * before its quantum is used up keeps its level, the time it used so far
+ * is still charged to it. Otherwise it is demoted like in schedule().
+ *
+ * \param dcb   Pointer to DCB to yield.
+ */
+void scheduler_yield(struct dcb *dcb)
+{
+    if (!in_queue(dcb)) {
+        return;
+    }
+
+    if (lastdisp == dcb) {
+        charge(dcb, systime_now());
+        lastdisp = NULL;    // Don't account for us anymore
+    }
+
+    queue_remove(dcb);
+    if (dcb->slice_used >= quantum(dcb->level)) {
+        demote(dcb);
+    }
+    queue_append(dcb);
+}
+
+#ifndef SCHEDULER_SIMULATOR
+void scheduler_reset_time(void)
+{
+    trace_event(TRACE_SUBSYS_KERNEL, TRACE_EVENT_KERNEL_TIMER_SYNC, 0);
+
+    struct kcb *k = kcb_current;
+    do {
+        for (unsigned int l = 0; l < MLFQ_LEVELS; l++) {
+            for (struct dcb *i = k->mlfq_head[l]; i != NULL; i = i->next) {
+                i->slice_used = 0;
+                i->last_dispatch = 0;
+            }
+        }
+        k = k->next;
+    } while (k && k != kcb_current);
+
+    // Forget all accounting information
+    lastdisp = NULL;
+    last_reset = 0;
+}
+
+void scheduler_convert(void)
+{
+    enum sched_state from = kcb_current->sched;
+    switch (from) {
+        case SCHED_MLFQ:
+            // do nothing
+            break;
+        case SCHED_RR:
+        {
+            struct dcb *i = kcb_current->ring_current;
+            if (i == NULL) {
+                break;
+            }
+            do {
+                struct dcb *tmp = i->next;
+                i->next = i->prev = NULL;
+                i->level = 0;
+                make_runnable(i);
+                i = tmp;
+            } while (i != kcb_current->ring_current);
+            break;
+        }
+        case SCHED_RBED:
+        {
+            struct dcb *i = kcb_current->queue_head;
+            while (i != NULL) {
+                struct dcb *tmp = i->next;
+                i->next = i->prev = NULL;
+                i->level = 0;
+                make_runnable(i);
+                i = tmp;
+            }
+            break;
+        }
+        default:
+            printf("don't know how to convert %d to MLFQ state\n", from);
+            break;
+    }
+}
+
+void scheduler_restore_state(void)
+{
+    // clear time slices
+    scheduler_reset_time();
+}
+#endif
@@ -375,13 +375,13 @@ struct dcb *schedule(void)
         // If nothing changed, run whatever ran last (task might have
         // yielded to another), unless it is blocked
         if(lastdisp == todisp && dcb_current != NULL && in_queue(dcb_current)) {
-            /* trace_event(TRACE_SUBSYS_KERNEL, TRACE_EVENT_KERNEL_SCHED_CURRENT, */
-            /*             (uint32_t)(lvaddr_t)dcb_current & 0xFFFFFFFF); */
+            trace_event(TRACE_SUBSYS_KERNEL, TRACE_EVENT_KERNEL_SCHED_CURRENT,
+                        (uint32_t)(lvaddr_t)dcb_current & 0xFFFFFFFF);
             return dcb_current;
         }
 
-        /* trace_event(TRACE_SUBSYS_KERNEL, TRACE_EVENT_KERNEL_SCHED_SCHEDULE, */
-        /*             (uint32_t)(lvaddr_t)todisp & 0xFFFFFFFF); */
+        trace_event(TRACE_SUBSYS_KERNEL, TRACE_EVENT_KERNEL_SCHED_SCHEDULE,
+                    (uint32_t)(lvaddr_t)todisp & 0xFFFFFFFF);
 
         // Remember who we run next
         lastdisp = todisp;
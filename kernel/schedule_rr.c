@@ -17,6 +17,8 @@
 #include <kcb.h>
 
 #include <timer.h> // update_sched_timer
+#include <trace/trace.h>
+#include <trace_definitions/trace_defs.h>
 
 /**
  * \brief Scheduler policy.
@@ -34,6 +36,8 @@ struct dcb *schedule(void)
     assert(kcb_current->ring_current->prev != NULL);
 
     kcb_current->ring_current = kcb_current->ring_current->next;
+    trace_event(TRACE_SUBSYS_KERNEL, TRACE_EVENT_KERNEL_SCHED_SCHEDULE,
+                (uint32_t)(lvaddr_t)kcb_current->ring_current & 0xFFFFFFFF);
     #ifdef CONFIG_ONESHOT_TIMER
     update_sched_timer(kernel_now + kernel_timeslice);
     #endif
@@ -1,7 +1,11 @@
+#include <aos/aos.h>
 #include <aos/aos_datachan.h>
+#include <aos/waitset_chan.h>
 
 #define CLOSE_MESSAGE (~((uintptr_t) 0))
 
+#define PIPE_DATA_OFFSET ROUND_UP(sizeof(struct aos_dc_pipe_ctl), 64)
+
 
 void aos_dc_buffer_init(struct aos_dc_ringbuffer *buf, size_t bytes, char *buffer)
 {
@@ -94,6 +98,37 @@ errval_t aos_dc_init_lmp(struct aos_datachan *dc, size_t buffer_length)
     dc->backend = AOS_RPC_LMP;
     dc->is_closed = false;
 
+    // the remote endpoint is set by the caller, if this end sends
+    lmp_chan_init(&dc->channel.lmp);
+    dc->channel.lmp.local_cap = NULL_CAP;
+    lmp_chan_fc_init(&dc->channel.lmp, 0);
+
+    return SYS_ERR_OK;
+}
+
+
+/**
+ * \brief create the endpoint the channel receives on
+ *
+ * \param depth number of messages the endpoint holds, this is the window a
+ *              sender gets
+ * \param ret_ep filled in with the capability to hand to the sender
+ */
+errval_t aos_dc_create_lmp_endpoint(struct aos_datachan *dc, uint32_t depth, struct capref *ret_ep)
+{
+    errval_t err;
+    struct lmp_chan *lc = &dc->channel.lmp;
+
+    err = endpoint_create(LMP_BUF_WORDS(depth), &lc->local_cap, &lc->endpoint);
+    ON_ERR_PUSH_RETURN(err, LIB_ERR_ENDPOINT_CREATE);
+    lc->buflen_words = LMP_BUF_WORDS(depth);
+
+    // a sender's first message brings the endpoint for its credits
+    err = lmp_chan_alloc_recv_slot(lc);
+    ON_ERR_PUSH_RETURN(err, LIB_ERR_LMP_ALLOC_RECV_SLOT);
+
+    lmp_chan_fc_init(lc, depth);
+    *ret_ep = lc->local_cap;
     return SYS_ERR_OK;
 }
 
@@ -121,6 +156,87 @@ errval_t aos_dc_init_ump(struct aos_datachan *dc, size_t buffer_length, lvaddr_t
 }
 
 
+/**
+ * \brief lay out a pipe in a mapped frame, before either end attaches to it
+ */
+void aos_dc_pipe_format(lvaddr_t frame, size_t frame_size)
+{
+    struct aos_dc_pipe_ctl *ctl = (struct aos_dc_pipe_ctl *) frame;
+    memset(ctl, 0, sizeof(struct aos_dc_pipe_ctl));
+    ctl->ring_size = ((frame_size - PIPE_DATA_OFFSET) / 2) & ~((size_t) 63);
+    dmb();  // magic after layout
+    ctl->magic = AOS_DC_PIPE_MAGIC;
+}
+
+
+bool aos_dc_pipe_is_formatted(lvaddr_t frame)
+{
+    return ((volatile struct aos_dc_pipe_ctl *) frame)->magic == AOS_DC_PIPE_MAGIC;
+}
+
+
+/**
+ * \brief attach to a pipe created with aos_dc_pipe_format()
+ *
+ * Like with UMP, the two ends pass opposite values of `first_half`.
+ */
+errval_t aos_dc_init_pipe(struct aos_datachan *dc, lvaddr_t frame, size_t frame_size, bool first_half)
+{
+    struct aos_dc_pipe_ctl *ctl = (struct aos_dc_pipe_ctl *) frame;
+    if (!aos_dc_pipe_is_formatted(frame)) {
+        return LIB_ERR_DC_NOT_A_PIPE;
+    }
+    assert(PIPE_DATA_OFFSET + 2 * ctl->ring_size <= frame_size);
+
+    aos_dc_buffer_init(&dc->buffer, 0, NULL);
+    dc->backend = AOS_DC_PIPE;
+    dc->is_closed = false;
+    dc->bytes_left = 0;
+
+    struct aos_dc_pipe *pipe = &dc->channel.pipe;
+    char *data = (char *) frame + PIPE_DATA_OFFSET;
+    pipe->size = ctl->ring_size;
+    if (first_half) {
+        pipe->send = &ctl->ring[0];
+        pipe->send_data = data;
+        pipe->recv = &ctl->ring[1];
+        pipe->recv_data = data + pipe->size;
+    }
+    else {
+        pipe->send = &ctl->ring[1];
+        pipe->send_data = data + pipe->size;
+        pipe->recv = &ctl->ring[0];
+        pipe->recv_data = data;
+    }
+
+    waitset_chanstate_init(&pipe->waitset_state, CHANTYPE_DC_PIPE_IN);
+    pipe->waitset_state.arg = pipe;
+
+    return SYS_ERR_OK;
+}
+
+
+/**
+ * \brief attach to a shared frame, as a pipe if it holds one and over UMP otherwise
+ */
+errval_t aos_dc_init_frame(struct aos_datachan *dc, size_t buffer_length, lvaddr_t frame, size_t frame_size, bool first_half)
+{
+    if (aos_dc_pipe_is_formatted(frame)) {
+        return aos_dc_init_pipe(dc, frame, frame_size, first_half);
+    }
+    return aos_dc_init_ump(dc, buffer_length, frame, frame_size, first_half);
+}
+
+
+/**
+ * \brief whether the waitset should wake the reader, also true once closed
+ */
+bool aos_dc_pipe_can_receive(struct aos_dc_pipe *pipe)
+{
+    return pipe->recv->head != pipe->recv->tail || pipe->recv->closed;
+}
+
+
 errval_t aos_dc_free(struct aos_datachan *dc)
 {
     if (dc->buffer.buffer) {
@@ -132,6 +248,9 @@ errval_t aos_dc_free(struct aos_datachan *dc)
     if (dc->backend == AOS_RPC_UMP) {
         ump_chan_destroy(&dc->channel.ump);
     }
+    if (dc->backend == AOS_DC_PIPE) {
+        waitset_chanstate_destroy(&dc->channel.pipe.waitset_state);
+    }
     return SYS_ERR_OK;
 }
 
@@ -144,10 +263,37 @@ bool aos_dc_send_is_connected(struct aos_datachan *dc)
     else if (dc->backend == AOS_RPC_UMP) {
         return dc->channel.ump.send_pane != NULL;
     }
+    else if (dc->backend == AOS_DC_PIPE) {
+        return dc->channel.pipe.send != NULL;
+    }
     return false;
 }
 
 
+/**
+ * \brief send one message, waiting for a credit
+ *
+ * The first message on a channel carries the endpoint the receiver returns
+ * credits to, it is created here.
+ */
+static errval_t aos_dc_send_one_lmp(struct aos_datachan *dc, lmp_send_flags_t flags, uintptr_t *msg)
+{
+    errval_t err;
+    struct lmp_chan *lc = &dc->channel.lmp;
+    struct capref bind_cap = NULL_CAP;
+
+    if (lc->endpoint == NULL) {
+        err = endpoint_create(LMP_BUF_WORDS(AOS_DC_LMP_CREDIT_DEPTH), &lc->local_cap, &lc->endpoint);
+        ON_ERR_PUSH_RETURN(err, LIB_ERR_ENDPOINT_CREATE);
+        bind_cap = lc->local_cap;
+    }
+
+    err = lmp_chan_fc_send(lc, flags, bind_cap, msg[0], msg[1], msg[2], msg[3]);
+    ON_ERR_PUSH_RETURN(err, LIB_ERR_LMP_CHAN_SEND);
+    return SYS_ERR_OK;
+}
+
+
 static errval_t aos_dc_send_lmp(struct aos_datachan *dc, size_t bytes, const char *data)
 {
     errval_t err;
@@ -163,23 +309,17 @@ static errval_t aos_dc_send_lmp(struct aos_datachan *dc, size_t bytes, const cha
 
     msg[0] = bytes;
     memcpy(&msg[1], data, min(first_msg_length, bytes));
-    do {
-        err = lmp_chan_send(&dc->channel.lmp, LMP_FLAG_YIELD | (bytes > first_msg_length ? LMP_FLAG_SYNC : 0), NULL_CAP, 4, msg[0], msg[1], msg[2], msg[3]);
-    } while (err_is_fail(err) && lmp_err_is_transient(err));
+    err = aos_dc_send_one_lmp(dc, LMP_FLAG_YIELD | (bytes > first_msg_length ? LMP_FLAG_SYNC : 0), msg);
+    ON_ERR_RETURN(err);
 
     for (size_t offs = first_msg_length; offs < bytes; offs += lmp_bytes_length) {
         memcpy(msg, data + offs, min(lmp_bytes_length, bytes - offs));
 
         bool is_last = offs + lmp_bytes_length >= bytes;
 
-        do {
-            if (is_last) {
-                err = lmp_chan_send(&dc->channel.lmp, LMP_FLAG_YIELD | LMP_FLAG_SYNC, NULL_CAP, 4, msg[0], msg[1], msg[2], msg[3]);
-            }
-            else {
-                err = lmp_chan_send(&dc->channel.lmp, LMP_FLAG_YIELD, NULL_CAP, 4, msg[0], msg[1], msg[2], msg[3]);
-            }
-        } while (err_is_fail(err) && lmp_err_is_transient(err));
+        // only the last message hands over the timeslice, credits pace the rest
+        err = aos_dc_send_one_lmp(dc, is_last ? LMP_FLAG_YIELD | LMP_FLAG_SYNC : 0, msg);
+        ON_ERR_RETURN(err);
     }
 
     return SYS_ERR_OK;
@@ -208,6 +348,39 @@ static errval_t aos_dc_send_ump(struct aos_datachan *dc, size_t bytes, const cha
 }
 
 
+/**
+ * \brief copy into the ring, waits for the reader while it is full
+ */
+static errval_t aos_dc_send_pipe(struct aos_datachan *dc, size_t bytes, const char *data)
+{
+    struct aos_dc_pipe *pipe = &dc->channel.pipe;
+    struct aos_dc_pipe_ring *ring = pipe->send;
+
+    while (bytes > 0) {
+        size_t head = ring->head;
+        size_t space = pipe->size - (head - ring->tail);
+        if (space == 0) {
+            thread_yield();
+            continue;
+        }
+        dmb();  // write after the reader is done with the space
+
+        size_t n = min(space, bytes);
+        size_t idx = head % pipe->size;
+        size_t first = min(n, pipe->size - idx);
+        memcpy(pipe->send_data + idx, data, first);
+        memcpy(pipe->send_data, data + first, n - first);
+
+        dmb();  // publish after write
+        ring->head = head + n;
+        data += n;
+        bytes -= n;
+    }
+
+    return SYS_ERR_OK;
+}
+
+
 errval_t aos_dc_send(struct aos_datachan *dc, size_t bytes, const char *data)
 {
     if (dc->backend == AOS_RPC_LMP) {
@@ -216,6 +389,9 @@ errval_t aos_dc_send(struct aos_datachan *dc, size_t bytes, const char *data)
     else if (dc->backend == AOS_RPC_UMP) {
         return aos_dc_send_ump(dc, bytes, data);
     }
+    else if (dc->backend == AOS_DC_PIPE) {
+        return aos_dc_send_pipe(dc, bytes, data);
+    }
     return SYS_ERR_NOT_IMPLEMENTED;
 }
 
@@ -232,12 +408,31 @@ static errval_t aos_dc_receive_one_message_lmp(struct aos_datachan *dc)
         thread_yield();
     }
 
+    struct capref cap = NULL_CAP;
     do {
-        err = lmp_chan_recv(&dc->channel.lmp, &msg, NULL);
+        err = lmp_chan_recv(&dc->channel.lmp, &msg, &cap);
         if (err_is_fail(err) && lmp_err_is_transient(err)) {
             thread_yield();
         }
     } while (err_is_fail(err) && lmp_err_is_transient(err));
+    ON_ERR_RETURN(err);
+
+    if (!capref_is_null(cap)) {
+        // a sender bound to us, the cap is where its credits go
+        err = lmp_chan_alloc_recv_slot(&dc->channel.lmp);
+        ON_ERR_RETURN(err);
+        err = lmp_chan_fc_grant(&dc->channel.lmp, cap);
+        if (err_no(err) == LIB_ERR_LMP_FC_BOUND) {
+            // not from our sender
+            return SYS_ERR_OK;
+        }
+    }
+    else {
+        err = lmp_chan_fc_consumed(&dc->channel.lmp);
+    }
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "returning credits");
+    }
 
     if (dc->bytes_left > 0) {
         // part of a multi message chunk
@@ -310,6 +505,46 @@ static errval_t aos_dc_receive_one_message_ump(struct aos_datachan *dc)
 }
 
 
+/**
+ * \brief number of bytes readable from the pipe, marks the channel closed
+ * once the writer closed it and everything was read
+ */
+static size_t aos_dc_pipe_available(struct aos_datachan *dc)
+{
+    struct aos_dc_pipe_ring *ring = dc->channel.pipe.recv;
+    bool closed = ring->closed;
+    dmb();  // the writer sets closed after its last head update
+    size_t avail = ring->head - ring->tail;
+    if (avail == 0 && closed) {
+        dc->is_closed = true;
+    }
+    dmb();  // read data after head
+    return avail;
+}
+
+
+static void aos_dc_pipe_consume(struct aos_datachan *dc, size_t bytes)
+{
+    dmb();  // release the space after reading it
+    dc->channel.pipe.recv->tail += bytes;
+}
+
+
+static size_t aos_dc_receive_pipe(struct aos_datachan *dc, size_t bytes, char *data)
+{
+    struct aos_dc_pipe *pipe = &dc->channel.pipe;
+
+    size_t n = min(aos_dc_pipe_available(dc), bytes);
+    size_t idx = pipe->recv->tail % pipe->size;
+    size_t first = min(n, pipe->size - idx);
+    memcpy(data, pipe->recv_data + idx, first);
+    memcpy(data + first, pipe->recv_data, n - first);
+
+    aos_dc_pipe_consume(dc, n);
+    return n;
+}
+
+
 static errval_t aos_dc_receive_buffered(struct aos_datachan *dc, size_t bytes, char *data)
 {
     while(bytes > 0) {
@@ -327,6 +562,17 @@ static errval_t aos_dc_receive_buffered(struct aos_datachan *dc, size_t bytes, c
                 errval_t err = aos_dc_receive_one_message_ump(dc);
                 ON_ERR_RETURN(err);
             }
+            else if (dc->backend == AOS_DC_PIPE) {
+                size_t read = aos_dc_receive_pipe(dc, bytes, data);
+                if (read == 0) {
+                    if (dc->is_closed) {
+                        return LIB_ERR_DC_CLOSED;
+                    }
+                    thread_yield();
+                }
+                bytes -= read;
+                data += read;
+            }
             else {
                 return LIB_ERR_NOT_IMPLEMENTED;
             }
@@ -339,6 +585,11 @@ static errval_t aos_dc_receive_buffered(struct aos_datachan *dc, size_t bytes, c
 errval_t aos_dc_receive_available(struct aos_datachan *dc, size_t bytes, char *data, size_t *received)
 {
     errval_t err = SYS_ERR_OK;
+    if (dc->backend == AOS_DC_PIPE) {
+        *received = aos_dc_receive_pipe(dc, bytes, data);
+        return SYS_ERR_OK;
+    }
+
     size_t read = aos_dc_read_from_buffer(&dc->buffer, bytes, data);
 
     while (read < bytes && (
@@ -381,6 +632,9 @@ errval_t aos_dc_can_receive(struct aos_datachan *dc)
     else if (dc->backend == AOS_RPC_UMP) {
         return ump_chan_can_receive(&dc->channel.ump);
     }
+    else if (dc->backend == AOS_DC_PIPE) {
+        return aos_dc_pipe_available(dc) > 0;
+    }
     return false;
 }
 
@@ -426,6 +680,44 @@ errval_t aos_dc_receive_all(struct aos_datachan *dc, size_t bytes, char *data)
     return SYS_ERR_OK;
 }
 
+errval_t aos_dc_forward(struct aos_datachan *to, struct aos_datachan *from, size_t max, size_t *forwarded)
+{
+    errval_t err;
+    *forwarded = 0;
+
+    if (from->backend == AOS_DC_PIPE) {
+        struct aos_dc_pipe *pipe = &from->channel.pipe;
+        // at most two contiguous pieces, before and after the wrap
+        for (int i = 0; i < 2 && *forwarded < max; i++) {
+            size_t idx = pipe->recv->tail % pipe->size;
+            size_t n = min(min(aos_dc_pipe_available(from), max - *forwarded), pipe->size - idx);
+            if (n == 0) {
+                break;
+            }
+            err = aos_dc_send(to, n, pipe->recv_data + idx);
+            ON_ERR_RETURN(err);
+            aos_dc_pipe_consume(from, n);
+            *forwarded += n;
+        }
+        return SYS_ERR_OK;
+    }
+
+    char buffer[1024];
+    size_t recvd;
+    do {
+        err = aos_dc_receive_available(from, min(sizeof buffer, max - *forwarded), buffer, &recvd);
+        ON_ERR_RETURN(err);
+        if (recvd > 0) {
+            err = aos_dc_send(to, recvd, buffer);
+            ON_ERR_RETURN(err);
+            *forwarded += recvd;
+        }
+    } while (recvd > 0 && *forwarded < max);
+
+    return SYS_ERR_OK;
+}
+
+
 errval_t aos_dc_register(struct aos_datachan *dc, struct waitset *ws, struct event_closure closure)
 {
     if (dc->backend == AOS_RPC_LMP) {
@@ -434,6 +726,9 @@ errval_t aos_dc_register(struct aos_datachan *dc, struct waitset *ws, struct eve
     else if (dc->backend == AOS_RPC_UMP) {
         return ump_chan_register_recv(&dc->channel.ump, ws, closure);
     }
+    else if (dc->backend == AOS_DC_PIPE) {
+        return waitset_chan_register_polled(ws, &dc->channel.pipe.waitset_state, closure);
+    }
     return LIB_ERR_NOT_IMPLEMENTED;
 }
 
@@ -445,6 +740,9 @@ errval_t aos_dc_deregister(struct aos_datachan *dc)
     else if (dc->backend == AOS_RPC_UMP) {
         return ump_chan_deregister_recv(&dc->channel.ump);
     }
+    else if (dc->backend == AOS_DC_PIPE) {
+        return waitset_chan_deregister(&dc->channel.pipe.waitset_state);
+    }
     return LIB_ERR_NOT_IMPLEMENTED;
 }
 
@@ -468,9 +766,8 @@ errval_t aos_dc_close(struct aos_datachan *dc)
         if (capref_is_null(dc->channel.lmp.remote_cap)) {
             return LIB_ERR_LMP_CHAN_SEND;
         }
-        do {
-            err = lmp_chan_send4(&dc->channel.lmp, LMP_FLAG_SYNC | LMP_FLAG_YIELD, NULL_CAP, CLOSE_MESSAGE, 0, 0, 0);
-        } while (err_is_fail(err) && lmp_err_is_transient(err));
+        uintptr_t msg[LMP_MSG_LENGTH] = { CLOSE_MESSAGE };
+        err = aos_dc_send_one_lmp(dc, LMP_FLAG_SYNC | LMP_FLAG_YIELD, msg);
         if (err_is_fail(err)) {
             return err;
         }
@@ -482,5 +779,9 @@ errval_t aos_dc_close(struct aos_datachan *dc)
 
         while(!ump_chan_send(&dc->channel.ump, msg, true));
     }
+    else if (dc->backend == AOS_DC_PIPE) {
+        dmb();  // closed after the last head update
+        dc->channel.pipe.send->closed = 1;
+    }
     return SYS_ERR_OK;
 }
@@ -20,12 +20,19 @@
 #include <aos/systime.h>
 #include <aos/kernel_cap_invocations.h>
 #include <aos/default_interfaces.h>
+#include <trace/trace.h>
+#include <trace_definitions/trace_defs.h>
 #include "init.h"
 
 
 
+/*
+ * Calls and replies are packed into long LMP messages, each fragment but the
+ * last is full. Fragments end early where a second capability follows, so
+ * the receiver takes the length of every fragment from the message.
+ */
 struct lmp_msg_info {
-    struct lmp_recv_msg msg;
+    struct lmp_recv_long_msg msg;
     int word_index;
     struct capref cap;
     bool cap_taken;
@@ -44,8 +51,8 @@ static void push_word_lmp(struct lmp_chan *lc, struct lmp_msg_info *lmi, uintptr
 static uintptr_t pull_word_ump(struct ump_chan *uc, struct ump_msg *um, int *word_ind);
 static void push_cap_lmp(struct lmp_chan *lc, struct lmp_msg_info *lmi, struct capref to_push);
 static struct capref pull_cap_lmp(struct lmp_chan *lc, struct lmp_msg_info *lmi);
-static void send_remaining_lmp(struct lmp_chan *lc, struct lmp_msg_info *lmi);
-static errval_t aos_rpc_unmarshall_retval_aarch64(struct aos_rpc *rpc, void **retptrs, struct aos_rpc_function_binding *binding, struct lmp_recv_msg *msg, struct capref cap);
+static void send_remaining_lmp(struct lmp_chan *lc, struct lmp_msg_info *lmi, lmp_send_flags_t flags);
+static errval_t aos_rpc_unmarshall_retval_aarch64(struct aos_rpc *rpc, void **retptrs, struct aos_rpc_function_binding *binding, struct lmp_recv_long_msg *msg, struct capref cap);
 static errval_t aos_rpc_unmarshall_lmp_aarch64(struct aos_rpc *rpc, void *handler, struct aos_rpc_function_binding *binding,
                                                struct lmp_msg_info *lmi);
 
@@ -266,6 +273,9 @@ errval_t aos_rpc_call(struct aos_rpc *rpc, enum aos_rpc_msg_type msg_type, ...)
         err = aos_rpc_call_lmp(rpc, msg_type, args);
         break;
 
+    default:
+        err = LIB_ERR_NOT_IMPLEMENTED;
+        break;
     }
     RPC_UNLOCK(rpc);
     va_end(args);
@@ -990,7 +1000,9 @@ static errval_t aos_rpc_call_lmp(struct aos_rpc *rpc, enum aos_rpc_msg_type msg_
 
     // debug_printf("THis domain: %d is calling call with type %d\n",disp_get_domain_id(),msg_type );
 
-    send_remaining_lmp(lc, &lmi);
+    // the last fragment hands our timeslice to the server until it replies
+    TRACE(AOS, RPC_CALL, msg_type);
+    send_remaining_lmp(lc, &lmi, LMP_SEND_FLAGS_CALL);
 
     for (int i = 0; i < n_rets; i++) {
         retptrs[ret_ind++] = va_arg(args, void*);
@@ -1013,10 +1025,10 @@ static errval_t aos_rpc_call_lmp(struct aos_rpc *rpc, enum aos_rpc_msg_type msg_
     }
 
 
-    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+    struct lmp_recv_long_msg msg = LMP_RECV_LONG_MSG_INIT;
     struct capref recieved_cap = NULL_CAP;
 
-    err = lmp_chan_recv(&rpc->channel.lmp, &msg, &recieved_cap);
+    err = lmp_chan_recv_long(&rpc->channel.lmp, &msg, &recieved_cap);
     ON_ERR_RETURN(err);
 
     if (!capref_is_null(recieved_cap)) {
@@ -1026,6 +1038,7 @@ static errval_t aos_rpc_call_lmp(struct aos_rpc *rpc, enum aos_rpc_msg_type msg_
     err = aos_rpc_unmarshall_retval_aarch64(rpc, retptrs, binding, &msg, recieved_cap);
     ON_ERR_RETURN(err);
 
+    TRACE(AOS, RPC_CALL_DONE, msg_type);
     return SYS_ERR_OK;
 }
 
@@ -1041,11 +1054,11 @@ void aos_rpc_on_lmp_message(void *arg)
 
     struct lmp_chan *channel = &rpc->channel.lmp;
 
-    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+    struct lmp_recv_long_msg msg = LMP_RECV_LONG_MSG_INIT;
     struct capref recieved_cap = NULL_CAP;
     errval_t err;
 
-    err = lmp_chan_recv(channel, &msg, &recieved_cap);
+    err = lmp_chan_recv_long(channel, &msg, &recieved_cap);
     if (err_is_fail(err) && lmp_err_is_transient(err)) {
         debug_printf("transient error\n");
         err = lmp_chan_register_recv(channel, rpc->waitset ? : get_default_waitset(), MKCLOSURE(&aos_rpc_on_lmp_message, arg));
@@ -1067,6 +1080,7 @@ void aos_rpc_on_lmp_message(void *arg)
     }
 
     uintptr_t msgtype = msg.words[0];
+    TRACE(AOS, RPC_RECV, msgtype);
 
     bool is_response = false;
     if (msgtype & AOS_RPC_RETURN_BIT) {
@@ -1157,8 +1171,8 @@ static void lmi_receive(struct lmp_chan *lc, struct lmp_msg_info *lmi)
     }
 
     do {
-        lmi->msg = LMP_RECV_MSG_INIT;
-        errval_t err = lmp_chan_recv(lc, &lmi->msg, &lmi->cap);
+        lmi->msg = LMP_RECV_LONG_MSG_INIT;
+        errval_t err = lmp_chan_recv_long(lc, &lmi->msg, &lmi->cap);
         received = err == SYS_ERR_OK;
     } while(!received);
 
@@ -1173,12 +1187,12 @@ static void lmi_receive(struct lmp_chan *lc, struct lmp_msg_info *lmi)
 
 static void lmi_send(struct lmp_chan *lc, struct lmp_msg_info *lmi)
 {
-    bool sent = false;
-    do {
-        errval_t err = lmp_chan_send(lc, LMP_FLAG_YIELD, lmi->cap, 4,
-                                        lmi->msg.words[0], lmi->msg.words[1], lmi->msg.words[2], lmi->msg.words[3]);
-        sent = err == SYS_ERR_OK;
-    } while (!sent);
+    // sleeps while the receiver's buffer is full
+    errval_t err = lmp_chan_send_long_wait(lc, LMP_FLAG_YIELD, lmi->cap, lmi->word_index,
+                                           lmi->msg.words);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "sending rpc fragment\n");
+    }
     lmi->cap = NULL_CAP;
     lmi->cap_taken = false;
     lmi->word_index = 0;
@@ -1194,7 +1208,7 @@ static void lmi_send(struct lmp_chan *lc, struct lmp_msg_info *lmi)
  */
 static uintptr_t pull_word_lmp(struct lmp_chan *lc, struct lmp_msg_info *lmi)
 {
-    if (lmi->word_index >= LMP_MSG_LENGTH) {
+    if (lmi->word_index >= lmi->msg.buf.msglen) {
         lmi_receive(lc, lmi);
     }
 
@@ -1234,7 +1248,7 @@ static struct capref pull_cap_lmp(struct lmp_chan *lc, struct lmp_msg_info *lmi)
  */
 static void push_word_lmp(struct lmp_chan *lc, struct lmp_msg_info *lmi, uintptr_t word)
 {
-    if (lmi->word_index >= LMP_MSG_LENGTH) {
+    if (lmi->word_index >= LMP_LONG_MSG_LENGTH) {
         lmi_send(lc, lmi);
     }
     lmi->msg.words[lmi->word_index++] = word;
@@ -1260,26 +1274,14 @@ static void push_cap_lmp(struct lmp_chan *lc, struct lmp_msg_info *lmi, struct c
 }
 
 
-static void send_remaining_lmp(struct lmp_chan *lc, struct lmp_msg_info *lmi)
+static void send_remaining_lmp(struct lmp_chan *lc, struct lmp_msg_info *lmi, lmp_send_flags_t flags)
 {
     if (lmi->word_index > 0 || lmi->cap_taken) {
-        bool sent = false;
-        do {
-            errval_t err = lmp_chan_send(lc, LMP_SEND_FLAGS_DEFAULT, lmi->cap, 4,
-                                         lmi->msg.words[0], lmi->msg.words[1], lmi->msg.words[2], lmi->msg.words[3]);
-
-            if (err_is_fail(err) && !lmp_err_is_transient(err)) {
-                DEBUG_ERR(err, "what is this?\n");
-                break;
-            }
-            else if (err_is_fail(err)) {
-                //err_print_calltrace(err);
-                // DEBUG_ERR(err, "interesting\n");
-                thread_yield_dispatcher(lc->remote_cap);
-            }
-        // debug_printf("Stuck here!\n");
-            sent = err == SYS_ERR_OK;
-        } while (!sent);
+        errval_t err = lmp_chan_send_long_wait(lc, flags, lmi->cap, lmi->word_index,
+                                               lmi->msg.words);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "what is this?\n");
+        }
         lmi->cap_taken = false;
         lmi->cap = NULL_CAP;
         lmi->word_index = 0;
@@ -1297,7 +1299,7 @@ static void send_remaining_lmp(struct lmp_chan *lc, struct lmp_msg_info *lmi)
  * retvals for calls
  */
 static errval_t aos_rpc_unmarshall_retval_aarch64(struct aos_rpc *rpc, void **retptrs, struct aos_rpc_function_binding *binding,
-                                                      struct lmp_recv_msg *msg, struct capref cap)
+                                                      struct lmp_recv_long_msg *msg, struct capref cap)
 {
 
     struct lmp_chan *lc = &rpc->channel.lmp;
@@ -1548,7 +1550,9 @@ static errval_t aos_rpc_unmarshall_lmp_aarch64(struct aos_rpc *rpc, void *handle
             break;
         }
     }
-    send_remaining_lmp(lc, lmi);
+    // switches straight back to the caller if it is waiting in a call
+    TRACE(AOS, RPC_REPLY, binding->msg_type);
+    send_remaining_lmp(lc, lmi, LMP_SEND_FLAGS_REPLY);
 
     return SYS_ERR_OK;
 }
@@ -1649,6 +1653,18 @@ errval_t aos_rpc_process_spawn(struct aos_rpc *rpc, char *cmdline, coreid_t core
     return aos_rpc_call(rpc, INIT_IFACE_SPAWN, cmdline, core, newpid);
 }
 
+/**
+ * \brief Spawn a process that maps a copy of state copy-on-write.
+ *
+ * The child gets the frame with paging_map_clone_state(). The caller keeps
+ * its cap, and protects its own mapping with paging_protect_cow() if it goes
+ * on writing to the state.
+ */
+errval_t aos_rpc_process_spawn_clone(struct aos_rpc *rpc, char *cmdline, coreid_t core,
+                                     struct capref state, domainid_t *newpid) {
+    return aos_rpc_call(rpc, INIT_IFACE_SPAWN_CLONE, cmdline, core, state, newpid);
+}
+
 /**
  * \brief Get the name of the process with the given PID.
  *
@@ -1723,12 +1739,116 @@ errval_t aos_rpc_get_ram_cap(struct aos_rpc *rpc, size_t bytes, size_t alignment
  * \brief Requesting ram via the rpc channel. Must be RPC channel to core 0!
  */
 errval_t aos_rpc_request_foreign_ram(struct aos_rpc *rpc, size_t size, struct capref *ret_cap, size_t *ret_size)
+{
+    errval_t err;
+    size_t n;
+    err = aos_rpc_request_foreign_ram_batch(rpc, size, 1, ret_cap, &n);
+    ON_ERR_RETURN(err);
+    if (n == 0) {
+        return LIB_ERR_RAM_ALLOC_FIXED_EXHAUSTED;
+    }
+    *ret_size = size;
+    return SYS_ERR_OK;
+}
+
+
+/*
+ * Caps cross cores as their struct capability, the receiving init forges a
+ * copy with its monitor cap. A batch packs many of them into one varbytes
+ * argument, so a single UMP round trip and a single slot allocation cover
+ * all of them instead of one of each per cap.
+ */
+
+/**
+ * \brief serialize n caps into out
+ *
+ * \param out out->bytes must hold n caps, out->length is set to the packed size
+ */
+errval_t aos_rpc_cap_batch_pack(struct capref *caps, size_t n,
+                                struct aos_rpc_varbytes *out)
+{
+    errval_t err;
+    if (n > AOS_RPC_CAP_BATCH_MAX || out->length < n * sizeof(struct capability)) {
+        return LIB_ERR_RPC_ARGUMENT_OVERFLOW;
+    }
+
+    struct capability *packed = (struct capability *) out->bytes;
+    for (size_t i = 0; i < n; i++) {
+        err = invoke_cap_identify(caps[i], &packed[i]);
+        ON_ERR_PUSH_RETURN(err, LIB_ERR_CAP_IDENTIFY);
+    }
+    out->length = n * sizeof(struct capability);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief forge the caps packed by aos_rpc_cap_batch_pack() into consecutive slots
+ *
+ * Only init holds the monitor cap needed for this.
+ *
+ * \param caps filled with the forged caps, room for AOS_RPC_CAP_BATCH_MAX
+ * \param n    set to the number of caps
+ */
+errval_t aos_rpc_cap_batch_forge(struct aos_rpc_varbytes in, struct capref *caps,
+                                 size_t *n)
+{
+    errval_t err;
+    size_t count = in.length / sizeof(struct capability);
+    *n = 0;
+    if (count == 0) {
+        return SYS_ERR_OK;
+    }
+    if (count > AOS_RPC_CAP_BATCH_MAX) {
+        return LIB_ERR_RPC_ARGUMENT_OVERFLOW;
+    }
+
+    struct capref first;
+    err = slot_alloc_n(count, &first);
+    ON_ERR_PUSH_RETURN(err, LIB_ERR_SLOT_ALLOC);
+
+    for (size_t i = 0; i < count; i++) {
+        struct capability cap;
+        memcpy(&cap, in.bytes + i * sizeof cap, sizeof cap);
+
+        caps[i] = first;
+        caps[i].slot += i;
+        err = invoke_monitor_create_cap((uint64_t *) &cap,
+                                        get_cnode_addr(caps[i]),
+                                        get_cnode_level(caps[i]),
+                                        caps[i].slot,
+                                        disp_get_core_id());
+        if (err_is_fail(err)) {
+            // keep what was forged so far, give back the rest of the slots
+            struct capref rest = caps[i];
+            slot_free_n(rest, count - i);
+            *n = i;
+            return err_push(err, LIB_ERR_MONITOR_CAP_SEND);
+        }
+    }
+    *n = count;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief request up to n_chunks ram caps of chunk_size bytes from init on core 0
+ *
+ * Must be the init channel to core 0. Core 0 may hand out fewer chunks than
+ * requested when it runs low, n_ret tells how many arrived.
+ */
+errval_t aos_rpc_request_foreign_ram_batch(struct aos_rpc *rpc, size_t chunk_size,
+                                           size_t n_chunks, struct capref *caps,
+                                           size_t *n_ret)
 {
     errval_t err;
     assert(rpc->backend == AOS_RPC_UMP && "Tried to call foreign ram request on an LMP channel!\n");
-    err = aos_rpc_call(rpc,AOS_RPC_REQUEST_RAM, size, 1, ret_cap,ret_size);
+
+    struct capability packed[AOS_RPC_CAP_BATCH_MAX];
+    struct aos_rpc_varbytes bytes = { .length = sizeof packed, .bytes = (char *) packed };
+    n_chunks = n_chunks > AOS_RPC_CAP_BATCH_MAX ? AOS_RPC_CAP_BATCH_MAX : n_chunks;
+
+    err = aos_rpc_call(rpc, INIT_IFACE_GET_RAM_BATCH, chunk_size, n_chunks, &bytes);
     ON_ERR_RETURN(err);
-    return err;
+    return aos_rpc_cap_batch_forge(bytes, caps, n_ret);
 }
 
 
@@ -142,6 +142,12 @@ struct capref cap_kernel = {
     .slot  = TASKCN_SLOT_KERNELCAP
 };
 
+/// Capability for the trace buffer of this core (only with tracing)
+struct capref cap_tracebuf = {
+    .cnode = TASK_CNODE_INIT,
+    .slot  = TASKCN_SLOT_TRACEBUF
+};
+
 /// Capability for IPI sending (only in monitor)
 struct capref cap_ipi = {
     .cnode = TASK_CNODE_INIT,
@@ -206,31 +206,119 @@ static errval_t map_module(struct mem_region *module, void **ret_addr)
 }
 
 /**
- * \brief allocated memory to load, then loads and relocates an elf image
- * 
- * \param mi will be filled in with the allocated memory
+ * \brief an ELF module whose symbols and layout were looked up already
  */
-static errval_t load_and_relocate(void *elf_image, size_t elf_image_size, struct mem_info *mi,
-                                  const char *entry_sym_name, size_t relocate_offset,
-                                  genpaddr_t *entry)
+struct coreboot_elf {
+    void *image;
+    size_t image_size;
+    genvaddr_t entry;       ///< unrelocated address of the entry symbol
+    size_t virtual_size;
+};
+
+/**
+ * \brief modules needed to boot a core, prepared by the first coreboot
+ *
+ * Every core needs a private copy of the boot and CPU driver, as both write
+ * to their data sections. The module mappings, symbol lookups and sizes are
+ * the same for all cores though and are only done once.
+ */
+static struct coreboot_images {
+    bool loaded;
+    const char *boot_driver;
+    const char *cpu_driver;
+    const char *init;
+
+    struct coreboot_elf boot;
+    struct coreboot_elf cpu;
+
+    struct capref init_cap;
+    size_t init_mod_size;
+    size_t init_size;
+} images;
+
+static errval_t prepare_elf(const char *name, const char *entry_sym_name,
+                            struct coreboot_elf *elf)
 {
     errval_t err;
+    struct mem_region *mod = multiboot_find_module(bi, name);
+    NULLPTR_CHECK(mod, SPAWN_ERR_FIND_MODULE);
+
+    err = map_module(mod, &elf->image);
+    ON_ERR_RETURN(err);
+    elf->image_size = mod->mrmod_size;
+
     uintptr_t eindex = 0;
-    struct Elf64_Sym *entry_sym = elf64_find_symbol_by_name((genvaddr_t) elf_image, elf_image_size, entry_sym_name, 0, STT_FUNC, &eindex);
+    struct Elf64_Sym *entry_sym = elf64_find_symbol_by_name((genvaddr_t) elf->image, elf->image_size, entry_sym_name, 0, STT_FUNC, &eindex);
     if (entry_sym == NULL) {
         return SPAWN_ERR_ELF_FIND_SYMBOL;
     }
-    genvaddr_t boot_entry = entry_sym->st_value;
-    
-    size_t size = elf_virtual_size((lvaddr_t) elf_image);
-    
+    elf->entry = entry_sym->st_value;
+    elf->virtual_size = elf_virtual_size((lvaddr_t) elf->image);
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief map the modules for booting cores and look up what coreboot needs
+ *
+ * Only the first call does any work, later calls have to pass the same names.
+ */
+errval_t coreboot_prepare_images(const char *boot_driver,
+                                 const char *cpu_driver,
+                                 const char *init)
+{
+    errval_t err;
+    if (images.loaded) {
+        assert(strcmp(images.boot_driver, boot_driver) == 0);
+        assert(strcmp(images.cpu_driver, cpu_driver) == 0);
+        assert(strcmp(images.init, init) == 0);
+        return SYS_ERR_OK;
+    }
+
+    err = prepare_elf(boot_driver, "boot_entry_psci", &images.boot);
+    ON_ERR_RETURN(err);
+    err = prepare_elf(cpu_driver, "arch_init", &images.cpu);
+    ON_ERR_RETURN(err);
+
+    struct mem_region *init_mod = multiboot_find_module(bi, init);
+    NULLPTR_CHECK(init_mod, SPAWN_ERR_FIND_MODULE);
+    images.init_cap = (struct capref) {
+        .cnode = cnode_module,
+        .slot = init_mod->mrmod_slot
+    };
+    images.init_mod_size = init_mod->mrmod_size;
+
+    void *init_image;
+    err = map_module(init_mod, &init_image);
+    ON_ERR_RETURN(err);
+    images.init_size = elf_virtual_size((lvaddr_t) init_image);
+
+    images.boot_driver = boot_driver;
+    images.cpu_driver = cpu_driver;
+    images.init = init;
+    images.loaded = true;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief allocated memory to load, then loads and relocates an elf image
+ * 
+ * \param mi will be filled in with the allocated memory
+ */
+static errval_t load_and_relocate(struct coreboot_elf *elf, struct mem_info *mi,
+                                  size_t relocate_offset, genpaddr_t *entry)
+{
+    errval_t err;
+    genvaddr_t boot_entry;
+
     struct capref frame;
-    err = frame_alloc_and_map(&frame, size, &mi->size, &mi->buf);
+    err = frame_alloc_and_map(&frame, elf->virtual_size, &mi->size, &mi->buf);
+    ON_ERR_PUSH_RETURN(err, LIB_ERR_FRAME_ALLOC);
     mi->phys_base = get_phys_addr(frame);
     
-    err = load_elf_binary((genvaddr_t) elf_image, mi, boot_entry, &boot_entry);
+    err = load_elf_binary((genvaddr_t) elf->image, mi, elf->entry, &boot_entry);
     ON_ERR_RETURN(err);
-    err = relocate_elf((genvaddr_t) elf_image, mi, relocate_offset);
+    err = relocate_elf((genvaddr_t) elf->image, mi, relocate_offset);
     ON_ERR_RETURN(err);
     
     *entry = boot_entry + relocate_offset;
@@ -297,27 +385,17 @@ errval_t coreboot(coreid_t mpid,
     // ==========================================
     // Load and relocate Boot Driver & CPU Driver
     // ==========================================
-    struct mem_region *boot_mod = multiboot_find_module(bi, boot_driver);
-    struct mem_region *cpu_driver_mod = multiboot_find_module(bi, cpu_driver);
-    NULLPTR_CHECK(boot_mod, SPAWN_ERR_FIND_MODULE);
-    NULLPTR_CHECK(cpu_driver_mod, SPAWN_ERR_FIND_MODULE);
-
-    void *boot_elf_blob;
-    void *cpu_driver_elf_blob;
+    err = coreboot_prepare_images(boot_driver, cpu_driver, init);
+    ON_ERR_RETURN(err);
 
     struct mem_info boot_mi;
     struct mem_info cpu_driver_mi;
     genpaddr_t boot_entry;
     genpaddr_t cpu_driver_entry;
 
-    err = map_module(boot_mod, &boot_elf_blob);
+    err = load_and_relocate(&images.boot, &boot_mi, 0, &boot_entry);
     ON_ERR_RETURN(err);
-    err = load_and_relocate(boot_elf_blob, boot_mod->mrmod_size, &boot_mi, "boot_entry_psci", 0, &boot_entry);
-    ON_ERR_RETURN(err);
-
-    err = map_module(cpu_driver_mod, &cpu_driver_elf_blob);
-    ON_ERR_RETURN(err);
-    err = load_and_relocate(cpu_driver_elf_blob, cpu_driver_mod->mrmod_size, &cpu_driver_mi, "arch_init", ARMv8_KERNEL_OFFSET, &cpu_driver_entry);
+    err = load_and_relocate(&images.cpu, &cpu_driver_mi, ARMv8_KERNEL_OFFSET, &cpu_driver_entry);
     ON_ERR_RETURN(err);
 
 
@@ -329,28 +407,12 @@ errval_t coreboot(coreid_t mpid,
     ON_ERR_PUSH_RETURN(err, LIB_ERR_RAM_ALLOC);
 
 
-    // ================
-    // Locate init blob
-    // ================
-    struct mem_region *init_mod = multiboot_find_module(bi, init);
-    NULLPTR_CHECK(init_mod, SPAWN_ERR_FIND_MODULE);
-    struct capref init_mod_cap = {
-        .cnode = cnode_module,
-        .slot = init_mod->mrmod_slot
-    };
-
-    void *init_image;
-    err = map_module(init_mod, &init_image);
-    ON_ERR_RETURN(err);
-    size_t init_size = elf_virtual_size((lvaddr_t) init_image);
-
-
     // ============
     // Alloc Memory 
     // ============
     struct capref init_ram;
     size_t init_ram_size;
-    err = frame_alloc(&init_ram, ROUND_UP(init_size, BASE_PAGE_SIZE) + ARMV8_CORE_DATA_PAGES * BASE_PAGE_SIZE, &init_ram_size);
+    err = frame_alloc(&init_ram, ROUND_UP(images.init_size, BASE_PAGE_SIZE) + ARMV8_CORE_DATA_PAGES * BASE_PAGE_SIZE, &init_ram_size);
     ON_ERR_PUSH_RETURN(err, LIB_ERR_RAM_ALLOC);
 
 
@@ -377,8 +439,8 @@ errval_t coreboot(coreid_t mpid,
     core_data->dst_arch_id = mpid;
 
     core_data->monitor_binary = (struct armv8_coredata_memreg) {
-        .base = get_phys_addr(init_mod_cap),
-        .length = init_mod->mrmod_size
+        .base = get_phys_addr(images.init_cap),
+        .length = images.init_mod_size
     };
 
     core_data->memory = (struct armv8_coredata_memreg) {
@@ -400,8 +462,10 @@ errval_t coreboot(coreid_t mpid,
     // ==========
     // Start core
     // ==========
+    // returns once the core is released, it boots on its own from here
     err = invoke_monitor_spawn_core(mpid, CPU_ARM8, boot_entry, get_phys_addr(core_data_frame), 0);
-    
+    ON_ERR_RETURN(err);
+
     return SYS_ERR_OK;
 }
 
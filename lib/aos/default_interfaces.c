@@ -77,6 +77,14 @@ static void initialize_interfaces(void)
     aos_rpc_initialize_binding(&init_interface, "spawn_extended", INIT_IFACE_GET_ALL_MODULES,
                                0, 1, AOS_RPC_VARSTR);
 
+    // params: chunk size, number of chunks; returns the packed ram caps
+    aos_rpc_initialize_binding(&init_interface, "get_ram_batch", INIT_IFACE_GET_RAM_BATCH,
+                               2, 1, AOS_RPC_WORD, AOS_RPC_WORD, AOS_RPC_VARBYTES);
+
+    // params: command line, core, state frame; returns the pid
+    aos_rpc_initialize_binding(&init_interface, "spawn_clone", INIT_IFACE_SPAWN_CLONE,
+                               3, 1, AOS_RPC_VARSTR, AOS_RPC_WORD, AOS_RPC_CAPABILITY, AOS_RPC_WORD);
+
 
     // ===================== Dispatcher Interface =====================
 
@@ -138,11 +138,8 @@ errval_t init_dispatcher_rpcs(void)
 
         // setup stdin
         struct capref stdin_epcap;
-        struct lmp_endpoint *stdin_endpoint;
-        err = endpoint_create(LMP_RECV_LENGTH * 8, &stdin_epcap, &stdin_endpoint);
         err = aos_dc_init_lmp(&stdin_chan, 1024);
-        stdin_chan.channel.lmp.endpoint = stdin_endpoint;
-        stdin_chan.channel.lmp.local_cap = stdin_epcap;
+        err = aos_dc_create_lmp_endpoint(&stdin_chan, AOS_DC_LMP_DEPTH, &stdin_epcap);
 
 
 
@@ -233,7 +230,7 @@ errval_t init_dispatcher_rpcs(void)
 
         size_t block_size = get_size(&oc);
 
-        err = aos_dc_init_ump(&stdout_chan, 64, (lvaddr_t) frame, block_size, 0);
+        err = aos_dc_init_frame(&stdout_chan, 64, (lvaddr_t) frame, block_size, 0);
         ON_ERR_RETURN(err);
     }
     else {
@@ -248,7 +245,7 @@ errval_t init_dispatcher_rpcs(void)
 
         size_t block_size = get_size(&ic);
 
-        err = aos_dc_init_ump(&stdin_chan, 64, (lvaddr_t) frame, block_size, 1);
+        err = aos_dc_init_frame(&stdin_chan, 64, (lvaddr_t) frame, block_size, 1);
         ON_ERR_RETURN(err);
     }
 
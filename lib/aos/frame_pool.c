@@ -0,0 +1,190 @@
+/**
+ * \file
+ * \brief Pool of ready base page frames, kept filled by a background thread
+ */
+
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <aos/aos.h>
+#include <aos/frame_pool.h>
+
+/*
+ * A lazily mapped page costs a slot, a ram request to the memory server and a
+ * retype, during which the kernel zeroes the frame, before it can be mapped.
+ * The pool does all of that ahead of time on its own thread, so a page fault
+ * only pops a frame and maps it. The refill thread sleeps until the pool
+ * drops below the low water mark and yields after every batch, so it only
+ * runs when the domain has nothing better to do.
+ *
+ * Most domains never fault in a page. The refill thread stays asleep until
+ * the first lazily mapped page is allocated through frame_pool_alloc_lazy(),
+ * so they don't pay for frames they never use.
+ */
+
+struct frame_pool {
+    struct thread_mutex mutex;
+    struct thread_cond low;         ///< signalled when count drops below low_water
+    struct capref frames[FRAME_POOL_MAX_FRAMES];
+    size_t count;
+    struct frame_pool_tunables tunables;
+    bool initialized;
+    bool armed;                     ///< a lazily mapped page was allocated
+};
+
+static struct frame_pool pool = {
+    .mutex = THREAD_MUTEX_INITIALIZER,
+    .low = THREAD_COND_INITIALIZER,
+    .tunables = {
+        .target = 64,
+        .low_water = 32,
+        .batch = 8,
+    },
+};
+
+
+static int frame_pool_refill_func(void *arg)
+{
+    errval_t err;
+
+    thread_mutex_lock(&pool.mutex);
+    while (true) {
+        while (!pool.armed || pool.count >= pool.tunables.low_water
+               || pool.count >= pool.tunables.target) {
+            thread_cond_wait(&pool.low, &pool.mutex);
+        }
+
+        size_t batch = pool.tunables.batch;
+        bool failed = false;
+        for (size_t i = 0; i < batch && pool.count < pool.tunables.target; i++) {
+            // the memory server is not asked with the pool locked
+            thread_mutex_unlock(&pool.mutex);
+            struct capref frame;
+            err = frame_alloc(&frame, BASE_PAGE_SIZE, NULL);
+            thread_mutex_lock(&pool.mutex);
+
+            if (err_is_fail(err)) {
+                DEBUG_ERR(err, "frame pool refill");
+                failed = true;
+                break;
+            }
+            if (pool.count < FRAME_POOL_MAX_FRAMES) {
+                pool.frames[pool.count++] = frame;
+            } else {
+                thread_mutex_unlock(&pool.mutex);
+                cap_destroy(frame);
+                thread_mutex_lock(&pool.mutex);
+            }
+        }
+
+        if (failed) {
+            // try again on the next fault instead of spinning on the memory server
+            thread_cond_wait(&pool.low, &pool.mutex);
+        } else if (pool.count < pool.tunables.target) {
+            thread_mutex_unlock(&pool.mutex);
+            thread_yield();
+            thread_mutex_lock(&pool.mutex);
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * \brief start the refill thread of the calling domain, it waits for the
+ * first lazily mapped page
+ */
+errval_t frame_pool_init(void)
+{
+    struct thread *t = thread_create(frame_pool_refill_func, NULL);
+    if (t == NULL) {
+        return LIB_ERR_THREAD_CREATE;
+    }
+    pool.initialized = true;
+    return SYS_ERR_OK;
+}
+
+
+static errval_t frame_pool_pop(struct capref *frame, bool arm)
+{
+    if (pool.initialized && thread_mutex_trylock(&pool.mutex)) {
+        pool.armed |= arm;
+        // a target of 0 bypasses the pool, the frames in it are kept
+        bool hit = pool.count > 0 && pool.tunables.target > 0;
+        if (hit) {
+            *frame = pool.frames[--pool.count];
+        }
+        if (pool.count < pool.tunables.low_water) {
+            thread_cond_signal(&pool.low);
+        }
+        thread_mutex_unlock(&pool.mutex);
+        if (hit) {
+            return SYS_ERR_OK;
+        }
+    }
+    return frame_alloc(frame, BASE_PAGE_SIZE, NULL);
+}
+
+
+/**
+ * \brief a zeroed frame of BASE_PAGE_SIZE bytes
+ *
+ * Pops one from the pool, or allocates it right away if the pool is empty or
+ * busy.
+ */
+errval_t frame_pool_alloc(struct capref *frame)
+{
+    return frame_pool_pop(frame, false);
+}
+
+
+/**
+ * \brief like frame_pool_alloc(), for a page faulted in by the domain
+ *
+ * The first call starts refilling the pool.
+ */
+errval_t frame_pool_alloc_lazy(struct capref *frame)
+{
+    return frame_pool_pop(frame, true);
+}
+
+
+size_t frame_pool_count(void)
+{
+    return pool.count;
+}
+
+
+void frame_pool_get_tunables(struct frame_pool_tunables *tunables)
+{
+    *tunables = pool.tunables;
+}
+
+
+/**
+ * \brief change the pool size and refill rate
+ *
+ * Frames above a lowered target stay in the pool until they are used, with
+ * a target of 0 until the pool is enabled again.
+ */
+void frame_pool_set_tunables(const struct frame_pool_tunables *tunables)
+{
+    thread_mutex_lock(&pool.mutex);
+    pool.tunables = *tunables;
+    if (pool.tunables.target > FRAME_POOL_MAX_FRAMES) {
+        pool.tunables.target = FRAME_POOL_MAX_FRAMES;
+    }
+    if (pool.tunables.batch == 0) {
+        pool.tunables.batch = 1;
+    }
+    if (pool.count < pool.tunables.low_water) {
+        thread_cond_signal(&pool.low);
+    }
+    thread_mutex_unlock(&pool.mutex);
+}
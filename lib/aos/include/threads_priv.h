@@ -12,6 +12,7 @@
 
 #include <aos/dispatcher_arch.h>
 #include <aos/except.h>
+#include <aos/slot_alloc.h>
 
 /// Maximum number of thread-local storage keys
 #define MAX_TLS         16
@@ -81,6 +82,8 @@ struct thread {
     errval_t    async_error;                ///< RPC async error
     uint32_t    outgoing_token;             ///< Token of outgoing message
     struct waitset_chanstate *local_trigger; ///< Trigger for a local thread event
+
+    struct slot_magazine slot_magazine;     ///< Slots for slot_alloc()
 };
 
 void thread_enqueue(struct thread *thread, struct thread **queue);
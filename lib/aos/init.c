@@ -25,9 +25,11 @@
 #include <barrelfish_kpi/dispatcher_shared.h>
 #include <aos/morecore.h>
 #include <aos/paging.h>
+#include <aos/frame_pool.h>
 #include <aos/systime.h>
 #include <aos/io_channels.h>
 #include <barrelfish_kpi/domain_params.h>
+#include <trace/trace.h>
 
 #include "threads_priv.h"
 #include "init.h"
@@ -218,7 +220,13 @@ errval_t barrelfish_init_onthread(struct spawn_domain_params *params)
 
     lmp_endpoint_init();
 
-    
+#ifdef CONFIG_TRACE
+    // init sets up the trace buffer of its core itself
+    if (!init_domain) {
+        trace_init_disp();
+    }
+#endif
+
     // HINT: Use init_domain to check if we are the init domain.
     if (init_domain) { // init does not need a channel to itself
         err = cap_retype(cap_selfep, cap_dispatcher, 0, ObjType_EndPointLMP, 0, 1);
@@ -234,6 +242,9 @@ errval_t barrelfish_init_onthread(struct spawn_domain_params *params)
 
     err = init_dispatcher_rpcs();
     ON_ERR_RETURN(err);
+
+    err = frame_pool_init();
+    ON_ERR_RETURN(err);
     // debug_printf("init_dispatcher_rpcs returned\n");
     if(get_ns_online()){
         err = init_nameserver_rpc((char* ) params -> argv[0]);
@@ -30,6 +30,7 @@ void lmp_chan_init(struct lmp_chan *lc)
     lc->connstate = LMP_DISCONNECTED;
     waitset_chanstate_init(&lc->send_waitset, CHANTYPE_LMP_OUT);
     lc->endpoint = NULL;
+    lc->fc.credits = lc->fc.window = lc->fc.consumed = 0;
 #ifndef NDEBUG
     lc->prev = lc->next = NULL;
 #endif
@@ -243,3 +244,228 @@ void lmp_channels_retry_send_disabled(dispatcher_handle_t handle)
 
     dp->lmp_send_events_list = NULL;
 }
+
+static void lmp_chan_wakeup(void *arg)
+{
+}
+
+/**
+ * \brief Block the calling thread until a send on the channel may succeed
+ *
+ * Gives the rest of the timeslice to the receiver, so it can drain its
+ * endpoint, and sleeps on a private waitset until the send event fires the
+ * next time this dispatcher runs.
+ */
+static errval_t lmp_chan_wait_send(struct lmp_chan *lc)
+{
+    struct waitset ws;
+    errval_t err;
+
+    waitset_init(&ws);
+    err = lmp_chan_register_send(lc, &ws, MKCLOSURE(lmp_chan_wakeup, NULL));
+    if (err_is_ok(err)) {
+        thread_yield_dispatcher(lc->remote_cap);
+        err = event_dispatch(&ws);
+    }
+    waitset_destroy(&ws);
+    return err;
+}
+
+/**
+ * \brief Block the calling thread until a message arrives on the channel
+ */
+static errval_t lmp_chan_wait_recv(struct lmp_chan *lc)
+{
+    struct waitset ws;
+    errval_t err;
+
+    waitset_init(&ws);
+    err = lmp_chan_register_recv(lc, &ws, MKCLOSURE(lmp_chan_wakeup, NULL));
+    if (err_is_ok(err)) {
+        thread_yield_dispatcher(lc->remote_cap);
+        err = event_dispatch(&ws);
+    }
+    waitset_destroy(&ws);
+    return err;
+}
+
+/**
+ * \brief Send a message, blocking while the receiver's buffer is full
+ *
+ * Same as lmp_chan_send(), but transient errors put the calling thread to
+ * sleep until the channel's send event fires instead of being returned.
+ * The channel must not have a send event registered.
+ */
+errval_t lmp_chan_send_wait(struct lmp_chan *lc, lmp_send_flags_t flags,
+                            struct capref send_cap, uint8_t length_words,
+                            uintptr_t arg1, uintptr_t arg2,
+                            uintptr_t arg3, uintptr_t arg4)
+{
+    for (;;) {
+        errval_t err = lmp_chan_send(lc, flags, send_cap, length_words,
+                                     arg1, arg2, arg3, arg4);
+        if (err_is_ok(err) || !lmp_err_is_transient(err)) {
+            return err;
+        }
+
+        err = lmp_chan_wait_send(lc);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+}
+
+/**
+ * \brief Send a long message, blocking while the receiver's buffer is full
+ *
+ * \param words Payload, an array of #LMP_LONG_MSG_LENGTH words
+ */
+errval_t lmp_chan_send_long_wait(struct lmp_chan *lc, lmp_send_flags_t flags,
+                                 struct capref send_cap, uint8_t length_words,
+                                 const uintptr_t *words)
+{
+    for (;;) {
+        errval_t err = lmp_chan_send_long(lc, flags, send_cap, length_words,
+                                          words);
+        if (err_is_ok(err) || !lmp_err_is_transient(err)) {
+            return err;
+        }
+
+        err = lmp_chan_wait_send(lc);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+}
+
+/*
+ * Credit based flow control for one-way streams. The receiver's endpoint
+ * holds fc.window messages and the sender may have as many outstanding. The
+ * sender starts out with a single credit, for a first message that carries
+ * the capability of the sender's own endpoint. Through it the receiver grants
+ * its window, and returns credits in one-word messages whenever it has taken
+ * half a window out of its buffer. All the sender receives on the channel are
+ * credits; it sleeps on them instead of retrying against a full buffer.
+ *
+ * The receiver keeps credit state for a single sender. Any further sender
+ * that binds gets LMP_FC_REJECT instead of a window, and its first message
+ * is dropped.
+ */
+
+/// credit word that turns away a second sender
+#define LMP_FC_REJECT ((uintptr_t) -1)
+
+/**
+ * \brief Enable flow control on a channel
+ *
+ * \param lc     LMP channel
+ * \param window Messages the local endpoint buffer holds, 0 on a sender
+ */
+void lmp_chan_fc_init(struct lmp_chan *lc, uint32_t window)
+{
+    lc->fc.credits = 1;
+    lc->fc.window = window;
+    lc->fc.consumed = 0;
+}
+
+/**
+ * \brief Add up the credits the receiver has returned so far
+ */
+static errval_t lmp_chan_fc_collect(struct lmp_chan *lc)
+{
+    while (lmp_chan_can_recv(lc)) {
+        struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+        errval_t err = lmp_chan_recv(lc, &msg, NULL);
+        if (err_no(err) == LIB_ERR_NO_LMP_MSG) {
+            break;
+        }
+        ON_ERR_RETURN(err);
+        if (msg.words[0] == LMP_FC_REJECT) {
+            return LIB_ERR_LMP_FC_BOUND;
+        }
+        lc->fc.credits += msg.words[0];
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Send a full-length message on a flow controlled channel
+ *
+ * Blocks until the receiver has room for the message. The first message
+ * has to carry the capability to our endpoint, for the receiver to return
+ * credits through.
+ */
+errval_t lmp_chan_fc_send(struct lmp_chan *lc, lmp_send_flags_t flags,
+                          struct capref send_cap, uintptr_t arg1,
+                          uintptr_t arg2, uintptr_t arg3, uintptr_t arg4)
+{
+    errval_t err;
+
+    assert(lc->endpoint != NULL);
+    for (;;) {
+        err = lmp_chan_fc_collect(lc);
+        ON_ERR_RETURN(err);
+        if (lc->fc.credits > 0) {
+            break;
+        }
+        err = lmp_chan_wait_recv(lc);
+        ON_ERR_RETURN(err);
+    }
+
+    err = lmp_chan_send_wait(lc, flags, send_cap, LMP_MSG_LENGTH,
+                             arg1, arg2, arg3, arg4);
+    if (err_is_ok(err)) {
+        lc->fc.credits--;
+    }
+    return err;
+}
+
+/**
+ * \brief Receiver side: a sender has bound to the channel, grant the window
+ *
+ * Call with the capability that came with the first message, in place of
+ * lmp_chan_fc_consumed() for that message. The buffer holds nothing of the
+ * sender any more, so it gets the whole window.
+ *
+ * \return LIB_ERR_LMP_FC_BOUND if another sender is already bound, the
+ *         message that came with peer_ep must then be dropped
+ */
+errval_t lmp_chan_fc_grant(struct lmp_chan *lc, struct capref peer_ep)
+{
+    assert(lc->fc.window > 0);
+    if (!capref_is_null(lc->remote_cap)) {
+        errval_t err = lmp_ep_send1(peer_ep, 0, NULL_CAP, LMP_FC_REJECT);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "turning away a second sender");
+        }
+        cap_destroy(peer_ep);
+        return LIB_ERR_LMP_FC_BOUND;
+    }
+    lc->remote_cap = peer_ep;
+    lc->fc.consumed = 0;
+    return lmp_chan_send_wait(lc, 0, NULL_CAP, 1, lc->fc.window, 0, 0, 0);
+}
+
+/**
+ * \brief Receiver side: account for a message taken out of the endpoint
+ *
+ * Returns the credits to the sender once half a window is free again.
+ */
+errval_t lmp_chan_fc_consumed(struct lmp_chan *lc)
+{
+    if (lc->fc.window == 0) {
+        return SYS_ERR_OK;
+    }
+
+    lc->fc.consumed++;
+    if (lc->fc.consumed * 2 < lc->fc.window || capref_is_null(lc->remote_cap)) {
+        return SYS_ERR_OK;
+    }
+
+    errval_t err = lmp_chan_send_wait(lc, 0, NULL_CAP, 1, lc->fc.consumed,
+                                      0, 0, 0);
+    if (err_is_ok(err)) {
+        lc->fc.consumed = 0;
+    }
+    return err;
+}
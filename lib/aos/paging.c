@@ -17,14 +17,26 @@
 #include <aos/except.h>
 #include <aos/slab.h>
 #include <aos/systime.h>
+#include <aos/frame_pool.h>
 #include "threads_priv.h"
+#include <trace/trace.h>
+#include <trace_definitions/trace_defs.h>
 #include <stdio.h>
 #include <string.h>
 
 static struct paging_state current;
+
+static errval_t paging_cow_fault(struct paging_state *st, lvaddr_t addr, int subtype,
+                                 bool *handled);
+
 errval_t frame_alloc_and_map_flags(struct capref *cap,size_t bytes,size_t* retbytes,void **buf,int flags){
     errval_t err;
-    err = frame_alloc(cap,bytes,retbytes);
+    if(bytes > 0 && bytes <= BASE_PAGE_SIZE){
+        err = frame_pool_alloc(cap);
+        *retbytes = BASE_PAGE_SIZE;
+    }else{
+        err = frame_alloc(cap,bytes,retbytes);
+    }
     ON_ERR_RETURN(err);
     return paging_map_frame_attr(get_current_paging_state(),buf,*retbytes,*cap,flags,NULL,NULL);
 }
@@ -54,6 +66,17 @@ void page_fault_handler(enum exception_type type, int subtype, void *addr, arch_
             thread_exit(1);
         }
 
+        // copy-on-write pages live in regions that are not lazily mapped
+        bool handled;
+        err = paging_cow_fault(st, (lvaddr_t) addr, subtype, &handled);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "copying copy-on-write page");
+            thread_exit(1);
+        }
+        if (handled) {
+            return;
+        }
+
         // if the virtual address is valid, we proceed to look up,
         // in which region the page fault happened
         struct paging_region *region = paging_region_lookup(st, (lvaddr_t) addr);
@@ -78,6 +101,7 @@ void page_fault_handler(enum exception_type type, int subtype, void *addr, arch_
         else if (region->lazily_mapped) {
             // in a lazily mapped region we should only page fault if a page is not mapped, so we map it
             // debug_printf("Handling pag fault in lazily mapped region\n");
+            TRACE(AOS, PAGEFAULT, (lvaddr_t) addr >> BASE_PAGE_BITS);
             err = paging_map_single_page_at(st,
                     (lvaddr_t) addr,
                     VREGION_FLAGS_READ_WRITE,
@@ -88,6 +112,7 @@ void page_fault_handler(enum exception_type type, int subtype, void *addr, arch_
                 debug_printf("error mapping page in page fauilt handler\n");
                 thread_exit(1);
             }
+            TRACE(AOS, PAGEFAULT_DONE, (lvaddr_t) addr >> BASE_PAGE_BITS);
             return;
         }
         else {
@@ -114,7 +139,7 @@ void page_fault_handler(enum exception_type type, int subtype, void *addr, arch_
  * \brief creates a frame and maps it around the specified address
  * 
  * This function is called from the page fault handler if a lazily mapped page
- * should be allocated.
+ * should be allocated. Base pages come from the frame pool.
  */
 errval_t paging_map_single_page_at(struct paging_state *st, lvaddr_t addr, int flags, size_t pagesize)
 {
@@ -123,7 +148,12 @@ errval_t paging_map_single_page_at(struct paging_state *st, lvaddr_t addr, int f
 
     struct capref frame;
     size_t retbytes;
-    errval_t err = frame_alloc_aligned(&frame, pagesize, pagesize, &retbytes);
+    errval_t err;
+    if (pagesize == BASE_PAGE_SIZE) {
+        err = frame_pool_alloc_lazy(&frame);
+    } else {
+        err = frame_alloc_aligned(&frame, pagesize, pagesize, &retbytes);
+    }
     ON_ERR_RETURN(err);
 
     lvaddr_t vaddr = ROUND_DOWN((lvaddr_t) addr, pagesize);
@@ -656,6 +686,20 @@ errval_t slab_refill_no_pagefault(struct slab_allocator *slabs, struct capref fr
 
 
 
+/**
+ * \brief Allocate a slot with the paging state's slot allocator
+ *
+ * Slots of the default allocator come from the thread's magazine.
+ */
+static inline errval_t paging_slot_alloc(struct paging_state *st,
+                                         struct capref *ret)
+{
+    if (st->slot_alloc == get_default_slot_allocator()) {
+        return slot_alloc(ret);
+    }
+    return st->slot_alloc->alloc(st->slot_alloc, ret);
+}
+
 /**
  * \brief Helper function that allocates a slot and
  *        creates a aarch64 page table capability for a certain level
@@ -664,7 +708,7 @@ static errval_t pt_alloc(struct paging_state * st, enum objtype type,
                          struct capref *ret) 
 {
     errval_t err;
-    err = st->slot_alloc->alloc(st->slot_alloc, ret);
+    err = paging_slot_alloc(st, ret);
     if (err_is_fail(err)) {
         debug_printf("slot_alloc failed: %s\n", err_getstring(err));
         return err;
@@ -672,6 +716,7 @@ static errval_t pt_alloc(struct paging_state * st, enum objtype type,
     err = vnode_create(*ret, type);
     if (err_is_fail(err) && err_no(err) != LIB_ERR_CAP_DESTROY) {
         debug_printf("vnode_create failed: %s\n", err_getstring(err));
+        slot_free(*ret);
         return err;
     }
     return SYS_ERR_OK;
@@ -692,7 +737,7 @@ static errval_t paging_check_spt_refill(struct paging_state *st)
             st->mappings_alloc_is_refilling = true;
             {
                 struct capref frameslot;
-                errval_t err = st->slot_alloc->alloc(st->slot_alloc, &frameslot);
+                errval_t err = paging_slot_alloc(st, &frameslot);
                 if (err_is_fail(err)) {
                     st->mappings_alloc_is_refilling = false;
                     PAGING_UNLOCK(st);
@@ -787,7 +832,7 @@ errval_t paging_spt_find(struct paging_state *st, int level, lvaddr_t vaddr, boo
             // if there exists no table at this position, create it
             struct capref pt_cap;
             struct capref mapping_cap;
-            err = st->slot_alloc->alloc(st->slot_alloc, &mapping_cap);
+            err = paging_slot_alloc(st, &mapping_cap);
             if (err_is_fail(err)) {
                 PAGING_UNLOCK(st);
                 return err_push(err, LIB_ERR_SLOT_ALLOC);
@@ -795,30 +840,28 @@ errval_t paging_spt_find(struct paging_state *st, int level, lvaddr_t vaddr, boo
 
             err = pt_alloc(st, child_type, &pt_cap);
             if (err_is_fail(err)) {
+                slot_free(mapping_cap);
                 PAGING_UNLOCK(st);
                 return err_push(err, LIB_ERR_PMAP_ALLOC_VNODE);
             }
 
             err = vnode_map(table->pt_cap, pt_cap, index, VREGION_FLAGS_READ, 0, 1, mapping_cap);
             if (err_is_fail(err)) {
+                cap_destroy(pt_cap);
+                slot_free(mapping_cap);
                 PAGING_UNLOCK(st);
-                //debug_printf("level = %d\n", level);
-                //debug_printf("vaddr = %lx\n", (vaddr >> (12 + 9)) == 0x8002a00/2);
                 debug_printf("vaddr = %lx\n", vaddr);
-                //char buf[128];
-                //debug_print_cap_at_capref(buf, 128, pt_cap);
-                //debug_printf("pt_cap = %s\n", buf);
                 debug_printf("err = %d\n", err);
-                //debug_printf("level = %d\n", level);
-                /*debug_printf("vaddr = %lx\n", vaddr);
-                debug_printf("mutex.locked = %d\n", st->mutex.locked);*/
                 return err_push(err, LIB_ERR_PMAP_DO_MAP);
             }
 
             child = slab_alloc(&st->mappings_alloc);
             if (child == NULL) {
+                // nothing refers to the new table yet, take it out again
+                vnode_unmap(table->pt_cap, mapping_cap);
+                cap_destroy(mapping_cap);
+                cap_destroy(pt_cap);
                 PAGING_UNLOCK(st);
-                debug_printf("THIS3!\n");
                 return LIB_ERR_SLAB_ALLOC_FAIL;
             }
 
@@ -853,6 +896,10 @@ errval_t paging_spt_find(struct paging_state *st, int level, lvaddr_t vaddr, boo
 
 /**
  * \brief like paging_map_fixed_attr, but you can specify an offset into the frame at which to map
+ *
+ * Contiguous pages that end up in the same leaf page table are installed
+ * with a single vnode_map invocation. Every entry covered by such a run
+ * refers to the run's mapping cap in the shadow page table.
  */
 errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
                                struct capref frame, size_t exact_bytes, int flags)
@@ -866,23 +913,23 @@ errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
 
     errval_t err;
 
-    // perform multiple mappings in order to map whole frame
-    for (size_t i = 0; i < bytes / BASE_PAGE_SIZE; i++) {
-
-        size_t offset = i * BASE_PAGE_SIZE;
+    // perform one mapping per run of entries in the same page table
+    size_t offset = 0;
+    while (offset < bytes) {
 
         // start address of page to map
         lvaddr_t page_start_addr = vaddr + offset;
         genpaddr_t page_start_paddr = paddr + offset;
 
-        size_t size_left = exact_bytes - offset;
+        size_t size_left = bytes - offset;
 
-        // check if we can map a superpage
+        // check if we can map superpages
         bool map_large_page = (page_start_addr % LARGE_PAGE_SIZE) == 0 &&
                               (page_start_paddr % LARGE_PAGE_SIZE) == 0 &&
                               size_left >= LARGE_PAGE_SIZE;
 
         int page_level = map_large_page ? 2 : 3;
+        size_t page_size = map_large_page ? LARGE_PAGE_SIZE : BASE_PAGE_SIZE;
 
         struct mapping_table *table;
         err = paging_spt_find(st, page_level, page_start_addr, true, &table);
@@ -895,15 +942,25 @@ errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
                 :
                 (page_start_addr >> BASE_PAGE_BITS) & 0x1FF;
 
-        if (!capcmp(table->mapping_caps[pt_index], NULL_CAP)) {
-            DEBUG_PRINTF("attempting to map already mapped page\n");
-            return LIB_ERR_PMAP_ADDR_NOT_FREE;
+        // the run ends at the end of the frame or of the page table
+        size_t pte_count = size_left / page_size;
+        if (pte_count > PTABLE_ENTRIES - pt_index) {
+            pte_count = PTABLE_ENTRIES - pt_index;
+        }
+
+        for (size_t i = 0; i < pte_count; i++) {
+            if (!capcmp(table->mapping_caps[pt_index + i], NULL_CAP) ||
+                    table->children[pt_index + i] != NULL) {
+                DEBUG_PRINTF("attempting to map already mapped page\n");
+                return LIB_ERR_PMAP_ADDR_NOT_FREE;
+            }
         }
 
         struct capref mapping;
-        err = st->slot_alloc->alloc(st->slot_alloc, &mapping);
+        err = paging_slot_alloc(st, &mapping);
         if (err_is_fail(err)) {
             DEBUG_ERR(err, "couldn't alloc slot\n");
+            return err_push(err, LIB_ERR_SLOT_ALLOC);
         }
 
         err = vnode_map (
@@ -912,20 +969,368 @@ errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
             pt_index,
             flags,
             offset,
-            1,
+            pte_count,
             mapping
         );
         if (err_is_fail(err)) {
+            slot_free(mapping);
             return err;
         }
-        //debug_printf("mapped at: %lx\n", page_start_addr);
+        //debug_printf("mapped %zu pages at: %lx\n", pte_count, page_start_addr);
+
+        for (size_t i = 0; i < pte_count; i++) {
+            table->mapping_caps[pt_index + i] = mapping;
+        }
+        offset += pte_count * page_size;
+    }
+
+    return SYS_ERR_OK;
+}
+
+
+/*
+ * Copy-on-write: every page of a range is mapped read-only with a mapping of
+ * its own, so a write fault can replace just that page. The fault copies the
+ * page through a bounce buffer into a frame from the pool and maps the copy
+ * writable at the same address. Once no page of a range maps the shared frame
+ * any more, this domain's copy of the frame cap is deleted. Other domains keep
+ * their own copies, so the frame lives as long as one of them maps it.
+ *
+ * Only faults of this domain copy pages. The kernel does not fault on behalf
+ * of user space, so a copy-on-write page must be written once before it is
+ * handed to a system call or used as a message buffer.
+ */
+
+/// faults are serialized by the paging lock, one bounce page is enough
+static uint8_t cow_bounce[BASE_PAGE_SIZE] __attribute__((aligned(BASE_PAGE_SIZE)));
+
+
+/**
+ * \brief unmap everything mapped in [vaddr, vaddr + bytes)
+ *
+ * Runs and superpages are unmapped as a whole, the caller has to make sure
+ * none of them reaches outside of the range.
+ */
+static errval_t paging_unmap_range(struct paging_state *st, lvaddr_t vaddr, size_t bytes)
+{
+    errval_t err;
+    lvaddr_t end = vaddr + bytes;
+
+    while (vaddr < end) {
+        struct mapping_table *table;
+        int level = 3;
+        err = paging_spt_find(st, 3, vaddr, false, &table);
+        if (err_no(err) == LIB_ERR_PMAP_NO_VNODE_BUT_SUPERPAGE) {
+            level = 2;
+            err = paging_spt_find(st, 2, vaddr, false, &table);
+        }
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_PMAP_SHADOWPT_LOOKUP);
+        }
+
+        size_t page_bits = level == 2 ? LARGE_PAGE_BITS : BASE_PAGE_BITS;
+        if (table != NULL) {
+            int pt_index = (vaddr >> page_bits) & 0x1FF;
+            struct capref mapping = table->mapping_caps[pt_index];
+
+            if (!capref_is_null(mapping)) {
+                err = vnode_unmap(table->pt_cap, mapping);
+                if (err_is_fail(err)) {
+                    return err_push(err, LIB_ERR_VNODE_UNMAP);
+                }
+                // a run shares its mapping cap between all of its entries
+                for (size_t i = 0; i < PTABLE_ENTRIES; i++) {
+                    if (capcmp(table->mapping_caps[i], mapping)) {
+                        table->mapping_caps[i] = NULL_CAP;
+                    }
+                }
+                err = cap_destroy(mapping);
+                if (err_is_fail(err)) {
+                    return err_push(err, LIB_ERR_CAP_DESTROY);
+                }
+            }
+        }
+        vaddr = ROUND_DOWN(vaddr, 1UL << page_bits) + (1UL << page_bits);
+    }
+    return SYS_ERR_OK;
+}
+
+
+/**
+ * \brief map the page at offset of frame read-only at vaddr, with its own mapping
+ */
+static errval_t paging_cow_map_page(struct paging_state *st, lvaddr_t vaddr,
+                                    struct capref frame, size_t offset)
+{
+    errval_t err;
+    struct mapping_table *table;
+    err = paging_spt_find(st, 3, vaddr, true, &table);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_PMAP_SHADOWPT_LOOKUP);
+    }
+
+    int pt_index = (vaddr >> BASE_PAGE_BITS) & 0x1FF;
+    if (!capref_is_null(table->mapping_caps[pt_index])) {
+        return LIB_ERR_PMAP_ADDR_NOT_FREE;
+    }
+
+    struct capref mapping;
+    err = paging_slot_alloc(st, &mapping);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_SLOT_ALLOC);
+    }
+
+    err = vnode_map(table->pt_cap, frame, pt_index, VREGION_FLAGS_READ, offset, 1, mapping);
+    if (err_is_fail(err)) {
+        slot_free(mapping);
+        return err_push(err, LIB_ERR_VNODE_MAP);
+    }
+    table->mapping_caps[pt_index] = mapping;
+    return SYS_ERR_OK;
+}
+
+
+/**
+ * \brief map all of [base, base + bytes) read-only and remember it as copy-on-write
+ *
+ * The caller holds the paging lock and made sure nothing is mapped in the range.
+ */
+static errval_t paging_cow_add_range(struct paging_state *st, lvaddr_t base, size_t bytes,
+                                     struct capref frame)
+{
+    errval_t err;
+    size_t pages = bytes / BASE_PAGE_SIZE;
+
+    struct paging_cow_range *range = calloc(1, sizeof(*range) + (pages + 7) / 8);
+    NULLPTR_CHECK(range, LIB_ERR_MALLOC_FAIL);
+
+    for (size_t offset = 0; offset < bytes; offset += BASE_PAGE_SIZE) {
+        err = paging_cow_map_page(st, base + offset, frame, offset);
+        if (err_is_fail(err)) {
+            paging_unmap_range(st, base, offset);
+            free(range);
+            return err;
+        }
+    }
+
+    range->base = base;
+    range->bytes = bytes;
+    range->frame = frame;
+    range->shared_pages = pages;
+    range->next = st->cow_ranges;
+    st->cow_ranges = range;
+    return SYS_ERR_OK;
+}
+
+
+/**
+ * \brief map a frame copy-on-write
+ *
+ * All processes that map copies of the frame this way see its contents as they
+ * were when they mapped it, writes only change the writer's private copy of a
+ * page.
+ *
+ * \param st the paging state to map the frame in
+ * \param buf returns the address the frame is mapped at
+ * \param bytes the number of bytes of the frame to map
+ * \param frame the frame, owned by the mapping from now on
+ * \return on an error nothing of the frame stays mapped and it is still the caller's
+ */
+errval_t paging_map_frame_cow(struct paging_state *st, void **buf, size_t bytes,
+                              struct capref frame)
+{
+    assert(st != NULL);
+    errval_t err;
+
+    bytes = ROUND_UP(bytes, BASE_PAGE_SIZE);
+
+    size_t ret_size;
+    PAGING_LOCK(st);
+    err = paging_region_map(&st->meta_region, bytes, buf, &ret_size);
+    if (err_is_fail(err)) {
+        PAGING_UNLOCK(st);
+        return err_push(err, LIB_ERR_VSPACE_MAP);
+    }
+
+    if (ret_size < bytes) {
+        err = LIB_ERR_VSPACE_MMU_AWARE_NO_SPACE;
+    } else {
+        err = paging_cow_add_range(st, (lvaddr_t) *buf, bytes, frame);
+    }
+    if (err_is_fail(err)) {
+        // the pages are unmapped again, hand back the address range while it
+        // is still the last one the region gave out
+        lvaddr_t base = (lvaddr_t) *buf;
+        if (st->meta_region.current_addr == base + ret_size) {
+            st->meta_region.current_addr = base;
+        }
+        PAGING_UNLOCK(st);
+        return err_push(err, LIB_ERR_PMAP_DO_MAP);
+    }
+    PAGING_UNLOCK(st);
+
+    return SYS_ERR_OK;
+}
+
+
+/**
+ * \brief make the writable mapping of a frame copy-on-write
+ *
+ * A domain that filled a frame and hands copies of it to others protects its
+ * own mapping this way, so its later writes do not show up in theirs. No other
+ * thread may access the frame while it is being protected.
+ *
+ * \param buf the address the whole frame is mapped at, as returned by
+ *            paging_map_frame_attr() or frame_alloc_and_map()
+ * \param frame the mapped frame, owned by the mapping from now on
+ */
+errval_t paging_protect_cow(struct paging_state *st, void *buf, struct capref frame)
+{
+    assert(st != NULL);
+    errval_t err;
+
+    struct frame_identity id;
+    err = frame_identify(frame, &id);
+    ON_ERR_PUSH_RETURN(err, LIB_ERR_PMAP_FRAME_IDENTIFY);
+
+    lvaddr_t base = (lvaddr_t) buf;
+    assert(base % BASE_PAGE_SIZE == 0);
+
+    PAGING_LOCK(st);
+    err = paging_unmap_range(st, base, id.bytes);
+    if (err_is_fail(err)) {
+        PAGING_UNLOCK(st);
+        return err_push(err, LIB_ERR_PMAP_UNMAP);
+    }
+
+    err = paging_cow_add_range(st, base, id.bytes, frame);
+    PAGING_UNLOCK(st);
+    ON_ERR_PUSH_RETURN(err, LIB_ERR_PMAP_DO_MAP);
+
+    return SYS_ERR_OK;
+}
+
+
+/**
+ * \brief map the state frame spawn_clone() put into this domain's cspace
+ *
+ * \param buf returns the address of the state, mapped copy-on-write
+ * \param bytes returns the size of the state frame
+ * \return an error if this domain was not started by spawn_clone()
+ */
+errval_t paging_map_clone_state(void **buf, size_t *bytes)
+{
+    errval_t err;
+    struct capref state = {
+        .cnode = cnode_task,
+        .slot = TASKCN_SLOT_CLONE_STATE
+    };
+
+    struct frame_identity id;
+    err = frame_identify(state, &id);
+    ON_ERR_PUSH_RETURN(err, LIB_ERR_PMAP_FRAME_IDENTIFY);
+
+    // the mapping frees the slot of the frame once all pages are copied
+    struct capref frame;
+    err = slot_alloc(&frame);
+    ON_ERR_PUSH_RETURN(err, LIB_ERR_SLOT_ALLOC);
+    err = cap_copy(frame, state);
+    if (err_is_fail(err)) {
+        slot_free(frame);
+        return err_push(err, LIB_ERR_CAP_COPY);
+    }
+
+    // a failed mapping leaves nothing behind but the state in its task slot
+    err = paging_map_frame_cow(get_current_paging_state(), buf, id.bytes, frame);
+    if (err_is_fail(err)) {
+        cap_destroy(frame);
+        return err;
+    }
 
-        table->mapping_caps[pt_index] = mapping;
-        if (map_large_page) {
-            i += LARGE_PAGE_SIZE / BASE_PAGE_SIZE - 1;
+    err = cap_delete(state);
+    ON_ERR_PUSH_RETURN(err, LIB_ERR_CAP_DELETE);
+
+    if (bytes != NULL) {
+        *bytes = id.bytes;
+    }
+    return SYS_ERR_OK;
+}
+
+
+/**
+ * \brief resolve a fault in a copy-on-write range
+ *
+ * \param handled set if addr is in a copy-on-write range, the faulting access
+ *                can be retried then
+ */
+static errval_t paging_cow_fault(struct paging_state *st, lvaddr_t addr, int subtype,
+                                 bool *handled)
+{
+    errval_t err;
+    *handled = false;
+
+    if (st->cow_ranges == NULL) {
+        return SYS_ERR_OK;
+    }
+
+    PAGING_LOCK(st);
+    struct paging_cow_range **prev = &st->cow_ranges;
+    struct paging_cow_range *range = st->cow_ranges;
+    for (; range != NULL; prev = &range->next, range = range->next) {
+        if (addr >= range->base && addr < range->base + range->bytes) {
+            break;
         }
     }
+    if (range == NULL || subtype == PAGEFLT_EXEC) {
+        PAGING_UNLOCK(st);
+        return SYS_ERR_OK;
+    }
+    *handled = true;
+
+    lvaddr_t page = ROUND_DOWN(addr, BASE_PAGE_SIZE);
+    size_t index = (page - range->base) / BASE_PAGE_SIZE;
+    uint8_t bit = 1 << (index % 8);
+    if (subtype != PAGEFLT_WRITE || (range->copied[index / 8] & bit)) {
+        // another thread copied the page or protected the range meanwhile
+        PAGING_UNLOCK(st);
+        return SYS_ERR_OK;
+    }
 
+    struct capref copy;
+    err = frame_pool_alloc_lazy(&copy);
+    if (err_is_fail(err)) {
+        PAGING_UNLOCK(st);
+        return err_push(err, LIB_ERR_FRAME_ALLOC);
+    }
+
+    memcpy(cow_bounce, (void *) page, BASE_PAGE_SIZE);
+
+    err = paging_unmap_range(st, page, BASE_PAGE_SIZE);
+    if (err_is_fail(err)) {
+        PAGING_UNLOCK(st);
+        return err_push(err, LIB_ERR_PMAP_UNMAP);
+    }
+
+    err = paging_map_fixed_attr(st, page, copy, BASE_PAGE_SIZE, VREGION_FLAGS_READ_WRITE);
+    if (err_is_fail(err)) {
+        PAGING_UNLOCK(st);
+        return err_push(err, LIB_ERR_PMAP_DO_MAP);
+    }
+
+    memcpy((void *) page, cow_bounce, BASE_PAGE_SIZE);
+    range->copied[index / 8] |= bit;
+
+    if (--range->shared_pages == 0) {
+        *prev = range->next;
+        err = cap_destroy(range->frame);
+        free(range);
+        if (err_is_fail(err)) {
+            PAGING_UNLOCK(st);
+            return err_push(err, LIB_ERR_CAP_DESTROY);
+        }
+    }
+
+    PAGING_UNLOCK(st);
     return SYS_ERR_OK;
 }
 
@@ -940,3 +1345,25 @@ errval_t paging_unmap(struct paging_state *st, const void *region)
     assert(st != NULL);
     return LIB_ERR_NOT_IMPLEMENTED;
 }
+
+
+/**
+ * \brief unmap the `bytes` bytes of a frame mapped at `buf`
+ *
+ * Deletes the mappings, so the frame cap can be destroyed afterwards. The
+ * virtual address range is not handed back, paging_region_unmap() does not
+ * track holes.
+ */
+errval_t paging_unmap_frame(struct paging_state *st, void *buf, size_t bytes)
+{
+    assert(st != NULL);
+    lvaddr_t base = (lvaddr_t) buf;
+    if (base % BASE_PAGE_SIZE != 0) {
+        return LIB_ERR_VREGION_BAD_ALIGNMENT;
+    }
+
+    PAGING_LOCK(st);
+    errval_t err = paging_unmap_range(st, base, ROUND_UP(bytes, BASE_PAGE_SIZE));
+    PAGING_UNLOCK(st);
+    return err;
+}
@@ -19,9 +19,13 @@
 /* remote (indirect through a channel) version of ram_alloc, for most domains */
 static errval_t ram_alloc_remote(struct capref *ret, size_t size, size_t alignment)
 {
-    //TODO(M3): Implement me!
-    return aos_rpc_get_ram_cap(aos_rpc_get_memory_channel(), size, alignment, ret, NULL);
-    //return LIB_ERR_NOT_IMPLEMENTED;
+    // the frame pool refills from its own thread, one call at a time on the
+    // channel. Nested, a fault inside the call may allocate again.
+    struct ram_alloc_state *ram_alloc_state = get_ram_alloc_state();
+    thread_mutex_lock_nested(&ram_alloc_state->ram_alloc_lock);
+    errval_t err = aos_rpc_get_ram_cap(aos_rpc_get_memory_channel(), size, alignment, ret, NULL);
+    thread_mutex_unlock(&ram_alloc_state->ram_alloc_lock);
+    return err;
 }
 
 
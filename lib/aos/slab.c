@@ -18,6 +18,8 @@
 #include <aos/aos.h>
 #include <aos/slab.h>
 #include <aos/static_assert.h>
+#include <trace/trace.h>
+#include <trace_definitions/trace_defs.h>
 
 struct block_head {
     struct block_head *next;///< Pointer to next block in free list
@@ -102,6 +104,7 @@ void *slab_alloc(struct slab_allocator *slabs)
         if (!slabs->refill_func) {
             return NULL;
         } else {
+            TRACE(AOS, SLAB_REFILL, slabs->blocksize);
             err = slabs->refill_func(slabs);
             
             if (err_is_fail(err)) {
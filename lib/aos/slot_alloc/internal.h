@@ -20,5 +20,14 @@ errval_t multi_free(struct slot_allocator *ca, struct capref cap);
 
 errval_t two_level_alloc(struct slot_allocator *ca, struct capref *ret);
 errval_t two_level_free(struct slot_allocator *ca, struct capref cap);
+errval_t two_level_alloc_run(struct slot_allocator *ca, cslot_t min, cslot_t max,
+                             struct capref *ret, cslot_t *count);
+errval_t two_level_free_n(struct slot_allocator *ca, struct capref first,
+                          cslot_t n);
+
+errval_t single_slot_alloc_run(struct single_slot_allocator *sca, cslot_t min,
+                               cslot_t max, struct capref *ret, cslot_t *count);
+errval_t single_slot_free_n(struct single_slot_allocator *sca,
+                            struct capref first, cslot_t n);
 
 #endif //SLOT_ALLOC_INTERNAL_H_
@@ -18,6 +18,7 @@
 
 #include <aos/aos.h>
 #include <aos/caddr.h>
+#include "internal.h"
 
 static errval_t salloc(struct slot_allocator *ca, struct capref *ret)
 {
@@ -155,6 +156,65 @@ static errval_t sfree(struct slot_allocator *ca, struct capref cap)
     return free_slots(sca, cap.slot, 1, &ca->mutex);
 }
 
+/**
+ * \brief Allocate a run of consecutive slots
+ *
+ * Takes the first free run of at least min slots, and up to max of it.
+ *
+ * \param ret   Filled in with the first slot of the run
+ * \param count Filled in with the length of the run
+ */
+errval_t single_slot_alloc_run(struct single_slot_allocator *sca, cslot_t min,
+                               cslot_t max, struct capref *ret, cslot_t *count)
+{
+    assert(min > 0 && min <= max);
+    if (sca->a.space < min) {
+        return LIB_ERR_SLOT_ALLOC_NO_SPACE;
+    }
+
+    thread_mutex_lock(&sca->a.mutex);
+
+    struct cnode_meta **walk = &sca->head;
+    while (*walk != NULL && (*walk)->space < min) {
+        walk = &(*walk)->next;
+    }
+    if (*walk == NULL) {
+        thread_mutex_unlock(&sca->a.mutex);
+        return LIB_ERR_SLOT_ALLOC_NO_SPACE;
+    }
+
+    cslot_t n = (*walk)->space < max ? (*walk)->space : max;
+    ret->cnode = sca->cnode;
+    ret->slot  = (*walk)->slot;
+    *count = n;
+
+    (*walk)->space -= n;
+    (*walk)->slot += n;
+    sca->a.space -= n;
+
+    if ((*walk)->space == 0) {
+        struct cnode_meta *empty = *walk;
+        *walk = empty->next;
+        slab_free(&sca->slab, empty);
+    }
+
+    thread_mutex_unlock(&sca->a.mutex);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Free n consecutive slots starting at first
+ */
+errval_t single_slot_free_n(struct single_slot_allocator *sca,
+                            struct capref first, cslot_t n)
+{
+    if (!cnodecmp(first.cnode, sca->cnode)) {
+        return LIB_ERR_SLOT_ALLOC_WRONG_CNODE;
+    }
+
+    return free_slots(sca, first.slot, n, &sca->a.mutex);
+}
+
 cslot_t single_slot_alloc_freecount(struct single_slot_allocator *this)
 {
     cslot_t freecount = 0;
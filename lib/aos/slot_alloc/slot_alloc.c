@@ -22,6 +22,7 @@
 #include <aos/caddr.h>
 #include <mm/mm.h>
 #include "internal.h"
+#include "threads_priv.h"
 
 
 /**
@@ -34,18 +35,110 @@ struct slot_allocator *get_default_slot_allocator(void)
     return (struct slot_allocator*)(&state->defca);
 }
 
+/*
+ * Every thread keeps a run of consecutive slots of the default allocator in
+ * its magazine and allocates from it without taking a lock. An empty
+ * magazine is refilled with up to SLOT_MAGAZINE_SIZE slots at once. Frees
+ * go back to the allocator, except for the slot just below the run, which
+ * is put back into the magazine: the common case of a slot that is
+ * allocated and freed again right away does not touch the allocator at all.
+ * Threads return their magazine when they exit.
+ */
+
+static struct slot_magazine *get_slot_magazine(void)
+{
+    struct thread *me = thread_self();
+    if (me == NULL || me->slot_magazine.busy) {
+        // no thread yet, or a nested call while the magazine is refilled
+        return NULL;
+    }
+    return &me->slot_magazine;
+}
+
+static errval_t slot_magazine_refill(struct slot_magazine *mag)
+{
+    struct slot_allocator *ca = get_default_slot_allocator();
+    struct capref first;
+    cslot_t count;
+
+    mag->busy = true;
+    errval_t err = two_level_alloc_run(ca, 1, SLOT_MAGAZINE_SIZE, &first,
+                                       &count);
+    if (err_is_ok(err)) {
+        mag->cnode = first.cnode;
+        mag->next = first.slot;
+        mag->count = count;
+    }
+    mag->busy = false;
+    return err;
+}
+
+/**
+ * \brief Give the slots left in a magazine back to the default allocator
+ */
+void slot_magazine_drain(struct slot_magazine *mag)
+{
+    if (mag->count == 0) {
+        return;
+    }
+
+    struct capref first = { .cnode = mag->cnode, .slot = mag->next };
+    cslot_t count = mag->count;
+    mag->count = 0;
+
+    errval_t err = slot_free_n(first, count);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "returning slot magazine");
+    }
+}
+
 /**
  * \brief Default slot allocator
  *
  * \param ret Pointer to the cap to return the allocated slot in
  *
- * Allocates one slot from the default allocator
+ * Allocates one slot from the calling thread's magazine, or from the default
+ * allocator
  */
 errval_t slot_alloc(struct capref *ret)
+{
+    struct slot_magazine *mag = get_slot_magazine();
+    if (mag == NULL) {
+        struct slot_allocator *ca = get_default_slot_allocator();
+        assert(ca != NULL);
+        return ca->alloc(ca, ret);
+    }
+
+    if (mag->count == 0) {
+        errval_t err = slot_magazine_refill(mag);
+        ON_ERR_RETURN(err);
+    }
+
+    struct capref slot = { .cnode = mag->cnode, .slot = mag->next };
+    mag->next++;
+    mag->count--;
+    *ret = slot;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Allocate n consecutive slots from the default allocator
+ *
+ * The slots are ret->slot to ret->slot + n - 1 of the same L2 CNode, they
+ * can be freed one by one or with slot_free_n().
+ *
+ * \param n   Number of slots, at most L2_CNODE_SLOTS
+ * \param ret Filled in with the first slot
+ */
+errval_t slot_alloc_n(cslot_t n, struct capref *ret)
 {
     struct slot_allocator *ca = get_default_slot_allocator();
-    assert(ca != NULL);
-    return ca->alloc(ca, ret);
+    cslot_t count;
+
+    if (n == 1) {
+        return slot_alloc(ret);
+    }
+    return two_level_alloc_run(ca, n, n, ret, &count);
 }
 
 /**
@@ -159,6 +252,14 @@ errval_t slot_free(struct capref ret)
         return ca->free(ca, ret);
     }
 
+    struct slot_magazine *mag = get_slot_magazine();
+    if (mag != NULL && mag->count > 0 && cnodecmp(ret.cnode, mag->cnode)
+        && ret.slot + 1 == mag->next) {
+        mag->next--;
+        mag->count++;
+        return SYS_ERR_OK;
+    }
+
     struct slot_allocator *ca = (struct slot_allocator*)(&state->defca);
     errval_t err = ca->free(ca, ret);
 
@@ -176,6 +277,17 @@ errval_t slot_free(struct capref ret)
 
 errval_t (*slot_free_other)(struct capref ret) = NULL;
 
+/**
+ * \brief Free n consecutive slots of the default allocator
+ *
+ * \param first First of the slots, as returned by slot_alloc_n()
+ */
+errval_t slot_free_n(struct capref first, cslot_t n)
+{
+    struct slot_allocator *ca = get_default_slot_allocator();
+    return two_level_free_n(ca, first, n);
+}
+
 /**
  * \brief Initializes the slot allocator
  *
@@ -206,6 +318,7 @@ errval_t slot_alloc_init(void)
     def->head->next = NULL;
     def->reserve = &state->reserve;
     def->reserve->next = NULL;
+    def->grower = NULL;
 
     // Head
     cap.cnode = cnode_root;
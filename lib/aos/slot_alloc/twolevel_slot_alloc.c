@@ -17,6 +17,153 @@
 #include "internal.h"
 #include <stdlib.h>
 
+/**
+ * \brief Create a new reserve CNode
+ *
+ * Called and returns with the allocator's mutex held, drops it while the
+ * CNode is created. Everything allocated is released again on failure,
+ * mca->reserve is only set once the reserve is complete.
+ */
+static errval_t two_level_new_reserve(struct multi_slot_allocator *mca)
+{
+    errval_t err;
+    struct slot_allocator *ca = &mca->a;
+
+    // Cnode: in Root CN
+    struct capref cap;
+    struct cnoderef cnode;
+    thread_mutex_unlock(&ca->mutex);
+    // Do not call slot_alloc_root() here as we want control over refill.
+    struct slot_alloc_state *state = get_slot_alloc_state();
+    struct slot_allocator *rca = (struct slot_allocator *)(&state->rootca);
+    // Need to refill when one slot left, otherwise it's too late
+    size_t rootcn_free = single_slot_alloc_freecount(&state->rootca);
+    if (rootcn_free == 1) {
+        // resize root slot allocator (and rootcn)
+        err = root_slot_allocator_refill(NULL, NULL);
+        if (err_is_fail(err)) {
+            thread_mutex_lock(&ca->mutex);
+            return err_push(err, LIB_ERR_ROOTSA_RESIZE);
+        }
+    }
+    err = rca->alloc(rca, &cap);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "allocating root cnode slot failed");
+        thread_mutex_lock(&ca->mutex);
+        return err_push(err, LIB_ERR_SLOT_ALLOC);
+    }
+    err = cnode_create_raw(cap, &cnode, ObjType_L2CNode, ca->nslots, NULL);
+    if (err_is_fail(err)) {
+        rca->free(rca, cap);
+        thread_mutex_lock(&ca->mutex);
+        return err_push(err, LIB_ERR_CNODE_CREATE);
+    }
+    thread_mutex_lock(&ca->mutex);
+
+    // Buffers
+    void *buf = slab_alloc(&mca->slab);
+    if (!buf) { /* Grow slab */
+        if (ca->space == 0) {
+            err = LIB_ERR_SLOT_ALLOC_NO_SPACE;
+            goto fail;
+        }
+        // Allocate slot out of the list
+        mca->a.space--;
+
+        thread_mutex_unlock(&ca->mutex);
+
+        // get slot for frame for refilling slab allocator
+        struct capref frame;
+        err = mca->a.alloc(&mca->a, &frame);
+        if (err_is_fail(err)) {
+            thread_mutex_lock(&ca->mutex);
+            err = err_push(err, LIB_ERR_SLOT_ALLOC);
+            goto fail;
+        }
+        // use slab refill function that never causes a pagefault
+        err = slab_refill_no_pagefault(&mca->slab, frame, SLAB_STATIC_SIZE(1, mca->slab.blocksize));
+        thread_mutex_lock(&ca->mutex);
+        if (err_is_fail(err)) {
+            err = err_push(err, LIB_ERR_SLAB_REFILL);
+            goto fail;
+        }
+
+        // Try allocating again
+        buf = slab_alloc(&mca->slab);
+        if (!buf) {
+            err = LIB_ERR_SLAB_ALLOC_FAIL;
+            goto fail;
+        }
+    }
+
+    struct slot_allocator_list *reserve = buf;
+    buf = (char *)buf + sizeof(struct slot_allocator_list);
+    size_t bufsize = mca->slab.blocksize - sizeof(struct slot_allocator_list);
+
+    // Allocator
+    err = single_slot_alloc_init_raw(&reserve->a, cap, cnode,
+                                     mca->a.nslots, buf, bufsize);
+    if (err_is_fail(err)) {
+        slab_free(&mca->slab, reserve);
+        err = err_push(err, LIB_ERR_SINGLE_SLOT_ALLOC_INIT_RAW);
+        goto fail;
+    }
+    reserve->next = NULL;
+    mca->reserve = reserve;
+    return SYS_ERR_OK;
+
+fail:
+    thread_mutex_unlock(&ca->mutex);
+    cap_destroy(cap);
+    thread_mutex_lock(&ca->mutex);
+    return err;
+}
+
+/**
+ * \brief Pull in the reserve CNode and set up a new reserve
+ *
+ * Called and returns with the allocator's mutex held. If another thread is
+ * growing the allocator already, waits for it to finish instead. If the
+ * thread doing so runs out of slots itself, it gets an error.
+ *
+ * A failed grow leaves no reserve behind, the next grow creates one before
+ * it pulls it in.
+ */
+static errval_t two_level_grow(struct multi_slot_allocator *mca)
+{
+    errval_t err = SYS_ERR_OK;
+    struct slot_allocator *ca = &mca->a;
+
+    if (mca->grower == thread_self()) {
+        return LIB_ERR_SLOT_ALLOC_NESTED_GROW;
+    }
+    if (mca->grower != NULL) {
+        while (mca->grower != NULL) {
+            thread_mutex_unlock(&ca->mutex);
+            thread_yield();
+            thread_mutex_lock(&ca->mutex);
+        }
+        return SYS_ERR_OK;
+    }
+    mca->grower = thread_self();
+
+    if (mca->reserve == NULL) {
+        err = two_level_new_reserve(mca);
+    }
+    if (err_is_ok(err)) {
+        /* Pull in the reserve */
+        ca->space += ca->nslots;
+        mca->reserve->next = mca->head;
+        mca->head = mca->reserve;
+        mca->reserve = NULL;
+
+        err = two_level_new_reserve(mca);
+    }
+
+    mca->grower = NULL;
+    return err;
+}
+
 /**
  * \brief slot allocator
  *
@@ -29,7 +176,14 @@ errval_t two_level_alloc(struct slot_allocator *ca, struct capref *ret)
     struct multi_slot_allocator *mca = (struct multi_slot_allocator*)ca;
 
     thread_mutex_lock(&ca->mutex);
-    assert(ca->space != 0);
+    if (ca->space == 0) {
+        // an earlier grow failed
+        err = two_level_grow(mca);
+        if (err_is_fail(err) || ca->space == 0) {
+            thread_mutex_unlock(&ca->mutex);
+            return err_is_fail(err) ? err : LIB_ERR_SLOT_ALLOC_NO_SPACE;
+        }
+    }
     ca->space--;
 
     /* Try allocating from the list of single slot allocators */
@@ -53,80 +207,72 @@ errval_t two_level_alloc(struct slot_allocator *ca, struct capref *ret)
         return err_push(err, LIB_ERR_SINGLE_SLOT_ALLOC);
     }
 
-    /* If no more slots left, grow */
+    /* If no more slots left, grow. The slot is ours either way, a failed
+       grow is retried by the next allocation. */
     if (ca->space == 0) {
-        ca->space = ca->nslots;
-        /* Pull in the reserve */
-        mca->reserve->next = mca->head;
-        mca->head = mca->reserve;
-
-        /* Setup a new reserve */
-        // Cnode: in Root CN
-        struct capref cap;
-        struct cnoderef cnode;
-        thread_mutex_unlock(&ca->mutex);
-        // Do not call slot_alloc_root() here as we want control over refill.
-        struct slot_alloc_state *state = get_slot_alloc_state();
-        struct slot_allocator *rca = (struct slot_allocator *)(&state->rootca);
-        // Need to refill when one slot left, otherwise it's too late
-        size_t rootcn_free = single_slot_alloc_freecount(&state->rootca);
-        if (rootcn_free == 1) {
-            // resize root slot allocator (and rootcn)
-            err = root_slot_allocator_refill(NULL, NULL);
-            if (err_is_fail(err)) {
-                return err_push(err, LIB_ERR_ROOTSA_RESIZE);
-            }
+        err = two_level_grow(mca);
+        if (err_is_fail(err) && err_no(err) != LIB_ERR_SLOT_ALLOC_NESTED_GROW) {
+            DEBUG_ERR(err, "growing the slot allocator");
         }
-        err = rca->alloc(rca, &cap);
-        if (err_is_fail(err)) {
-            DEBUG_ERR(err, "allocating root cnode slot failed");
-            return err_push(err, LIB_ERR_SLOT_ALLOC);
-        }
-        err = cnode_create_raw(cap, &cnode, ObjType_L2CNode, ca->nslots, NULL);
-        if (err_is_fail(err)) {
-            return err_push(err, LIB_ERR_CNODE_CREATE);
-        }
-        thread_mutex_lock(&ca->mutex);
+    }
 
-        // Buffers
-        void *buf = slab_alloc(&mca->slab);
-        if (!buf) { /* Grow slab */
-            // Allocate slot out of the list
-            mca->a.space--;
+    thread_mutex_unlock(&ca->mutex);
+    return SYS_ERR_OK;
+}
 
-            thread_mutex_unlock(&ca->mutex);
+/**
+ * \brief Allocate a run of consecutive slots in one L2 CNode
+ *
+ * Takes the first run of at least min free slots, and up to max of it. If
+ * no CNode has such a run, the reserve is pulled in, which is empty.
+ *
+ * \param ca    Instance of the allocator
+ * \param min   Slots needed, at most the slots of a CNode
+ * \param max   Slots wanted
+ * \param ret   Filled in with the first slot of the run
+ * \param count Filled in with the length of the run
+ */
+errval_t two_level_alloc_run(struct slot_allocator *ca, cslot_t min, cslot_t max,
+                             struct capref *ret, cslot_t *count)
+{
+    errval_t err = SYS_ERR_OK;
+    struct multi_slot_allocator *mca = (struct multi_slot_allocator*)ca;
 
-            // get slot for frame for refilling slab allocator
-            struct capref frame;
-            err = mca->a.alloc(&mca->a, &frame);
-            if (err_is_fail(err)) {
-                return err_push(err, LIB_ERR_SLOT_ALLOC);
-            }
-            // use slab refill function that never causes a pagefault
-            err = slab_refill_no_pagefault(&mca->slab, frame, SLAB_STATIC_SIZE(1, mca->slab.blocksize));
-            if (err_is_fail(err)) {
-                return err_push(err, LIB_ERR_SLAB_REFILL);
-            }
-            thread_mutex_lock(&ca->mutex);
+    if (min == 0 || min > ca->nslots || min > max) {
+        return LIB_ERR_SLOT_ALLOC_NO_SPACE;
+    }
 
-            // Try allocating again
-            buf = slab_alloc(&mca->slab);
-            if (!buf) {
-                thread_mutex_unlock(&ca->mutex);
-                return err_push(err, LIB_ERR_SLAB_ALLOC_FAIL);
+    thread_mutex_lock(&ca->mutex);
+    for (;;) {
+        for (struct slot_allocator_list *walk = mca->head; walk != NULL;
+             walk = walk->next) {
+            err = single_slot_alloc_run(&walk->a, min, max, ret, count);
+            if (err_no(err) != LIB_ERR_SLOT_ALLOC_NO_SPACE) {
+                break;
             }
         }
+        if (err_no(err) != LIB_ERR_SLOT_ALLOC_NO_SPACE) {
+            break;
+        }
 
-        mca->reserve = buf;
-        buf = (char *)buf + sizeof(struct slot_allocator_list);
-        size_t bufsize = mca->slab.blocksize - sizeof(struct slot_allocator_list);
-
-        // Allocator
-        err = single_slot_alloc_init_raw(&mca->reserve->a, cap, cnode,
-                                         mca->a.nslots, buf, bufsize);
+        err = two_level_grow(mca);
         if (err_is_fail(err)) {
-            thread_mutex_unlock(&ca->mutex);
-            return err_push(err, LIB_ERR_SINGLE_SLOT_ALLOC_INIT_RAW);
+            break;
+        }
+    }
+    if (err_is_fail(err)) {
+        thread_mutex_unlock(&ca->mutex);
+        return err_push(err, LIB_ERR_SINGLE_SLOT_ALLOC);
+    }
+
+    assert(ca->space >= *count);
+    ca->space -= *count;
+
+    // grow early, a failed grow is retried by the next allocation
+    if (ca->space == 0) {
+        err = two_level_grow(mca);
+        if (err_is_fail(err) && err_no(err) != LIB_ERR_SLOT_ALLOC_NESTED_GROW) {
+            DEBUG_ERR(err, "growing the slot allocator");
         }
     }
 
@@ -165,6 +311,32 @@ errval_t two_level_free(struct slot_allocator *ca, struct capref cap)
     return LIB_ERR_SLOT_ALLOC_WRONG_CNODE;
 }
 
+/**
+ * \brief Free n consecutive slots of one L2 CNode
+ */
+errval_t two_level_free_n(struct slot_allocator *ca, struct capref first,
+                          cslot_t n)
+{
+    errval_t err;
+    thread_mutex_lock(&ca->mutex);
+    struct multi_slot_allocator *mca = (struct multi_slot_allocator*)ca;
+
+    for (struct slot_allocator_list *walk = mca->head; walk != NULL;
+         walk = walk->next) {
+        err = single_slot_free_n(&walk->a, first, n);
+        if (err_is_ok(err)) {
+            mca->a.space += n;
+        }
+        if (err_no(err) != LIB_ERR_SLOT_ALLOC_WRONG_CNODE) {
+            thread_mutex_unlock(&ca->mutex);
+            return err;
+        }
+    }
+
+    thread_mutex_unlock(&ca->mutex);
+    return LIB_ERR_SLOT_ALLOC_WRONG_CNODE;
+}
+
 /**
  * \brief Initializer that does not allocate any space
  *
@@ -195,6 +367,7 @@ errval_t two_level_slot_alloc_init_raw(struct multi_slot_allocator *ret,
 
     ret->head->next = NULL;
     ret->reserve->next = NULL;
+    ret->grower = NULL;
 
     /* Head */
     err = single_slot_alloc_init_raw(&ret->head->a, initial_cap,
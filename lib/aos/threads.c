@@ -248,6 +248,7 @@ static void thread_init(dispatcher_handle_t disp, struct thread *newthread)
     newthread->rpc_in_progress = false;
     newthread->async_error = SYS_ERR_OK;
     newthread->local_trigger = NULL;
+    memset(&newthread->slot_magazine, 0, sizeof(newthread->slot_magazine));
 }
 
 /**
@@ -840,6 +841,8 @@ void thread_exit(int status)
 {
     struct thread *me = thread_self();
 
+    slot_magazine_drain(&me->slot_magazine);
+
     thread_mutex_lock(&me->exit_lock);
 
     // if this is the static thread, we don't need to do anything but cleanup
@@ -0,0 +1,238 @@
+/**
+ * \file
+ * \brief Setup and control of the per-core trace buffer
+ *
+ * The init domain of every core allocates the trace frame of its core and
+ * registers it with the kernel. Spawned domains inherit a copy of the cap in
+ * TASKCN_SLOT_TRACEBUF and map it on startup to record their own events. A
+ * tracing domain maps it read-only and streams the events out.
+ */
+
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <string.h>
+
+#include <aos/aos.h>
+#include <aos/systime.h>
+#include <aos/dispatcher_arch.h>
+#include <aos/curdispatcher_arch.h>
+#include <trace/trace.h>
+#include <trace_definitions/trace_defs.h>
+
+/// The trace buffer of this core, which is its own master
+lvaddr_t trace_buffer_master = 0;
+lvaddr_t trace_buffer_va = 0;
+
+
+static void trace_set_disp_buffer(struct trace_buffer *buf)
+{
+    dispatcher_handle_t handle = curdispatcher();
+    struct dispatcher_generic *disp = get_dispatcher_generic(handle);
+    disp->trace_buf = buf;
+
+    trace_buffer_va = (lvaddr_t) buf;
+    trace_buffer_master = (lvaddr_t) buf;
+}
+
+/**
+ * \brief Allocate the trace buffer of this core and hand it to the kernel
+ *
+ * Only the init domain of a core may call this, it needs the kernel cap.
+ * The frame is also placed in cap_tracebuf, so it is passed on to children.
+ *
+ * \param retcap Returns the frame cap of the trace buffer.
+ */
+errval_t trace_setup_on_core(struct capref *retcap)
+{
+    errval_t err;
+    struct capref frame;
+    size_t size;
+    void *buf;
+
+    err = frame_alloc_and_map(&frame, TRACE_ALLOC_SIZE, &size, &buf);
+    ON_ERR_PUSH_RETURN(err, TRACE_ERR_CREATE_CAP);
+    memset(buf, 0, TRACE_ALLOC_SIZE);
+
+    struct trace_buffer *tb = buf;
+    tb->master = tb;
+    tb->stop_time = UINT64_MAX;
+
+    err = cap_copy(cap_tracebuf, frame);
+    ON_ERR_PUSH_RETURN(err, TRACE_ERR_CAP_COPY);
+
+    err = cap_invoke3(cap_kernel, KernelCmd_Setup_trace, get_cap_addr(frame),
+                      get_cap_level(frame)).error;
+    ON_ERR_PUSH_RETURN(err, TRACE_ERR_KERNEL_INVOKE);
+
+    trace_set_disp_buffer(tb);
+
+    if (retcap != NULL) {
+        *retcap = frame;
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Pass the trace buffer of this core on to a new domain
+ *
+ * A no-op if tracing is not set up on this core.
+ */
+errval_t trace_setup_child(struct cnoderef taskcn)
+{
+    if (trace_buffer_master == 0) {
+        return SYS_ERR_OK;
+    }
+
+    struct capref child_tracebuf = {
+        .cnode = taskcn,
+        .slot = TASKCN_SLOT_TRACEBUF
+    };
+    errval_t err = cap_copy(child_tracebuf, cap_tracebuf);
+    ON_ERR_PUSH_RETURN(err, TRACE_ERR_CAP_COPY);
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Map the trace buffer passed on by our parent, if there is one
+ */
+errval_t trace_my_setup(void)
+{
+    struct frame_identity id;
+    errval_t err = frame_identify(cap_tracebuf, &id);
+    if (err_is_fail(err)) {
+        // the parent does not trace
+        return TRACE_ERR_NO_BUFFER;
+    }
+    if (id.bytes < TRACE_ALLOC_SIZE) {
+        return TRACE_ERR_NO_BUFFER;
+    }
+
+    void *buf;
+    err = paging_map_frame(get_current_paging_state(), &buf, TRACE_ALLOC_SIZE,
+                           cap_tracebuf, NULL, NULL);
+    ON_ERR_PUSH_RETURN(err, TRACE_ERR_MAP_BUF);
+
+    trace_set_disp_buffer(buf);
+    return SYS_ERR_OK;
+}
+
+void trace_init_disp(void)
+{
+    errval_t err = trace_my_setup();
+    if (err_is_fail(err) && err_no(err) != TRACE_ERR_NO_BUFFER) {
+        DEBUG_ERR(err, "failed to map trace buffer");
+    }
+}
+
+/**
+ * \brief Stop recording the events of this domain
+ *
+ * The buffer stays set up for trace_control() and friends.
+ */
+errval_t trace_disable_domain(void)
+{
+    dispatcher_handle_t handle = curdispatcher();
+    struct dispatcher_generic *disp = get_dispatcher_generic(handle);
+    disp->trace_buf = NULL;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Map the trace buffer of this core read-only, for tracing domains
+ *
+ * \param ret Returns the mapped trace buffer.
+ */
+errval_t trace_map_readonly(struct trace_buffer **ret)
+{
+    struct frame_identity id;
+    errval_t err = frame_identify(cap_tracebuf, &id);
+    if (err_is_fail(err) || id.bytes < TRACE_ALLOC_SIZE) {
+        return TRACE_ERR_NO_BUFFER;
+    }
+
+    void *buf;
+    err = paging_map_frame_attr(get_current_paging_state(), &buf, TRACE_ALLOC_SIZE,
+                                cap_tracebuf, VREGION_FLAGS_READ, NULL, NULL);
+    ON_ERR_PUSH_RETURN(err, TRACE_ERR_MAP_BUF);
+
+    *ret = buf;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Start recording events
+ *
+ * \param start_trigger Raw event that starts the trace, 0 to start now.
+ * \param stop_trigger Raw event that stops the trace, 0 for none.
+ * \param duration Maximum duration of the trace in systime ticks, 0 for none.
+ */
+errval_t trace_control(uint64_t start_trigger, uint64_t stop_trigger,
+                       uint64_t duration)
+{
+    struct trace_buffer *master = (struct trace_buffer *) trace_buffer_master;
+    if (master == NULL) {
+        return TRACE_ERR_NO_BUFFER;
+    }
+
+    master->running = false;
+    master->start_trigger = start_trigger;
+    master->stop_trigger = stop_trigger;
+    master->duration = duration;
+    master->stop_time = UINT64_MAX;
+
+    if (start_trigger == 0) {
+        master->t0 = systime_now();
+        if (duration != 0) {
+            master->stop_time = master->t0 + duration;
+        }
+        master->running = true;
+    }
+    return SYS_ERR_OK;
+}
+
+void trace_reset_buffer(void)
+{
+    struct trace_buffer *buf = (struct trace_buffer *) trace_buffer_va;
+    if (buf != NULL) {
+        buf->head_index = 0;
+        buf->tail_index = 0;
+#ifdef TRACE_PERCORE_FRAMES
+        memset((void *) buf->committed, 0, sizeof(buf->committed));
+#endif
+    }
+}
+
+errval_t trace_set_subsys_enabled(uint16_t subsys, bool enabled)
+{
+    if (trace_buffer_master == 0) {
+        return TRACE_ERR_NO_BUFFER;
+    }
+    if (subsys >= TRACE_NUM_SUBSYSTEMS) {
+        return TRACE_ERR_UNAVAIL;
+    }
+
+    bool *subsystem_states = (bool *) (trace_buffer_master + TRACE_BUF_SIZE);
+    subsystem_states[subsys] = enabled;
+    return SYS_ERR_OK;
+}
+
+errval_t trace_set_all_subsys_enabled(bool enabled)
+{
+    if (trace_buffer_master == 0) {
+        return TRACE_ERR_NO_BUFFER;
+    }
+
+    bool *subsystem_states = (bool *) (trace_buffer_master + TRACE_BUF_SIZE);
+    for (int i = 0; i < TRACE_NUM_SUBSYSTEMS; i++) {
+        subsystem_states[i] = enabled;
+    }
+    return SYS_ERR_OK;
+}
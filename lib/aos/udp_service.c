@@ -1,14 +1,31 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <aos/aos.h>
+#include <aos/deferred.h>
 #include <aos/nameserver.h>
 #include <aos/udp_service.h>
 
 /**
  * \brief initialize an aos-socket with the given configurations.
  * \param sockref reference to socket instance data - all flags will be overwritten
+ *
+ * Allocates the rings shared with the driver and hands them over with the
+ * CREATE request. The driver may fill the whole RX ring.
  */
 errval_t aos_socket_initialize(struct aos_socket *sockref,
                                uint32_t ip_dest, uint16_t f_port, uint16_t l_port) {
+    return aos_socket_initialize_depth(sockref, ip_dest, f_port, l_port, 0);
+}
+
+/**
+ * \brief initialize an aos-socket with a bounded receive queue
+ * \param rx_depth number of received datagrams the driver queues before it
+ * drops, 0 or more than UDP_RING_SLOTS for the whole ring
+ */
+errval_t aos_socket_initialize_depth(struct aos_socket *sockref, uint32_t ip_dest,
+                                     uint16_t f_port, uint16_t l_port,
+                                     uint16_t rx_depth) {
     errval_t *erref;
     errval_t err;
     err = nameservice_lookup(ENET_SERVICE_NAME, &sockref->_nschan);
@@ -16,6 +33,24 @@ errval_t aos_socket_initialize(struct aos_socket *sockref,
         return err;
     }
 
+    // caps only travel over indirect channels
+    err = nameservice_lookup(ENET_SHM_SERVICE_NAME, &sockref->_shmchan);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    size_t bytes;
+    void *shm;
+    err = frame_alloc_and_map(&sockref->shm_frame, UDP_SHM_SIZE, &bytes, &shm);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    memset(shm, 0, sizeof(struct udp_shm));
+    sockref->shm = shm;
+    sockref->tx_next = 0;
+    sockref->rx_ep = NULL;
+    sockref->rx_armed = false;
+
     size_t msgsize =
         sizeof(struct udp_service_message) +
         sizeof(struct udp_socket_create_info);
@@ -26,13 +61,14 @@ errval_t aos_socket_initialize(struct aos_socket *sockref,
     usm->len = 0;
     struct udp_socket_create_info *usci = (struct udp_socket_create_info *) usm->data;
     usci->f_port = f_port;
+    usci->rx_depth = rx_depth;
     usci->ip_dest = ip_dest;
 
     size_t response_bytes;
 
-    err = nameservice_rpc(sockref->_nschan, (void *) usm, msgsize,
+    err = nameservice_rpc(sockref->_shmchan, (void *) usm, msgsize,
                           (void **) &erref, &response_bytes,
-                          NULL_CAP, NULL_CAP);
+                          sockref->shm_frame, NULL_CAP);
     free(usm);
 
     sockref->ip_dest = ip_dest;
@@ -41,113 +77,413 @@ errval_t aos_socket_initialize(struct aos_socket *sockref,
 
     if (!err_is_fail(err)) {
         err = *erref;
+        free(erref);
+    }
+    if (err_is_fail(err)) {
+        errval_t unmap_err = paging_unmap_frame(get_current_paging_state(), shm,
+                                                UDP_SHM_SIZE);
+        if (err_is_fail(unmap_err)) {
+            // the frame stays, it is still mapped
+            DEBUG_ERR(unmap_err, "unmapping socket rings");
+        } else {
+            cap_destroy(sockref->shm_frame);
+        }
+        sockref->shm = NULL;
     }
 
-    free(erref);
     return err;
 }
 
 /**
- * \brief send data over an aos_socket
+ * \brief get the next received packet, without copying it
+ *
+ * The buffer stays valid until it is released with aos_socket_rx_release().
+ * Buffers have to be released in the order they were received.
  */
-errval_t aos_socket_send(struct aos_socket *sockref, void *data, uint16_t len) {
-    errval_t *erref;
-    size_t msgsize = sizeof(struct udp_service_message) + len * sizeof(char);
-    struct udp_service_message *usm = malloc(msgsize);
+errval_t aos_socket_rx_next(struct aos_socket *sockref, struct aos_socket_buf *buf) {
+    struct udp_ring *rx = &sockref->shm->rx;
+    uint32_t tail = rx->tail;
+    if (tail == rx->head) {
+        return ENET_ERR_RING_EMPTY;
+    }
+    // read the descriptor only after seeing the head
+    dmb();
+
+    struct udp_ring_desc *d = &rx->desc[tail % UDP_RING_SLOTS];
+    buf->ip = d->ip;
+    buf->port = d->port;
+    buf->len = d->len;
+    buf->data = (char *) sockref->shm + udp_shm_rx_offset(tail);
+    buf->idx = tail;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief give an RX buffer back to the driver
+ */
+void aos_socket_rx_release(struct aos_socket *sockref, struct aos_socket_buf *buf) {
+    assert(buf->idx == sockref->shm->rx.tail);
+    dmb();
+    sockref->shm->rx.tail = buf->idx + 1;
+}
 
-    usm->type = SEND;
-    usm->port = sockref->l_port;
-    usm->len = len;
-    memcpy((void *) usm->data, data, len);
+/**
+ * \brief get a free TX buffer to write a payload of up to
+ * UDP_RING_MAX_PAYLOAD bytes into
+ *
+ * Fill in ip, port and len and queue it with aos_socket_tx_put(), in the
+ * order the buffers were handed out.
+ */
+errval_t aos_socket_tx_get(struct aos_socket *sockref, struct aos_socket_buf *buf) {
+    struct udp_ring *tx = &sockref->shm->tx;
+    uint32_t idx = sockref->tx_next;
+    if (idx - tx->done >= UDP_RING_SLOTS) {
+        return ENET_ERR_RING_FULL;
+    }
+    sockref->tx_next = idx + 1;
 
+    buf->ip = sockref->ip_dest;
+    buf->port = sockref->f_port;
+    buf->len = 0;
+    buf->data = (char *) sockref->shm + udp_shm_tx_offset(idx) + UDP_RING_HEADROOM;
+    buf->idx = idx;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief queue a filled TX buffer, it is sent on the next aos_socket_tx_kick()
+ */
+void aos_socket_tx_put(struct aos_socket *sockref, struct aos_socket_buf *buf) {
+    struct udp_ring *tx = &sockref->shm->tx;
+    assert(buf->idx == tx->head);
+
+    struct udp_ring_desc *d = &tx->desc[buf->idx % UDP_RING_SLOTS];
+    d->ip = buf->ip;
+    d->port = buf->port;
+    d->len = buf->len > UDP_RING_MAX_PAYLOAD ? UDP_RING_MAX_PAYLOAD : buf->len;
+
+    // publish descriptor and payload before the head
+    dmb();
+    tx->head = buf->idx + 1;
+}
+
+/**
+ * \brief tell the driver there are packets in the TX ring
+ *
+ * \return the error of the first packet that could not be sent, if any
+ */
+errval_t aos_socket_tx_kick(struct aos_socket *sockref) {
+    errval_t *erref;
+    struct udp_service_message usm = {
+        .type = TX_KICK,
+        .port = sockref->l_port,
+    };
 
     size_t response_bytes;
 
-    errval_t err = nameservice_rpc(sockref->_nschan, (void *) usm, msgsize,
+    errval_t err = nameservice_rpc(sockref->_nschan, (void *) &usm, sizeof(usm),
                                    (void **) &erref, &response_bytes,
                                    NULL_CAP, NULL_CAP);
-    free(usm);
-
     if (!err_is_fail(err)) {
         err = *erref;
+        free(erref);
     }
-
-    free(erref);
     return err;
 }
 
-errval_t aos_socket_send_to(struct aos_socket *sockref, void *data, uint16_t len,
-                            uint32_t ip, uint16_t port) {
-    errval_t *erref = malloc(sizeof(errval_t));
-    size_t msgsize = sizeof(struct udp_service_message) + len * sizeof(char);
-    struct udp_service_message *usm = malloc(msgsize);
+static void rx_notify_handler(void *arg) {
+    struct aos_socket *sockref = arg;
+    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
 
-    usm->type = SEND_TO;
-    usm->port = sockref->l_port;
-    usm->len = len;
-    usm->ip = ip;
-    usm->tgt_port = port;
-    memcpy((void *) usm->data, data, len);
+    // notifications carry no payload, one wakeup is as good as several
+    while (err_is_ok(lmp_endpoint_recv(sockref->rx_ep, &msg.buf, NULL))) {
+    }
+    sockref->rx_armed = false;
+}
 
-    size_t response_bytes;
+static void rx_recheck_handler(void *arg) {
+    // nothing to do, the waiter looks at the ring again
+}
 
-    errval_t err = nameservice_rpc(sockref->_nschan, (void *) usm, msgsize,
-                                   (void **) &erref, &response_bytes,
-                                   NULL_CAP, NULL_CAP);
-    free(usm);
+/**
+ * \brief create the endpoint the driver notifies us on and hand it over
+ */
+static errval_t rx_notify_setup(struct aos_socket *sockref) {
+    errval_t *erref;
+    errval_t err;
 
+    waitset_init(&sockref->rx_ws);
+    err = endpoint_create(DEFAULT_LMP_BUF_WORDS, &sockref->rx_ep_cap,
+                          &sockref->rx_ep);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    struct udp_service_message usm = {
+        .type = RX_NOTIFY,
+        .port = sockref->l_port,
+    };
+    size_t response_bytes;
+
+    err = nameservice_rpc(sockref->_shmchan, (void *) &usm, sizeof(usm),
+                          (void **) &erref, &response_bytes,
+                          sockref->rx_ep_cap, NULL_CAP);
     if (!err_is_fail(err)) {
         err = *erref;
+        free(erref);
+    }
+    if (err_is_fail(err)) {
+        lmp_endpoint_free(sockref->rx_ep);
+        cap_destroy(sockref->rx_ep_cap);
+        sockref->rx_ep = NULL;
     }
-
-    free(erref);
     return err;
 }
 
-errval_t aos_socket_receive(struct aos_socket *sockref, struct udp_msg *retptr) {
-    size_t msgsize = sizeof(struct udp_service_message);
-    struct udp_service_message *usm = malloc(msgsize);
+/**
+ * \brief block until there is at least one packet in the RX ring
+ *
+ * The thread parks on an endpoint the driver signals when it fills the ring.
+ * It still looks at the ring every UDP_RX_WAIT_RECHECK_US, which covers
+ * drivers on another core, where the endpoint cannot be signalled.
+ */
+errval_t aos_socket_rx_wait(struct aos_socket *sockref) {
+    struct udp_ring *rx = &sockref->shm->rx;
+    errval_t err;
 
-    usm->type = RECV;
-    usm->port = sockref->l_port;
-    usm->len = 0;
+    if (rx->tail != rx->head) {
+        return SYS_ERR_OK;
+    }
 
-    void *response;
-    size_t response_bites;
+    if (sockref->rx_ep == NULL) {
+        err = rx_notify_setup(sockref);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
 
-    __unused errval_t err = nameservice_rpc(sockref->_nschan, (void *) usm, msgsize,
-                                   &response, &response_bites,
-                                   NULL_CAP, NULL_CAP);
-    free(usm);
+    while (rx->tail == rx->head) {
+        rx->wait = 1;
+        // the driver must see wait before we look at the head again
+        dmb();
+        if (rx->tail != rx->head) {
+            break;
+        }
+
+        if (!sockref->rx_armed) {
+            err = lmp_endpoint_register(sockref->rx_ep, &sockref->rx_ws,
+                                        MKCLOSURE(rx_notify_handler, sockref));
+            if (err_is_fail(err)) {
+                return err;
+            }
+            sockref->rx_armed = true;
+        }
+
+        struct deferred_event recheck;
+        deferred_event_init(&recheck);
+        err = deferred_event_register(&recheck, &sockref->rx_ws,
+                                      UDP_RX_WAIT_RECHECK_US,
+                                      MKCLOSURE(rx_recheck_handler, NULL));
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+        err = event_dispatch(&sockref->rx_ws);
+        deferred_event_cancel(&recheck);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
 
-    memcpy(retptr, response, response_bites);
-    free(response);
+    rx->wait = 0;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief receive up to n datagrams with one call
+ *
+ * Copies the payloads into msgs[i].data, which has room for msgs[i].len
+ * bytes; longer payloads are truncated. The ring slots are given back to the
+ * driver in one go.
+ *
+ * \param flags AOS_SOCKET_WAIT to block until at least one datagram arrived
+ * \param ret_n returns the number of received datagrams
+ */
+errval_t aos_socket_recvmmsg(struct aos_socket *sockref, struct aos_socket_mmsg *msgs,
+                             size_t n, int flags, size_t *ret_n) {
+    struct udp_ring *rx = &sockref->shm->rx;
+    errval_t err;
 
-    if (response_bites == 0) {
-        return LIB_ERR_NOT_IMPLEMENTED;
+    *ret_n = 0;
+    if (flags & AOS_SOCKET_WAIT) {
+        err = aos_socket_rx_wait(sockref);
+        if (err_is_fail(err)) {
+            return err;
+        }
     }
 
+    uint32_t tail = rx->tail;
+    uint32_t avail = rx->head - tail;
+    if (avail == 0) {
+        return ENET_ERR_RING_EMPTY;
+    }
+    // read the descriptors only after seeing the head
+    dmb();
+
+    size_t i;
+    for (i = 0; i < n && i < avail; i++) {
+        struct udp_ring_desc *d = &rx->desc[(tail + i) % UDP_RING_SLOTS];
+        uint16_t len = d->len < msgs[i].len ? d->len : msgs[i].len;
+
+        msgs[i].ip = d->ip;
+        msgs[i].port = d->port;
+        msgs[i].len = len;
+        memcpy(msgs[i].data, (char *) sockref->shm + udp_shm_rx_offset(tail + i), len);
+    }
+
+    dmb();
+    rx->tail = tail + i;
+    *ret_n = i;
     return SYS_ERR_OK;
 }
 
-errval_t aos_socket_teardown(struct aos_socket *sockref) {
-    errval_t *erref = malloc(sizeof(errval_t));
-    size_t msgsize = sizeof(struct udp_service_message);
-    struct udp_service_message *usm = malloc(msgsize);
+/**
+ * \brief send up to n datagrams with one call
+ *
+ * The payloads are copied into the TX ring and the driver is kicked once for
+ * the whole batch, or once more whenever the ring fills up in between.
+ *
+ * \param ret_n returns the number of datagrams that were queued
+ * \return the error of the first datagram that could not be sent, if any
+ */
+errval_t aos_socket_sendmmsg(struct aos_socket *sockref, struct aos_socket_mmsg *msgs,
+                             size_t n, size_t *ret_n) {
+    struct aos_socket_buf buf;
+    errval_t err = SYS_ERR_OK;
+    size_t queued = 0;
+
+    *ret_n = 0;
+    for (size_t i = 0; i < n; i++) {
+        err = aos_socket_tx_get(sockref, &buf);
+        if (err_no(err) == ENET_ERR_RING_FULL) {
+            // the driver sends synchronously, a kick frees all queued slots
+            err = aos_socket_tx_kick(sockref);
+            queued = 0;
+            if (err_is_fail(err)) {
+                return err;
+            }
+            err = aos_socket_tx_get(sockref, &buf);
+        }
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+        uint16_t len = msgs[i].len > UDP_RING_MAX_PAYLOAD ? UDP_RING_MAX_PAYLOAD
+                                                          : msgs[i].len;
+        memcpy(buf.data, msgs[i].data, len);
+        buf.ip = msgs[i].ip;
+        buf.port = msgs[i].port;
+        buf.len = len;
+        aos_socket_tx_put(sockref, &buf);
+        queued++;
+        *ret_n = i + 1;
+    }
+
+    if (queued > 0) {
+        err = aos_socket_tx_kick(sockref);
+    }
+    return err;
+}
+
+/**
+ * \brief send data over an aos_socket
+ */
+errval_t aos_socket_send(struct aos_socket *sockref, void *data, uint16_t len) {
+    return aos_socket_send_to(sockref, data, len, sockref->ip_dest, sockref->f_port);
+}
+
+errval_t aos_socket_send_to(struct aos_socket *sockref, void *data, uint16_t len,
+                            uint32_t ip, uint16_t port) {
+    struct aos_socket_buf buf;
+    errval_t err = aos_socket_tx_get(sockref, &buf);
+    if (err_no(err) == ENET_ERR_RING_FULL) {
+        // the driver sends synchronously, a kick frees all queued slots
+        aos_socket_tx_kick(sockref);
+        err = aos_socket_tx_get(sockref, &buf);
+    }
+    if (err_is_fail(err)) {
+        return err;
+    }
 
-    usm->type = DESTROY;
-    usm->port = sockref->l_port;
+    if (len > UDP_RING_MAX_PAYLOAD) {
+        len = UDP_RING_MAX_PAYLOAD;
+    }
+    memcpy(buf.data, data, len);
+    buf.ip = ip;
+    buf.port = port;
+    buf.len = len;
+    aos_socket_tx_put(sockref, &buf);
+
+    return aos_socket_tx_kick(sockref);
+}
+
+/**
+ * \brief copy the next received packet into retptr
+ *
+ * retptr needs room for UDP_RING_MAX_PAYLOAD bytes of data.
+ */
+errval_t aos_socket_receive(struct aos_socket *sockref, struct udp_msg *retptr) {
+    struct aos_socket_buf buf;
+    errval_t err = aos_socket_rx_next(sockref, &buf);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    retptr->f_port = buf.port;
+    retptr->ip = buf.ip;
+    retptr->len = buf.len;
+    memcpy(retptr->data, buf.data, buf.len);
+    aos_socket_rx_release(sockref, &buf);
+
+    return SYS_ERR_OK;
+}
+
+errval_t aos_socket_teardown(struct aos_socket *sockref) {
+    errval_t *erref;
+    struct udp_service_message usm = {
+        .type = DESTROY,
+        .port = sockref->l_port,
+    };
 
     size_t response_botes;
 
-    errval_t err = nameservice_rpc(sockref->_nschan, (void *) usm, msgsize,
+    errval_t err = nameservice_rpc(sockref->_nschan, (void *) &usm, sizeof(usm),
                                    (void **) &erref, &response_botes,
                                    NULL_CAP, NULL_CAP);
-    free(usm);
+    if (!err_is_fail(err)) {
+        err = *erref;
+        free(erref);
+    }
 
-    err = err_is_fail(err) ? err : *erref;
+    if (sockref->rx_ep != NULL) {
+        if (sockref->rx_armed) {
+            lmp_endpoint_deregister(sockref->rx_ep);
+        }
+        lmp_endpoint_free(sockref->rx_ep);
+        cap_destroy(sockref->rx_ep_cap);
+        sockref->rx_ep = NULL;
+    }
+
+    // the driver has dropped its mapping of the rings
+    errval_t unmap_err = paging_unmap_frame(get_current_paging_state(), sockref->shm,
+                                            UDP_SHM_SIZE);
+    if (err_is_fail(unmap_err)) {
+        // the frame stays, it is still mapped
+        return err_is_fail(err) ? err : err_push(unmap_err, LIB_ERR_PMAP_UNMAP);
+    }
+    cap_destroy(sockref->shm_frame);
+    sockref->shm = NULL;
 
-    free(erref);
     return err;
 }
 
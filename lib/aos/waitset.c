@@ -26,6 +26,7 @@
 #include "threads_priv.h"
 #include "waitset_chan_priv.h"
 #include <aos/ump_chan.h>
+#include <aos/aos_datachan.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -229,6 +230,14 @@ void poll_channels_disabled(dispatcher_handle_t handle) {
                     }
                     break;
                 }
+            case CHANTYPE_DC_PIPE_IN:
+                {
+                    struct aos_dc_pipe *pipe = (struct aos_dc_pipe *) chan->arg;
+                    if (chan->waitset != NULL && aos_dc_pipe_can_receive(pipe)) {
+                        chan_ready = true;
+                    }
+                    break;
+                }
             default:
                 assert_disabled(!ws_chantype_is_polled(chan->chantype));
                 assert_disabled(!"invalid channel type to poll!");
@@ -13,21 +13,136 @@
 
 #include "collections/hash_table.h"
 #include "inttypes.h"
+#include <stdbool.h>
 
 /******************************************************
- * a simple hash table implementation
+ * an open addressing hash table implementation
+ *
+ * Every element sits in the slot array, at most dist - 1 slots after its home
+ * slot. On insert, an element that is further from home than the one in the
+ * slot takes the slot and the displaced one moves on (Robin Hood), so a
+ * lookup can stop as soon as it meets an element closer to home than itself.
+ *
+ * Above 7/8 load the table doubles. The old slots stay around and every
+ * insert and delete moves COLLECTIONS_HASH_MIGRATE_STEP of them into the new
+ * table, lookups check both. Moved and deleted elements of the old table are
+ * tombstones that keep their dist, so the old table's probe runs stay intact.
  ******************************************************/
 
+// dist bit of a tombstone in the old table
+#define COLLECTIONS_HASH_TOMB	0x80000000u
+
+// old slots moved to the new table by each insert or delete
+#define COLLECTIONS_HASH_MIGRATE_STEP	16
+
+static inline uint64_t collections_hash_key(uint64_t key)
+{
+	// fmix64 of MurmurHash3, keys are often sequential or aligned pointers
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return key;
+}
+
+static inline bool collections_hash_slot_live(collections_hash_elem *e)
+{
+	return e->dist != 0 && !(e->dist & COLLECTIONS_HASH_TOMB);
+}
+
+/*
+ * Robin Hood insert into a slot array with room left.
+ */
+static void collections_hash_slots_insert(collections_hash_elem *slots, uint32_t num_slots,
+                         uint64_t key, void *data)
+{
+	uint32_t mask = num_slots - 1;
+	uint32_t i = collections_hash_key(key) & mask;
+	collections_hash_elem cur = { .key = key, .data = data, .dist = 1 };
+
+	for (;; i = (i + 1) & mask, cur.dist++) {
+		collections_hash_elem *e = &slots[i];
+		if (e->dist == 0) {
+			*e = cur;
+			return;
+		}
+		if (e->dist < cur.dist) {
+			collections_hash_elem tmp = *e;
+			*e = cur;
+			cur = tmp;
+		}
+	}
+}
+
+/*
+ * Slot holding key in a slot array, NULL if there is none. Tombstones keep
+ * their place in the probe run but never match.
+ */
+static collections_hash_elem *collections_hash_slots_find(collections_hash_elem *slots,
+                                         uint32_t num_slots, uint64_t key)
+{
+	uint32_t mask = num_slots - 1;
+	uint32_t i = collections_hash_key(key) & mask;
+
+	for (uint32_t dist = 1;; i = (i + 1) & mask, dist++) {
+		collections_hash_elem *e = &slots[i];
+		if ((e->dist & ~COLLECTIONS_HASH_TOMB) < dist) {
+			// empty, or an element closer to home than key would be
+			return NULL;
+		}
+		if (e->key == key && !(e->dist & COLLECTIONS_HASH_TOMB)) {
+			return e;
+		}
+	}
+}
+
+/*
+ * Move up to n slots of the old table over, free it once it is empty.
+ */
+static void collections_hash_migrate_slots(collections_hash_table *t, uint32_t n)
+{
+	for (; n > 0 && t->old_next < t->old_num_slots; n--) {
+		collections_hash_elem *e = &t->old_slots[t->old_next++];
+		if (collections_hash_slot_live(e)) {
+			collections_hash_slots_insert(t->slots, t->num_slots, e->key, e->data);
+			e->dist |= COLLECTIONS_HASH_TOMB;
+		}
+	}
+
+	if (t->old_next == t->old_num_slots) {
+		free(t->old_slots);
+		t->old_slots = NULL;
+		t->old_num_slots = 0;
+		t->old_next = 0;
+	}
+}
+
 /*
- * Function to identify the right element from the
- * linked list.
+ * Incremental part of a resize. Nothing moves during a traversal.
  */
-static int32_t match_key(void *data, void *arg)
+static void collections_hash_migrate(collections_hash_table *t, uint32_t n)
+{
+	if (t->old_slots != NULL && t->cur_bucket_num == -1) {
+		collections_hash_migrate_slots(t, n);
+	}
+}
+
+static void collections_hash_grow(collections_hash_table *t)
 {
-	collections_hash_elem *elem = (collections_hash_elem *) data;
-	uint64_t key  = *((uint64_t *)arg);
+	// a previous resize still going on is finished first
+	if (t->old_slots != NULL) {
+		collections_hash_migrate_slots(t, UINT32_MAX);
+	}
 
-    return (elem->key == key);
+	collections_hash_elem *slots = calloc(t->num_slots * 2, sizeof(*slots));
+	assert(slots != NULL);
+
+	t->old_slots = t->slots;
+	t->old_num_slots = t->num_slots;
+	t->old_next = 0;
+	t->slots = slots;
+	t->num_slots *= 2;
 }
 
 /*
@@ -35,18 +150,17 @@ static int32_t match_key(void *data, void *arg)
  */
 static void collections_hash_create_core(collections_hash_table **t, int num_buckets, collections_hash_data_free data_free)
 {
-	int i;
+	uint32_t num_slots = COLLECTIONS_HASH_MIN_SLOTS;
+	while (num_slots < (uint32_t) num_buckets) {
+		num_slots *= 2;
+	}
 
 	*t = (collections_hash_table *) malloc (sizeof(collections_hash_table));
 	memset(*t, 0, sizeof(collections_hash_table));
 
-	(*t)->num_buckets = num_buckets;
-
-	// create a linked list node for each bucket
-	(*t)->buckets = (collections_listnode **) malloc(sizeof(collections_listnode *) * num_buckets);
-	for (i = 0; i < num_buckets; i ++) {
-		collections_list_create(&(*t)->buckets[i], NULL);
-	}
+	(*t)->num_slots = num_slots;
+	(*t)->slots = calloc(num_slots, sizeof(collections_hash_elem));
+	assert((*t)->slots != NULL);
 
 	(*t)->num_elems = 0;
     (*t)->data_free = data_free;
@@ -58,64 +172,51 @@ static void collections_hash_create_core(collections_hash_table **t, int num_buc
 
 void collections_hash_create(collections_hash_table **t, collections_hash_data_free elem_free)
 {
-	collections_hash_create_core(t, NUM_BUCKETS, elem_free);
+	collections_hash_create_core(t, COLLECTIONS_HASH_MIN_SLOTS, elem_free);
 }
 
+/*
+ * The table grows on demand, num_buckets only sizes the initial table.
+ */
 void collections_hash_create_with_buckets(collections_hash_table **t, int num_buckets, collections_hash_data_free elem_free)
 {
 	collections_hash_create_core(t, num_buckets, elem_free);
 }
 
-static int collections_hash_release_elem(void* elem, void * arg)
+static void collections_hash_release_slots(collections_hash_table *t,
+                                           collections_hash_elem *slots,
+                                           uint32_t num_slots)
 {
-    collections_hash_table *t = (collections_hash_table *)arg;
-    collections_hash_elem *he = (collections_hash_elem *)elem;
-    if (t->data_free)
-    {
-        t->data_free(he->data);
-    }
-    free(he);
-
-	t->num_elems--;
-
-    return 1;
+	for (uint32_t i = 0; i < num_slots; i++) {
+		if (collections_hash_slot_live(&slots[i])) {
+			if (t->data_free) {
+				t->data_free(slots[i].data);
+			}
+			t->num_elems--;
+		}
+	}
+	free(slots);
 }
 
 // delete the entire hash table
 void collections_hash_release(collections_hash_table *t)
 {
-	int bucket_num;
-	int bucket_size;
-	collections_listnode *bucket;
-
-	for (bucket_num = 0; bucket_num < t->num_buckets; bucket_num ++) {
-        uint32_t before, after;
-		bucket = t->buckets[bucket_num];
-		bucket_size = collections_list_size(bucket);
-        
-        before = t->num_elems;
-        collections_list_visit(bucket, collections_hash_release_elem, t);
-        after = t->num_elems;
-        assert(before - after == bucket_size);
-
-        collections_list_release(bucket);
+	collections_hash_release_slots(t, t->slots, t->num_slots);
+	if (t->old_slots != NULL) {
+		collections_hash_release_slots(t, t->old_slots, t->old_num_slots);
 	}
     assert(t->num_elems == 0);
 
-	free(t->buckets);
 	free(t);
 }
 
 static collections_hash_elem* collections_hash_find_elem(collections_hash_table *t, uint64_t key)
 {
-	uint32_t bucket_num;	
-	collections_listnode *bucket;	
-	collections_hash_elem *elem;
-
-	bucket_num = key % t->num_buckets;
-	bucket = t->buckets[bucket_num];
-	elem = (collections_hash_elem*) collections_list_find_if(bucket, match_key, &key);
-    return elem;
+	collections_hash_elem *elem = collections_hash_slots_find(t->slots, t->num_slots, key);
+	if (elem == NULL && t->old_slots != NULL) {
+		elem = collections_hash_slots_find(t->old_slots, t->old_num_slots, key);
+	}
+	return elem;
 }
 
 /*
@@ -123,10 +224,10 @@ static collections_hash_elem* collections_hash_find_elem(collections_hash_table
  */
 void collections_hash_insert(collections_hash_table *t, uint64_t key, void *data)
 {
-	uint32_t bucket_num;
-	collections_listnode *bucket;
 	collections_hash_elem *elem;
 
+	collections_hash_migrate(t, COLLECTIONS_HASH_MIGRATE_STEP);
+
     elem = collections_hash_find_elem(t, key);
 	if (elem != NULL) {
 		printf("Error: key %" PRIu64 " already present in hash table %" PRIu64 "\n",
@@ -135,12 +236,12 @@ void collections_hash_insert(collections_hash_table *t, uint64_t key, void *data
 		return;
 	}
 
-	bucket_num = key % t->num_buckets;
-	bucket = t->buckets[bucket_num];
-	elem = (collections_hash_elem *) malloc(sizeof(collections_hash_elem));
-	elem->key = key;
-	elem->data = data;
-	collections_list_insert(bucket, (void *)elem);
+	// the old table drains long before the new one fills up
+	if ((uint64_t) (t->num_elems + 1) * 8 > (uint64_t) t->num_slots * 7) {
+		collections_hash_grow(t);
+	}
+
+	collections_hash_slots_insert(t->slots, t->num_slots, key, data);
 	t->num_elems ++;
 }
 
@@ -158,22 +259,40 @@ void *collections_hash_find(collections_hash_table *t, uint64_t key)
  */
 void collections_hash_delete(collections_hash_table *t, uint64_t key)
 {	
-	uint32_t bucket_num;	
-	collections_listnode *bucket;	
 	collections_hash_elem *elem;
+	void *data;
 
-	bucket_num = key % t->num_buckets;
-	bucket = t->buckets[bucket_num];
-	elem = (collections_hash_elem*) collections_list_remove_if(bucket, match_key, &key);
+	collections_hash_migrate(t, COLLECTIONS_HASH_MIGRATE_STEP);
+
+	elem = collections_hash_slots_find(t->slots, t->num_slots, key);
 	if (elem) {
-        uint32_t n = t->num_elems;
-        collections_hash_release_elem(elem, t);
-        assert(1 == n - t->num_elems);
-	}
-    else
-    {
+		// shift the rest of the probe run back by one
+		uint32_t mask = t->num_slots - 1;
+		uint32_t i = elem - t->slots;
+		data = elem->data;
+		for (;;) {
+			collections_hash_elem *next = &t->slots[(i + 1) & mask];
+			if (next->dist <= 1) {
+				break;
+			}
+			t->slots[i] = *next;
+			t->slots[i].dist--;
+			i = (i + 1) & mask;
+		}
+		t->slots[i].dist = 0;
+	} else if (t->old_slots != NULL
+	           && (elem = collections_hash_slots_find(t->old_slots, t->old_num_slots, key)) != NULL) {
+		data = elem->data;
+		elem->dist |= COLLECTIONS_HASH_TOMB;
+	} else {
 	    printf("Error: cannot find the node with key %" PRIu64 " in collections_hash_release\n", key);
-    }
+	    return;
+	}
+
+	if (t->data_free) {
+		t->data_free(data);
+	}
+	t->num_elems--;
 }
 
 /*
@@ -184,27 +303,11 @@ uint32_t collections_hash_size(collections_hash_table *t)
 	return (t->num_elems);
 }
 
-static collections_listnode* collections_hash_get_next_valid_bucket(collections_hash_table* t)
-{
-	collections_listnode* bucket;
-
-	do {
-		t->cur_bucket_num ++;
-		if (t->cur_bucket_num < t->num_buckets) {
-			if (!t->buckets[t->cur_bucket_num]) {
-				continue;
-			}
-		} else {
-			return NULL;
-		}
-	} while (collections_list_size(t->buckets[t->cur_bucket_num]) <= 0);
-
-	bucket = t->buckets[t->cur_bucket_num];
-	collections_list_traverse_start(bucket);
-
-	return bucket;
-}
-
+/*
+ * Traversal walks the new table and then the old one, cur_bucket_num is the
+ * next slot to look at across both. The table must not be modified while a
+ * traversal is open.
+ */
 int32_t collections_hash_traverse_start(collections_hash_table *t)
 {
 	if (t->cur_bucket_num != -1) {
@@ -214,7 +317,7 @@ int32_t collections_hash_traverse_start(collections_hash_table *t)
 		return -1;
 	}
 
-	collections_hash_get_next_valid_bucket(t);
+	t->cur_bucket_num = 0;
 
 	return 1;
 }
@@ -233,39 +336,20 @@ void* collections_hash_traverse_next(collections_hash_table* t, uint64_t *key)
 		printf("Error: collections_hash_table must be opened for traversal first.\n");
 		return NULL;
 	}
-	
-	if (t->cur_bucket_num >= t->num_buckets) {
-		// all the buckets have been traversed.
-		return NULL;
-	} else {
-		collections_listnode*	bucket;
-		collections_hash_elem*	ret;
-
-		if (t->buckets[t->cur_bucket_num]) {
-			bucket = t->buckets[t->cur_bucket_num];
-			ret = (collections_hash_elem*) collections_list_traverse_next(bucket);
-
-			if (ret) {
-				*key = ret->key;
-				return ret->data;
-			} else {
-				// this list traversal is over.
-				// let's close it.
-				collections_list_traverse_end(bucket);
-			}
-		}
 
-		bucket = collections_hash_get_next_valid_bucket(t);
-		if (!bucket) {
-			return NULL;
-		} else {
-			ret = (collections_hash_elem*) collections_list_traverse_next(bucket);
-			assert(ret != NULL);
+	uint32_t total = t->num_slots + t->old_num_slots;
+	while ((uint32_t) t->cur_bucket_num < total) {
+		uint32_t i = t->cur_bucket_num++;
+		collections_hash_elem *e = i < t->num_slots ? &t->slots[i]
+		                                            : &t->old_slots[i - t->num_slots];
+		if (collections_hash_slot_live(e)) {
+			*key = e->key;
+			return e->data;
 		}
-
-		*key = ret->key;
-		return ret->data;
 	}
+
+	// all the slots have been traversed.
+	return NULL;
 }
 
 int32_t	collections_hash_traverse_end(collections_hash_table* t)
@@ -277,37 +361,28 @@ int32_t	collections_hash_traverse_end(collections_hash_table* t)
 		return -1;
 	}
 
-    // XXX The bucktes (list) are not reset here which may cause errors when the
-    // hash table is only traversed half way. 
-
 	t->cur_bucket_num = -1;
 	return 1;
 }
 
-struct collections_hash_visitor_tuple
-{
-    collections_hash_visitor_func func;
-    void *arg;
-};
-
-static int collections_hash_visit0(void* list_data, void* arg)
+static int collections_hash_visit_slots(collections_hash_elem *slots, uint32_t num_slots,
+                                        collections_hash_visitor_func func, void *arg)
 {
-    struct collections_hash_visitor_tuple *t = (struct collections_hash_visitor_tuple *)arg;
-    collections_hash_elem *he = (collections_hash_elem*)list_data;
-    return t->func(he->key, he->data, t->arg);
+	for (uint32_t i = 0; i < num_slots; i++) {
+		if (collections_hash_slot_live(&slots[i]) && func(slots[i].key, slots[i].data, arg) == 0) {
+			return 0;
+		}
+	}
+	return 1;
 }
 
 int collections_hash_visit(collections_hash_table* t, collections_hash_visitor_func func, void* arg)
 {
-    struct collections_hash_visitor_tuple tuple = { func, arg };
-    int i = 0;
-    while (i < t->num_buckets)
-    {
-        if (collections_list_visit(t->buckets[i], collections_hash_visit0, &tuple) == 0) {
-            break;
-        }
-        i++;
-    }
-
-    return (i == t->num_buckets);
+	if (collections_hash_visit_slots(t->slots, t->num_slots, func, arg) == 0) {
+		return 0;
+	}
+	if (t->old_slots != NULL) {
+		return collections_hash_visit_slots(t->old_slots, t->old_num_slots, func, arg);
+	}
+	return 1;
 }
@@ -22,42 +22,177 @@
 #include <hashtable/hashtable.h>
 #include <hashtable/multimap.h>
 
+/*
+ * Open addressing with Robin Hood linear probing: an entry sits at most
+ * dist - 1 slots after its home slot, and a put hands a slot over to the
+ * entry that is further from home. A lookup stops at the first entry closer
+ * to home than the key would be.
+ *
+ * Past the load factor the table doubles. The old slots stay in old_entries
+ * and every put and remove moves HT_MIGRATE_STEP of them over, lookups check
+ * both arrays. Moved and removed entries of the old array become tombstones
+ * that keep their dist, so probe runs there stay intact.
+ */
+
+/// dist bit of a tombstone in the old slot array
+#define HT_TOMB 0x80000000u
+
+/// old slots moved over by each put and remove
+#define HT_MIGRATE_STEP 16
+
+#define HT_MIN_LENGTH 16
+
 /**
  * \brief get a hash value for a string
  * \param str the string
  * \return the hash value
  */
-static inline int hash(const char *str, size_t key_len)
+static inline uint64_t hash(const char *str, size_t key_len)
 {
-    register int _hash = 5381;
-    register int _c;
+    uint64_t _hash = key_len * 0x9e3779b97f4a7c15ULL;
+    uint64_t _w;
 
-    for(size_t i = 0; i < key_len; i++) {
-        _c = str[i];
-        _hash = ((_hash << 5) + _hash) + _c;
+    // a word at a time, then the tail
+    for (; key_len >= sizeof(_w); str += sizeof(_w), key_len -= sizeof(_w)) {
+        memcpy(&_w, str, sizeof(_w));
+        _hash = (_hash ^ _w) * 0x9e3779b97f4a7c15ULL;
+        _hash ^= _hash >> 32;
+    }
+    _w = 0;
+    for (size_t i = 0; i < key_len; i++) {
+        _w |= (uint64_t) (uint8_t) str[i] << (8 * i);
     }
+    _hash ^= _w;
+
+    // fmix64 of MurmurHash3
+    _hash ^= _hash >> 33;
+    _hash *= 0xff51afd7ed558ccdULL;
+    _hash ^= _hash >> 33;
+    _hash *= 0xc4ceb9fe1a85ec53ULL;
+    _hash ^= _hash >> 33;
     return _hash;
 }
 
+static inline const void *entry_key(const struct _ht_entry *e)
+{
+    return e->key_len <= HT_INLINE_KEY_LEN ? e->key_inline : e->key;
+}
+
+static inline bool entry_live(const struct _ht_entry *e)
+{
+    return e->dist != 0 && !(e->dist & HT_TOMB);
+}
+
+/**
+ * \brief check an entry against a key
+ */
+static inline bool equals(const struct _ht_entry *e, uint64_t hash_value,
+                          const void *key, size_t key_len)
+{
+    return e->hash_value == hash_value && e->key_len == key_len
+           && !memcmp(entry_key(e), key, key_len);
+}
+
 /**
- * \brief get the index for an given hash in the bucket table
- * \param table_length the length of the table
- * \param hash_value the hash
- * \return the index
+ * \brief Robin Hood insert of an entry into a slot array with room left
  */
-static inline int index_for(int table_length, int hash_value)
+static void slots_insert(struct _ht_entry *slots, int length,
+                         struct _ht_entry *entry)
 {
-    return ((unsigned)hash_value % table_length);
+    uint32_t mask = length - 1;
+    uint32_t i = entry->hash_value & mask;
+    struct _ht_entry cur = *entry;
+
+    for (cur.dist = 1;; i = (i + 1) & mask, cur.dist++) {
+        struct _ht_entry *e = &slots[i];
+        if (e->dist == 0) {
+            *e = cur;
+            return;
+        }
+        if (e->dist < cur.dist) {
+            struct _ht_entry tmp = *e;
+            *e = cur;
+            cur = tmp;
+        }
+    }
 }
 
 /**
- * \brief check two keys for equality
- * \param k1 the first string
- * \param k2 the second string
- * \return true if the strings are equal
+ * \brief slot holding a key in a slot array, NULL if there is none
  */
-#define equals(_k1, _k2, len) (!memcmp((_k1), (_k2), (len)))
+static struct _ht_entry *slots_find(struct _ht_entry *slots, int length,
+                                    uint64_t hash_value, const void *key,
+                                    size_t key_len)
+{
+    uint32_t mask = length - 1;
+    uint32_t i = hash_value & mask;
 
+    for (uint32_t dist = 1;; i = (i + 1) & mask, dist++) {
+        struct _ht_entry *e = &slots[i];
+        if ((e->dist & ~HT_TOMB) < dist) {
+            return NULL;
+        }
+        if (!(e->dist & HT_TOMB) && equals(e, hash_value, key, key_len)) {
+            return e;
+        }
+    }
+}
+
+static struct _ht_entry *ht_find(struct hashtable *ht, uint64_t hash_value,
+                                 const void *key, size_t key_len)
+{
+    struct _ht_entry *e = slots_find(ht->entries, ht->table_length, hash_value,
+                                     key, key_len);
+    if (e == NULL && ht->old_entries != NULL) {
+        e = slots_find(ht->old_entries, ht->old_length, hash_value, key, key_len);
+    }
+    return e;
+}
+
+/**
+ * \brief move up to n old slots over, free the old array once it is empty
+ */
+static void ht_migrate(struct hashtable *ht, int n)
+{
+    if (ht->old_entries == NULL) {
+        return;
+    }
+
+    for (; n > 0 && ht->old_next < ht->old_length; n--) {
+        struct _ht_entry *e = &ht->old_entries[ht->old_next++];
+        if (entry_live(e)) {
+            slots_insert(ht->entries, ht->table_length, e);
+            e->dist |= HT_TOMB;
+        }
+    }
+
+    if (ht->old_next == ht->old_length) {
+        free(ht->old_entries);
+        ht->old_entries = NULL;
+        ht->old_length = 0;
+        ht->old_next = 0;
+    }
+}
+
+static int ht_grow(struct hashtable *ht)
+{
+    struct _ht_entry *entries = calloc(ht->table_length * 2,
+                                       sizeof(struct _ht_entry));
+    if (entries == NULL) {
+        return 1;
+    }
+
+    // a previous resize still going on is finished first
+    ht_migrate(ht, INT32_MAX);
+
+    ht->old_entries = ht->entries;
+    ht->old_length = ht->table_length;
+    ht->old_next = 0;
+    ht->entries = entries;
+    ht->table_length *= 2;
+    ht->threshold = ((int64_t) ht->table_length * ht->load_factor) / 100;
+    return 0;
+}
 
 /**
  * \brief get the number of entries in a hashtable
@@ -75,10 +210,10 @@ static int ht_size(struct dictionary *dict)
 /**
  * \brief put a new key/value pair into the hashtable
  * \param ht the hashtable
- * \param key the key. Has to be a string.
- * \param value the value. Can be any pointer. This function does
- *      not copy the value or stores it. The caller is responsible for
- *      maintaining the value, the hashtable only keeps pointers.
+ * \param entry the entry to copy into the table, key set. A value stored
+ *      under the same key before is replaced. The value is not copied, the
+ *      caller is responsible for maintaining it, the hashtable only keeps
+ *      pointers.
  * \return 0 if the operation succeeded, otherwise an error code.
  */
 static int ht_put(struct dictionary *dict, struct _ht_entry *entry)
@@ -86,46 +221,56 @@ static int ht_put(struct dictionary *dict, struct _ht_entry *entry)
     assert(dict != NULL);
     struct hashtable *ht = (struct hashtable*) dict;
 
-    int _hash_value = hash(entry->key, entry->key_len);
+    ht_migrate(ht, HT_MIGRATE_STEP);
 
-    // TODO: XXX check for size and increase capacity, if necessary
-    ++(ht->entry_count);
+    entry->hash_value = hash(entry->key, entry->key_len);
+    if (entry->key_len <= HT_INLINE_KEY_LEN) {
+        memcpy(entry->key_inline, entry->key, entry->key_len);
+        entry->key = NULL;
+    }
+
+    struct _ht_entry *_e = ht_find(ht, entry->hash_value, entry_key(entry),
+                                   entry->key_len);
+    if (_e != NULL) {
+        _e->value = entry->value;
+        _e->capvalue = entry->capvalue;
+        _e->type = entry->type;
+        return 0;
+    }
 
-    entry->hash_value = _hash_value;
-    int _index = index_for(ht->table_length, _hash_value);
-    entry->next = ht->entries[_index];
-    ht->entries[_index] = entry;
+    if (ht->entry_count + 1 > ht->threshold && ht_grow(ht) != 0) {
+        return 1;
+    }
+
+    slots_insert(ht->entries, ht->table_length, entry);
+    ++(ht->entry_count);
     return 0;
 }
 
 static int ht_put_word(struct dictionary *dict, const char *key, size_t key_len,
                        uintptr_t value)
 {
-    struct _ht_entry *e = malloc(sizeof(struct _ht_entry));
-    if (NULL == e) {
-        return 1;
-    }
-    e->key = key;
-    e->key_len = key_len;
-    e->value = (void*) value;
-    e->type = TYPE_WORD;
+    struct _ht_entry e = {
+        .key = key,
+        .key_len = key_len,
+        .value = (void*) value,
+        .type = TYPE_WORD,
+    };
 
-    return ht_put(dict, e);
+    return ht_put(dict, &e);
 }
 
 static int ht_put_capability(struct dictionary *dict, char *key,
                              struct capref cap)
 {
-    struct _ht_entry *e = malloc(sizeof(struct _ht_entry));
-    if (NULL == e) {
-        return 1;
-    }
-    e->key = key;
-    e->key_len = strlen(key);
-    e->capvalue = cap;
-    e->type = TYPE_CAPABILITY;
+    struct _ht_entry e = {
+        .key = key,
+        .key_len = strlen(key),
+        .capvalue = cap,
+        .type = TYPE_CAPABILITY,
+    };
 
-    return ht_put(dict, e);
+    return ht_put(dict, &e);
 }
 
 /**
@@ -143,17 +288,11 @@ static ENTRY_TYPE ht_get(struct dictionary *dict, const char *key, size_t key_le
 
     struct hashtable *ht = (struct hashtable*) dict;
 
-    int _hash_value = hash(key, key_len);
-    int _index = index_for(ht->table_length, _hash_value);
-    struct _ht_entry *_e = ht->entries[_index];
-
-    while (NULL != _e) {
-        if ((_hash_value == _e->hash_value) && (equals(key, _e->key, key_len))) {
-            assert(_e->type != TYPE_CAPABILITY);
-            *value = _e->value;
-            return _e->type;
-        }
-        _e = _e->next;
+    struct _ht_entry *_e = ht_find(ht, hash(key, key_len), key, key_len);
+    if (_e != NULL) {
+        assert(_e->type != TYPE_CAPABILITY);
+        *value = _e->value;
+        return _e->type;
     }
     *value = NULL;
     return 0;
@@ -168,17 +307,12 @@ static ENTRY_TYPE ht_get_capability(struct dictionary *dict, char *key,
 
     struct hashtable *ht = (struct hashtable*) dict;
     size_t key_len = strlen(key);
-    int _hash_value = hash(key, key_len);
-    int _index = index_for(ht->table_length, _hash_value);
-    struct _ht_entry *_e = ht->entries[_index];
-
-    while (NULL != _e) {
-        if ((_hash_value == _e->hash_value) && (equals(key, _e->key, key_len))) {
-            assert(_e->type == TYPE_CAPABILITY);
-            *value = _e->capvalue;
-            return _e->type;
-        }
-        _e = _e->next;
+
+    struct _ht_entry *_e = ht_find(ht, hash(key, key_len), key, key_len);
+    if (_e != NULL) {
+        assert(_e->type == TYPE_CAPABILITY);
+        *value = _e->capvalue;
+        return _e->type;
     }
     *value = NULL_CAP;
     return 0;
@@ -189,24 +323,35 @@ static int ht_remove(struct dictionary *dict, const char *key, size_t key_len)
     assert(dict != NULL);
     struct hashtable *ht = (struct hashtable*) dict;
 
-    int _hash_value = hash(key, key_len);
-    int _index = index_for(ht->table_length, _hash_value);
-    struct _ht_entry *_e = ht->entries[_index];
-    struct _ht_entry *_prev = NULL;
-    while (NULL != _e) {
-        if ((_hash_value == _e->hash_value) && (equals(key, _e->key, key_len))) {
-            if (_prev == NULL) {
-                ht->entries[_index] = _e->next;
-            } else {
-                _prev->next = _e->next;
+    ht_migrate(ht, HT_MIGRATE_STEP);
+
+    uint64_t _hash_value = hash(key, key_len);
+    struct _ht_entry *_e = slots_find(ht->entries, ht->table_length,
+                                      _hash_value, key, key_len);
+    if (_e != NULL) {
+        // shift the rest of the probe run back by one
+        uint32_t mask = ht->table_length - 1;
+        uint32_t i = _e - ht->entries;
+        for (;;) {
+            struct _ht_entry *_next = &ht->entries[(i + 1) & mask];
+            if (_next->dist <= 1) {
+                break;
             }
-            free(_e);
-            return 0;
+            ht->entries[i] = *_next;
+            ht->entries[i].dist--;
+            i = (i + 1) & mask;
         }
-        _prev = _e;
-        _e = _e->next;
+        ht->entries[i].dist = 0;
+    } else if (ht->old_entries != NULL
+               && (_e = slots_find(ht->old_entries, ht->old_length,
+                                   _hash_value, key, key_len)) != NULL) {
+        _e->dist |= HT_TOMB;
+    } else {
+        return 1;
     }
-    return 1;
+
+    --(ht->entry_count);
+    return 0;
 }
 
 // XXX implement destructors
@@ -219,13 +364,24 @@ static int ht_remove(struct dictionary *dict, const char *key, size_t key_len)
  */
 static void ht_init(struct hashtable *_ht, int capacity, int load_factor)
 {
+    // Robin Hood probing copes with a high load, but there has to be room
+    if (load_factor <= 0 || load_factor > 90) {
+        load_factor = 90;
+    }
+
     _ht->capacity = capacity;
     _ht->load_factor = load_factor;
-    _ht->table_length = capacity;
-    _ht->entries = malloc(_ht->table_length * sizeof(struct _ht_entry));
+    _ht->entry_count = 0;
+    _ht->table_length = HT_MIN_LENGTH;
+    while (_ht->table_length < capacity) {
+        _ht->table_length *= 2;
+    }
+    _ht->entries = calloc(_ht->table_length, sizeof(struct _ht_entry));
     assert(_ht->entries != NULL);
-    memset(_ht->entries, 0, _ht->table_length * sizeof(struct _ht_entry));
-    _ht->threshold = (capacity * load_factor) / 100;
+    _ht->threshold = (_ht->table_length * load_factor) / 100;
+    _ht->old_entries = NULL;
+    _ht->old_length = 0;
+    _ht->old_next = 0;
     _ht->d.size = ht_size;
     _ht->d.put_word = ht_put_word;
     _ht->d.put_capability = ht_put_capability;
@@ -1,6 +1,12 @@
+#include <string.h>
+
 #include <netutil/checksum.h>
 #include <netutil/htons.h>
 
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 
 static uint16_t
 lwip_standard_chksum(void *dataptr, uint16_t len)
@@ -39,10 +45,139 @@ lwip_standard_chksum(void *dataptr, uint16_t len)
   return htons((uint16_t)acc);
 };
 
+/*
+ * The routines below sum the data as native words in memory order. Ones'
+ * complement addition is byte order independent (RFC 1071, 2.B), so the
+ * folded result is the checksum in network order, ready to be stored, on
+ * either endianness. A carry out of a 64-bit accumulator is added back in at
+ * the bottom, as 2^64 = 1 modulo 0xffff.
+ */
+
+static inline uint64_t csum_add(uint64_t acc, uint64_t w)
+{
+  acc += w;
+  return acc + (acc < w);
+}
+
+static uint64_t csum_scalar(const uint8_t *p, size_t len, uint64_t acc)
+{
+  while (len >= 8) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    acc = csum_add(acc, w);
+    p += 8;
+    len -= 8;
+  }
+  if (len >= 4) {
+    uint32_t w;
+    memcpy(&w, p, 4);
+    acc = csum_add(acc, w);
+    p += 4;
+    len -= 4;
+  }
+  if (len >= 2) {
+    uint16_t w;
+    memcpy(&w, p, 2);
+    acc = csum_add(acc, w);
+    p += 2;
+    len -= 2;
+  }
+  if (len > 0) {
+    /* the last octet is padded with a zero octet in memory order */
+    uint16_t w = 0;
+    memcpy(&w, p, 1);
+    acc = csum_add(acc, w);
+  }
+  return acc;
+}
+
+#if defined(__ARM_NEON)
+/* a 32-bit lane takes 2 * 0xffff per 64 bytes, flush it before it can wrap */
+#define CSUM_NEON_CHUNK (64 * 1024)
+
+static uint64_t csum_neon(const uint8_t *p, size_t len, uint64_t acc)
+{
+  while (len >= 64) {
+    size_t chunk = len < CSUM_NEON_CHUNK ? len & ~(size_t)63 : CSUM_NEON_CHUNK;
+    uint32x4_t a0 = vdupq_n_u32(0);
+    uint32x4_t a1 = vdupq_n_u32(0);
+    uint32x4_t a2 = vdupq_n_u32(0);
+    uint32x4_t a3 = vdupq_n_u32(0);
+
+    len -= chunk;
+    for (; chunk > 0; chunk -= 64) {
+      /* pairwise add the 16-bit words into 32-bit lanes */
+      a0 = vpadalq_u16(a0, vreinterpretq_u16_u8(vld1q_u8(p)));
+      a1 = vpadalq_u16(a1, vreinterpretq_u16_u8(vld1q_u8(p + 16)));
+      a2 = vpadalq_u16(a2, vreinterpretq_u16_u8(vld1q_u8(p + 32)));
+      a3 = vpadalq_u16(a3, vreinterpretq_u16_u8(vld1q_u8(p + 48)));
+      p += 64;
+    }
+
+    uint64x2_t s = vpaddlq_u32(a0);
+    s = vpadalq_u32(s, a1);
+    s = vpadalq_u32(s, a2);
+    s = vpadalq_u32(s, a3);
+    acc = csum_add(acc, vgetq_lane_u64(s, 0));
+    acc = csum_add(acc, vgetq_lane_u64(s, 1));
+  }
+  return csum_scalar(p, len, acc);
+}
+#endif
+
+/**
+ * \brief ones' complement sum over len bytes, added to sum
+ *
+ * Sums can be chained over several buffers, all but the last one have to be
+ * of even length. Finish with inet_checksum_fold().
+ */
+uint32_t inet_checksum_partial(const void *dataptr, size_t len, uint32_t sum)
+{
+#if defined(__ARM_NEON)
+  uint64_t acc = csum_neon(dataptr, len, sum);
+#else
+  uint64_t acc = csum_scalar(dataptr, len, sum);
+#endif
+  acc = (acc & 0xffffffffULL) + (acc >> 32);
+  acc = (acc & 0xffffffffULL) + (acc >> 32);
+  return acc;
+}
+
+/**
+ * \brief fold a sum from inet_checksum_partial() into the checksum field value
+ */
+uint16_t inet_checksum_fold(uint32_t sum)
+{
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum;
+}
+
+/**
+ * \brief sum of the IPv4 pseudo header for UDP/TCP checksums
+ * \param src, dest addresses as they are in the IP header (network order)
+ * \param len length of the UDP/TCP segment in host order
+ */
+uint32_t inet_pseudo_sum(uint32_t src, uint32_t dest, uint8_t proto,
+                         uint16_t len)
+{
+  uint64_t acc = (uint64_t) src + dest + htons(proto) + htons(len);
+  acc = (acc & 0xffffffffULL) + (acc >> 32);
+  return acc;
+}
+
 /**
  * Calculate a short such that ret + dataptr[..] becomes 0
  */
 uint16_t inet_checksum(void *dataptr, uint16_t len)
+{
+  return inet_checksum_fold(inet_checksum_partial(dataptr, len, 0));
+};
+
+/**
+ * Same as inet_checksum(), one octet at a time. Reference for testing.
+ */
+uint16_t inet_checksum_ref(void *dataptr, uint16_t len)
 {
   return ~lwip_standard_chksum(dataptr, len);
 };
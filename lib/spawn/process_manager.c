@@ -1,11 +1,18 @@
 #include "spawn/process_manager.h"
+#include <collections/hash_table.h>
 
 
 
+/*
+ * spawninfos are indexed by pid and by the address of their rpc channel.
+ * spawninfos are never freed, so entries are only added or replaced.
+ */
 struct process_manager
 {
     struct slab_allocator si_allocator;
     struct spawninfo *first;
+    collections_hash_table *by_pid;
+    collections_hash_table *by_rpc;
 } instance;
 
 
@@ -35,6 +42,8 @@ static struct process_manager *get_process_manager(void)
         slab_init(&instance.si_allocator, sizeof(struct spawninfo), &slab_big_refill);
         slab_big_refill(&instance.si_allocator);
         instance.first = NULL;
+        collections_hash_create(&instance.by_pid, NULL);
+        collections_hash_create(&instance.by_rpc, NULL);
         initialized = true;
     }
     return &instance;
@@ -49,6 +58,9 @@ struct spawninfo *spawn_create_spawninfo(void)
     if (si == NULL) {
         return NULL;
     }
+    si->child_clone_state_cap = NULL_CAP;
+
+    collections_hash_insert(pm->by_rpc, (uintptr_t) &si->rpc, si);
 
     // insert new si at head of list
     si->next = pm->first;
@@ -58,30 +70,33 @@ struct spawninfo *spawn_create_spawninfo(void)
 }
 
 
-struct aos_rpc *get_rpc_from_spawn_info(domainid_t pid){
+/**
+ * \brief make si findable by its pid, once the pid is assigned.
+ * A later domain with the same pid replaces si.
+ */
+errval_t spawn_index_pid(struct spawninfo *si)
+{
     struct process_manager *pm = get_process_manager();
-    for(struct spawninfo * curr = pm -> first; curr != NULL;curr = curr -> next ){
-        if(curr  -> pid == pid){
-
-            return &curr -> rpc;
-        }
+    if (collections_hash_find(pm->by_pid, si->pid) != NULL) {
+        collections_hash_delete(pm->by_pid, si->pid);
     }
+    collections_hash_insert(pm->by_pid, si->pid, si);
+    return SYS_ERR_OK;
+}
+
 
-    assert(false && "Did not find rpc from spawninfos for pid");
-    return NULL;
+struct aos_rpc *get_rpc_from_spawn_info(domainid_t pid){
+    struct spawninfo *si = collections_hash_find(get_process_manager()->by_pid, pid);
+    assert(si != NULL && "Did not find rpc from spawninfos for pid");
+    return si == NULL ? NULL : &si->rpc;
 }
 
 
 struct spawninfo *get_si_from_rpc(struct aos_rpc * rpc){
-    struct process_manager *pm = get_process_manager();
-    for(struct spawninfo * curr = pm -> first; curr != NULL;curr = curr -> next ){
-        if(&curr  -> rpc == rpc){
-
-            return curr;
-        }
-    }
-    assert(false && "Did not find si from rpc");
-    return NULL;
+    struct spawninfo *si = collections_hash_find(get_process_manager()->by_rpc,
+                                                 (uintptr_t) rpc);
+    assert(si != NULL && "Did not find si from rpc");
+    return si;
 }
 
 // domainid_t spawn_get_new_domainid(void)
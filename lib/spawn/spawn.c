@@ -16,6 +16,7 @@
 #include <spawn/process_manager.h>
 #include <string.h>
 #include <aos/default_interfaces.h>
+#include <trace/trace.h>
 
 extern struct bootinfo *bi;
 extern coreid_t my_core_id;
@@ -113,26 +114,19 @@ errval_t spawn_setup_dispatcher(int argc, const char *const *argv, struct spawni
     // const char* name = argv[0];
     // DEBUG_PRINTF("Spawning process: %s\n", name);
     // debug_printf("Spawning process: %s\n",argv[0]);
-    struct capref cnode_child_l1;
-    struct cnoderef child_ref;
-    err = cnode_create_l1(&cnode_child_l1, &child_ref);
-    ON_ERR_PUSH_RETURN(err, SPAWN_ERR_CREATE_ROOTCN);
+    // take the pre-built cspace of the template if there is one
+    struct spawn_cspace cs;
+    if (si->template == NULL || !spawn_template_take_cspace(si->template, &cs)) {
+        err = spawn_cspace_create(&cs);
+        ON_ERR_RETURN(err);
+    }
 
+    struct capref cnode_child_l1 = cs.rootcn;
     si->rootcn = cnode_child_l1;
 
     //DEBUG_PRINTF("cnode_child_l1 slot is: %d\n", cnode_child_l1.slot);
 
-    struct cnoderef taskcn;
-    struct cnoderef basepagecn;
-    struct cnoderef pagecn;
-    struct cnoderef argcn;
-
-    struct cnoderef alloc0;
-    struct cnoderef alloc1;
-    struct cnoderef alloc2;
-
-    err = setup_c_space(cnode_child_l1, &taskcn, &basepagecn, &pagecn, &argcn, &alloc0, &alloc1, &alloc2);
-    ON_ERR_RETURN(err);
+    struct cnoderef taskcn = cs.taskcn;
 
     // endpoint to itself in child cspace
     struct capref child_ep_cap = (struct capref) {
@@ -175,6 +169,10 @@ errval_t spawn_setup_dispatcher(int argc, const char *const *argv, struct spawni
         .cnode = taskcn,
         .slot = TASKCN_SLOT_SPAWNER_EP
     };
+    struct capref child_clone_state_cap = (struct capref) {
+        .cnode = taskcn,
+        .slot = TASKCN_SLOT_CLONE_STATE
+    };
 
     err = dispatcher_create(child_dispatcher);
     ON_ERR_PUSH_RETURN(err, SPAWN_ERR_CREATE_DISPATCHER);
@@ -216,25 +214,21 @@ errval_t spawn_setup_dispatcher(int argc, const char *const *argv, struct spawni
         ON_ERR_PUSH_RETURN(err, LIB_ERR_CAP_COPY_FAIL);
     }
 
-    // ===========================================
-    // create l0 vnode and initialize paging state
-    // ===========================================
-    struct capref child_l0_vnodecap = (struct capref) {
-        .cnode = pagecn,
-        .slot = 0
-    };
-    struct capref l0_vnode;
+    if (!capref_is_null(si->child_clone_state_cap)) {
+        err = cap_copy(child_clone_state_cap, si->child_clone_state_cap);
+        ON_ERR_PUSH_RETURN(err, LIB_ERR_CAP_COPY_FAIL);
+    }
 
-    err = slot_alloc(&l0_vnode);
+#ifdef CONFIG_TRACE
+    // the child records into the trace buffer of this core
+    err = trace_setup_child(taskcn);
     ON_ERR_RETURN(err);
+#endif
 
-    err = vnode_create(child_l0_vnodecap, ObjType_VNode_AARCH64_l0);
-    ON_ERR_PUSH_RETURN(err, SPAWN_ERR_CREATE_VNODE);
-
-    err = cap_copy(l0_vnode, child_l0_vnodecap);
-    ON_ERR_PUSH_RETURN(err, SPAWN_ERR_COPY_VNODE);
-
-    err = paging_init_state_foreign(&si->ps, VADDR_OFFSET, l0_vnode, get_default_slot_allocator());
+    // ===========================================
+    // initialize paging state (l0 vnode is part of the cspace)
+    // ===========================================
+    err = paging_init_state_foreign(&si->ps, VADDR_OFFSET, cs.l0_vnode, get_default_slot_allocator());
     ON_ERR_PUSH_RETURN(err, LIB_ERR_PMAP_INIT);
 
     struct capref argframe;
@@ -271,14 +265,25 @@ errval_t spawn_setup_dispatcher(int argc, const char *const *argv, struct spawni
     }
 
     genvaddr_t retentry;
-    err = elf_load(EM_AARCH64, &allocate_elf_memory, &si->ps, si->mapped_elf, si->mapped_elf_size, &retentry);
-    ON_ERR_PUSH_RETURN(err, SPAWN_ERR_LOAD);
+    lvaddr_t got_base_address_in_childs_vspace;
+    if (si->template != NULL) {
+        // segments are already loaded and relocated, just clone them
+        err = spawn_template_clone(si->template, &si->ps);
+        ON_ERR_PUSH_RETURN(err, SPAWN_ERR_LOAD);
+
+        retentry = si->template->entry;
+        got_base_address_in_childs_vspace = si->template->got_base;
+    }
+    else {
+        err = elf_load(EM_AARCH64, &allocate_elf_memory, &si->ps, si->mapped_elf, si->mapped_elf_size, &retentry);
+        ON_ERR_PUSH_RETURN(err, SPAWN_ERR_LOAD);
 
-    struct Elf64_Shdr *got = elf64_find_section_header_name(si->mapped_elf, si->mapped_elf_size, ".got");
-    NULLPTR_CHECK(got, SPAWN_ERR_LOAD);
+        struct Elf64_Shdr *got = elf64_find_section_header_name(si->mapped_elf, si->mapped_elf_size, ".got");
+        NULLPTR_CHECK(got, SPAWN_ERR_LOAD);
 
-    //debug_printf("0x%lx -> 0x%lx\n", si->mapped_elf, si->mapped_elf_size);
-    lvaddr_t got_base_address_in_childs_vspace = got->sh_addr;
+        //debug_printf("0x%lx -> 0x%lx\n", si->mapped_elf, si->mapped_elf_size);
+        got_base_address_in_childs_vspace = got->sh_addr;
+    }
     //debug_printf("possible 0x%lx\n", got_base_address_in_childs_vspace);
     //lvaddr_t got_base_offset = got->sh_addr - si->mapped_elf;
 
@@ -350,6 +355,8 @@ errval_t spawn_setup_dispatcher(int argc, const char *const *argv, struct spawni
         si -> pid = 0;
         *pid = 0;
     }
+    err = spawn_index_pid(si);
+    ON_ERR_RETURN(err);
 
 
     if(get_pm_online()){
@@ -380,7 +387,7 @@ errval_t spawn_invoke_dispatcher(struct spawninfo *si)
         .slot = 0
     };
 
-    return invoke_dispatcher(
+    errval_t err = invoke_dispatcher(
         si->dispatcher,
         si->dispatcher_cap,
         si->rootcn,
@@ -388,6 +395,17 @@ errval_t spawn_invoke_dispatcher(struct spawninfo *si)
         si->dispframe_cap,
         true
     );
+    ON_ERR_RETURN(err);
+
+    // the child is running, prepare the cspace for the next one once the
+    // caller is done with this spawn
+    if (si->template != NULL) {
+        err = spawn_template_refill_later(si->template);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "refilling spawn template failed");
+        }
+    }
+    return SYS_ERR_OK;
 }
 
 
@@ -510,33 +528,16 @@ static void strip_extra_spaces(char* str) {
 errval_t spawn_setup_module_by_name(const char *binary_name, struct spawninfo *si)
 {
     errval_t err;
-    struct mem_region* mem_region = multiboot_find_module(bi, binary_name);
-    
-    if (mem_region == NULL) {
-        return SPAWN_ERR_MAP_MODULE;
-    }
-
+    struct spawn_template *tmpl;
 
-    //this mem_region should be of type module
-    assert(mem_region->mr_type == RegionType_Module);
-    struct capability cap;
-    struct capref child_frame = {
-        .cnode = cnode_module,
-        .slot = mem_region->mrmod_slot
-    };
-    err = invoke_cap_identify(child_frame, &cap);
+    si->template = NULL;
+    err = spawn_template_get(binary_name, &tmpl);
     ON_ERR_RETURN(err);
 
-    size_t mapping_size = get_size(&cap);
-    // debug_printf("capsize: %ld\n", mapping_size);
-    char* elf_address;
-    
-    paging_map_frame_attr(get_current_paging_state(), (void **) &elf_address,
-                          mapping_size, child_frame, VREGION_FLAGS_READ_WRITE, NULL, NULL);
+    si->template = tmpl;
+    si->mapped_elf = tmpl->mapped_elf;
+    si->mapped_elf_size = tmpl->mapped_elf_size;
 
-    si->mapped_elf = (lvaddr_t) elf_address;
-    si->mapped_elf_size = (size_t) mem_region->mrmod_size;
-    
     return SYS_ERR_OK;
 }
 
@@ -574,8 +575,7 @@ errval_t spawn_setup_by_name(char *binary_name, struct spawninfo *si, domainid_t
 
     }
     else {
-        struct mem_region* mem_region = multiboot_find_module(bi, res[0]);
-        char * args_string = (char *)  multiboot_module_opts(mem_region);
+        char * args_string = (char *) si->template->opts;
         char copy[strlen(args_string)];
         strcpy(copy,args_string);
         strip_extra_spaces(copy);
@@ -627,6 +627,24 @@ errval_t spawn_load_by_name(char *binary_name, struct spawninfo *si,
 }
 
 
-
-
-
+/**
+ * \brief Spawn a worker that starts from already initialized state
+ *
+ * The child runs cmdline like spawn_load_by_name() does, so its code and
+ * read-only data are shared with all other instances of the binary through
+ * the spawn template. It finds a copy of the state frame in its cspace and
+ * maps it with paging_map_clone_state(). Every clone and the caller, if it
+ * protected its own mapping with paging_protect_cow(), share the pages of the
+ * frame until they write to them.
+ *
+ * \param cmdline The command line of the child, the binary name first.
+ * \param state The frame holding the state, stays with the caller.
+ * \param si A pointer to the spawninfo struct representing the child.
+ * \param pid Returns the pid of the child.
+ */
+errval_t spawn_clone(char *cmdline, struct capref state, struct spawninfo *si,
+                     domainid_t *pid)
+{
+    si->child_clone_state_cap = state;
+    return spawn_load_by_name(cmdline, si, pid);
+}
@@ -0,0 +1,390 @@
+/**
+ * \file
+ * \brief Cache of pre-parsed and pre-loaded process images
+ *
+ * The first spawn of a binary looks up the multiboot module, maps it, runs
+ * the ELF loader into frames owned by the template and remembers the
+ * resulting segments. Later spawns of the same binary only clone these
+ * segments into the child's vspace: read-only segments share the template's
+ * frame, writable segments get a private copy.
+ */
+
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <string.h>
+
+#include <aos/aos.h>
+#include <elf/elf.h>
+#include <barrelfish_kpi/paging_arm_v8.h>
+#include <spawn/spawn.h>
+#include <spawn/multiboot.h>
+#include <spawn/spawn_template.h>
+
+extern struct bootinfo *bi;
+
+static struct spawn_template *templates = NULL;
+static struct thread_mutex templates_mutex = THREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * \brief Create a fresh CSpace for a child including its L0 VNode
+ */
+errval_t spawn_cspace_create(struct spawn_cspace *cs)
+{
+    errval_t err;
+    struct cnoderef rootcn_ref;
+    err = cnode_create_l1(&cs->rootcn, &rootcn_ref);
+    ON_ERR_PUSH_RETURN(err, SPAWN_ERR_CREATE_ROOTCN);
+
+    err = setup_c_space(cs->rootcn, &cs->taskcn, &cs->basepagecn, &cs->pagecn,
+                        &cs->argcn, &cs->alloc0, &cs->alloc1, &cs->alloc2);
+    ON_ERR_RETURN(err);
+
+    struct capref child_l0_vnodecap = (struct capref) {
+        .cnode = cs->pagecn,
+        .slot = 0
+    };
+
+    err = slot_alloc(&cs->l0_vnode);
+    ON_ERR_RETURN(err);
+
+    err = vnode_create(child_l0_vnodecap, ObjType_VNode_AARCH64_l0);
+    ON_ERR_PUSH_RETURN(err, SPAWN_ERR_CREATE_VNODE);
+
+    err = cap_copy(cs->l0_vnode, child_l0_vnodecap);
+    ON_ERR_PUSH_RETURN(err, SPAWN_ERR_COPY_VNODE);
+
+    return SYS_ERR_OK;
+}
+
+
+/**
+ * \brief elf_load callback that loads segments into frames owned by the template
+ */
+static errval_t template_allocate_elf_memory(void *state, genvaddr_t base, size_t size,
+                                             uint32_t flags, void **ret)
+{
+    struct spawn_template *tmpl = (struct spawn_template *) state;
+
+    if (tmpl->n_segments >= SPAWN_TEMPLATE_MAX_SEGMENTS) {
+        return SPAWN_ERR_ELF_MAP;
+    }
+
+    genvaddr_t real_base = ROUND_DOWN(base, BASE_PAGE_SIZE);
+    genvaddr_t real_size = ROUND_UP(size + (base - real_base), BASE_PAGE_SIZE);
+
+    int actual_flags = 0;
+    if (flags & PF_R)
+        actual_flags |= KPI_PAGING_FLAGS_READ;
+    if (flags & PF_W)
+        actual_flags |= KPI_PAGING_FLAGS_WRITE;
+    if (flags & PF_X)
+        actual_flags |= KPI_PAGING_FLAGS_EXECUTE;
+
+    errval_t err;
+    struct spawn_template_segment *seg = &tmpl->segments[tmpl->n_segments];
+
+    size_t actual_size;
+    err = frame_alloc(&seg->frame, real_size, &actual_size);
+    ON_ERR_PUSH_RETURN(err, SPAWN_ERR_MAP_MODULE);
+
+    err = paging_map_frame(get_current_paging_state(), &seg->mapped, actual_size, seg->frame, NULL, NULL);
+    ON_ERR_PUSH_RETURN(err, SPAWN_ERR_MAP_MODULE);
+
+    seg->base = real_base;
+    seg->size = actual_size;
+    seg->flags = actual_flags;
+    tmpl->n_segments++;
+
+    *ret = seg->mapped + (base - real_base);
+    return SYS_ERR_OK;
+}
+
+
+/**
+ * \brief Map the module and load it into a new template
+ */
+static errval_t template_create(const char *name, struct spawn_template **ret)
+{
+    errval_t err;
+    struct mem_region *mem_region = multiboot_find_module(bi, name);
+    if (mem_region == NULL) {
+        return SPAWN_ERR_FIND_MODULE;
+    }
+    assert(mem_region->mr_type == RegionType_Module);
+
+    struct spawn_template *tmpl = calloc(1, sizeof(struct spawn_template));
+    NULLPTR_CHECK(tmpl, LIB_ERR_MALLOC_FAIL);
+
+    tmpl->name = strdup(name);
+    tmpl->opts = multiboot_module_opts(mem_region);
+
+    struct capref module_frame = {
+        .cnode = cnode_module,
+        .slot = mem_region->mrmod_slot
+    };
+    struct capability cap;
+    err = invoke_cap_identify(module_frame, &cap);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    void *elf_address;
+    err = paging_map_frame_attr(get_current_paging_state(), &elf_address, get_size(&cap),
+                                module_frame, VREGION_FLAGS_READ, NULL, NULL);
+    if (err_is_fail(err)) {
+        err = err_push(err, SPAWN_ERR_MAP_MODULE);
+        goto fail;
+    }
+    tmpl->mapped_elf = (lvaddr_t) elf_address;
+    tmpl->mapped_elf_size = (size_t) mem_region->mrmod_size;
+
+    err = elf_load(EM_AARCH64, &template_allocate_elf_memory, tmpl,
+                   tmpl->mapped_elf, tmpl->mapped_elf_size, &tmpl->entry);
+    if (err_is_fail(err)) {
+        err = err_push(err, SPAWN_ERR_LOAD);
+        goto fail;
+    }
+
+    struct Elf64_Shdr *got = elf64_find_section_header_name(tmpl->mapped_elf, tmpl->mapped_elf_size, ".got");
+    if (got == NULL) {
+        err = SPAWN_ERR_LOAD;
+        goto fail;
+    }
+    tmpl->got_base = got->sh_addr;
+
+    // the first spawn builds its own cspace, later ones take the spare one
+    tmpl->has_spare_cspace = false;
+    waitset_chanstate_init(&tmpl->refill_chan, CHANTYPE_OTHER);
+
+    *ret = tmpl;
+    return SYS_ERR_OK;
+
+fail:
+    free(tmpl->name);
+    free(tmpl);
+    return err;
+}
+
+
+/**
+ * \brief Find the template of a binary, creating it on the first request
+ *
+ * \param name Name of the module, without arguments.
+ * \param ret Returns the template, which stays valid forever.
+ */
+errval_t spawn_template_get(const char *name, struct spawn_template **ret)
+{
+    errval_t err = SYS_ERR_OK;
+    thread_mutex_lock(&templates_mutex);
+
+    struct spawn_template *tmpl;
+    for (tmpl = templates; tmpl != NULL; tmpl = tmpl->next) {
+        if (strcmp(tmpl->name, name) == 0) {
+            break;
+        }
+    }
+
+    if (tmpl == NULL) {
+        err = template_create(name, &tmpl);
+        if (err_is_ok(err)) {
+            tmpl->next = templates;
+            templates = tmpl;
+        }
+    }
+
+    thread_mutex_unlock(&templates_mutex);
+    if (err_is_ok(err)) {
+        *ret = tmpl;
+    }
+    return err;
+}
+
+
+/**
+ * \brief Copy a writable segment into a new frame
+ */
+static errval_t template_copy_segment(struct spawn_template_segment *seg, struct capref *ret)
+{
+    errval_t err;
+    void *copy;
+    size_t copy_size;
+    err = frame_alloc_and_map(ret, seg->size, &copy_size, &copy);
+    ON_ERR_RETURN(err);
+    memcpy(copy, seg->mapped, seg->size);
+
+    // only the child maps the copy
+    err = paging_unmap_frame(get_current_paging_state(), copy, copy_size);
+    if (err_is_fail(err)) {
+        cap_destroy(*ret);
+        return err;
+    }
+    return SYS_ERR_OK;
+}
+
+
+/**
+ * \brief Map the segments of a template into the vspace of a new child
+ *
+ * Read-only segments are shared with the template, writable ones are copied.
+ * On failure, the frames handed to the child so far are deleted again. The
+ * mappings in the child's vspace go away with its cspace.
+ */
+errval_t spawn_template_clone(struct spawn_template *tmpl, struct paging_state *child_ps)
+{
+    errval_t err;
+    struct capref frames[SPAWN_TEMPLATE_MAX_SEGMENTS];
+    size_t n_frames = 0;
+
+    // slots for the copies of the shared frames, all in one go
+    cslot_t n_shared = 0;
+    for (size_t i = 0; i < tmpl->n_segments; i++) {
+        if (!(tmpl->segments[i].flags & KPI_PAGING_FLAGS_WRITE)) {
+            n_shared++;
+        }
+    }
+    struct capref shared_slots = NULL_CAP;
+    if (n_shared > 0) {
+        err = slot_alloc_n(n_shared, &shared_slots);
+        ON_ERR_PUSH_RETURN(err, LIB_ERR_SLOT_ALLOC);
+    }
+
+    struct capref next_shared = shared_slots;
+    for (size_t i = 0; i < tmpl->n_segments; i++) {
+        struct spawn_template_segment *seg = &tmpl->segments[i];
+        struct capref frame;
+
+        if (seg->flags & KPI_PAGING_FLAGS_WRITE) {
+            err = template_copy_segment(seg, &frame);
+            if (err_is_fail(err)) {
+                err = err_push(err, SPAWN_ERR_ELF_MAP);
+                goto fail;
+            }
+        }
+        else {
+            frame = next_shared;
+            next_shared.slot++;
+            err = cap_copy(frame, seg->frame);
+            if (err_is_fail(err)) {
+                err = err_push(err, LIB_ERR_CAP_COPY_FAIL);
+                goto fail;
+            }
+        }
+        frames[n_frames++] = frame;
+
+        err = paging_map_fixed_attr(child_ps, seg->base, frame, seg->size, seg->flags);
+        if (err_is_fail(err)) {
+            err = err_push(err, SPAWN_ERR_ELF_MAP);
+            goto fail;
+        }
+    }
+
+    thread_mutex_lock(&templates_mutex);
+    tmpl->n_spawns++;
+    thread_mutex_unlock(&templates_mutex);
+    return SYS_ERR_OK;
+
+fail:
+    // the copies of shared frames live in one block of slots, freed below
+    for (size_t i = 0; i < n_frames; i++) {
+        if (tmpl->segments[i].flags & KPI_PAGING_FLAGS_WRITE) {
+            cap_destroy(frames[i]);
+        } else {
+            cap_delete(frames[i]);
+        }
+    }
+    for (cslot_t i = 0; i < n_shared; i++) {
+        struct capref slot = shared_slots;
+        slot.slot += i;
+        slot_free(slot);
+    }
+    return err;
+}
+
+
+/**
+ * \brief Hand out the pre-built cspace of a template, if there is one
+ *
+ * \return true if 'ret' was filled in.
+ */
+bool spawn_template_take_cspace(struct spawn_template *tmpl, struct spawn_cspace *ret)
+{
+    bool taken = false;
+    thread_mutex_lock(&templates_mutex);
+    if (tmpl->has_spare_cspace) {
+        *ret = tmpl->spare_cspace;
+        tmpl->has_spare_cspace = false;
+        taken = true;
+    }
+    thread_mutex_unlock(&templates_mutex);
+    return taken;
+}
+
+
+/**
+ * \brief Build a spare cspace for the next spawn of this template right away
+ */
+errval_t spawn_template_refill(struct spawn_template *tmpl)
+{
+    thread_mutex_lock(&templates_mutex);
+    bool needed = !tmpl->has_spare_cspace;
+    thread_mutex_unlock(&templates_mutex);
+    if (!needed) {
+        return SYS_ERR_OK;
+    }
+
+    struct spawn_cspace cs;
+    errval_t err = spawn_cspace_create(&cs);
+    ON_ERR_RETURN(err);
+
+    thread_mutex_lock(&templates_mutex);
+    if (!tmpl->has_spare_cspace) {
+        tmpl->spare_cspace = cs;
+        tmpl->has_spare_cspace = true;
+    }
+    thread_mutex_unlock(&templates_mutex);
+    return SYS_ERR_OK;
+}
+
+
+static void template_refill_handler(void *arg)
+{
+    errval_t err = spawn_template_refill((struct spawn_template *) arg);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "refilling spawn template failed");
+    }
+}
+
+
+/**
+ * \brief Build a spare cspace for the next spawn once the current event is done
+ *
+ * The refill is queued as an event on the default waitset, so it runs after
+ * the handler that spawned the child has returned and replied, and before
+ * any later event. If nobody dispatches the default waitset, the next spawn
+ * simply builds its own cspace.
+ */
+errval_t spawn_template_refill_later(struct spawn_template *tmpl)
+{
+    thread_mutex_lock(&templates_mutex);
+    bool needed = !tmpl->has_spare_cspace;
+    thread_mutex_unlock(&templates_mutex);
+    if (!needed) {
+        return SYS_ERR_OK;
+    }
+
+    errval_t err = waitset_chan_trigger_closure(get_default_waitset(), &tmpl->refill_chan,
+                                                MKCLOSURE(template_refill_handler, tmpl));
+    if (err_no(err) == LIB_ERR_CHAN_ALREADY_REGISTERED) {
+        // a refill is already queued
+        return SYS_ERR_OK;
+    }
+    return err;
+}
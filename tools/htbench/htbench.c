@@ -0,0 +1,552 @@
+/**
+ * \file
+ * \brief Host-side benchmark of the collections and hashtable hash tables
+ *
+ * Builds lib/collections/hash_table.c and lib/hashtable/hashtable.c natively.
+ * First runs random inserts, lookups and deletes on both against a plain
+ * array model, so the incremental resizing is crossed many times. Then
+ * measures insert, hit, miss and delete against the chained tables they
+ * replaced: per-element list nodes in 1013 buckets, and a djb2 hashed
+ * hashtable of create_hashtable() that never grows.
+ *
+ * Usage: htbench [max elements]
+ */
+
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../../lib/collections/list.c"
+#include "../../lib/collections/hash_table.c"
+#include "../../lib/hashtable/hashtable.c"
+
+#define CHECK_KEYS 4096
+#define CHECK_OPS (1 << 21)
+#define KEY_LEN 64
+
+/*
+ * The previous collections hash table: a list node and an element per key.
+ */
+
+#define REF_NUM_BUCKETS 1013
+
+struct ref_hash_elem {
+    uint64_t key;
+    void *data;
+};
+
+struct ref_hash {
+    int num_buckets;
+    collections_listnode **buckets;
+    uint32_t num_elems;
+};
+
+static int32_t ref_match_key(void *data, void *arg)
+{
+    return ((struct ref_hash_elem *) data)->key == *(uint64_t *) arg;
+}
+
+static struct ref_hash *ref_hash_create(void)
+{
+    struct ref_hash *t = calloc(1, sizeof(*t));
+    t->num_buckets = REF_NUM_BUCKETS;
+    t->buckets = malloc(sizeof(collections_listnode *) * t->num_buckets);
+    for (int i = 0; i < t->num_buckets; i++) {
+        collections_list_create(&t->buckets[i], NULL);
+    }
+    return t;
+}
+
+static void *ref_hash_find(struct ref_hash *t, uint64_t key)
+{
+    struct ref_hash_elem *e = collections_list_find_if(
+        t->buckets[key % t->num_buckets], ref_match_key, &key);
+    return e ? e->data : NULL;
+}
+
+static void ref_hash_insert(struct ref_hash *t, uint64_t key, void *data)
+{
+    collections_listnode *bucket = t->buckets[key % t->num_buckets];
+    assert(collections_list_find_if(bucket, ref_match_key, &key) == NULL);
+    struct ref_hash_elem *e = malloc(sizeof(*e));
+    e->key = key;
+    e->data = data;
+    collections_list_insert(bucket, e);
+    t->num_elems++;
+}
+
+static void ref_hash_delete(struct ref_hash *t, uint64_t key)
+{
+    free(collections_list_remove_if(t->buckets[key % t->num_buckets],
+                                    ref_match_key, &key));
+    t->num_elems--;
+}
+
+static void ref_hash_release(struct ref_hash *t)
+{
+    for (int i = 0; i < t->num_buckets; i++) {
+        collections_list_release(t->buckets[i]);
+    }
+    free(t->buckets);
+    free(t);
+}
+
+/*
+ * The previous hashtable: djb2, chained entries, 11 buckets.
+ */
+
+struct ref_ht_entry {
+    const char *key;
+    size_t key_len;
+    void *value;
+    int hash_value;
+    struct ref_ht_entry *next;
+};
+
+struct ref_ht {
+    int table_length;
+    struct ref_ht_entry **entries;
+};
+
+static int ref_ht_hash(const char *str, size_t key_len)
+{
+    // wraps like the int arithmetic it replaced
+    unsigned h = 5381;
+    for (size_t i = 0; i < key_len; i++) {
+        h = ((h << 5) + h) + str[i];
+    }
+    return h;
+}
+
+static struct ref_ht *ref_ht_create(void)
+{
+    struct ref_ht *ht = malloc(sizeof(*ht));
+    ht->table_length = 11;
+    ht->entries = calloc(ht->table_length, sizeof(struct ref_ht_entry *));
+    return ht;
+}
+
+static void ref_ht_put(struct ref_ht *ht, const char *key, size_t key_len,
+                       void *value)
+{
+    struct ref_ht_entry *e = malloc(sizeof(*e));
+    e->key = key;
+    e->key_len = key_len;
+    e->value = value;
+    e->hash_value = ref_ht_hash(key, key_len);
+    int i = (unsigned) e->hash_value % ht->table_length;
+    e->next = ht->entries[i];
+    ht->entries[i] = e;
+}
+
+static void *ref_ht_get(struct ref_ht *ht, const char *key, size_t key_len)
+{
+    int h = ref_ht_hash(key, key_len);
+    struct ref_ht_entry *e = ht->entries[(unsigned) h % ht->table_length];
+    for (; e != NULL; e = e->next) {
+        if (e->hash_value == h && !memcmp(key, e->key, key_len)) {
+            return e->value;
+        }
+    }
+    return NULL;
+}
+
+static void ref_ht_remove(struct ref_ht *ht, const char *key, size_t key_len)
+{
+    int h = ref_ht_hash(key, key_len);
+    struct ref_ht_entry **pe = &ht->entries[(unsigned) h % ht->table_length];
+    for (; *pe != NULL; pe = &(*pe)->next) {
+        if ((*pe)->hash_value == h && !memcmp(key, (*pe)->key, key_len)) {
+            struct ref_ht_entry *e = *pe;
+            *pe = e->next;
+            free(e);
+            return;
+        }
+    }
+}
+
+static void ref_ht_release(struct ref_ht *ht)
+{
+    assert(ht->table_length > 0);
+    free(ht->entries);
+    free(ht);
+}
+
+/*
+ * Checks
+ */
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t rng(void)
+{
+    // xorshift64
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static int count_visit(uint64_t key, void *data, void *arg)
+{
+    assert((uintptr_t) data == key + 1);
+    (*(uint32_t *) arg)++;
+    return 1;
+}
+
+static int check_collections(void)
+{
+    static void *model[CHECK_KEYS];
+    collections_hash_table *t;
+    uint32_t n = 0;
+
+    collections_hash_create(&t, NULL);
+    memset(model, 0, sizeof(model));
+
+    for (int op = 0; op < CHECK_OPS; op++) {
+        // the key range drifts so the table keeps growing and shrinking
+        uint32_t range = 16 + ((op >> 12) % 64) * (CHECK_KEYS / 64);
+        uint64_t k = rng() % range;
+        // spread keys like IPs and pointers would be
+        uint64_t key = k * 0x100000040ULL;
+        void *want = model[k];
+
+        void *got = collections_hash_find(t, key);
+        if (got != want) {
+            printf("collections: find %" PRIu64 " got %p want %p at op %d\n",
+                   key, got, want, op);
+            return 1;
+        }
+        if (want == NULL && (rng() & 3) != 0) {
+            model[k] = (void *) (uintptr_t) (key + 1);
+            collections_hash_insert(t, key, model[k]);
+            n++;
+        } else if (want != NULL && (rng() & 1) != 0) {
+            model[k] = NULL;
+            collections_hash_delete(t, key);
+            n--;
+        }
+        if (collections_hash_size(t) != n) {
+            printf("collections: size %" PRIu32 " want %" PRIu32 "\n",
+                   collections_hash_size(t), n);
+            return 1;
+        }
+
+        if ((op & 0xffff) == 0) {
+            uint32_t visited = 0, traversed = 0;
+            uint64_t tk;
+            collections_hash_visit(t, count_visit, &visited);
+            collections_hash_traverse_start(t);
+            while (collections_hash_traverse_next(t, &tk) != NULL) {
+                traversed++;
+            }
+            collections_hash_traverse_end(t);
+            if (visited != n || traversed != n) {
+                printf("collections: visited %" PRIu32 " traversed %" PRIu32
+                       " want %" PRIu32 "\n", visited, traversed, n);
+                return 1;
+            }
+        }
+    }
+
+    collections_hash_release(t);
+    return 0;
+}
+
+static char check_keys[CHECK_KEYS][KEY_LEN];
+
+static int check_hashtable(void)
+{
+    static uintptr_t model[CHECK_KEYS];
+    struct hashtable *ht = create_hashtable();
+    int n = 0;
+
+    memset(model, 0, sizeof(model));
+    for (int i = 0; i < CHECK_KEYS; i++) {
+        // every eighth key is too long to be inlined
+        snprintf(check_keys[i], KEY_LEN, i % 8 ? "srv%d"
+                 : "/aos/services/some/long/path/%d", i);
+    }
+
+    for (int op = 0; op < CHECK_OPS; op++) {
+        uint32_t range = 16 + ((op >> 12) % 64) * (CHECK_KEYS / 64);
+        uint32_t k = rng() % range;
+        const char *key = check_keys[k];
+        void *got;
+
+        ht->d.get(&ht->d, key, strlen(key), &got);
+        if ((uintptr_t) got != model[k]) {
+            printf("hashtable: get %s got %p want %" PRIxPTR " at op %d\n",
+                   key, got, model[k], op);
+            return 1;
+        }
+        if ((rng() & 3) != 0) {
+            // puts replace
+            model[k] = op + 1;
+            if (got == NULL) {
+                n++;
+            }
+            ht->d.put_word(&ht->d, key, strlen(key), model[k]);
+        } else {
+            int err = ht->d.remove(&ht->d, key, strlen(key));
+            if (err != (got == NULL)) {
+                printf("hashtable: remove %s returned %d\n", key, err);
+                return 1;
+            }
+            if (got != NULL) {
+                n--;
+            }
+            model[k] = 0;
+        }
+        if (ht->d.size(&ht->d) != n) {
+            printf("hashtable: size %d want %d\n", ht->d.size(&ht->d), n);
+            return 1;
+        }
+    }
+
+    // there is no destructor for hashtables
+    free(ht->entries);
+    free(ht->old_entries);
+    free(ht);
+    return 0;
+}
+
+/*
+ * Benchmarks
+ */
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static volatile uintptr_t sink;
+
+struct bench_times {
+    double insert, hit, miss, delete;
+};
+
+static void bench_print(const char *name, uint32_t n, int reps,
+                        struct bench_times *bt)
+{
+    double ops = (double) n * reps;
+    printf("  %-7s %8" PRIu32 " %8.1f %8.1f %8.1f %8.1f\n", name, n,
+           bt->insert / ops, bt->hit / ops, bt->miss / ops, bt->delete / ops);
+}
+
+/*
+ * Each round builds the table from scratch, looks up every key and one
+ * missing key per key, then deletes every key.
+ */
+static void bench_collections(uint64_t *keys, uint32_t n, int reps)
+{
+    struct bench_times open = { 0 }, chained = { 0 };
+    uintptr_t s = 0;
+    double t0, t1, t2, t3, t4;
+
+    for (int r = 0; r < reps; r++) {
+        collections_hash_table *t;
+        collections_hash_create(&t, NULL);
+        t0 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            collections_hash_insert(t, keys[i], (void *) (uintptr_t) (i + 1));
+        }
+        t1 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            s += (uintptr_t) collections_hash_find(t, keys[i]);
+        }
+        t2 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            s += (uintptr_t) collections_hash_find(t, keys[i] + 1);
+        }
+        t3 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            collections_hash_delete(t, keys[i]);
+        }
+        t4 = now_ns();
+        collections_hash_release(t);
+        open.insert += t1 - t0;
+        open.hit += t2 - t1;
+        open.miss += t3 - t2;
+        open.delete += t4 - t3;
+    }
+
+    // separate rounds, so neither table runs on memory the other one freed
+    for (int r = 0; r < reps; r++) {
+        struct ref_hash *rt = ref_hash_create();
+        t0 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            ref_hash_insert(rt, keys[i], (void *) (uintptr_t) (i + 1));
+        }
+        t1 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            s += (uintptr_t) ref_hash_find(rt, keys[i]);
+        }
+        t2 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            s += (uintptr_t) ref_hash_find(rt, keys[i] + 1);
+        }
+        t3 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            ref_hash_delete(rt, keys[i]);
+        }
+        t4 = now_ns();
+        ref_hash_release(rt);
+        chained.insert += t1 - t0;
+        chained.hit += t2 - t1;
+        chained.miss += t3 - t2;
+        chained.delete += t4 - t3;
+    }
+
+    bench_print("open", n, reps, &open);
+    bench_print("chained", n, reps, &chained);
+    sink = s;
+}
+
+static void bench_hashtable(char (*keys)[KEY_LEN], char (*miss)[KEY_LEN],
+                            uint32_t n, int reps)
+{
+    struct bench_times open = { 0 }, chained = { 0 };
+    uintptr_t s = 0;
+    double t0, t1, t2, t3, t4;
+    void *v;
+
+    for (int r = 0; r < reps; r++) {
+        struct hashtable *ht = create_hashtable();
+        t0 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            ht->d.put_word(&ht->d, keys[i], strlen(keys[i]), i + 1);
+        }
+        t1 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            ht->d.get(&ht->d, keys[i], strlen(keys[i]), &v);
+            s += (uintptr_t) v;
+        }
+        t2 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            ht->d.get(&ht->d, miss[i], strlen(miss[i]), &v);
+            s += (uintptr_t) v;
+        }
+        t3 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            ht->d.remove(&ht->d, keys[i], strlen(keys[i]));
+        }
+        t4 = now_ns();
+        // there is no destructor for hashtables
+        free(ht->entries);
+        free(ht->old_entries);
+        free(ht);
+        open.insert += t1 - t0;
+        open.hit += t2 - t1;
+        open.miss += t3 - t2;
+        open.delete += t4 - t3;
+    }
+
+    for (int r = 0; r < reps; r++) {
+        struct ref_ht *rt = ref_ht_create();
+        t0 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            ref_ht_put(rt, keys[i], strlen(keys[i]), (void *) (uintptr_t) (i + 1));
+        }
+        t1 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            s += (uintptr_t) ref_ht_get(rt, keys[i], strlen(keys[i]));
+        }
+        t2 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            s += (uintptr_t) ref_ht_get(rt, miss[i], strlen(miss[i]));
+        }
+        t3 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            ref_ht_remove(rt, keys[i], strlen(keys[i]));
+        }
+        t4 = now_ns();
+        ref_ht_release(rt);
+        chained.insert += t1 - t0;
+        chained.hit += t2 - t1;
+        chained.miss += t3 - t2;
+        chained.delete += t4 - t3;
+    }
+
+    bench_print("open", n, reps, &open);
+    bench_print("chained", n, reps, &chained);
+    sink = s;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t max = argc > 1 ? strtoul(argv[1], NULL, 0) : 65536;
+    uint32_t hmax = max < 16384 ? max : 16384;
+
+    if (check_collections() != 0 || check_hashtable() != 0) {
+        printf("check FAILED\n");
+        return 1;
+    }
+    printf("checks passed\n");
+
+    uint64_t *keys = malloc(max * sizeof(uint64_t));
+    char (*skeys)[KEY_LEN] = malloc(hmax * KEY_LEN);
+    char (*smiss)[KEY_LEN] = malloc(hmax * KEY_LEN);
+
+    printf("\ncollections_hash, sequential IPs, ns/op\n");
+    printf("  table   elements   insert      hit     miss   delete\n");
+    for (uint32_t n = 64; n <= max; n *= 4) {
+        for (uint32_t i = 0; i < n; i++) {
+            keys[i] = 0x0a000000 + 2 * i;
+        }
+        bench_collections(keys, n, 1 + (1 << 18) / n);
+    }
+
+    printf("\ncollections_hash, heap pointers, ns/op\n");
+    printf("  table   elements   insert      hit     miss   delete\n");
+    for (uint32_t n = 64; n <= max; n *= 4) {
+        for (uint32_t i = 0; i < n; i++) {
+            keys[i] = 0x400000000000ULL + (rng() % (64 * n)) * 64;
+            for (uint32_t j = 0; j < i; j++) {
+                if (keys[j] == keys[i]) {
+                    keys[i] += 64 * 64 * n;
+                    j = -1;
+                }
+            }
+        }
+        bench_collections(keys, n, 1 + (1 << 18) / n);
+    }
+
+    // the chained hashtable has 11 buckets, keep it to sizes it can finish
+    printf("\nhashtable, service names, ns/op\n");
+    printf("  table   elements   insert      hit     miss   delete\n");
+    for (uint32_t n = 4; n <= hmax; n *= 4) {
+        for (uint32_t i = 0; i < n; i++) {
+            snprintf(skeys[i], KEY_LEN, "serverbench%" PRIu32, i);
+            snprintf(smiss[i], KEY_LEN, "serverbench%" PRIu32, i + n);
+        }
+        bench_hashtable(skeys, smiss, n, 1 + (1 << 14) / n);
+    }
+
+    printf("\nhashtable, long names, ns/op\n");
+    printf("  table   elements   insert      hit     miss   delete\n");
+    for (uint32_t n = 4; n <= hmax; n *= 4) {
+        for (uint32_t i = 0; i < n; i++) {
+            snprintf(skeys[i], KEY_LEN, "/aos/services/net/udp/port/%" PRIu32, i);
+            snprintf(smiss[i], KEY_LEN, "/aos/services/net/udp/port/%" PRIu32, i + n);
+        }
+        bench_hashtable(skeys, smiss, n, 1 + (1 << 14) / n);
+    }
+
+    free(keys);
+    free(skeys);
+    free(smiss);
+    return 0;
+}
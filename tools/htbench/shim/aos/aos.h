@@ -0,0 +1,38 @@
+/**
+ * \file
+ * \brief Stand-in for aos/aos.h when building libhashtable on the host
+ *
+ * hashtable/dictionary.h only needs struct capref, which is laid out like
+ * the one in aos/caddr.h.
+ */
+
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef HTBENCH_AOS_SHIM_H
+#define HTBENCH_AOS_SHIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+struct cnoderef {
+    uint32_t croot;
+    uint32_t cnode;
+    uint32_t level;
+};
+
+struct capref {
+    struct cnoderef cnode;
+    uint32_t slot;
+};
+
+#define NULL_CAP (struct capref){ .slot = 0 }
+
+#endif
@@ -0,0 +1,268 @@
+/**
+ * \file
+ * \brief Host-side simulator for the kernel scheduling policies
+ *
+ * Compiles one of kernel/schedule_rbed.c or kernel/schedule_mlfq.c with
+ * SCHEDULER_SIMULATOR defined against a minimal fake kernel and runs a
+ * synthetic workload on it: a number of CPU-bound dispatchers (think
+ * mandelbrot workers) and a number of interactive dispatchers that are
+ * periodically woken up by a message (think enet driver or memory server),
+ * run for a short burst and block again. The wakeup path mirrors
+ * lmp_deliver_payload(): by default the one of an ordinary LMP message, which
+ * only makes the receiver runnable under RBED and goes through
+ * make_runnable_boost() under MLFQ. With "notify" as wakeup argument it is the
+ * one of notifications, make_runnable() followed by schedule_now(), which is
+ * also the path of timer wakeups.
+ *
+ * Reports the latency from wakeup to first dispatch of the interactive
+ * dispatchers and the CPU share of the CPU-bound ones.
+ *
+ * Usage: schedsim_<policy> [cpu_tasks] [io_tasks] [io_period_us] [io_burst_us]
+ *                          [msg|notify]
+ */
+
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCHEDULER_SIMULATOR
+#define CONFIG_ONESHOT_TIMER
+
+typedef uint64_t systime_t;
+typedef uintptr_t lvaddr_t;
+
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+
+enum task_type {
+    TASK_TYPE_BEST_EFFORT,
+    TASK_TYPE_SOFT_REALTIME,
+    TASK_TYPE_HARD_REALTIME
+};
+
+#define MLFQ_LEVELS     3
+
+/// Union of the scheduler fields of the kernel's struct dcb
+struct dcb {
+    struct dcb          *next, *prev;
+    // RBED
+    systime_t           release_time, etime, last_dispatch;
+    systime_t           wcet, period, deadline;
+    unsigned short      weight;
+    enum task_type      type;
+    // MLFQ
+    unsigned int        level;
+    systime_t           slice_used;
+
+    // simulator state
+    int                 id;
+    bool                interactive;
+    bool                runnable;
+    systime_t           burst_left;     ///< remaining work until it blocks
+    systime_t           next_wakeup;
+    systime_t           woken_at;
+    bool                waiting;        ///< woken, but not yet dispatched
+    systime_t           runtime;
+    systime_t           lat_sum, lat_max;
+    uint64_t            lat_n;
+};
+
+struct kcb {
+    struct kcb *next;
+    struct dcb *ring_current;
+    struct dcb *queue_head, *queue_tail;
+    unsigned int u_hrt, u_srt, w_be, n_be;
+    struct dcb *mlfq_head[MLFQ_LEVELS], *mlfq_tail[MLFQ_LEVELS];
+};
+
+static struct kcb sim_kcb;
+static struct kcb *kcb_current = &sim_kcb;
+static struct dcb *dcb_current = NULL;
+
+static systime_t sim_now = 0;
+static systime_t sched_timer = 0;
+static bool sched_timer_set = false;
+
+/// 10ms timeslice, time unit is microseconds
+static systime_t kernel_timeslice = 10000;
+
+#define kernel_now      sim_now
+
+static inline systime_t systime_now(void)
+{
+    return sim_now;
+}
+
+static void update_sched_timer(systime_t t)
+{
+    sched_timer = t;
+    sched_timer_set = true;
+}
+
+#define trace_event(subsys, event, arg)     do { } while (0)
+
+static __attribute__((unused)) void panic(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    abort();
+}
+
+#if defined(SIM_MLFQ)
+#       include "../../kernel/schedule_mlfq.c"
+#       define POLICY "mlfq"
+#elif defined(SIM_RBED)
+#       include "../../kernel/schedule_rbed.c"
+#       define POLICY "rbed"
+#else
+#       error "define SIM_MLFQ or SIM_RBED"
+#endif
+
+#define MAX_TASKS       64
+#define SIM_DURATION    (10ULL * 1000 * 1000)   // 10s
+
+static struct dcb tasks[MAX_TASKS];
+
+/// LMP delivery to a blocked receiver, see lmp_deliver_payload()
+static void deliver(struct dcb *d, bool notify)
+{
+    d->runnable = true;
+    d->waiting = true;
+    d->woken_at = sim_now;
+    if (notify) {
+        make_runnable(d);
+        schedule_now(d);
+        return;
+    }
+#if defined(SIM_MLFQ)
+    make_runnable_boost(d);
+#else
+    make_runnable(d);
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    int n_cpu = argc > 1 ? atoi(argv[1]) : 4;
+    int n_io = argc > 2 ? atoi(argv[2]) : 2;
+    systime_t io_period = argc > 3 ? strtoull(argv[3], NULL, 0) : 5000;
+    systime_t io_burst = argc > 4 ? strtoull(argv[4], NULL, 0) : 200;
+    bool notify = argc > 5 && strcmp(argv[5], "notify") == 0;
+
+    if (n_cpu + n_io > MAX_TASKS || n_cpu + n_io == 0) {
+        fprintf(stderr, "between 1 and %d tasks supported\n", MAX_TASKS);
+        return EXIT_FAILURE;
+    }
+
+    int n = n_cpu + n_io;
+    for (int i = 0; i < n; i++) {
+        struct dcb *d = &tasks[i];
+        d->id = i;
+        d->type = TASK_TYPE_BEST_EFFORT;
+        d->interactive = i >= n_cpu;
+        if (d->interactive) {
+            // stagger the wakeups a bit
+            d->next_wakeup = io_period + (systime_t)i * 37;
+        } else {
+            d->runnable = true;
+            make_runnable(d);
+        }
+    }
+
+    uint64_t switches = 0;
+    while (sim_now < SIM_DURATION) {
+        sched_timer_set = false;
+        struct dcb *next = schedule();
+        if (next != dcb_current) {
+            switches++;
+        }
+        dcb_current = next;
+
+        if (next != NULL && next->waiting) {
+            systime_t lat = sim_now - next->woken_at;
+            next->lat_sum += lat;
+            next->lat_n++;
+            if (lat > next->lat_max) {
+                next->lat_max = lat;
+            }
+            next->waiting = false;
+        }
+
+        // find the next event
+        systime_t until = sched_timer_set ? sched_timer : sim_now + kernel_timeslice;
+        if (until <= sim_now) {
+            until = sim_now + 1;
+        }
+        for (int i = 0; i < n; i++) {
+            if (tasks[i].interactive && !tasks[i].runnable &&
+                tasks[i].next_wakeup < until) {
+                until = tasks[i].next_wakeup;
+            }
+        }
+        if (next != NULL && next->interactive && sim_now + next->burst_left < until) {
+            until = sim_now + next->burst_left;
+        }
+
+        // run
+        systime_t ran = until - sim_now;
+        sim_now = until;
+        if (next != NULL) {
+            next->runtime += ran;
+            if (next->interactive) {
+                next->burst_left -= ran;
+                if (next->burst_left == 0) {
+                    // waits for the next message
+                    next->runnable = false;
+                    scheduler_remove(next);
+                    dcb_current = NULL;
+                }
+            }
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct dcb *d = &tasks[i];
+            if (d->interactive && !d->runnable && d->next_wakeup <= sim_now) {
+                d->burst_left = io_burst;
+                d->next_wakeup += io_period;
+                deliver(d, notify);
+            }
+        }
+    }
+
+    printf("policy %s: %d cpu-bound, %d interactive (period %" PRIu64
+           "us, burst %" PRIu64 "us, woken by %s), timeslice %" PRIu64 "us\n",
+           POLICY, n_cpu, n_io, io_period, io_burst,
+           notify ? "notification" : "message", kernel_timeslice);
+    printf("context switches: %" PRIu64 "\n", switches);
+
+    for (int i = 0; i < n; i++) {
+        struct dcb *d = &tasks[i];
+        if (d->interactive) {
+            printf("  io  %2d: wakeups %6" PRIu64 "  latency avg %8" PRIu64
+                   "us  max %8" PRIu64 "us\n", d->id, d->lat_n,
+                   d->lat_n ? d->lat_sum / d->lat_n : 0, d->lat_max);
+        } else {
+            printf("  cpu %2d: share %5.1f%%\n", d->id,
+                   100.0 * d->runtime / sim_now);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
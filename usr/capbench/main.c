@@ -0,0 +1,306 @@
+/**
+ * \file
+ * \brief Latency of capability operations and IPC primitives as seen by a domain
+ *
+ * Every operation is timed on its own, the results are printed as percentiles
+ * and a log2 histogram of the cycles it took. The cpu driver's side of the
+ * same operations is measured by the kernel microbenchmarks, enabled with
+ * the microbenchmarks option in hake/Config.hs. That option also opens the
+ * cycle counter to user space, without it the system counter is used.
+ *
+ * Usage: capbench [iterations]
+ */
+
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <aos/aos.h>
+#include <aos/systime.h>
+#include <aos/aos_rpc.h>
+#include <aos/paging.h>
+#include <aos/lmp_endpoints.h>
+
+#define DEFAULT_ITERATIONS 1000
+#define HISTOGRAM_BUCKETS 32
+
+#ifdef CONFIG_MICROBENCHMARKS
+#define CYCLE_UNIT "cycles"
+static inline uint64_t cycles(void)
+{
+    uint64_t c;
+    __asm volatile("isb; mrs %0, pmccntr_el0" : "=r"(c) :: "memory");
+    return c;
+}
+#else
+#define CYCLE_UNIT "ticks"
+static inline uint64_t cycles(void)
+{
+    return systime_now();
+}
+#endif
+
+struct capbench {
+    const char *name;
+    /// runs the operation n times, timing every run into samples
+    errval_t (*run)(uint64_t *samples, size_t n);
+};
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_results(const char *name, uint64_t *samples, size_t n)
+{
+    size_t histogram[HISTOGRAM_BUCKETS] = { 0 };
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        sum += samples[i];
+        int bucket = 0;
+        while (bucket < HISTOGRAM_BUCKETS - 1 && (samples[i] >> (bucket + 1)) != 0) {
+            bucket++;
+        }
+        histogram[bucket]++;
+    }
+    qsort(samples, n, sizeof(uint64_t), compare_u64);
+
+    printf("%-24s avg %8lu  p50 %8lu  p90 %8lu  p99 %8lu  max %8lu %s\n",
+           name, sum / n, samples[n / 2], samples[n * 90 / 100],
+           samples[n * 99 / 100], samples[n - 1], CYCLE_UNIT);
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        if (histogram[b] > 0) {
+            printf("    [%8lu, %8lu) %6zu\n", 1UL << b, 2UL << b, histogram[b]);
+        }
+    }
+}
+
+
+static errval_t cap_copy_bench(uint64_t *samples, size_t n)
+{
+    errval_t err;
+    struct capref frame, copy;
+    err = frame_alloc(&frame, BASE_PAGE_SIZE, NULL);
+    ON_ERR_RETURN(err);
+    err = slot_alloc(&copy);
+    ON_ERR_RETURN(err);
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t start = cycles();
+        err = cap_copy(copy, frame);
+        samples[i] = cycles() - start;
+        ON_ERR_RETURN(err);
+        err = cap_delete(copy);
+        ON_ERR_RETURN(err);
+    }
+
+    slot_free(copy);
+    return cap_destroy(frame);
+}
+
+static errval_t cap_delete_bench(uint64_t *samples, size_t n)
+{
+    errval_t err;
+    struct capref frame, copy;
+    err = frame_alloc(&frame, BASE_PAGE_SIZE, NULL);
+    ON_ERR_RETURN(err);
+    err = slot_alloc(&copy);
+    ON_ERR_RETURN(err);
+
+    for (size_t i = 0; i < n; i++) {
+        err = cap_copy(copy, frame);
+        ON_ERR_RETURN(err);
+        uint64_t start = cycles();
+        err = cap_delete(copy);
+        samples[i] = cycles() - start;
+        ON_ERR_RETURN(err);
+    }
+
+    slot_free(copy);
+    return cap_destroy(frame);
+}
+
+static errval_t cap_retype_bench(uint64_t *samples, size_t n)
+{
+    errval_t err;
+    struct capref ram, frame;
+    err = ram_alloc(&ram, BASE_PAGE_SIZE);
+    ON_ERR_RETURN(err);
+    err = slot_alloc(&frame);
+    ON_ERR_RETURN(err);
+
+    for (size_t i = 0; i < n; i++) {
+        // includes zeroing the new frame
+        uint64_t start = cycles();
+        err = cap_retype(frame, ram, 0, ObjType_Frame, BASE_PAGE_SIZE, 1);
+        samples[i] = cycles() - start;
+        ON_ERR_RETURN(err);
+        err = cap_delete(frame);
+        ON_ERR_RETURN(err);
+    }
+
+    slot_free(frame);
+    return cap_destroy(ram);
+}
+
+static errval_t cap_revoke_bench(uint64_t *samples, size_t n)
+{
+    errval_t err;
+    struct capref ram, frame;
+    err = ram_alloc(&ram, BASE_PAGE_SIZE);
+    ON_ERR_RETURN(err);
+    err = slot_alloc(&frame);
+    ON_ERR_RETURN(err);
+
+    for (size_t i = 0; i < n; i++) {
+        err = cap_retype(frame, ram, 0, ObjType_Frame, BASE_PAGE_SIZE, 1);
+        ON_ERR_RETURN(err);
+        uint64_t start = cycles();
+        err = cap_revoke(ram);
+        samples[i] = cycles() - start;
+        ON_ERR_RETURN(err);
+    }
+
+    // the revoke emptied the slot
+    slot_free(frame);
+    return cap_destroy(ram);
+}
+
+static errval_t vnode_map_bench(uint64_t *samples, size_t n)
+{
+    errval_t err;
+    struct paging_state *st = get_current_paging_state();
+    struct capref frame, mapping;
+    err = frame_alloc(&frame, BASE_PAGE_SIZE, NULL);
+    ON_ERR_RETURN(err);
+    err = slot_alloc(&mapping);
+    ON_ERR_RETURN(err);
+
+    // the page is never touched, the shadow table entry stays empty
+    void *buf;
+    err = paging_alloc(st, &buf, BASE_PAGE_SIZE, BASE_PAGE_SIZE);
+    ON_ERR_RETURN(err);
+    struct mapping_table *table;
+    err = paging_spt_find(st, 3, (lvaddr_t) buf, true, &table);
+    ON_ERR_RETURN(err);
+    capaddr_t slot = ((lvaddr_t) buf >> BASE_PAGE_BITS) & 0x1FF;
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t start = cycles();
+        err = vnode_map(table->pt_cap, frame, slot, VREGION_FLAGS_READ_WRITE,
+                        0, 1, mapping);
+        ON_ERR_RETURN(err);
+        err = vnode_unmap(table->pt_cap, mapping);
+        samples[i] = cycles() - start;
+        ON_ERR_RETURN(err);
+        err = cap_delete(mapping);
+        ON_ERR_RETURN(err);
+    }
+
+    slot_free(mapping);
+    return cap_destroy(frame);
+}
+
+static errval_t lmp_bench(uint64_t *samples, size_t n)
+{
+    errval_t err;
+    struct capref ep_cap;
+    struct lmp_endpoint *ep;
+    err = endpoint_create(DEFAULT_LMP_BUF_WORDS, &ep_cap, &ep);
+    ON_ERR_RETURN(err);
+
+    for (size_t i = 0; i < n; i++) {
+        struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+        uint64_t start = cycles();
+        err = lmp_ep_send4(ep_cap, 0, NULL_CAP, i, 1, 2, 3);
+        ON_ERR_RETURN(err);
+        err = lmp_endpoint_recv(ep, &msg.buf, NULL);
+        samples[i] = cycles() - start;
+        ON_ERR_RETURN(err);
+    }
+
+    lmp_endpoint_free(ep);
+    return cap_destroy(ep_cap);
+}
+
+static errval_t yield_bench(uint64_t *samples, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        // with nothing else runnable this is a trip through the scheduler and
+        // back into this dispatcher, entering it with an upcall
+        uint64_t start = cycles();
+        thread_yield_dispatcher(NULL_CAP);
+        samples[i] = cycles() - start;
+    }
+    return SYS_ERR_OK;
+}
+
+static errval_t rpc_bench(uint64_t *samples, size_t n)
+{
+    struct aos_rpc *rpc = get_init_rpc();
+    for (size_t i = 0; i < n; i++) {
+        uint64_t start = cycles();
+        errval_t err = aos_rpc_call(rpc, AOS_RPC_ROUNDTRIP);
+        samples[i] = cycles() - start;
+        ON_ERR_RETURN(err);
+    }
+    return SYS_ERR_OK;
+}
+
+static struct capbench benchmarks[] = {
+    { "cap_copy",              cap_copy_bench },
+    { "cap_delete",            cap_delete_bench },
+    { "cap_retype (4K frame)", cap_retype_bench },
+    { "cap_revoke (1 desc)",   cap_revoke_bench },
+    { "vnode_map + unmap",     vnode_map_bench },
+    { "lmp send + recv",       lmp_bench },
+    { "dispatcher yield",      yield_bench },
+    { "rpc round trip",        rpc_bench },
+};
+
+
+int main(int argc, char *argv[])
+{
+    size_t n = DEFAULT_ITERATIONS;
+    if (argc > 1) {
+        n = strtoul(argv[1], NULL, 0);
+    }
+    if (n == 0) {
+        printf("usage: %s [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t *samples = malloc(n * sizeof(uint64_t));
+    if (samples == NULL) {
+        DEBUG_ERR(LIB_ERR_MALLOC_FAIL, "allocating samples");
+        return EXIT_FAILURE;
+    }
+
+    printf("capbench: %zu iterations per operation\n", n);
+    for (size_t b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++) {
+        // one untimed round faults in the code and buffers involved
+        uint64_t warmup;
+        errval_t err = benchmarks[b].run(&warmup, 1);
+        if (err_is_ok(err)) {
+            err = benchmarks[b].run(samples, n);
+        }
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "%s", benchmarks[b].name);
+            continue;
+        }
+        print_results(benchmarks[b].name, samples, n);
+    }
+
+    free(samples);
+    return EXIT_SUCCESS;
+}
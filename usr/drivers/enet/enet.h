@@ -8,6 +8,10 @@
  */
 
 #include <collections/hash_table.h>
+#include <aos/udp_service.h>
+#include <aos/systime.h>
+#include <aos/deferred.h>
+#include <netutil/etharp.h>
 
 #ifndef ENET_H_
 #define ENET_H_
@@ -33,6 +37,18 @@ void inline ENET_DEBUG_UI32_AS_IP(char *msg, uint32_t ip) {}
 
 #define ENET_PROMISC
 
+#define IMX8X_ENET_INT 290  // ENET0 ring 0, SPI 258
+#define ENET_RX_BUDGET 64  // frames handled per pass before serving requests
+#define ENET_STATS_WINDOW_US 1000000
+#define ENET_UDP_PORT_BUCKETS 1024  // initial slots of the socket tables, they grow on demand
+
+#define ARP_ENTRY_TTL_US (60 * 1000000)  // refresh resolved entries this often
+#define ARP_RETRY_US 500000  // resend an unanswered request after
+#define ARP_MAX_RETRIES 5  // unanswered requests before an entry is dropped
+#define ARP_AGE_PERIOD_US 100000
+#define ARP_PENDING_MAX 32  // frames queued per unresolved peer
+#define UDP_TEARDOWN_TIMEOUT_US 100000  // wait for the NIC to return a closing socket's buffers
+
 #define TX_RING_SIZE 512
 #define ENET_RX_FRSIZE 2048
 #define ENET_RX_PAGES 256
@@ -96,13 +112,15 @@ struct enet_queue {
     struct region_entry* regions;
 };
 
-// struct to represent a single udp packet in a receive-buffer
-struct udp_recv_elem {
-    void *data;
-    uint16_t f_port;
-    uint32_t ip_addr;
-    uint16_t len;
-    struct udp_recv_elem *next;
+/**
+ * A queue the protocol handlers run on, independent of the backend (the
+ * ENET MAC or the software NIC). Keeps the regions the backend has mapped,
+ * so the handlers can get at the data of a buffer.
+ */
+struct net_queue {
+    struct devq* q;
+    size_t size;  // number of descriptors
+    struct region_entry** regions;  // owned by the backend
 };
 
 // NOTE: all numbers (ip, ports,...) are in host-byte-order
@@ -112,11 +130,35 @@ struct aos_udp_socket {
     uint16_t l_port;  // local port
     /* uint8_t listen_only;  // non-zero if socket is only for listening */
 
-    struct udp_recv_elem *receive_buffer;
-    struct udp_recv_elem *last_elem;
-    /* uint64_t sock_id; */
+    struct udp_shm *shm;  // rings shared with the application
+    regionid_t shm_rid;  // the shared frame in the TX devq
+    bool tx_sent[UDP_RING_SLOTS];  // sent, but not yet covered by tx.done
+    struct capref rx_notify;  // endpoint of a receiver parked on the RX ring
+    uint32_t rx_depth;  // RX slots the driver fills before dropping
+    uint64_t rx_dropped;  // driver's count, the one in shm is the app's to reset
+};
+
+enum arp_state {
+    ARP_INCOMPLETE,  // request sent, no MAC yet
+    ARP_RESOLVED,
+    ARP_STALE,  // MAC still used, refresh request sent
+};
+
+// a frame waiting for the MAC of its destination
+struct arp_pending {
+    struct devq_buf buf;
+    struct arp_pending *next;
+};
 
-    struct aos_udp_socket* next;
+struct arp_entry {
+    uint32_t ip;
+    struct eth_addr mac;
+    enum arp_state state;
+    systime_t updated;  // last time the peer told us its MAC
+    systime_t requested;  // last request sent
+    uint8_t retries;  // requests sent since the last answer
+    struct arp_pending *pending, *pending_tail;
+    size_t npending;
 };
 
 struct aos_icmp_socket {
@@ -133,8 +175,9 @@ struct enet_driver_state {
     struct capref regs;
     lvaddr_t d_vaddr;
 
-    struct enet_queue* rxq;  // receive queue
-    struct enet_queue* txq;  // send queue
+    struct net_queue* rxq;  // receive queue
+    struct net_queue* txq;  // send queue
+    struct soft_nic* soft;  // software NIC, NULL when running on the ENET MAC
     enet_t* d;
     uint64_t mac;
 
@@ -143,38 +186,73 @@ struct enet_driver_state {
     struct capref rx_mem;  // receive memcap
     struct capref tx_mem;  // send memcap
 
-    collections_hash_table* arp_table;  // arp-related state
-    collections_hash_table* inv_table;  // inverse arp-table: ip 2 mac
+    collections_hash_table* inv_table;  // arp cache: ip 2 struct arp_entry
+    struct periodic_event arp_ager;
+    uint64_t arp_expired;  // entries dropped because the peer went silent
     struct enet_qstate* send_qstate;  // regionman for send-queue
 
-    struct aos_udp_socket *sockets;
+    collections_hash_table* udp_ports;  // local port 2 socket
+    collections_hash_table* udp_rids;  // region of the socket rings 2 socket
+    uint64_t udp_unbound;  // datagrams to ports without a socket
+    uint64_t udp_dropped;  // datagrams dropped on full socket rings
+    bool csum_offload;  // the MAC inserts and checks IP/UDP/ICMP checksums
+    uint64_t csum_errors;  // received packets dropped for bad checksums
     struct aos_icmp_socket *pings;
+
+    // RX processing
+    bool rx_irq;  // woken by the RX interrupt, otherwise the ring is polled
+    bool rx_pending;  // interrupt taken, ring not drained yet
+    bool stats;  // print the RX statistics every window
+    struct enet_rx_stats {
+        systime_t window_start;
+        systime_t idle;  // time spent waiting for work in this window
+        uint64_t packets;  // frames in this window
+        uint64_t passes;
+        uint64_t over_budget;  // passes that hit ENET_RX_BUDGET
+        uint64_t peak_pps;
+    } rx_stats;
 };
 
+struct region_entry* net_get_region(struct net_queue* q, regionid_t rid);
+
 // ETH handler functions
 void print_arp_table(struct enet_driver_state *st);
-errval_t handle_ARP(struct enet_queue* q, struct devq_buf* buf,
+errval_t handle_ARP(struct net_queue* q, struct devq_buf* buf,
                     lvaddr_t vaddr, struct enet_driver_state* st);
-errval_t handle_IP(struct enet_queue* q, struct devq_buf* buf,
+errval_t handle_IP(struct net_queue* q, struct devq_buf* buf,
                    lvaddr_t vaddr, struct enet_driver_state* st);
-errval_t handle_packet(struct enet_queue* q, struct devq_buf* buf,
+errval_t handle_packet(struct net_queue* q, struct devq_buf* buf,
                        struct enet_driver_state* st);
+struct ip_hdr;
+void ip_set_checksums(struct enet_driver_state* st, struct ip_hdr *ih);
+
+// ARP cache
+errval_t arp_cache_init(struct enet_driver_state *st);
+void arp_learn(struct enet_driver_state *st, uint32_t ip, struct eth_addr *mac);
+errval_t arp_output(struct enet_driver_state *st, uint32_t ip,
+                    struct devq_buf *buf);
+void arp_forget_region(struct enet_driver_state *st, regionid_t rid);
 
 // UDP Socket functions
 /* struct aos_udp_socket* get_socket_from_id(struct enet_driver_state *st, */
 /*                                           uint64_t socket_id); */
 #define UDP_SOCK_MAX_LEN (2048 - UDP_HLEN - IP_HLEN - ETH_HLEN)
+#define UDP_FRAME_HLEN (ETH_HLEN + IP_HLEN + UDP_HLEN)
 
 struct aos_udp_socket* get_socket_from_port(struct enet_driver_state *st,
                                             uint16_t port);
 errval_t udp_socket_append_message(struct aos_udp_socket *s, uint16_t f_port, uint32_t ip,
                                    void *data, uint32_t len);
-struct udp_recv_elem *udp_socket_receive(struct aos_udp_socket *s);
 errval_t udp_socket_teardown(struct enet_driver_state *st,
                              struct aos_udp_socket *socket);
 struct aos_udp_socket* create_udp_socket(struct enet_driver_state *st,
                                          uint32_t ip_dest, uint16_t f_port,
-                                         uint16_t l_port);
+                                         uint16_t l_port, uint16_t rx_depth,
+                                         struct capref shm);
+errval_t udp_socket_tx_ring(struct enet_driver_state *st,
+                            struct aos_udp_socket *s);
+errval_t udp_socket_set_notify(struct aos_udp_socket *s, struct capref ep);
+void udp_socket_tx_done(void *arg, struct devq_buf *buf);
 errval_t arp_request(struct enet_driver_state *st, uint32_t ip_to);
 errval_t udp_socket_send(struct enet_driver_state *st, uint16_t port,
                          void *data, uint16_t len);
@@ -0,0 +1,276 @@
+/**
+ * \file
+ * \brief ARP cache of the enet driver
+ *
+ * Every peer has an entry in st->inv_table, keyed by its IP. The first frame
+ * to an unknown peer creates the entry and sends a request, further frames
+ * queue on the entry until the reply resolves it. Resolved entries are
+ * refreshed after ARP_ENTRY_TTL_US and dropped together with their queued
+ * frames once the peer stops answering.
+ */
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <devif/queue_interface_backend.h>
+#include <devif/backends/net/enet_devif.h>
+#include <aos/aos.h>
+#include <aos/deferred.h>
+#include <aos/systime.h>
+#include <driverkit/driverkit.h>
+#include <dev/imx8x/enet_dev.h>
+#include <netutil/etharp.h>
+
+#include <collections/hash_table.h>
+
+#include "enet_regionman.h"
+#include "enet.h"
+
+/**
+ * \brief give a frame that will not be sent back to its owner
+ *
+ * Frames from the socket rings are completed as if they were sent, so the
+ * application gets the slot back.
+ */
+static void arp_frame_release(struct enet_driver_state *st,
+                              struct devq_buf *buf) {
+    struct enet_qstate *qs = st->send_qstate;
+    if (buf->rid == qs->rid) {
+        put_free_buf(qs, buf);
+    } else if (qs->foreign_done != NULL) {
+        qs->foreign_done(qs->foreign_arg, buf);
+    }
+}
+
+static errval_t arp_frame_send(struct enet_driver_state *st,
+                               struct arp_entry *e, struct devq_buf *buf) {
+    struct region_entry *entry = net_get_region(st->txq, buf->rid);
+    struct eth_hdr *eh = (struct eth_hdr *) ((char *) entry->mem.vbase
+                                             + buf->offset + buf->valid_data);
+    eh->dst = e->mac;
+    dmb();
+
+    errval_t err = enqueue_buf(st->send_qstate, buf);
+    if (err_no(err) == DEVQ_ERR_QUEUE_FULL) {
+        dequeue_bufs(st->send_qstate);
+        err = enqueue_buf(st->send_qstate, buf);
+    }
+    return err;
+}
+
+/**
+ * \brief send the frames queued on a resolved entry, in order
+ *
+ * Stops when the TX queue is full, the rest goes out with the next frame to
+ * the peer or the next aging pass.
+ */
+static void arp_entry_flush(struct enet_driver_state *st, struct arp_entry *e) {
+    while (e->pending != NULL) {
+        struct arp_pending *p = e->pending;
+        errval_t err = arp_frame_send(st, e, &p->buf);
+        if (err_no(err) == DEVQ_ERR_QUEUE_FULL) {
+            return;
+        }
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "sending queued frame");
+            arp_frame_release(st, &p->buf);
+        }
+
+        e->pending = p->next;
+        e->npending--;
+        free(p);
+    }
+    e->pending_tail = NULL;
+}
+
+static void arp_entry_request(struct enet_driver_state *st, struct arp_entry *e) {
+    e->requested = systime_now();
+    e->retries++;
+    // a lost request is retried by the aging pass
+    errval_t err = arp_request(st, e->ip);
+    if (err_is_fail(err)) {
+        ETHARP_DEBUG("could not send ARP request\n");
+    }
+}
+
+static struct arp_entry *arp_entry_create(struct enet_driver_state *st,
+                                          uint32_t ip) {
+    struct arp_entry *e = calloc(1, sizeof(struct arp_entry));
+    assert(e != NULL);
+    e->ip = ip;
+    e->state = ARP_INCOMPLETE;
+    collections_hash_insert(st->inv_table, ip, e);
+    return e;
+}
+
+/**
+ * \brief store the MAC of a peer and send what was waiting for it
+ */
+void arp_learn(struct enet_driver_state *st, uint32_t ip, struct eth_addr *mac) {
+    struct arp_entry *e = collections_hash_find(st->inv_table, ip);
+    if (e == NULL) {
+        ETHARP_DEBUG("adding new ARP table entry\n");
+        e = arp_entry_create(st, ip);
+    }
+
+    e->mac = *mac;
+    e->state = ARP_RESOLVED;
+    e->updated = systime_now();
+    e->retries = 0;
+    arp_entry_flush(st, e);
+}
+
+/**
+ * \brief send a frame to ip, or queue it until the MAC of ip is known
+ *
+ * The frame has to have all headers but the destination MAC in place.
+ * On success the frame belongs to the ARP cache, it is sent or given back to
+ * its owner when the peer turns out to be unreachable.
+ * \return ENET_ERR_ARP_QUEUE_FULL if too many frames wait for ip already
+ */
+errval_t arp_output(struct enet_driver_state *st, uint32_t ip,
+                    struct devq_buf *buf) {
+    struct arp_entry *e = collections_hash_find(st->inv_table, ip);
+    if (e == NULL) {
+        e = arp_entry_create(st, ip);
+        arp_entry_request(st, e);
+    }
+
+    if (e->state != ARP_INCOMPLETE) {
+        arp_entry_flush(st, e);
+        if (e->pending == NULL) {
+            return arp_frame_send(st, e, buf);
+        }
+    }
+
+    if (e->npending >= ARP_PENDING_MAX) {
+        return ENET_ERR_ARP_QUEUE_FULL;
+    }
+
+    struct arp_pending *p = malloc(sizeof(struct arp_pending));
+    assert(p != NULL);
+    p->buf = *buf;
+    p->next = NULL;
+    if (e->pending_tail != NULL) {
+        e->pending_tail->next = p;
+    } else {
+        e->pending = p;
+    }
+    e->pending_tail = p;
+    e->npending++;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief drop the queued frames that live in a region about to go away
+ *
+ * The dropped frames are completed like sent ones, through foreign_done of
+ * the send queue.
+ */
+void arp_forget_region(struct enet_driver_state *st, regionid_t rid) {
+    if (collections_hash_traverse_start(st->inv_table) == -1) {
+        return;
+    }
+
+    uint64_t key;
+    struct arp_entry *e = collections_hash_traverse_next(st->inv_table, &key);
+    for (; e != NULL; e = collections_hash_traverse_next(st->inv_table, &key)) {
+        struct arp_pending **pp = &e->pending;
+        e->pending_tail = NULL;
+        while (*pp != NULL) {
+            struct arp_pending *p = *pp;
+            if (p->buf.rid == rid) {
+                *pp = p->next;
+                e->npending--;
+                if (st->send_qstate->foreign_done != NULL) {
+                    st->send_qstate->foreign_done(st->send_qstate->foreign_arg, &p->buf);
+                }
+                free(p);
+            } else {
+                e->pending_tail = p;
+                pp = &p->next;
+            }
+        }
+    }
+    collections_hash_traverse_end(st->inv_table);
+}
+
+/**
+ * \brief one aging pass over the cache, runs every ARP_AGE_PERIOD_US
+ */
+static void arp_age(void *arg) {
+    struct enet_driver_state *st = arg;
+    systime_t now = systime_now();
+
+    uint32_t n = collections_hash_size(st->inv_table);
+    if (n == 0 || collections_hash_traverse_start(st->inv_table) == -1) {
+        return;
+    }
+
+    // entries can't be removed while traversing
+    uint32_t *expired = malloc(n * sizeof(uint32_t));
+    uint32_t nexpired = 0;
+
+    uint64_t key;
+    struct arp_entry *e = collections_hash_traverse_next(st->inv_table, &key);
+    for (; e != NULL; e = collections_hash_traverse_next(st->inv_table, &key)) {
+        switch (e->state) {
+        case ARP_RESOLVED:
+            arp_entry_flush(st, e);
+            if (systime_to_us(now - e->updated) >= ARP_ENTRY_TTL_US) {
+                // keep using the MAC while we ask again
+                e->state = ARP_STALE;
+                e->retries = 0;
+                arp_entry_request(st, e);
+            }
+            break;
+        case ARP_STALE:
+            arp_entry_flush(st, e);
+            // fall through
+        case ARP_INCOMPLETE:
+            if (systime_to_us(now - e->requested) < ARP_RETRY_US) {
+                break;
+            }
+            if (e->retries >= ARP_MAX_RETRIES) {
+                expired[nexpired++] = e->ip;
+            } else {
+                arp_entry_request(st, e);
+            }
+            break;
+        }
+    }
+    collections_hash_traverse_end(st->inv_table);
+
+    for (uint32_t i = 0; i < nexpired; i++) {
+        e = collections_hash_find(st->inv_table, expired[i]);
+        ETHARP_DEBUG("ARP entry expired, dropping %zu frames\n", e->npending);
+        while (e->pending != NULL) {
+            struct arp_pending *p = e->pending;
+            e->pending = p->next;
+            arp_frame_release(st, &p->buf);
+            free(p);
+        }
+        st->arp_expired++;
+        collections_hash_delete(st->inv_table, expired[i]);
+    }
+    free(expired);
+}
+
+/**
+ * \brief start aging the ARP cache, the pass runs on the default waitset
+ */
+errval_t arp_cache_init(struct enet_driver_state *st) {
+    collections_hash_create(&st->inv_table, free);
+    return periodic_event_create(&st->arp_ager, get_default_waitset(),
+                                 ARP_AGE_PERIOD_US, MKCLOSURE(arp_age, st));
+}
@@ -86,6 +86,31 @@ static errval_t enet_register(struct devq* q, struct capref cap, regionid_t rid)
     return SYS_ERR_OK;
 }
 
+static errval_t enet_deregister(struct devq* q, regionid_t rid)
+{
+    struct enet_queue* queue = (struct enet_queue*) q;
+
+    struct region_entry** cur = &queue->regions;
+    while (*cur != NULL && (*cur)->rid != rid) {
+        cur = &(*cur)->next;
+    }
+    if (*cur == NULL) {
+        return DEVQ_ERR_INVALID_REGION_ID;
+    }
+
+    struct region_entry* entry = *cur;
+    errval_t err = paging_unmap_frame(get_current_paging_state(),
+                                      (void*) entry->mem.vbase, entry->mem.size);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    *cur = entry->next;
+    free(entry);
+
+    ENET_DEBUG("deregistered region id %d \n", rid);
+    return SYS_ERR_OK;
+}
+
 static inline size_t enet_full_slots(struct enet_queue* q)
 {
     size_t head = q->head;
@@ -316,12 +341,28 @@ static errval_t enet_rx_enqueue(struct devq* que, regionid_t rid, genoffset_t of
                 q->ring[q->tail], addr, offset, length);
     */
     // activate RX (This is only needed if ring is empty)
-    enet_activate_rx_ring(q->d);
+    if (!(flags & ENET_RXQ_FLAG_BATCH)) {
+        enet_activate_rx_ring(q->d);
+    }
 
     q->tail = (q->tail + 1) & (q->size -1);
     return SYS_ERR_OK;
 }
 
+static errval_t enet_rx_notify(struct devq* que)
+{
+    struct enet_queue* q = (struct enet_queue*) que;
+    enet_activate_rx_ring(q->d);
+    return SYS_ERR_OK;
+}
+
+static errval_t enet_tx_notify(struct devq* que)
+{
+    struct enet_queue* q = (struct enet_queue*) que;
+    enet_activate_tx_ring(q->d);
+    return SYS_ERR_OK;
+}
+
 errval_t enet_rx_queue_create(struct enet_queue ** q, enet_t *dev)
 {
     errval_t err;
@@ -398,8 +439,10 @@ errval_t enet_rx_queue_create(struct enet_queue ** q, enet_t *dev)
     }
 
     rxq->q.f.reg = enet_register;
+    rxq->q.f.dereg = enet_deregister;
     rxq->q.f.enq = enet_rx_enqueue;
     rxq->q.f.deq = enet_rx_dequeue;
+    rxq->q.f.notify = enet_rx_notify;
 
     *q = rxq;
 
@@ -485,8 +528,10 @@ errval_t enet_tx_queue_create(struct enet_queue ** q, struct enet_t* dev)
     }
 
     txq->q.f.reg = enet_register;
+    txq->q.f.dereg = enet_deregister;
     txq->q.f.enq = enet_tx_enqueue;
     txq->q.f.deq = enet_tx_dequeue;
+    txq->q.f.notify = enet_tx_notify;
 
     *q = txq;
 
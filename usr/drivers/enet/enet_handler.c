@@ -24,41 +24,31 @@
 // #define STATIC_UDP_ECHO 1  // enable echo-server inside driver
 
 void print_arp_table(struct enet_driver_state *st) {
-    if (collections_hash_traverse_start(st->arp_table) == -1) {
+    if (collections_hash_traverse_start(st->inv_table) == -1) {
         ENET_DEBUG("unable to print arp-table rn\n");
         return;
     }
 
     ENET_DEBUG("============ ARP Table ============\n");
     uint64_t key;
-    uint32_t *curp = collections_hash_traverse_next(st->arp_table, &key);
-    while (curp) {
-        uint32_t ip_c = *curp;
-        uint8_t ip_tbl[4];
-
-        ip_tbl[3] = (ip_c >> 24) & 0xff;
-        ip_tbl[2] = (ip_c >> 16) & 0xff;
-        ip_tbl[1] = (ip_c >> 8) & 0xff;
-        ip_tbl[0] = ip_c & 0xff;
-
-        ENET_DEBUG("%d.%d.%d.%d --- %x:%x:%x:%x:%x:%x\n",
-                   ip_tbl[3],
-                   ip_tbl[2],
-                   ip_tbl[1],
-                   ip_tbl[0],
-                   (uint8_t) key >> 2,
-                   (uint8_t) key >> 3,
-                   (uint8_t) key >> 4,
-                   (uint8_t) key >> 5,
-                   (uint8_t) key >> 6,
-                   (uint8_t) key >> 7
-            );
-
-        curp = collections_hash_traverse_next(st->arp_table, &key);
+    struct arp_entry *cur = collections_hash_traverse_next(st->inv_table, &key);
+    while (cur) {
+        uint32_t ip_c = cur->ip;
+        uint8_t *mac = cur->mac.addr;
+
+        ENET_DEBUG("%d.%d.%d.%d --- %x:%x:%x:%x:%x:%x%s\n",
+                   (ip_c >> 24) & 0xff,
+                   (ip_c >> 16) & 0xff,
+                   (ip_c >> 8) & 0xff,
+                   ip_c & 0xff,
+                   mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+                   cur->state == ARP_INCOMPLETE ? " (incomplete)" : "");
+
+        cur = collections_hash_traverse_next(st->inv_table, &key);
     }
 
     ENET_DEBUG("===================================\n");
-    collections_hash_traverse_end(st->arp_table);
+    collections_hash_traverse_end(st->inv_table);
 }
 
 static void inline deb_print_mac(char *msg, struct eth_addr* mac) {
@@ -72,17 +62,6 @@ static void inline deb_print_mac(char *msg, struct eth_addr* mac) {
                mac->addr[5]);
 }
 
-static struct region_entry* get_region(struct enet_queue* q, regionid_t rid)
-{
-    struct region_entry* entry = q->regions;
-    while (entry != NULL) {
-        if (entry->rid == rid) {
-            return entry;
-        }
-        entry = entry->next;
-    }
-    return NULL;
-}
 
 static void print_ip_packet(struct ip_hdr *ih) {
     IP_DEBUG("======== IP  PACKET ========\n");
@@ -114,7 +93,7 @@ static void print_arp_packet(struct arp_hdr* h) {
  * \brief Handle an ARP request: possibly update local ARP table and send
  * back device's MAC address
  */
-static errval_t arp_request_handle(struct enet_queue* q, struct devq_buf* buf,
+static errval_t arp_request_handle(struct net_queue* q, struct devq_buf* buf,
                                    struct arp_hdr *h, struct enet_driver_state* st,
                                    lvaddr_t original_header) {
     if (ntohl(h->ip_dst) != STATIC_ENET_IP) {
@@ -126,31 +105,9 @@ static errval_t arp_request_handle(struct enet_queue* q, struct devq_buf* buf,
     ETHARP_DEBUG("|    |\n");
     ETHARP_DEBUG("`-><-'\n");
 
-    // extract src-info
+    // the sender will talk to us, remember its MAC
     errval_t err;
-    uint64_t mac_src = eth_addr_to_u64(&h->eth_src);
-    uint32_t *ip_src_ref = malloc(sizeof(uint32_t));
-    *ip_src_ref = ntohl(h->ip_src);
-    uint64_t *mac_src_ref = malloc(sizeof(uint64_t));
-    *mac_src_ref = mac_src;
-
-    uint32_t *stored = collections_hash_find(st->arp_table, mac_src);
-    if (stored) {
-        if (*stored != *ip_src_ref) {
-            ETHARP_DEBUG("updating ARP table entry\n");
-            collections_hash_delete(st->arp_table, mac_src);
-            collections_hash_insert(st->arp_table, mac_src, ip_src_ref);
-            collections_hash_delete(st->inv_table, *ip_src_ref);
-            collections_hash_insert(st->inv_table, *ip_src_ref, mac_src_ref);
-        } else {
-            ETHARP_DEBUG("ARP entry already stored\n");
-        }
-    } else {
-        // save info in arp-table
-        ETHARP_DEBUG("adding new ARP table entry\n");
-        collections_hash_insert(st->arp_table, mac_src, ip_src_ref);
-        collections_hash_insert(st->inv_table, *ip_src_ref, mac_src_ref);
-    }
+    arp_learn(st, ntohl(h->ip_src), &h->eth_src);
 
     // reply to it
     struct devq_buf repl;
@@ -161,7 +118,7 @@ static errval_t arp_request_handle(struct enet_queue* q, struct devq_buf* buf,
     }
 
     // write eth-header for reply
-    struct region_entry *entry = get_region(st->txq, repl.rid);
+    struct region_entry *entry = net_get_region(st->txq, repl.rid);
     lvaddr_t raddr = (lvaddr_t) entry->mem.vbase + repl.offset + repl.valid_data;
     char *ra2 = (char *) raddr;
     char *oh2 = (char *) original_header;
@@ -202,9 +159,9 @@ static errval_t arp_request_handle(struct enet_queue* q, struct devq_buf* buf,
 
 /**
  * \brief Handle an ARP reply. If addressed to this device, add the received
- * information into the local ARP table
+ * information into the local ARP table and send the frames that waited for it
  */
-static errval_t arp_reply_handle(struct enet_queue* q, struct devq_buf* buf,
+static errval_t arp_reply_handle(struct net_queue* q, struct devq_buf* buf,
                                  struct arp_hdr *h, struct enet_driver_state* st,
                                  lvaddr_t original_header) {
     errval_t err = SYS_ERR_OK;
@@ -216,29 +173,7 @@ static errval_t arp_reply_handle(struct enet_queue* q, struct devq_buf* buf,
 
     // if for us, just save contained information
     ETHARP_DEBUG("reply for me :D\n");
-    uint64_t mac_src = eth_addr_to_u64(&h->eth_src);
-    uint32_t *ip_src_ref = malloc(sizeof(uint32_t));
-    *ip_src_ref = ntohl(h->ip_src);
-    uint64_t *mac_src_ref = malloc(sizeof(uint64_t));
-    *mac_src_ref = mac_src;
-
-    uint32_t *stored = collections_hash_find(st->arp_table, mac_src);
-    if (stored) {
-        if (*stored != *ip_src_ref) {
-            ETHARP_DEBUG("updating ARP table entry\n");
-            collections_hash_delete(st->arp_table, mac_src);
-            collections_hash_insert(st->arp_table, mac_src, ip_src_ref);
-            collections_hash_delete(st->inv_table, *ip_src_ref);
-            collections_hash_insert(st->inv_table, *ip_src_ref, mac_src_ref);
-        } else {
-            ETHARP_DEBUG("ARP entry already stored\n");
-        }
-    } else {
-        // save info in arp-table
-        ETHARP_DEBUG("adding new ARP table entry\n");
-        collections_hash_insert(st->arp_table, mac_src, ip_src_ref);
-        collections_hash_insert(st->inv_table, *ip_src_ref, mac_src_ref);
-    }
+    arp_learn(st, ntohl(h->ip_src), &h->eth_src);
 
     return err;
 }
@@ -246,7 +181,7 @@ static errval_t arp_reply_handle(struct enet_queue* q, struct devq_buf* buf,
 /**
  * \breif handle an ARP request: check the packet's type and call the corresponding handler.
  */
-errval_t handle_ARP(struct enet_queue* q, struct devq_buf* buf,
+errval_t handle_ARP(struct net_queue* q, struct devq_buf* buf,
                     lvaddr_t vaddr, struct enet_driver_state* st) {
     errval_t err = SYS_ERR_OK;
     struct arp_hdr *header = (struct arp_hdr*) ((char *) vaddr + ETH_HLEN);
@@ -274,7 +209,7 @@ errval_t handle_ARP(struct enet_queue* q, struct devq_buf* buf,
  * received payload and send it.
  */
 static errval_t icmp_echo_handle(
-    struct enet_queue* q, struct devq_buf* buf,
+    struct net_queue* q, struct devq_buf* buf,
     struct icmp_echo_hdr *h, struct enet_driver_state* st,
     lvaddr_t original_header) {
     // extract some info
@@ -290,7 +225,7 @@ static errval_t icmp_echo_handle(
         return err;
     }
 
-    struct region_entry *entry = get_region(st->txq, repl.rid);
+    struct region_entry *entry = net_get_region(st->txq, repl.rid);
     lvaddr_t raddr = (lvaddr_t) entry->mem.vbase + repl.offset + repl.valid_data;
     struct eth_hdr *oeh = (struct eth_hdr *) original_header;
     struct eth_hdr *reh = (struct eth_hdr *) raddr;
@@ -322,8 +257,6 @@ static errval_t icmp_echo_handle(
     struct icmp_echo_hdr *rch = (struct icmp_echo_hdr *) ((char *) rih + IP_HLEN);
     rch->type = ICMP_ER;
     rch->code = och->code;
-    // NOTE: chksum
-    rch->chksum = 0;
     rch->id = och->id;
     rch->seqno = och->seqno;
 
@@ -331,12 +264,7 @@ static errval_t icmp_echo_handle(
     memcpy((void *) ((char *) rch) + ICMP_HLEN, (void *) ((char *) och) + ICMP_HLEN,
            ntohs(oih->len) - ICMP_HLEN - IP_HLEN);
 
-    rch->chksum = (inet_checksum((char *) rch, ntohs(oih->len) - IP_HLEN));
-
-    // IP chksum
-    rih->chksum = 0;
-    rih->chksum = (inet_checksum((void *) rih, IP_HLEN));
-    /* rih->chksum = htons(inet_checksum((void *) rch, ntohs(oih->len) - IP_HLEN)); */
+    ip_set_checksums(st, rih);
 
     repl.valid_length = ETH_HLEN + IP_HLEN + htons(rih->len) - IP_HLEN;
 
@@ -353,7 +281,7 @@ static errval_t icmp_echo_handle(
  * inside the driver, adjust its seq_rcv and seq_sent as needed.
  */
 static errval_t icmp_er_handle(
-    struct enet_queue* q, struct devq_buf* buf,
+    struct net_queue* q, struct devq_buf* buf,
     struct icmp_echo_hdr *h, struct enet_driver_state* st,
     lvaddr_t original_header) {
     struct ip_hdr *ih = (struct ip_hdr *) ((char *) original_header + ETH_HLEN);
@@ -376,7 +304,7 @@ static errval_t icmp_er_handle(
  * \brief handle an ICMP packet: check the packet's type and call
  * the corresponding handler.
  */
-static errval_t handle_ICMP(struct enet_queue* q, struct devq_buf* buf,
+static errval_t handle_ICMP(struct net_queue* q, struct devq_buf* buf,
                             struct icmp_echo_hdr *h, struct enet_driver_state* st,
                             lvaddr_t original_header) {
     errval_t err = SYS_ERR_OK;
@@ -400,7 +328,7 @@ static errval_t handle_ICMP(struct enet_queue* q, struct devq_buf* buf,
  * \brief static UDP echo server: send back all UDP payloads received
  * on port ..|.....|..|.
  */
-static errval_t udp_echo(struct enet_queue* q, struct devq_buf* buf,
+static errval_t udp_echo(struct net_queue* q, struct devq_buf* buf,
                          struct udp_hdr *h, struct enet_driver_state* st,
                          lvaddr_t original_header) {
     errval_t err = SYS_ERR_OK;
@@ -413,7 +341,7 @@ static errval_t udp_echo(struct enet_queue* q, struct devq_buf* buf,
         return err;
     }
 
-    struct region_entry *entry = get_region(st->txq, repl.rid);
+    struct region_entry *entry = net_get_region(st->txq, repl.rid);
     lvaddr_t raddr = (lvaddr_t) entry->mem.vbase + repl.offset + repl.valid_data;
     struct eth_hdr *oeh = (struct eth_hdr *) original_header;
     struct eth_hdr *reh = (struct eth_hdr *) raddr;
@@ -446,11 +374,7 @@ static errval_t udp_echo(struct enet_queue* q, struct devq_buf* buf,
     ruh->len = ouh->len;
     memcpy((char *) ruh + UDP_HLEN, (char *) ouh + UDP_HLEN, ntohs(ouh->len) - UDP_HLEN);
 
-    // NOTE: it appears, the only way to get this to work is by not setting the checksum
-    ruh->chksum = 0;
-
-    rih->chksum = 0;
-    rih->chksum = inet_checksum(rih, IP_HLEN);
+    ip_set_checksums(st, rih);
 
     repl.valid_length = ETH_HLEN + htons(rih->len);
 
@@ -467,7 +391,7 @@ static errval_t udp_echo(struct enet_queue* q, struct devq_buf* buf,
  * \brief handle UMP packets: Check if a local socket on the incoming
  * port exists. If so, add the received data to the socket's receive buffer.
  */
-static errval_t handle_UDP(struct enet_queue* q, struct devq_buf* buf,
+static errval_t handle_UDP(struct net_queue* q, struct devq_buf* buf,
                            struct udp_hdr *h, struct enet_driver_state* st,
                            lvaddr_t original_header) {
     errval_t err = SYS_ERR_OK;
@@ -485,27 +409,107 @@ static errval_t handle_UDP(struct enet_queue* q, struct devq_buf* buf,
     struct aos_udp_socket *socket = get_socket_from_port(st, d_p);
     if (socket == NULL) {
         UDP_DEBUG("no listening socket found on port %d\n", d_p);
+        st->udp_unbound++;
         return err;
     }
 
     struct ip_hdr *iihh = (struct ip_hdr*) ((char *) original_header + ETH_HLEN);
     char *payload = (char *) h + UDP_HLEN;
     err = udp_socket_append_message(socket, ntohs(h->src), ntohl(iihh->src), (void *) payload, ntohs(h->len) - UDP_HLEN);
+    if (err_no(err) == ENET_ERR_RING_FULL) {
+        st->udp_dropped++;
+    }
 
     return err;
 }
 
+/**
+ * \brief fill in the IP header checksum and the UDP or ICMP checksum of an
+ * outgoing packet. The payload has to be in place already.
+ *
+ * With checksum offload the fields are cleared, the MAC inserts them.
+ */
+void ip_set_checksums(struct enet_driver_state* st, struct ip_hdr *ih) {
+    uint16_t len = ntohs(ih->len) - IP_HLEN;
+    struct udp_hdr *uh = (struct udp_hdr *) ((char *) ih + IP_HLEN);
+    struct icmp_echo_hdr *ch = (struct icmp_echo_hdr *) ((char *) ih + IP_HLEN);
+
+    ih->chksum = 0;
+    if (ih->proto == IP_PROTO_UDP) {
+        uh->chksum = 0;
+    } else if (ih->proto == IP_PROTO_ICMP) {
+        ch->chksum = 0;
+    }
+    if (st->csum_offload) {
+        return;
+    }
+
+    ih->chksum = inet_checksum(ih, IP_HLEN);
+    if (ih->proto == IP_PROTO_UDP) {
+        uint32_t sum = inet_pseudo_sum(ih->src, ih->dest, IP_PROTO_UDP, len);
+        uint16_t c = inet_checksum_fold(inet_checksum_partial(uh, len, sum));
+        // 0 means no checksum for UDP
+        uh->chksum = c == 0 ? 0xffff : c;
+    } else if (ih->proto == IP_PROTO_ICMP) {
+        ch->chksum = inet_checksum(ch, len);
+    }
+}
+
+/**
+ * \brief verify the checksums of a received IP packet of at most len bytes
+ *
+ * With checksum offload the MAC has discarded broken packets already.
+ */
+static bool ip_checksums_ok(struct enet_driver_state* st, struct ip_hdr *ih,
+                            size_t len) {
+    size_t hlen = IPH_HL(ih) * 4;
+    size_t tot = ntohs(ih->len);
+    if (hlen < IP_HLEN || tot < hlen || tot > len) {
+        return false;
+    }
+    if (st->csum_offload) {
+        return true;
+    }
+
+    if (inet_checksum(ih, hlen) != 0) {
+        return false;
+    }
+
+    void *l4 = (char *) ih + hlen;
+    size_t l4len = tot - hlen;
+    if (ih->proto == IP_PROTO_UDP) {
+        struct udp_hdr *uh = l4;
+        if (l4len < UDP_HLEN) {
+            return false;
+        }
+        if (uh->chksum == 0) {
+            return true;
+        }
+        uint32_t sum = inet_pseudo_sum(ih->src, ih->dest, IP_PROTO_UDP, l4len);
+        return inet_checksum_fold(inet_checksum_partial(uh, l4len, sum)) == 0;
+    } else if (ih->proto == IP_PROTO_ICMP) {
+        return inet_checksum_fold(inet_checksum_partial(l4, l4len, 0)) == 0;
+    }
+    return true;
+}
+
 /**
  * \brief handle IP packet: Check its type and call the
  * corresponding handler.
  */
-errval_t handle_IP(struct enet_queue* q, struct devq_buf* buf,
+errval_t handle_IP(struct net_queue* q, struct devq_buf* buf,
                    lvaddr_t vaddr, struct enet_driver_state* st) {
     errval_t err;
     IP_DEBUG("handling IP packet\n");
     struct ip_hdr *header = (struct ip_hdr*) ((char *) vaddr + ETH_HLEN);
     print_ip_packet(header);
 
+    if (!ip_checksums_ok(st, header, buf->valid_length - ETH_HLEN)) {
+        IP_DEBUG("dropping packet with bad checksum\n");
+        st->csum_errors++;
+        return SYS_ERR_OK;
+    }
+
     IP_DEBUG("prot %d, %d, %d\n", header->proto, IP_PROTO_UDPLITE, IP_PROTO_UDP);
     switch (header->proto) {
     case IP_PROTO_ICMP:
@@ -534,11 +538,11 @@ errval_t handle_IP(struct enet_queue* q, struct devq_buf* buf,
  * \brief handle an incoming packet: Check its ETH type and call the
  * corresponding handler.
  */
-errval_t handle_packet(struct enet_queue* q, struct devq_buf* buf,
+errval_t handle_packet(struct net_queue* q, struct devq_buf* buf,
                        struct enet_driver_state* st) {
     ENET_DEBUG("handling new packet\n");
     /* print_packet(q, buf); */
-    struct region_entry *entry = get_region(q, buf->rid);
+    struct region_entry *entry = net_get_region(q, buf->rid);
     lvaddr_t vaddr = (lvaddr_t) entry->mem.vbase + buf->offset + buf->valid_data;
 
     struct eth_hdr *header = (struct eth_hdr*) vaddr;
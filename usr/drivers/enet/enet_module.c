@@ -21,6 +21,9 @@
 #include <aos/aos.h>
 #include <aos/nameserver.h>
 #include <aos/deferred.h>
+#include <aos/inthandler.h>
+#include <aos/systime.h>
+#include <drivers/gic_dist.h>
 #include <driverkit/driverkit.h>
 #include <dev/imx8x/enet_dev.h>
 #include <netutil/etharp.h>
@@ -30,22 +33,10 @@
 
 #include "enet.h"
 #include "enet_regionman.h"
+#include "net_soft.h"
 
 #define PHY_ID 0x2
 
-// NOTE: defined in other thingy too but nis
-static struct region_entry* get_region(struct enet_queue* q, regionid_t rid)
-{
-    struct region_entry* entry = q->regions;
-    while (entry != NULL) {
-        if (entry->rid == rid) {
-            return entry;
-        }
-        entry = entry->next;
-    }
-    return NULL;
-}
-
 const int DEVFRAME_ATTRIBUTES = KPI_PAGING_FLAGS_READ
     | KPI_PAGING_FLAGS_WRITE
     | KPI_PAGING_FLAGS_NOCACHE;
@@ -481,6 +472,14 @@ static errval_t enet_open(struct enet_driver_state *st)
     enet_ecr_en1588_wrf(st->d, 0x0);
     // Enable store and forward mode
     enet_tfwr_strfwd_wrf(st->d, 0x1);
+    if (st->csum_offload) {
+        // insert IP/UDP/ICMP checksums on TX (fields must be 0), drop
+        // frames with bad ones on RX (needs RSFL 0, the reset value)
+        enet_tacc_ipchk_wrf(st->d, 0x1);
+        enet_tacc_prochk_wrf(st->d, 0x1);
+        enet_racc_ipdis_wrf(st->d, 0x1);
+        enet_racc_prodis_wrf(st->d, 0x1);
+    }
     // Enable controler
     enet_ecr_etheren_wrf(st->d, 0x1);
 
@@ -547,7 +546,6 @@ static errval_t enet_init(struct enet_driver_state* st)
         return err;
     }
 
-    st->sockets = NULL;
     st->pings = NULL;
 
     return err;
@@ -590,8 +588,8 @@ static errval_t enet_probe(struct enet_driver_state* st)
  * \brief Print all hte bytes in a given packet, in hex format.
  */
 __attribute__((unused))
-static void print_packet(struct enet_queue* q, struct devq_buf* buf) {
-    struct region_entry *entry = get_region(q, buf->rid);
+static void print_packet(struct net_queue* q, struct devq_buf* buf) {
+    struct region_entry *entry = net_get_region(q, buf->rid);
     __attribute__((unused))
         char* pkt = (char*) entry->mem.vbase + buf->offset + buf->valid_data;
     for (int i = 0; i < buf->valid_length; i++) {
@@ -599,15 +597,12 @@ static void print_packet(struct enet_queue* q, struct devq_buf* buf) {
     }
 }
 
-
-int main(int argc, char *argv[]) {
+/**
+ * \brief Bring up the ENET MAC and create its queues.
+ */
+static errval_t enet_hw_setup(struct enet_driver_state* st)
+{
     errval_t err;
-
-    ENET_DEBUG("Enet driver started \n");
-    struct enet_driver_state * st = (struct enet_driver_state*)
-        calloc(1, sizeof(struct enet_driver_state));
-    assert(st != NULL);
-
     struct capref devframe = {
         .cnode = cnode_task,
         .slot = TASKCN_SLOT_DEV
@@ -634,8 +629,6 @@ int main(int argc, char *argv[]) {
     /* Initialize Mackerel binding */
     st->d = (enet_t *) malloc(sizeof(enet_t));
     enet_initialize(st->d, (void *) st->d_vaddr);
-    collections_hash_create(&st->arp_table, free);
-    collections_hash_create(&st->inv_table, free);
 
     assert(st->d != NULL);
     enet_read_mac(st);
@@ -656,18 +649,220 @@ int main(int argc, char *argv[]) {
     
     ENET_DEBUG("Creating devqs \n");
    
-    err = enet_rx_queue_create(&st->rxq, st->d);
+    struct enet_queue *rxq, *txq;
+    err = enet_rx_queue_create(&rxq, st->d);
     if (err_is_fail(err)) {
         ENET_DEBUG("Failed creating RX devq \n");
         return err;
     }
 
-    err = enet_tx_queue_create(&st->txq, st->d);
+    err = enet_tx_queue_create(&txq, st->d);
     if (err_is_fail(err)) {
         ENET_DEBUG("Failed creating RX devq \n");
         return err;
     }
 
+    st->rxq = malloc(sizeof(struct net_queue));
+    st->rxq->q = (struct devq*) rxq;
+    st->rxq->size = rxq->size;
+    st->rxq->regions = &rxq->regions;
+
+    st->txq = malloc(sizeof(struct net_queue));
+    st->txq->q = (struct devq*) txq;
+    st->txq->size = txq->size;
+    st->txq->regions = &txq->regions;
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief RX interrupt, masks itself until the ring is drained by the main loop
+ */
+static void enet_rx_irq(void *arg)
+{
+    struct enet_driver_state* st = arg;
+
+    enet_eimr_rxf_wrf(st->d, 0);
+    enet_eir_rxf_wrf(st->d, 1);
+    st->rx_pending = true;
+}
+
+/**
+ * \brief route the frame-received interrupt of ENET0 to this core
+ *
+ * Needs the GIC distributor frame in TASKCN_SLOT_BOOTINFO, without it the
+ * driver keeps polling the RX ring.
+ */
+static errval_t enet_irq_setup(struct enet_driver_state* st)
+{
+    errval_t err;
+    struct capref gic_devframe = {
+        .cnode = cnode_task,
+        .slot = TASKCN_SLOT_BOOTINFO
+    };
+
+    struct capability gic_cap;
+    err = cap_direct_identify(gic_devframe, &gic_cap);
+    if (err_is_fail(err) || gic_cap.type != ObjType_DevFrame) {
+        return ENET_ERR_NO_GIC;
+    }
+
+    void *device_frame;
+    err = paging_map_frame_attr(get_current_paging_state(), &device_frame,
+                                get_phys_size(gic_devframe), gic_devframe,
+                                DEVFRAME_ATTRIBUTES, NULL, NULL);
+    ON_ERR_RETURN(err);
+
+    struct gic_dist_s *gic_driver_state;
+    err = gic_dist_init(&gic_driver_state, device_frame);
+    ON_ERR_RETURN(err);
+
+    struct capref irq_ep;
+    err = inthandler_alloc_dest_irq_cap(IMX8X_ENET_INT, &irq_ep);
+    ON_ERR_RETURN(err);
+
+    err = inthandler_setup(irq_ep, get_default_waitset(), MKCLOSURE(enet_rx_irq, st));
+    ON_ERR_RETURN(err);
+
+    err = gic_dist_enable_interrupt(gic_driver_state, IMX8X_ENET_INT,
+                                    1 << disp_get_core_id(), 5);
+    ON_ERR_RETURN(err);
+
+    // the main loop unmasks once the ring is empty
+    enet_eir_rxf_wrf(st->d, 1);
+    st->rx_irq = true;
+    st->rx_pending = true;
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief handle up to budget received frames
+ *
+ * The buffers go back to the ring in one batch, the ring is activated once and
+ * finished transmissions are reclaimed once per pass instead of per frame.
+ *
+ * \return number of handled frames
+ */
+static size_t enet_rx_poll(struct enet_driver_state* st, size_t budget)
+{
+    errval_t err;
+    struct devq_buf bufs[ENET_RX_BUDGET];
+    size_t n = 0;
+
+    assert(budget <= ENET_RX_BUDGET);
+    while (n < budget) {
+        struct devq_buf *buf = &bufs[n];
+        err = devq_dequeue(st->rxq->q, &buf->rid, &buf->offset, &buf->length,
+                           &buf->valid_data, &buf->valid_length, &buf->flags);
+        if (err_is_fail(err)) {
+            break;
+        }
+        ENET_DEBUG("Received Packet of size %lu \n", buf->valid_length);
+        handle_packet(st->rxq, buf, st);
+        n++;
+    }
+
+    if (n == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        err = devq_enqueue(st->rxq->q, bufs[i].rid, bufs[i].offset,
+                           bufs[i].length, bufs[i].valid_data,
+                           bufs[i].valid_length,
+                           bufs[i].flags | ENET_RXQ_FLAG_BATCH);
+        assert(err_is_ok(err));
+    }
+    err = devq_notify(st->rxq->q);
+    assert(err_is_ok(err));
+
+    dequeue_bufs(st->send_qstate);
+
+    st->rx_stats.packets += n;
+    st->rx_stats.passes++;
+    if (n == budget) {
+        st->rx_stats.over_budget++;
+    }
+    return n;
+}
+
+static void enet_rx_stats_report(struct enet_driver_state* st, systime_t now)
+{
+    struct enet_rx_stats *rs = &st->rx_stats;
+    uint64_t us = systime_to_us(now - rs->window_start);
+    if (us < ENET_STATS_WINDOW_US) {
+        return;
+    }
+
+    uint64_t pps = rs->packets * 1000000 / us;
+    if (pps > rs->peak_pps) {
+        rs->peak_pps = pps;
+    }
+
+    if (st->stats) {
+        printf("enet: %" PRIu64 " pkt/s (peak %" PRIu64 "), idle %" PRIu64
+               "%%, %" PRIu64 " passes, %" PRIu64 " over budget, %s, "
+               "udp dropped %" PRIu64 " unbound %" PRIu64 ", bad csum %" PRIu64 "\n",
+               pps, rs->peak_pps, systime_to_us(rs->idle) * 100 / us,
+               rs->passes, rs->over_budget, st->rx_irq ? "irq" : "polling",
+               st->udp_dropped, st->udp_unbound, st->csum_errors);
+    }
+
+    rs->window_start = now;
+    rs->idle = 0;
+    rs->packets = 0;
+    rs->passes = 0;
+    rs->over_budget = 0;
+}
+
+/*
+ * Usage: enet [soft]
+ *
+ * With "soft", the driver runs on the software NIC instead of the ENET MAC,
+ * see net_soft.c.
+ */
+int main(int argc, char *argv[]) {
+    errval_t err;
+
+    ENET_DEBUG("Enet driver started \n");
+    struct enet_driver_state * st = (struct enet_driver_state*)
+        calloc(1, sizeof(struct enet_driver_state));
+    assert(st != NULL);
+
+    err = arp_cache_init(st);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "setting up the ARP cache");
+        return err;
+    }
+    collections_hash_create_with_buckets(&st->udp_ports, ENET_UDP_PORT_BUCKETS, NULL);
+    collections_hash_create_with_buckets(&st->udp_rids, ENET_UDP_PORT_BUCKETS, NULL);
+
+    bool soft = false, poll = false, sw_csum = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "soft") == 0) {
+            soft = true;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            st->stats = true;
+        } else if (strcmp(argv[i], "-p") == 0) {
+            poll = true;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            sw_csum = true;
+        }
+    }
+    st->csum_offload = !soft && !sw_csum;
+
+    if (soft) {
+        err = soft_nic_create(&st->soft, &st->rxq, &st->txq);
+        st->mac = SOFT_NIC_MAC;
+    } else {
+        err = enet_hw_setup(st);
+    }
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "setting up the NIC");
+        return err;
+    }
+
     // Add some memory to receive stuffa
     err = frame_alloc(&st->rx_mem, 512*2048, NULL);
     if (err_is_fail(err)) {
@@ -675,14 +870,14 @@ int main(int argc, char *argv[]) {
     }
 
     regionid_t rid;
-    err = devq_register((struct devq*) st->rxq, st->rx_mem, &rid);
+    err = devq_register(st->rxq->q, st->rx_mem, &rid);
     if (err_is_fail(err)) {
         return err;
     }
 
     // Enqueue buffers
     for (int i = 0; i < st->rxq->size-1; i++) {
-        err = devq_enqueue((struct devq*) st->rxq, rid, i*(2048), 2048,
+        err = devq_enqueue(st->rxq->q, rid, i*(2048), 2048,
                             0, 2048, 0);
         if (err_is_fail(err)) {
             return err;
@@ -694,7 +889,7 @@ int main(int argc, char *argv[]) {
         return err;
     }
 
-    err = devq_register((struct devq*) st->txq, st->tx_mem, &rid);
+    err = devq_register(st->txq->q, st->tx_mem, &rid);
     if (err_is_fail(err)) {
         return err;
     }
@@ -702,6 +897,10 @@ int main(int argc, char *argv[]) {
     // initialize region-manager for send-queue
     st->send_qstate = malloc(sizeof(struct enet_qstate));
     err = init_enet_qstate(st->txq, st->send_qstate);
+    // socket rings are registered as further regions of the TX queue
+    st->send_qstate->rid = rid;
+    st->send_qstate->foreign_done = udp_socket_tx_done;
+    st->send_qstate->foreign_arg = st;
     for (int i = 0; i < st->txq->size - 1; i++) {
         struct devq_buf *curb = malloc(sizeof(struct devq_buf));
         curb->rid = rid;
@@ -720,24 +919,45 @@ int main(int argc, char *argv[]) {
     // initialize nameserver
     name_server_initialize(st);
 
-    struct devq_buf buf;
+    if (!soft && !poll) {
+        err = enet_irq_setup(st);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "no RX interrupt, polling the ring");
+        }
+    }
+
+    st->rx_stats.window_start = systime_now();
     while(true) {
-        err = event_dispatch_non_block(get_default_waitset());
-        if(err_no(err) == LIB_ERR_NO_EVENT) {
-            err = devq_dequeue((struct devq*) st->rxq, &buf.rid, &buf.offset,
-                               &buf.length, &buf.valid_data, &buf.valid_length,
-                               &buf.flags);
-            if (err_is_ok(err)) {
-                ENET_DEBUG("Received Packet of size %lu \n", buf.valid_length);
-                handle_packet(st->rxq, &buf, st);
-                /* print_packet(st->rxq, &buf); */
-                err = devq_enqueue((struct devq*) st->rxq, buf.rid, buf.offset,
-                                   buf.length, buf.valid_data, buf.valid_length,
-                                   buf.flags);
-                assert(err_is_ok(err));
-            } else {
+        if (st->rx_irq && !st->rx_pending) {
+            // ring is drained and the interrupt armed, sleep until either
+            // a frame or a request arrives
+            systime_t start = systime_now();
+            err = event_dispatch(get_default_waitset());
+            st->rx_stats.idle += systime_now() - start;
+            if (err_is_fail(err)) {
+                DEBUG_ERR(err, "in event_dispatch");
+            }
+        } else {
+            // serve the requests that queued up during the last pass
+            while (err_is_ok(event_dispatch_non_block(get_default_waitset())));
+
+            if (st->soft != NULL) {
+                soft_nic_poll(st->soft);
+            }
+
+            size_t n = enet_rx_poll(st, ENET_RX_BUDGET);
+            if (n < ENET_RX_BUDGET && st->rx_irq) {
+                // ring drained, rearm. A frame that arrived since the
+                // dequeue raises the interrupt right away.
+                st->rx_pending = false;
+                enet_eimr_rxf_wrf(st->d, 1);
+            } else if (n == 0) {
+                systime_t start = systime_now();
                 thread_yield();
+                st->rx_stats.idle += systime_now() - start;
             }
         }
+
+        enet_rx_stats_report(st, systime_now());
     }
 }
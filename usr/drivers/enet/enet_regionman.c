@@ -3,17 +3,37 @@
 #include <aos/aos.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <driverkit/driverkit.h>
+#include <dev/imx8x/enet_dev.h>
 
 #include "enet_regionman.h"
+#include "enet.h"
+
+/**
+ * \brief Find the mapping of a region registered with a queue.
+ * \return the region, NULL if rid is not registered
+ */
+struct region_entry* net_get_region(struct net_queue* q, regionid_t rid) {
+    struct region_entry* entry = *q->regions;
+    while (entry != NULL) {
+        if (entry->rid == rid) {
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
 
 /**
  * \brief Initialize an enet-qstate-struct.
  */
-errval_t init_enet_qstate(struct enet_queue* queue,
+errval_t init_enet_qstate(struct net_queue* queue,
                                  struct enet_qstate* tgt) {
     assert(queue != NULL);
     tgt->queue = queue;
     tgt->free = NULL;
+    tgt->foreign_done = NULL;
+    tgt->foreign_arg = NULL;
     return SYS_ERR_OK;
 }
 
@@ -30,6 +50,7 @@ void qstate_append_free(struct enet_qstate* qs,
 
 /**
  * \brief Dequeues as many buffers as it can.
+ * Buffers of other regions than the own one are handed to foreign_done.
  * NOTE: the 'content' of the buffers is completely ignored.
  * DO NOT USE THIS FOR THE RECEIVE QUEUE!!!! only for the send queue
  */
@@ -37,18 +58,27 @@ errval_t dequeue_bufs(struct enet_qstate* qs) {
     struct devq_buf buf;
     errval_t err;
 
-    err = devq_dequeue((struct devq*) qs->queue, &buf.rid, &buf.offset,
+    err = devq_dequeue(qs->queue->q, &buf.rid, &buf.offset,
                        &buf.length, &buf.valid_data, &buf.valid_length,
                        &buf.flags);
 
     while (err_is_ok(err)) {
+        if (buf.rid != qs->rid && qs->foreign_done != NULL) {
+            // e.g. sent straight out of a socket's rings
+            qs->foreign_done(qs->foreign_arg, &buf);
+            err = devq_dequeue(qs->queue->q, &buf.rid, &buf.offset,
+                               &buf.length, &buf.valid_data, &buf.valid_length,
+                               &buf.flags);
+            continue;
+        }
+
         struct devq_buf* nub = calloc(1, sizeof(struct devq_buf));
         struct dev_list* nul = calloc(1, sizeof(struct dev_list));
         *nub = buf;
         nul->cur = nub;
         qstate_append_free(qs, nul);
 
-        err = devq_dequeue((struct devq*) qs->queue, &buf.rid, &buf.offset,
+        err = devq_dequeue(qs->queue->q, &buf.rid, &buf.offset,
                            &buf.length, &buf.valid_data, &buf.valid_length,
                            &buf.flags);
     }
@@ -84,11 +114,22 @@ errval_t get_free_buf(struct enet_qstate* qs, struct devq_buf* ret) {
     return SYS_ERR_OK;
 }
 
+/**
+ * \brief Give back a buffer from get_free_buf that was not enqueued.
+ */
+void put_free_buf(struct enet_qstate* qs, struct devq_buf* buf) {
+    struct devq_buf* nub = calloc(1, sizeof(struct devq_buf));
+    struct dev_list* nul = calloc(1, sizeof(struct dev_list));
+    *nub = *buf;
+    nul->cur = nub;
+    qstate_append_free(qs, nul);
+}
+
 /**
  * \brief Put a new buf into a queue.
  */
 errval_t enqueue_buf(struct enet_qstate* qs, struct devq_buf* buf) {
-    return devq_enqueue((struct devq*) qs->queue, buf->rid, buf->offset,
+    return devq_enqueue(qs->queue->q, buf->rid, buf->offset,
                         buf->length, buf->valid_data, buf->valid_length,
                         buf->flags);
 }
@@ -3,13 +3,20 @@ struct dev_list {
     struct dev_list* next;
 };
 
+// called for sent buffers that are not from the qstate's own region
+typedef void (*enet_foreign_done_t)(void *arg, struct devq_buf *buf);
+
 // struct to keep track of an entire enet-region
 struct enet_qstate {
-    struct enet_queue* queue;
+    struct net_queue* queue;
     struct dev_list* free;
+
+    regionid_t rid;  // own region, buffers of other regions are foreign
+    enet_foreign_done_t foreign_done;
+    void *foreign_arg;
 };
 
-errval_t init_enet_qstate(struct enet_queue* queue,
+errval_t init_enet_qstate(struct net_queue* queue,
                                 struct enet_qstate* tgt);
 
 void qstate_append_free(struct enet_qstate* qs,
@@ -19,4 +26,6 @@ errval_t dequeue_bufs(struct enet_qstate* qs);
 
 errval_t get_free_buf(struct enet_qstate* qs, struct devq_buf* ret);
 
+void put_free_buf(struct enet_qstate* qs, struct devq_buf* buf);
+
 errval_t enqueue_buf(struct enet_qstate* qs, struct devq_buf* buf);
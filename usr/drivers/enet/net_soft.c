@@ -0,0 +1,419 @@
+/**
+ * \file
+ * \brief Software NIC for the enet driver
+ *
+ * Stands in for the ENET MAC, so the protocol handlers and the socket
+ * service can be run and load-tested without a board. It consists of an RX
+ * and a TX devq joined by a wire: a transmitted frame is copied into the next
+ * posted RX buffer (loopback) or, if a domain has attached to the tap (see
+ * aos/net_tap.h), into the tap's from_nic ring. Frames the tap domain puts
+ * into its to_nic ring are received like frames from the network.
+ */
+
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <devif/queue_interface_backend.h>
+#include <aos/aos.h>
+#include <aos/nameserver.h>
+#include <aos/net_tap.h>
+#include <driverkit/driverkit.h>
+#include <dev/imx8x/enet_dev.h>
+
+#include "enet.h"
+#include "net_soft.h"
+
+struct soft_fifo {
+    struct devq_buf bufs[SOFT_NIC_QUEUE_SIZE];
+    size_t head;
+    size_t tail;
+    size_t num;
+};
+
+struct soft_queue {
+    struct devq q;
+    struct soft_nic* nic;
+    struct region_entry* regions;
+    struct net_queue nq;
+};
+
+struct soft_nic {
+    struct soft_queue rx;
+    struct soft_queue tx;
+
+    struct soft_fifo rx_free;  // posted by the driver, empty
+    struct soft_fifo rx_done;  // filled, not yet dequeued by the driver
+    struct soft_fifo tx_done;  // sent, not yet dequeued by the driver
+
+    struct net_tap_shm* tap;  // NULL: transmitted frames are looped back
+    struct capref tap_frame;
+
+    uint64_t rx_dropped;  // no RX buffer posted
+};
+
+static bool fifo_push(struct soft_fifo* f, struct devq_buf* buf) {
+    if (f->num == SOFT_NIC_QUEUE_SIZE) {
+        return false;
+    }
+    f->bufs[f->head] = *buf;
+    f->head = (f->head + 1) % SOFT_NIC_QUEUE_SIZE;
+    f->num++;
+    return true;
+}
+
+static bool fifo_pop(struct soft_fifo* f, struct devq_buf* buf) {
+    if (f->num == 0) {
+        return false;
+    }
+    *buf = f->bufs[f->tail];
+    f->tail = (f->tail + 1) % SOFT_NIC_QUEUE_SIZE;
+    f->num--;
+    return true;
+}
+
+static struct region_entry* soft_get_region(struct soft_queue* sq, regionid_t rid) {
+    for (struct region_entry* entry = sq->regions; entry; entry = entry->next) {
+        if (entry->rid == rid) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \brief receive a frame from the wire into the next posted RX buffer
+ */
+static void soft_nic_rx(struct soft_nic* nic, char* frame, size_t len) {
+    struct devq_buf buf;
+    if (!fifo_pop(&nic->rx_free, &buf)) {
+        nic->rx_dropped++;
+        return;
+    }
+
+    struct region_entry* entry = soft_get_region(&nic->rx, buf.rid);
+    assert(entry != NULL);
+    if (len > buf.length) {
+        len = buf.length;
+    }
+    memcpy((char*) entry->mem.vbase + buf.offset, frame, len);
+    buf.valid_data = 0;
+    buf.valid_length = len;
+
+    fifo_push(&nic->rx_done, &buf);
+}
+
+/**
+ * \brief put a transmitted frame on the wire
+ */
+static void soft_nic_wire(struct soft_nic* nic, char* frame, size_t len) {
+    struct net_tap_shm* tap = nic->tap;
+    if (tap == NULL) {
+        soft_nic_rx(nic, frame, len);
+        return;
+    }
+
+    struct net_tap_ring* r = &tap->from_nic;
+    uint32_t head = r->head;
+    if (head - r->tail >= NET_TAP_SLOTS) {
+        r->dropped++;
+        return;
+    }
+    if (len > NET_TAP_SLOT_SIZE) {
+        len = NET_TAP_SLOT_SIZE;
+    }
+    memcpy(net_tap_from_nic_buf(tap, head), frame, len);
+    r->len[head % NET_TAP_SLOTS] = len;
+    dmb();
+    r->head = head + 1;
+}
+
+/**
+ * \brief move the frames the tap domain has sent into posted RX buffers
+ * \return number of received frames
+ */
+size_t soft_nic_poll(struct soft_nic* nic) {
+    struct net_tap_shm* tap = nic->tap;
+    if (tap == NULL) {
+        return 0;
+    }
+
+    struct net_tap_ring* r = &tap->to_nic;
+    uint32_t tail = r->tail;
+    uint32_t head = r->head;
+    dmb();
+
+    size_t n = 0;
+    for (; tail != head && nic->rx_free.num > 0; tail++, n++) {
+        soft_nic_rx(nic, net_tap_to_nic_buf(tap, tail), r->len[tail % NET_TAP_SLOTS]);
+    }
+
+    dmb();
+    r->tail = tail;
+    return n;
+}
+
+static errval_t soft_register(struct devq* q, struct capref cap, regionid_t rid) {
+    struct soft_queue* sq = (struct soft_queue*) q;
+
+    struct frame_identity id;
+    errval_t err = frame_identify(cap, &id);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    void* va;
+    err = paging_map_frame_attr(get_current_paging_state(), &va, id.bytes,
+                                cap, VREGION_FLAGS_READ_WRITE, NULL, NULL);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    struct region_entry* entry = calloc(1, sizeof(struct region_entry));
+    assert(entry);
+    entry->rid = rid;
+    entry->mem.devaddr = id.base;
+    entry->mem.vbase = (lvaddr_t) va;
+    entry->mem.mem = cap;
+    entry->mem.size = id.bytes;
+    entry->next = sq->regions;
+    sq->regions = entry;
+
+    return SYS_ERR_OK;
+}
+
+static errval_t soft_deregister(struct devq* q, regionid_t rid) {
+    struct soft_queue* sq = (struct soft_queue*) q;
+
+    struct region_entry** cur = &sq->regions;
+    while (*cur != NULL && (*cur)->rid != rid) {
+        cur = &(*cur)->next;
+    }
+    if (*cur == NULL) {
+        return DEVQ_ERR_INVALID_REGION_ID;
+    }
+
+    struct region_entry* entry = *cur;
+    errval_t err = paging_unmap_frame(get_current_paging_state(),
+                                      (void*) entry->mem.vbase, entry->mem.size);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    *cur = entry->next;
+    free(entry);
+    return SYS_ERR_OK;
+}
+
+static errval_t soft_rx_enqueue(struct devq* q, regionid_t rid, genoffset_t offset,
+                                genoffset_t length, genoffset_t valid_data,
+                                genoffset_t valid_length, uint64_t flags) {
+    struct soft_nic* nic = ((struct soft_queue*) q)->nic;
+    struct devq_buf buf = {
+        .rid = rid,
+        .offset = offset,
+        .length = length,
+        .valid_data = valid_data,
+        .valid_length = valid_length,
+        .flags = flags,
+    };
+    return fifo_push(&nic->rx_free, &buf) ? SYS_ERR_OK : DEVQ_ERR_QUEUE_FULL;
+}
+
+static errval_t soft_rx_dequeue(struct devq* q, regionid_t* rid, genoffset_t* offset,
+                                genoffset_t* length, genoffset_t* valid_data,
+                                genoffset_t* valid_length, uint64_t* flags) {
+    struct soft_nic* nic = ((struct soft_queue*) q)->nic;
+    struct devq_buf buf;
+    if (!fifo_pop(&nic->rx_done, &buf)) {
+        return DEVQ_ERR_QUEUE_EMPTY;
+    }
+    *rid = buf.rid;
+    *offset = buf.offset;
+    *length = buf.length;
+    *valid_data = buf.valid_data;
+    *valid_length = buf.valid_length;
+    *flags = buf.flags;
+    return SYS_ERR_OK;
+}
+
+static errval_t soft_tx_enqueue(struct devq* q, regionid_t rid, genoffset_t offset,
+                                genoffset_t length, genoffset_t valid_data,
+                                genoffset_t valid_length, uint64_t flags) {
+    struct soft_queue* sq = (struct soft_queue*) q;
+    struct soft_nic* nic = sq->nic;
+
+    if (nic->tx_done.num == SOFT_NIC_QUEUE_SIZE) {
+        return DEVQ_ERR_QUEUE_FULL;
+    }
+
+    struct region_entry* entry = soft_get_region(sq, rid);
+    if (entry == NULL) {
+        return DEVQ_ERR_INVALID_REGION_ID;
+    }
+
+    // like the ENET MAC, the frame is on the wire when enqueue returns
+    soft_nic_wire(nic, (char*) entry->mem.vbase + offset + valid_data, valid_length);
+
+    struct devq_buf buf = {
+        .rid = rid,
+        .offset = offset,
+        .length = length,
+        .valid_data = valid_data,
+        .valid_length = valid_length,
+        .flags = flags,
+    };
+    fifo_push(&nic->tx_done, &buf);
+    return SYS_ERR_OK;
+}
+
+static errval_t soft_tx_dequeue(struct devq* q, regionid_t* rid, genoffset_t* offset,
+                                genoffset_t* length, genoffset_t* valid_data,
+                                genoffset_t* valid_length, uint64_t* flags) {
+    struct soft_nic* nic = ((struct soft_queue*) q)->nic;
+    struct devq_buf buf;
+    if (!fifo_pop(&nic->tx_done, &buf)) {
+        return DEVQ_ERR_QUEUE_EMPTY;
+    }
+    *rid = buf.rid;
+    *offset = buf.offset;
+    *length = buf.length;
+    *valid_data = 0;  // same as the ENET TX queue
+    *valid_length = buf.valid_length;
+    *flags = buf.flags;
+    return SYS_ERR_OK;
+}
+
+static errval_t soft_notify(struct devq* q) {
+    return SYS_ERR_OK;
+}
+
+static errval_t soft_control(struct devq* q, uint64_t request, uint64_t value,
+                             uint64_t* result) {
+    return SYS_ERR_OK;
+}
+
+static errval_t tap_err;
+
+/**
+ * \brief nameservice handler for NET_TAP_SERVICE_NAME
+ */
+static void soft_nic_tap_handler(void* stptr, void* message, size_t bytes,
+                                 void** response, size_t* response_bytes,
+                                 struct capref rx_cap, struct capref* tx_cap) {
+    struct soft_nic* nic = stptr;
+    enum net_tap_cmd* cmd = message;
+    struct frame_identity id;
+    void* va;
+
+    *response = &tap_err;
+    *response_bytes = sizeof(errval_t);
+
+    switch (*cmd) {
+    case NET_TAP_ATTACH:
+        if (nic->tap != NULL) {
+            tap_err = ENET_ERR_TAP_BUSY;
+            return;
+        }
+        tap_err = frame_identify(rx_cap, &id);
+        if (err_is_fail(tap_err)) {
+            return;
+        }
+        if (id.bytes < NET_TAP_SIZE) {
+            tap_err = LIB_ERR_INVALID_ARGS;
+            return;
+        }
+        tap_err = paging_map_frame_attr(get_current_paging_state(), &va, NET_TAP_SIZE,
+                                        rx_cap, VREGION_FLAGS_READ_WRITE, NULL, NULL);
+        if (err_is_fail(tap_err)) {
+            return;
+        }
+        nic->tap_frame = rx_cap;
+        nic->tap = va;
+        break;
+    case NET_TAP_DETACH:
+        if (nic->tap != NULL) {
+            tap_err = paging_unmap_frame(get_current_paging_state(), nic->tap,
+                                         NET_TAP_SIZE);
+            if (err_is_fail(tap_err)) {
+                return;
+            }
+            nic->tap = NULL;
+            cap_destroy(nic->tap_frame);
+        }
+        tap_err = SYS_ERR_OK;
+        break;
+    default:
+        tap_err = LIB_ERR_NOT_IMPLEMENTED;
+        break;
+    }
+}
+
+static errval_t soft_queue_init(struct soft_queue* sq, struct soft_nic* nic,
+                                devq_enqueue_t enq, devq_dequeue_t deq) {
+    errval_t err = devq_init(&sq->q, false);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    sq->nic = nic;
+    sq->regions = NULL;
+    sq->q.f.enq = enq;
+    sq->q.f.deq = deq;
+    sq->q.f.reg = soft_register;
+    sq->q.f.dereg = soft_deregister;
+    sq->q.f.ctrl = soft_control;
+    sq->q.f.notify = soft_notify;
+
+    sq->nq.q = &sq->q;
+    sq->nq.size = SOFT_NIC_QUEUE_SIZE;
+    sq->nq.regions = &sq->regions;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief create the software NIC and register its tap service
+ * \param rxq returns the receive queue for the protocol handlers
+ * \param txq returns the send queue for the protocol handlers
+ */
+errval_t soft_nic_create(struct soft_nic** ret, struct net_queue** rxq,
+                         struct net_queue** txq) {
+    errval_t err;
+
+    struct soft_nic* nic = calloc(1, sizeof(struct soft_nic));
+    if (nic == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    err = soft_queue_init(&nic->rx, nic, soft_rx_enqueue, soft_rx_dequeue);
+    if (err_is_fail(err)) {
+        free(nic);
+        return err;
+    }
+    err = soft_queue_init(&nic->tx, nic, soft_tx_enqueue, soft_tx_dequeue);
+    if (err_is_fail(err)) {
+        free(nic);
+        return err;
+    }
+
+    err = nameservice_register_properties(NET_TAP_SERVICE_NAME, soft_nic_tap_handler,
+                                          nic, false, "type=tap");
+    if (err_is_fail(err)) {
+        free(nic);
+        return err;
+    }
+
+    *ret = nic;
+    *rxq = &nic->rx.nq;
+    *txq = &nic->tx.nq;
+    return SYS_ERR_OK;
+}
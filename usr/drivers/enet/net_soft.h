@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef NET_SOFT_H_
+#define NET_SOFT_H_
+
+#define SOFT_NIC_QUEUE_SIZE 512
+// locally administered, 02:00:00:00:02:01
+#define SOFT_NIC_MAC 0x020000000201ULL
+
+struct soft_nic;
+struct net_queue;
+
+errval_t soft_nic_create(struct soft_nic** ret, struct net_queue** rxq,
+                         struct net_queue** txq);
+size_t soft_nic_poll(struct soft_nic* nic);
+
+#endif // NET_SOFT_H_
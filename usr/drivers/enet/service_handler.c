@@ -37,50 +37,48 @@
         USER_PANIC_ERR(err, msg);               \
     }
 
-static struct udp_msg *repl_msg;
 static char arp_tbl[2048];
 static errval_t err;
 __unused static uint16_t ping_seq;
 
-static void udp_receive_handler_ns(struct enet_driver_state* st,
-                                   struct udp_service_message *msg,
-                                   void **response, size_t *response_bytes,
-                                   struct aos_udp_socket *sock) {
-    struct udp_recv_elem *ure = udp_socket_receive(sock);
-    if (ure == NULL) {
-        /* *response = NULL; */
-        *response_bytes = 0;
-        return;
+static void tx_kick_handler_ns(struct enet_driver_state *st,
+                               struct udp_service_message *msg,
+                               void **response, size_t *response_bytes) {
+    struct aos_udp_socket *sock = get_socket_from_port(st, msg->port);
+    if (sock == NULL) {
+        err = ENET_ERR_NO_SOCKET;
+    } else {
+        err = udp_socket_tx_ring(st, sock);
+        // hand the sent slots back before we reply
+        dequeue_bufs(st->send_qstate);
     }
-
-    size_t mln = sizeof(struct udp_msg) + ure->len * sizeof(char);
-    struct udp_msg *rm = repl_msg;
-    rm->f_port = ure->f_port;
-    rm->len = ure->len;
-    rm->ip = ure->ip_addr;
-    memcpy(rm->data, ure->data, ure->len);
-
-    free(ure->data);
-    free(ure);
-    *response = (void *) rm;
-    *response_bytes = mln;
+    *response = &err;
+    *response_bytes = sizeof(errval_t);
 }
 
 static void arp_tbl_handler_ns(struct enet_driver_state* st,
                               struct udp_service_message *msg,
                               void **response, size_t *response_bytes,
                               struct aos_udp_socket *sock) {
-    if (collections_hash_traverse_start(st->arp_table) == -1) {
+    if (collections_hash_traverse_start(st->inv_table) == -1) {
         // unable to print arp-table right now
         return;
     }
     char *res = arp_tbl;
     int ri = 0;  // index into res
     uint64_t key;
-    uint32_t *curp = collections_hash_traverse_next(st->arp_table, &key);
+    struct arp_entry *cur = collections_hash_traverse_next(st->inv_table, &key);
 
-    while (curp) {
-        uint32_t ip_c = *curp;
+    for (; cur; cur = collections_hash_traverse_next(st->inv_table, &key)) {
+        if (cur->state == ARP_INCOMPLETE) {
+            continue;
+        }
+        // one line is 36 characters
+        if (ri + 36 >= (int) sizeof(arp_tbl)) {
+            break;
+        }
+
+        uint32_t ip_c = cur->ip;
         uint8_t ip_tbl[4];
 
         ip_tbl[3] = (ip_c >> 24) & 0xff;
@@ -98,16 +96,11 @@ static void arp_tbl_handler_ns(struct enet_driver_state* st,
         }
         ri += 16;
         ri += sprintf(&res[ri], "  ");
-        ri += sprintf(&res[ri], "%x:%x:%x:%x:%x:%x\n",
-                      (uint8_t) key >> 2,
-                      (uint8_t) key >> 3,
-                      (uint8_t) key >> 4,
-                      (uint8_t) key >> 5,
-                      (uint8_t) key >> 6,
-                      (uint8_t) key >> 7);
-        curp = collections_hash_traverse_next(st->arp_table, &key);
+        uint8_t *mac = cur->mac.addr;
+        ri += sprintf(&res[ri], "%02x:%02x:%02x:%02x:%02x:%02x\n",
+                      mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
     }
-    collections_hash_traverse_end(st->arp_table);
+    collections_hash_traverse_end(st->inv_table);
     res[ri++] = '\0';
 
     *response = res;
@@ -154,18 +147,18 @@ static void server_recv_handler(void *stptr, void *message,
         break;
     case RECV:
         HAN_DEBUG("Give plz\n");
+        // the application is the only consumer of a socket's RX ring
         sock = get_socket_from_port(st, msg->port);
-        if (sock == NULL) {
-            *response_bytes = 0;
-        } else {
-            udp_receive_handler_ns(st, msg, response, response_bytes,
-                                   sock);
-        }
+        err = sock == NULL ? ENET_ERR_NO_SOCKET : ENET_ERR_RING_ONLY;
+        *response = &err;
+        *response_bytes = sizeof(errval_t);
         break;
     case CREATE:
         HAN_DEBUG("Create\n");
         usci = (struct udp_socket_create_info *) msg->data;
-        ptr = create_udp_socket(st, usci->ip_dest, usci->f_port, msg->port);
+        // only over ENET_SHM_SERVICE_NAME, which carries the rings in rx_cap
+        ptr = create_udp_socket(st, usci->ip_dest, usci->f_port, msg->port,
+                                usci->rx_depth, rx_cap);
         HAN_DEBUG("==================== BP3\n");
 
         *response_bytes = sizeof(errval_t);
@@ -202,6 +195,16 @@ static void server_recv_handler(void *stptr, void *message,
     case ICMP_PING_RECV:
         ping_recv_handler_ns(st, msg->ip, response, response_bytes);
         break;
+    case TX_KICK:
+        tx_kick_handler_ns(st, msg, response, response_bytes);
+        break;
+    case RX_NOTIFY:
+        // only over ENET_SHM_SERVICE_NAME, the endpoint comes in rx_cap
+        sock = get_socket_from_port(st, msg->port);
+        err = udp_socket_set_notify(sock, rx_cap);
+        *response_bytes = sizeof(errval_t);
+        *response = &err;
+        break;
     }
 }
 
@@ -210,6 +213,7 @@ void name_server_initialize(struct enet_driver_state *st) {
     err2 = nameservice_register_properties(ENET_SERVICE_NAME, server_recv_handler, (void *) st, true,
                                           "type=ethernet,mac=secret,bugs=no-bugs-at-all-everything-is-perfect");
     PANIC_IF_FAIL(err, "failed to register...\n");
-
-    repl_msg = malloc(sizeof(struct udp_msg) + 2048 * sizeof(char));
+    err2 = nameservice_register_properties(ENET_SHM_SERVICE_NAME, server_recv_handler, (void *) st, false,
+                                          "type=ethernet");
+    PANIC_IF_FAIL(err2, "failed to register shm service...\n");
 }
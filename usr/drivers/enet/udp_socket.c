@@ -7,6 +7,7 @@
 #include <devif/backends/net/enet_devif.h>
 #include <aos/aos.h>
 #include <aos/deferred.h>
+#include <aos/systime.h>
 #include <driverkit/driverkit.h>
 #include <dev/imx8x/enet_dev.h>
 #include <netutil/etharp.h>
@@ -26,19 +27,6 @@
 static char* icmp_payload = "Thro’ the ghoul-guarded gateways of slumber";
 static const int icmp_plen = 44;
 
-// NOTE: defined in other thingy too but nis
-static struct region_entry* get_region(struct enet_queue* q, regionid_t rid)
-{
-    struct region_entry* entry = q->regions;
-    while (entry != NULL) {
-        if (entry->rid == rid) {
-            return entry;
-        }
-        entry = entry->next;
-    }
-    return NULL;
-}
-
 /* /\** */
 /*  * \brief given an id and a driver state, retrieve the corresponding udp socket. */
 /*  * \return reference to the according udp socket, NULL if none could be found */
@@ -59,84 +47,116 @@ static struct region_entry* get_region(struct enet_queue* q, regionid_t rid)
  */
 struct aos_udp_socket* get_socket_from_port(struct enet_driver_state *st,
                                             uint16_t port) {
-    for (struct aos_udp_socket *i = st->sockets; i; i = i->next) {
-        if (i->l_port == port)
-            return i;
-    }
-    return NULL;
+    return collections_hash_find(st->udp_ports, port);
 }
 
 /**
- * \brief adds a new incoming message to the provided udp-socket.
+ * \brief adds a new incoming message to the RX ring of the provided udp-socket.
  * \param data pointer to the incoming data to append
  * \param len length of the incoming message, in bytes
  * NOTE: the length should already be adjusted for the udp-header length
  * it should only describe the payload-length, without any headers.
+ * If the application has not caught up and rx_depth messages are queued
+ * already, the message is dropped.
  */
 errval_t udp_socket_append_message(struct aos_udp_socket *s, uint16_t f_port, uint32_t ip,
                                    void *data, uint32_t len) {
-    errval_t err = SYS_ERR_OK;
-
-    struct udp_recv_elem *im = malloc(sizeof(struct udp_recv_elem));
-    void *msg_ptr = malloc(sizeof(char) * len);
-    im->data = msg_ptr;
-    im->len = len;
-    im->next = NULL;
-    im->f_port = f_port;
-    im->ip_addr = ip;
-    memcpy(msg_ptr, data, len);
-
-    struct udp_recv_elem *prev_last = s->last_elem;
-    if (prev_last) {
-        prev_last->next = im;
-        s->last_elem = im;
-    } else {
-        s->receive_buffer = im;
-        s->last_elem = im;
+    struct udp_ring *rx = &s->shm->rx;
+    uint32_t head = rx->head;
+    if (head - rx->tail >= s->rx_depth) {
+        rx->dropped++;
+        s->rx_dropped++;
+        return ENET_ERR_RING_FULL;
     }
-    return err;
-}
 
-struct udp_recv_elem *udp_socket_receive(struct aos_udp_socket *s) {
-    if (s->receive_buffer == NULL) {
-        return NULL;
+    if (len > UDP_RING_SLOT_SIZE) {
+        len = UDP_RING_SLOT_SIZE;
     }
+    memcpy((char *) s->shm + udp_shm_rx_offset(head), data, len);
+
+    struct udp_ring_desc *d = &rx->desc[head % UDP_RING_SLOTS];
+    d->ip = ip;
+    d->port = f_port;
+    d->len = len;
 
-    struct udp_recv_elem *res = s->receive_buffer;
-    s->receive_buffer = res->next;
-    if (s->last_elem == res) {
-        s->last_elem = NULL;
+    // publish payload and descriptor before the head
+    dmb();
+    rx->head = head + 1;
+
+    // the head must be visible before we look at wait, see aos_socket_rx_wait()
+    dmb();
+    if (rx->wait && !capref_is_null(s->rx_notify)) {
+        rx->wait = 0;
+        // don't yield, more packets of the same burst may follow. If the
+        // endpoint is full, a notification is pending anyway.
+        lmp_ep_send0(s->rx_notify, 0, NULL_CAP);
     }
+    return SYS_ERR_OK;
+}
 
-    return res;
+/**
+ * \brief set the endpoint to signal when a parked receiver has new packets
+ */
+errval_t udp_socket_set_notify(struct aos_udp_socket *s, struct capref ep) {
+    if (s == NULL) {
+        return ENET_ERR_NO_SOCKET;
+    }
+    if (!capref_is_null(s->rx_notify)) {
+        cap_destroy(s->rx_notify);
+    }
+    s->rx_notify = ep;
+    return SYS_ERR_OK;
 }
 
 /**
  * \brief tears down an udp socket: deletes it from the driver state,
  * frees all data connected to its state.
+ *
+ * The rings are only deregistered once the NIC has handed back every slot
+ * that was sent out of them. Frames still waiting for ARP are dropped. If
+ * the NIC does not finish within UDP_TEARDOWN_TIMEOUT_US, the region stays
+ * registered and the socket stays known by its region, so late completions
+ * don't touch freed memory.
  */
 errval_t udp_socket_teardown(struct enet_driver_state *st,
                              struct aos_udp_socket *socket) {
-    // remove from linked list
-    if (st->sockets == socket) {  // easy case
-        st->sockets = socket->next;
-    } else {
-        struct aos_udp_socket *prev = st->sockets;
-        for (; prev->next && prev->next != socket; prev = prev->next)
-            ;
-
-        if (prev) {
-            prev->next = socket->next;
-        } else {
-            // should not happen
+    if (socket == NULL) {
+        return ENET_ERR_NO_SOCKET;
+    }
+
+    // no more packets in either direction
+    collections_hash_delete(st->udp_ports, socket->l_port);
+    arp_forget_region(st, socket->shm_rid);
+
+    struct udp_ring *tx = &socket->shm->tx;
+    systime_t start = systime_now();
+    dequeue_bufs(st->send_qstate);
+    while (tx->done != tx->tail
+           && systime_to_us(systime_now() - start) < UDP_TEARDOWN_TIMEOUT_US) {
+        thread_yield();
+        dequeue_bufs(st->send_qstate);
+    }
+    if (tx->done != tx->tail) {
+        debug_printf("socket on port %d still has %u packets in the NIC, "
+                     "keeping its rings registered\n", socket->l_port,
+                     tx->tail - tx->done);
+        if (!capref_is_null(socket->rx_notify)) {
+            cap_destroy(socket->rx_notify);
+            socket->rx_notify = NULL_CAP;
         }
+        return SYS_ERR_OK;
     }
 
-    // free all remaining data from in-buffer
-    for (struct udp_recv_elem *i = socket->receive_buffer;
-         i; i = i->next) {
-        free(i->data);
-        free(i);
+    collections_hash_delete(st->udp_rids, socket->shm_rid);
+
+    struct capref shm;
+    errval_t err = devq_deregister(st->txq->q, socket->shm_rid, &shm);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "deregistering socket rings");
+    }
+
+    if (!capref_is_null(socket->rx_notify)) {
+        cap_destroy(socket->rx_notify);
     }
 
     // free socket itself
@@ -148,26 +168,48 @@ errval_t udp_socket_teardown(struct enet_driver_state *st,
  * \brief create a new udp-socket with given souce-port, destination-ip/port
  * on the provided driver-state. The created socket will already be inserted
  * into `st`.
+ * \param shm frame holding the rings shared with the application, it is
+ * registered with the TX queue so packets are sent straight out of it.
+ * \param rx_depth number of RX slots that may be filled before incoming
+ * messages are dropped, 0 or more than UDP_RING_SLOTS means the whole ring.
  * \return reference to the new socket, if it was created. If it was not
  * created (presumably because a port with the same local port already exists),
  * return NULL instead.
  */
 struct aos_udp_socket* create_udp_socket(struct enet_driver_state *st,
                                          uint32_t ip_dest, uint16_t f_port,
-                                         uint16_t l_port) {
+                                         uint16_t l_port, uint16_t rx_depth,
+                                         struct capref shm) {
     struct aos_udp_socket *ex = get_socket_from_port(st, l_port);
     if (ex) {  // does another socket on that port aready exist?
         return NULL;
     }
 
-    struct aos_udp_socket *nu = malloc(sizeof(struct aos_udp_socket));
+    struct frame_identity id;
+    errval_t err = frame_identify(shm, &id);
+    if (err_is_fail(err) || id.bytes < UDP_SHM_SIZE) {
+        UDP_DEBUG("no rings for socket on port %d\n", l_port);
+        return NULL;
+    }
+
+    regionid_t rid;
+    err = devq_register(st->txq->q, shm, &rid);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "registering socket rings");
+        return NULL;
+    }
+
+    struct aos_udp_socket *nu = calloc(1, sizeof(struct aos_udp_socket));
     nu->ip_dest = ip_dest;
     nu->f_port = f_port;
     nu->l_port = l_port;
-    nu->receive_buffer = NULL;
-    nu->last_elem = NULL;
-    nu->next = st->sockets;
-    st->sockets = nu;
+    nu->shm = (struct udp_shm *) net_get_region(st->txq, rid)->mem.vbase;
+    nu->shm_rid = rid;
+    nu->rx_notify = NULL_CAP;
+    nu->rx_depth = rx_depth == 0 || rx_depth > UDP_RING_SLOTS ? UDP_RING_SLOTS
+                                                              : rx_depth;
+    collections_hash_insert(st->udp_ports, l_port, nu);
+    collections_hash_insert(st->udp_rids, rid, nu);
 
     return nu;
 }
@@ -185,7 +227,7 @@ errval_t arp_request(struct enet_driver_state *st, uint32_t ip_to) {
     }
 
     // write eth-header for request
-    struct region_entry *entry = get_region(st->txq, requ.rid);
+    struct region_entry *entry = net_get_region(st->txq, requ.rid);
     lvaddr_t raddr = (lvaddr_t) entry->mem.vbase + requ.offset + requ.valid_data;
     char *ra2 = (char *) raddr;
     memset(ra2, 0xff, 6);  // leave dest-mac empty -> dk
@@ -221,52 +263,18 @@ errval_t arp_request(struct enet_driver_state *st, uint32_t ip_to) {
 }
 
 /**
- * \brief send a UDP message over the provided port.
- * \param port outgoing port of the message.
- * NOTE: since only one connection per port is allowed, this
- * uniquely defines a UDP connection, including destination information.
- * \param data pointer to the payload to send
- * \param len length of the payload. This implementation does not (yet)
- * support fragmentation etc. If the payload is too long for a single
- * UDP message, it will simply be truncated.
+ * \brief write the ETH, IP and UDP headers for a payload of len bytes
+ * into frame, the payload has to be in place at UDP_FRAME_HLEN already, as
+ * the UDP checksum covers it. The destination MAC is left to arp_output().
  */
-errval_t udp_socket_send(struct enet_driver_state *st, uint16_t port,
-                         void *data, uint16_t len) {
+static void udp_write_headers(struct enet_driver_state *st, char *frame,
+                              uint16_t port, uint32_t ip_to,
+                              uint16_t port_to, uint16_t len) {
     static uint16_t generic_id = 5555;  // NOTE: maybe store in socket obj instead
-    // possibly truncate len
-    if (len > UDP_SOCK_MAX_LEN)
-        len = UDP_SOCK_MAX_LEN;
-    const uint16_t eth_tot_len = len + ETH_HLEN + IP_HLEN + UDP_HLEN;
-
-    errval_t err;
-    struct aos_udp_socket *sock = get_socket_from_port(st, port);
-    if (sock == NULL) {
-        return ENET_ERR_NO_SOCKET;
-    }
-
-    // get packeT
-    struct devq_buf repl;
-    err = get_free_buf(st->send_qstate, &repl);
-    if (err_is_fail(err)) {
-        UDP_DEBUG("un4ble 2 get free buffer\n");
-        return err;
-    }
-
-    struct region_entry *entry = get_region(st->txq, repl.rid);
-    lvaddr_t maddr = (lvaddr_t) entry->mem.vbase + repl.offset + repl.valid_data;
-    struct eth_hdr *meh = (struct eth_hdr *) maddr;
-    uint64_t *mac_tgt = collections_hash_find(st->inv_table, sock->ip_dest);
-
-    if (mac_tgt == NULL) {
-        UDP_DEBUG("but...where (not to)? %d\n", sock->ip_dest);
-        print_arp_table(st);
-        err = arp_request(st, sock->ip_dest);
-        return err_is_fail(err) ? err : ENET_ERR_ARP_UNKNOWN;
-    }
 
     // write ETH header
     UDP_DEBUG("writing ETH header\n");
-    u64_to_eth_addr(*mac_tgt, &meh->dst);
+    struct eth_hdr *meh = (struct eth_hdr *) frame;
     uint8_t* macref = (uint8_t *) &(st->mac);
     for (int i = 0; i < 6; i++) {
         meh->src.addr[i] = macref[5 - i];
@@ -278,46 +286,51 @@ errval_t udp_socket_send(struct enet_driver_state *st, uint16_t port,
     struct ip_hdr *mih = (struct ip_hdr *) ((char *) meh + ETH_HLEN);
     IPH_VHL_SET(mih, 4, 5);
     mih->tos = 0;  // ?
-    mih->len = htons(eth_tot_len - ETH_HLEN);
+    mih->len = htons(IP_HLEN + UDP_HLEN + len);
     mih->id = ++generic_id;
     mih->offset = 0;
     mih->ttl = 64;
     mih->proto = IP_PROTO_UDP;
     mih->src = htonl(STATIC_ENET_IP);
-    mih->dest = htonl(sock->ip_dest);
-    mih->chksum = 0;
-    mih->chksum = inet_checksum(mih, IP_HLEN);
+    mih->dest = htonl(ip_to);
 
     // write UDP header
     UDP_DEBUG("writing UDP header\n");
     struct udp_hdr *muh = (struct udp_hdr *) ((char *) mih + IP_HLEN);
     muh->src = htons(port);
-    muh->dest = htons(sock->f_port);
-    muh->len = htons(len);
-    muh->chksum = 0;
-
-    // copy payload
-    UDP_DEBUG("writing payload\n");
-    memcpy((char *) muh + UDP_HLEN, data, len);
-    repl.valid_length = eth_tot_len;
+    muh->dest = htons(port_to);
+    muh->len = htons(UDP_HLEN + len);
 
-    dmb();
+    ip_set_checksums(st, mih);
+}
 
-    UDP_DEBUG("=========== SENDING MESSAGE\n");
-    err = enqueue_buf(st->send_qstate, &repl);
+/**
+ * \brief send a UDP message over the provided port.
+ * \param port outgoing port of the message.
+ * NOTE: since only one connection per port is allowed, this
+ * uniquely defines a UDP connection, including destination information.
+ * \param data pointer to the payload to send
+ * \param len length of the payload. This implementation does not (yet)
+ * support fragmentation etc. If the payload is too long for a single
+ * UDP message, it will simply be truncated.
+ */
+errval_t udp_socket_send(struct enet_driver_state *st, uint16_t port,
+                         void *data, uint16_t len) {
+    struct aos_udp_socket *sock = get_socket_from_port(st, port);
+    if (sock == NULL) {
+        return ENET_ERR_NO_SOCKET;
+    }
 
-    return err;
+    return udp_socket_send_to(st, port, data, len, sock->ip_dest, sock->f_port);
 }
 
 errval_t udp_socket_send_to(struct enet_driver_state *st, uint16_t port,
                             void *data, uint16_t len, uint32_t ip_to,
                             uint16_t port_to) {
     UDP_DEBUG("sending to\n");
-    static uint16_t generic_id = 5555;  // NOTE: maybe store in socket obj instead
     // possibly truncate len
     if (len > UDP_SOCK_MAX_LEN)
         len = UDP_SOCK_MAX_LEN;
-    const uint16_t eth_tot_len = len + ETH_HLEN + IP_HLEN + UDP_HLEN;
 
     errval_t err;
     struct aos_udp_socket *sock = get_socket_from_port(st, port);
@@ -336,61 +349,110 @@ errval_t udp_socket_send_to(struct enet_driver_state *st, uint16_t port,
     }
 
     UDP_DEBUG("getting buf and so on\n");
-    struct region_entry *entry = get_region(st->txq, repl.rid);
-    lvaddr_t maddr = (lvaddr_t) entry->mem.vbase + repl.offset + repl.valid_data;
-    struct eth_hdr *meh = (struct eth_hdr *) maddr;
-    uint64_t *mac_tgt = collections_hash_find(st->inv_table, ip_to);
+    struct region_entry *entry = net_get_region(st->txq, repl.rid);
+    char *frame = (char *) entry->mem.vbase + repl.offset + repl.valid_data;
+
+    // copy payload, the checksum covers it
+    UDP_DEBUG("writing payload\n");
+    memcpy(frame + UDP_FRAME_HLEN, data, len);
+    repl.valid_length = UDP_FRAME_HLEN + len;
+
+    udp_write_headers(st, frame, port, ip_to, port_to, len);
 
-    if (mac_tgt == NULL) {
-        UDP_DEBUG("but...where? %d\n", ip_to);
-        print_arp_table(st);
-        err = arp_request(st, ip_to);
-        return err_is_fail(err) ? err : ENET_ERR_ARP_UNKNOWN;
+    UDP_DEBUG("=========== SENDING MESSAGE\n");
+    // sent right away, or once the MAC of ip_to is known
+    err = arp_output(st, ip_to, &repl);
+    if (err_is_fail(err)) {
+        put_free_buf(st->send_qstate, &repl);
     }
 
-    // write ETH header
-    UDP_DEBUG("writing ETH header\n");
-    u64_to_eth_addr(*mac_tgt, &meh->dst);
-    uint8_t* macref = (uint8_t *) &(st->mac);
-    for (int i = 0; i < 6; i++) {
-        meh->src.addr[i] = macref[5 - i];
+    return err;
+}
+
+/**
+ * \brief mark a TX slot of a socket as sent and give all slots up to the
+ * first one still in flight back to the application
+ */
+static void udp_socket_tx_slot_done(struct aos_udp_socket *s, uint32_t slot) {
+    struct udp_ring *tx = &s->shm->tx;
+    s->tx_sent[slot % UDP_RING_SLOTS] = true;
+
+    uint32_t done = tx->done;
+    while (done != tx->tail && s->tx_sent[done % UDP_RING_SLOTS]) {
+        s->tx_sent[done % UDP_RING_SLOTS] = false;
+        done++;
     }
-    meh->type = htons(ETH_TYPE_IP);
+    tx->done = done;
+}
 
-    // write IP header
-    UDP_DEBUG("writing IP header\n");
-    struct ip_hdr *mih = (struct ip_hdr *) ((char *) meh + ETH_HLEN);
-    IPH_VHL_SET(mih, 4, 5);
-    mih->tos = 0;  // ?
-    mih->len = htons(eth_tot_len - ETH_HLEN);
-    mih->id = ++generic_id;
-    mih->offset = 0;
-    mih->ttl = 64;
-    mih->proto = IP_PROTO_UDP;
-    mih->src = htonl(STATIC_ENET_IP);
-    mih->dest = htonl(ip_to);
-    mih->chksum = 0;
-    mih->chksum = inet_checksum(mih, IP_HLEN);
+/**
+ * \brief hand all packets the application has queued in the TX ring of a
+ * socket to the NIC, without copying them
+ * \return the error of the first packet that could not be sent
+ */
+errval_t udp_socket_tx_ring(struct enet_driver_state *st,
+                            struct aos_udp_socket *s) {
+    errval_t ret = SYS_ERR_OK;
+    struct udp_ring *tx = &s->shm->tx;
+    uint32_t head = tx->head;
+    // read the descriptors only after seeing the head
+    dmb();
 
-    // write UDP header
-    UDP_DEBUG("writing UDP header\n");
-    struct udp_hdr *muh = (struct udp_hdr *) ((char *) mih + IP_HLEN);
-    muh->src = htons(port);
-    muh->dest = htons(port_to);
-    muh->len = htons(eth_tot_len - ETH_HLEN - IP_HLEN);
-    muh->chksum = 0;
+    // the application owns the slots from tx.done on, never more than the
+    // ring. Anything else is a bogus head, don't send stale slots for it.
+    if (head - tx->done > UDP_RING_SLOTS) {
+        return ENET_ERR_RING_BAD_HEAD;
+    }
 
-    // copy payload
-    UDP_DEBUG("writing payload\n");
-    memcpy((char *) muh + UDP_HLEN, data, len);
-    repl.valid_length = eth_tot_len;
+    while (tx->tail != head) {
+        uint32_t idx = tx->tail;
+        struct udp_ring_desc d = tx->desc[idx % UDP_RING_SLOTS];
+        uint16_t len = d.len > UDP_RING_MAX_PAYLOAD ? UDP_RING_MAX_PAYLOAD : d.len;
+
+        genoffset_t offset = udp_shm_tx_offset(idx);
+        genoffset_t valid_data = UDP_RING_HEADROOM - UDP_FRAME_HLEN;
+        char *frame = (char *) s->shm + offset + valid_data;
+
+        udp_write_headers(st, frame, s->l_port, d.ip, d.port, len);
+        struct devq_buf buf = {
+            .rid = s->shm_rid,
+            .offset = offset,
+            .length = UDP_RING_SLOT_SIZE,
+            .valid_data = valid_data,
+            .valid_length = UDP_FRAME_HLEN + len,
+            .flags = 0
+        };
+        // slots waiting for ARP are completed when sent or given up on
+        errval_t err = arp_output(st, d.ip, &buf);
+        if (err_no(err) == DEVQ_ERR_QUEUE_FULL) {
+            // try again with the next kick
+            break;
+        }
 
-    dmb();
+        tx->tail = idx + 1;
+        if (err_is_fail(err)) {
+            tx->dropped++;
+            udp_socket_tx_slot_done(s, idx);
+            if (err_is_ok(ret)) {
+                ret = err;
+            }
+        }
+    }
 
-    UDP_DEBUG("=========== SENDING MESSAGE\n");
-    err = enqueue_buf(st->send_qstate, &repl);
+    return ret;
+}
 
-    return err;
+/**
+ * \brief called for sent buffers of the TX queue that belong to a socket
+ */
+void udp_socket_tx_done(void *arg, struct devq_buf *buf) {
+    struct enet_driver_state *st = arg;
+
+    struct aos_udp_socket *s = collections_hash_find(st->udp_rids, buf->rid);
+    if (s != NULL) {
+        uint32_t slot = (buf->offset - UDP_SHM_TX_BUFS) / UDP_RING_SLOT_SIZE;
+        udp_socket_tx_slot_done(s, slot);
+    }
 }
 
 /**
@@ -467,14 +529,6 @@ errval_t ping_socket_send_next(struct enet_driver_state *st, uint32_t ip) {
         return ENET_ERR_NO_SOCKET;
     }
 
-    // check if arp known
-    uint64_t *mac_tgt = collections_hash_find(st->inv_table, ip);
-    if (mac_tgt == NULL) {
-        ICMP_DEBUG("unknown ping-destination %d\n", ip);
-        err = arp_request(st, ip);
-        return err_is_fail(err) ? err : ENET_ERR_ARP_UNKNOWN;
-    }
-
     uint16_t seqno;
     if (is->seq_sent == is->seq_rcv) {
         seqno = ++is->seq_sent;
@@ -492,13 +546,12 @@ errval_t ping_socket_send_next(struct enet_driver_state *st, uint32_t ip) {
         return err;
     }
 
-    struct region_entry *entry = get_region(st->txq, repl.rid);
+    struct region_entry *entry = net_get_region(st->txq, repl.rid);
     lvaddr_t maddr = (lvaddr_t) entry->mem.vbase + repl.offset + repl.valid_data;
     struct eth_hdr *meh = (struct eth_hdr *) maddr;
 
-    // write ETH header
+    // write ETH header, the destination is filled in by arp_output()
     ICMP_DEBUG("writing ETH header\n");
-    u64_to_eth_addr(*mac_tgt, &meh->dst);
     uint8_t* macref = (uint8_t *) &(st->mac);
     for (int i = 0; i < 6; i++) {
         meh->src.addr[i] = macref[5 - i];
@@ -517,28 +570,26 @@ errval_t ping_socket_send_next(struct enet_driver_state *st, uint32_t ip) {
     mih->proto = IP_PROTO_ICMP;
     mih->src = htonl(STATIC_ENET_IP);
     mih->dest = htonl(ip);
-    mih->chksum = 0;
-    mih->chksum = inet_checksum(mih, IP_HLEN);
 
     // write ICMP header
     ICMP_DEBUG("writing ICMP header\n");
     struct icmp_echo_hdr *mieh = (struct icmp_echo_hdr *) ((char *) mih + IP_HLEN);
     mieh->type = ICMP_ECHO;
     mieh->code = 0;  // ?
-    mieh->chksum = 0;
     mieh->id = htons(pkid);
     mieh->seqno = htons(seqno);
 
     memcpy((void *) ((char *) mieh) + ICMP_HLEN, icmp_payload,
            icmp_plen);
-    mieh->chksum = (inet_checksum((char *) mieh, icmp_plen + ICMP_HLEN));
+    ip_set_checksums(st, mih);
 
     repl.valid_length = ETH_HLEN + IP_HLEN + ICMP_HLEN + icmp_plen;
 
-    dmb();
-
     ICMP_DEBUG("=========== SENDING REQUEST\n");
-    enqueue_buf(st->send_qstate, &repl);
+    err = arp_output(st, ip, &repl);
+    if (err_is_fail(err)) {
+        put_free_buf(st->send_qstate, &repl);
+    }
 
     return err;
 }
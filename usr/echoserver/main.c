@@ -1,17 +1,58 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <aos/aos.h>
+#include <aos/systime.h>
 #include <aos/udp_service.h>
 #define MK_IP(a,b,c,d) (((a)<<24)|((b)<<16)|((c)<<8)|(d))
 
+// report the echoed packets per second this often
+#define STATS_INTERVAL_US 1000000
+
+/**
+ * \brief echo everything in the RX ring straight from the ring buffers
+ * \return number of echoed packets
+ */
+static size_t echo_pending(struct aos_socket *sock) {
+    size_t n = 0;
+    struct aos_socket_buf in, out;
+
+    while (err_is_ok(aos_socket_rx_next(sock, &in))) {
+        errval_t err = aos_socket_tx_get(sock, &out);
+        if (err_is_fail(err)) {
+            // the driver sends synchronously, send what we have so far
+            aos_socket_tx_kick(sock);
+            err = aos_socket_tx_get(sock, &out);
+            if (err_is_fail(err)) {
+                break;
+            }
+        }
+
+        memcpy(out.data, in.data, in.len);
+        out.ip = in.ip;
+        out.port = in.port;
+        out.len = in.len;
+        aos_socket_tx_put(sock, &out);
+        aos_socket_rx_release(sock, &in);
+        n++;
+    }
+
+    // one doorbell for the whole batch
+    if (n > 0) {
+        aos_socket_tx_kick(sock);
+    }
+    return n;
+}
+
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        printf("invalid number of arguments! EXIT\n");
+    if (argc < 2) {
+        printf("usage: %s port [-s]\n", argv[0]);
         return EXIT_SUCCESS;
     }
 
     int port = atoi(argv[1]);
+    bool stats = argc > 2 && strcmp(argv[2], "-s") == 0;
 
     errval_t err;
     printf("starting echo-server on port %d\n", port);
@@ -23,20 +64,30 @@ int main(int argc, char **argv) {
         return EXIT_SUCCESS;
     }
 
-    struct udp_msg *in = malloc(sizeof(struct udp_msg) + 2048 * sizeof(char));
+    uint64_t echoed = 0;
+    systime_t last = systime_now();
     while (1) {
-        err = aos_socket_receive(&sock, in);
+        size_t n = echo_pending(&sock);
+        echoed += n;
 
-        if (err_is_fail(err)) {
-            thread_yield();
-            continue;
+        if (stats) {
+            systime_t now = systime_now();
+            uint64_t us = systime_to_us(now - last);
+            if (us >= STATS_INTERVAL_US) {
+                printf("echoserver: %" PRIu64 " pkt/s, rx dropped %u, tx dropped %u\n",
+                       echoed * 1000000 / us, sock.shm->rx.dropped,
+                       sock.shm->tx.dropped);
+                echoed = 0;
+                last = now;
+            }
         }
 
-        // printf("received message:\n%s", in->data);
-        aos_socket_send_to(&sock, in->data, in->len, in->ip, in->f_port);
+        if (n == 0) {
+            // park until the driver fills the ring
+            aos_socket_rx_wait(&sock);
+        }
     }
 
     aos_socket_teardown(&sock);
-    free(in);
     return EXIT_SUCCESS;
 }
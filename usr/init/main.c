@@ -50,6 +50,7 @@
 
 #include <process_manager_interface.h>
 #include <fs/fs.h>
+#include <trace/trace.h>
 
 
 
@@ -233,6 +234,22 @@ static errval_t start_josh_on_serial(void)
 }
 
 
+#ifdef CONFIG_TRACE
+/**
+ * \brief Sets up the trace buffer of this core and starts recording
+ */
+static void setup_tracing(void)
+{
+    errval_t err = trace_setup_on_core(NULL);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "Failed to set up the trace buffer");
+        return;
+    }
+    trace_set_all_subsys_enabled(true);
+    trace_control(0, 0, 0);
+}
+#endif
+
 __unused static void handle_fast_RTT(void * arg){
     debug_printf("Here\n");
     return;
@@ -261,6 +278,10 @@ static int bsp_main(int argc, char *argv[])
         DEBUG_ERR(err, "/>/> Error: starting memory thread");
     }
 
+#ifdef CONFIG_TRACE
+    setup_tracing();
+#endif
+
     // Grading
 
     grading_test_mm(&aos_mm);
@@ -282,10 +303,14 @@ static int bsp_main(int argc, char *argv[])
     
 
 
-    spawn_new_core(1);
-    spawn_new_core(2);
-    spawn_new_core(3);
-    barrelfish_usleep(500000);
+    err = spawn_app_cores(4);
+    if(err_is_fail(err)){
+        DEBUG_ERR(err,"Failed to boot application cores\n");
+    }
+    err = spawn_wait_cores_ready(SPAWN_CORES_TIMEOUT_US);
+    if(err_is_fail(err)){
+        DEBUG_ERR(err,"Application cores did not come up\n");
+    }
 
     init_filesystemserver();
 
@@ -341,6 +366,10 @@ static int app_main(int argc, char *argv[])
     if(err_is_fail(err)){
         DEBUG_ERR(err,"Failed to initialize ram and bootinfo for new core core\n");
     }
+
+#ifdef CONFIG_TRACE
+    setup_tracing();
+#endif
     
 
     grading_setup_app_init(bi);
@@ -6,6 +6,7 @@
 #include "mem_alloc.h"
 #include <mm/mm.h>
 #include <aos/paging.h>
+#include <aos/aos_rpc.h>
 #include <grading.h>
 
 /// MM allocator instance data
@@ -13,9 +14,59 @@ struct mm aos_mm;
 
 struct bootinfo *bi;
 
+/// Size of the chunks an app core requests from core 0, and chunks per request
+#define FOREIGN_RAM_CHUNK_SIZE  (4 * 1024 * 1024)
+#define FOREIGN_RAM_BATCH       16
+
+/**
+ * \brief get more ram for an app core from core 0, in one batch
+ */
+static errval_t foreign_ram_refill(size_t size, size_t alignment)
+{
+    static bool refilling = false;
+    errval_t err;
+
+    struct aos_rpc *core0 = get_core_channel(0);
+    // forging the batch may need slots, whose refill may need ram again
+    if (core0 == NULL || refilling) {
+        return MM_ERR_NOT_FOUND;
+    }
+
+    // a request above the chunk size gets a chunk of its own, nothing more
+    size_t chunk = ROUND_UP(size + alignment, BASE_PAGE_SIZE);
+    size_t n_chunks = FOREIGN_RAM_BATCH;
+    if (chunk > FOREIGN_RAM_CHUNK_SIZE) {
+        n_chunks = 1;
+    } else {
+        chunk = FOREIGN_RAM_CHUNK_SIZE;
+    }
+
+    struct capref caps[AOS_RPC_CAP_BATCH_MAX];
+    size_t n;
+    refilling = true;
+    err = aos_rpc_request_foreign_ram_batch(core0, chunk, n_chunks, caps, &n);
+    refilling = false;
+    // add whatever was forged, even if the batch was cut short
+    for (size_t i = 0; i < n; i++) {
+        errval_t add_err = add_foreign_ram_cap(caps[i]);
+        if (err_is_fail(add_err)) {
+            DEBUG_ERR(add_err, "adding ram from core 0");
+        }
+    }
+    ON_ERR_RETURN(err);
+    return n > 0 ? SYS_ERR_OK : MM_ERR_NOT_FOUND;
+}
+
 errval_t aos_ram_alloc_aligned(struct capref *ret, size_t size, size_t alignment)
 {
-    return mm_alloc_aligned(&aos_mm, size, alignment, ret);
+    errval_t err = mm_alloc_aligned(&aos_mm, size, alignment, ret);
+    if (err_is_fail(err) && disp_get_core_id() != 0) {
+        if (err_is_fail(foreign_ram_refill(size, alignment))) {
+            return err;
+        }
+        err = mm_alloc_aligned(&aos_mm, size, alignment, ret);
+    }
+    return err;
 }
 
 errval_t aos_ram_free(struct capref cap)
@@ -178,6 +178,38 @@ void handle_request_ram(struct aos_rpc *r, uintptr_t size, uintptr_t alignment,
     }
 }
 
+/**
+ * \brief handler function for ram requests of init on another core
+ *
+ * Allocates up to n_chunks chunks and returns them packed, stops early when
+ * the local allocator runs out.
+ */
+void handle_request_ram_batch(struct aos_rpc *r, uintptr_t chunk_size,
+                              uintptr_t n_chunks, struct aos_rpc_varbytes *caps)
+{
+    errval_t err;
+    struct capref chunks[AOS_RPC_CAP_BATCH_MAX];
+    size_t n;
+
+    n_chunks = n_chunks > AOS_RPC_CAP_BATCH_MAX ? AOS_RPC_CAP_BATCH_MAX : n_chunks;
+    for (n = 0; n < n_chunks; n++) {
+        err = ram_alloc(&chunks[n], chunk_size);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "remote ram batch stopped after %zu chunks", n);
+            break;
+        }
+    }
+
+    err = aos_rpc_cap_batch_pack(chunks, n, caps);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "packing remote ram batch");
+        caps->length = 0;
+        for (size_t i = 0; i < n; i++) {
+            aos_ram_free(chunks[i]);
+        }
+    }
+}
+
 /**
  * \brief handler function for initiate rpc call
  * 
@@ -281,6 +313,40 @@ void handle_spawn_extended(struct aos_rpc *rpc, struct aos_rpc_varbytes request,
 }
 
 
+void handle_spawn_clone(struct aos_rpc *rpc, const char *cmdline, uintptr_t core_id,
+                        struct capref state, uintptr_t *new_pid)
+{
+    errval_t err;
+    coreid_t current_core_id = disp_get_core_id();
+
+    if (core_id == current_core_id) {
+        domainid_t pid;
+        err = spawn_clone_domain(cmdline, state, &pid);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "Failed to spawn clone\n");
+            pid = MOD_NOT_FOUND;
+        }
+        *new_pid = pid;
+    }
+    else {
+        // application cores are only reachable through core 0
+        struct aos_rpc *core_rpc = get_core_channel(current_core_id == 0 ? core_id : 0);
+        if (core_rpc == NULL) {
+            *new_pid = COREID_INVALID;
+        }
+        else {
+            err = aos_rpc_call(core_rpc, INIT_IFACE_SPAWN_CLONE, cmdline, core_id, state, new_pid);
+            if (err_is_fail(err)) {
+                DEBUG_ERR(err, "Failed to forward spawn clone to core %d\n", core_id);
+            }
+        }
+    }
+
+    // the child and the forwarded call hold their own copies
+    cap_destroy(state);
+}
+
+
 void handle_ns_on(struct aos_rpc *r){
     set_ns_online();
 }
@@ -428,6 +494,11 @@ void handle_forward_ns_reg(struct aos_rpc *rpc,uintptr_t core_id,const char* nam
     if(err_is_fail(err)){
         DEBUG_ERR(err,"Failed to forward ns reg!\n");
     }
+
+    // init on an application core registers once it is up
+    if(err_is_ok(err) && core_id != 0 && disp_get_core_id() == 0 && strcmp(name,"init") == 0){
+        spawn_core_ready(core_id);
+    }
 }
 
 
@@ -664,6 +735,7 @@ errval_t initialize_rpc_handlers(struct aos_rpc *rpc)
     //INIT INTERFACE (MOSTLY FORWARDING)
     aos_rpc_register_handler(rpc, INIT_IFACE_SPAWN, &handle_spawn);
     aos_rpc_register_handler(rpc, INIT_IFACE_SPAWN_EXTENDED, &handle_spawn_extended);
+    aos_rpc_register_handler(rpc, INIT_IFACE_SPAWN_CLONE, &handle_spawn_clone);
     aos_rpc_register_handler(rpc, INIT_NAMESERVER_ON, &handle_ns_on);
     aos_rpc_register_handler(rpc,INIT_REG_NAMESERVER,&handle_forward_ns_reg);
     aos_rpc_register_handler(rpc,INIT_MULTI_HOP_CON,&handle_multi_hop_init);
@@ -674,6 +746,7 @@ errval_t initialize_rpc_handlers(struct aos_rpc *rpc)
     aos_rpc_register_handler(rpc,INIT_BINDING_REQUEST,&handle_binding_request);
     aos_rpc_register_handler(rpc, INIT_IFACE_GET_ALL_MODULES, &handle_get_all_modules);
     aos_rpc_register_handler(rpc,INIT_FS_ON,&handle_fs_on);
+    aos_rpc_register_handler(rpc, INIT_IFACE_GET_RAM_BATCH, &handle_request_ram_batch);
 
     return SYS_ERR_OK;
 }
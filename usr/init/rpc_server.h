@@ -29,12 +29,16 @@ void handle_getchar(struct aos_rpc *r, uintptr_t *c);
 void handle_request_ram(struct aos_rpc *r, uintptr_t size,
                         uintptr_t alignment, struct capref *cap,
                         uintptr_t *ret_size);
+void handle_request_ram_batch(struct aos_rpc *r, uintptr_t chunk_size,
+                              uintptr_t n_chunks, struct aos_rpc_varbytes *caps);
 void handle_initiate(struct aos_rpc *rpc, struct capref cap);
 void handle_spawn(struct aos_rpc *old_rpc, const char *name,
                   uintptr_t core_id, uintptr_t *new_pid);
 void handle_spawn_extended(struct aos_rpc *rpc, struct aos_rpc_varbytes request,
                            uintptr_t core_id, struct capref spawner_ep, struct capref stdin_cap,
                            struct capref stdout_cap, uintptr_t *new_pid);
+void handle_spawn_clone(struct aos_rpc *rpc, const char *cmdline, uintptr_t core_id,
+                        struct capref state, uintptr_t *new_pid);
 void handle_foreign_spawn(struct aos_rpc *origin_rpc, const char *name,
                           uintptr_t core_id, uintptr_t *new_pid);
 // void handle_send_number(struct aos_rpc *r, uintptr_t number);
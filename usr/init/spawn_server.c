@@ -9,16 +9,87 @@
 #include <aos/default_interfaces.h>
 #include <aos/aos_datachan.h>
 #include <aos/coreboot.h>
+#include <aos/systime.h>
 
 #include <maps/imx8x_map.h>
 
 
+static const char *boot_driver = "boot_armv8_generic";
+static const char *cpu_driver = "cpu_imx8x";
+static const char *init_binary = "init";
+
+/// cores released by spawn_new_core and cores whose init registered since
+static uint64_t cores_started;
+static uint64_t cores_ready;
+static systime_t cores_boot_start;
+
+
+/**
+ * \brief boot cores 1 to n_cores - 1 without waiting for any of them
+ *
+ * The boot modules are prepared once, then each core is released as soon as
+ * its memory is set up, so it boots while the next one is prepared.
+ * spawn_wait_cores_ready() waits for them to come up.
+ */
+errval_t spawn_app_cores(coreid_t n_cores)
+{
+    errval_t err;
+    cores_boot_start = systime_now();
+
+    err = coreboot_prepare_images(boot_driver, cpu_driver, init_binary);
+    ON_ERR_RETURN(err);
+
+    for (coreid_t core = 1; core < n_cores; core++) {
+        err = spawn_new_core(core);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "Failed to spawn core %d", core);
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+
+/**
+ * \brief called when init on an application core registered itself
+ */
+void spawn_core_ready(coreid_t core)
+{
+    cores_ready |= 1ULL << core;
+}
+
+
+/**
+ * \brief handle messages until all started cores are ready
+ *
+ * \return SPAWN_ERR_CORES_TIMEOUT if a core did not come up within timeout_us
+ */
+errval_t spawn_wait_cores_ready(uint64_t timeout_us)
+{
+    errval_t err;
+    struct waitset *ws = get_default_waitset();
+    while (cores_ready != cores_started) {
+        if (systime_to_us(systime_now() - cores_boot_start) > timeout_us) {
+            debug_printf("cores not ready: 0x%lx\n", cores_started & ~cores_ready);
+            return SPAWN_ERR_CORES_TIMEOUT;
+        }
+        err = event_dispatch_non_block(ws);
+        if (err == LIB_ERR_NO_EVENT) {
+            thread_yield();
+        }
+        else if (err_is_fail(err)) {
+            return err;
+        }
+    }
+    debug_printf("all %d application cores ready after %lu us\n",
+                 __builtin_popcountll(cores_ready),
+                 systime_to_us(systime_now() - cores_boot_start));
+    return SYS_ERR_OK;
+}
+
+
 errval_t spawn_new_core(coreid_t core)
 {
     errval_t err;
-    const char *boot_driver = "boot_armv8_generic";
-    const char *cpu_driver = "cpu_imx8x";
-    const char *init = "init";
     struct capref urpc_cap;
     size_t urpc_cap_size;
     err  = frame_alloc(&urpc_cap,BASE_PAGE_SIZE,&urpc_cap_size);
@@ -63,10 +134,12 @@ errval_t spawn_new_core(coreid_t core)
     cpu_dcache_wbinv_range((vm_offset_t) urpc_data, BASE_PAGE_SIZE);
 
     coreid_t coreid = core;
-    err = coreboot(coreid,boot_driver,cpu_driver,init,urpc_frame_id);
+    err = coreboot(coreid,boot_driver,cpu_driver,init_binary,urpc_frame_id);
     if(err_is_fail(err)){
         DEBUG_ERR(err,"Failed to boot core");
+        return err;
     }
+    cores_started |= 1ULL << coreid;
 
     err = init_core_channel(coreid, (lvaddr_t) urpc_init);
     ON_ERR_RETURN(err);
@@ -80,8 +153,9 @@ static void handle_binding(struct aos_rpc *r, struct capref ep, struct capref re
 }
 
 
-errval_t spawn_new_domain(const char *mod_name, int argc, char **argv, domainid_t *new_pid,
-                          struct capref spawner_ep, struct capref child_stdout_cap, struct capref child_stdin_cap, struct spawninfo **ret_si)
+static errval_t spawn_domain(const char *mod_name, int argc, char **argv, domainid_t *new_pid,
+                             struct capref spawner_ep, struct capref child_stdout_cap, struct capref child_stdin_cap,
+                             struct capref clone_state, struct spawninfo **ret_si)
 {
     errval_t err;
     struct spawninfo *si = spawn_create_spawninfo();
@@ -108,7 +182,11 @@ errval_t spawn_new_domain(const char *mod_name, int argc, char **argv, domainid_
     si->child_stdout_cap = child_stdout_cap;
     si->child_stdin_cap = child_stdin_cap;
     //initialize_rpc_handlers(rpc);
-    if (argv == NULL || argc == 0) {
+    if (!capref_is_null(clone_state)) {
+        err = spawn_clone((char*) mod_name, clone_state, si, pid);
+        ON_ERR_RETURN(err);
+    }
+    else if (argv == NULL || argc == 0) {
         err = spawn_load_by_name((char*) mod_name, si, pid);
         ON_ERR_RETURN(err);
         // si -> binary_name = (char*) mod_name;
@@ -145,6 +223,23 @@ errval_t spawn_new_domain(const char *mod_name, int argc, char **argv, domainid_
 }
 
 
+errval_t spawn_new_domain(const char *mod_name, int argc, char **argv, domainid_t *new_pid,
+                          struct capref spawner_ep, struct capref child_stdout_cap, struct capref child_stdin_cap, struct spawninfo **ret_si)
+{
+    return spawn_domain(mod_name, argc, argv, new_pid, spawner_ep, child_stdout_cap, child_stdin_cap,
+                        NULL_CAP, ret_si);
+}
+
+
+/**
+ * \brief spawn cmdline with a copy-on-write view of the state frame, see spawn_clone()
+ */
+errval_t spawn_clone_domain(const char *cmdline, struct capref state, domainid_t *new_pid)
+{
+    return spawn_domain(cmdline, 0, NULL, new_pid, NULL_CAP, NULL_CAP, NULL_CAP, state, NULL);
+}
+
+
 errval_t spawn_lpuart_driver(const char *mod_name, struct spawninfo **ret_si, struct capref in, struct capref out)
 {
     errval_t err;
@@ -275,6 +370,16 @@ errval_t spawn_enet_driver(const char *mod_name, struct spawninfo **ret_si) {
     err = cap_retype(child_dev_frame, dev_frame, IMX8X_ENET_BASE - source_addr, ObjType_DevFrame, IMX8X_ENET_SIZE, 1);
     ON_ERR_PUSH_RETURN(err, LIB_ERR_CAP_RETYPE);
 
+    // the GIC distributor for the RX interrupt, the driver polls without it
+    struct capref child_gic_frame = (struct capref) {
+        .cnode = child_taskcn,
+        .slot = TASKCN_SLOT_BOOTINFO
+    };
+    err = cap_retype(child_gic_frame, dev_frame, IMX8X_GIC_DIST_BASE - source_addr, ObjType_DevFrame, IMX8X_GIC_DIST_SIZE, 1);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "retyping the GIC distributor for the enet driver");
+    }
+
     struct capref irq = (struct capref) {
         .cnode = child_taskcn,
         .slot = TASKCN_SLOT_IRQ
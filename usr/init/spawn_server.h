@@ -5,9 +5,16 @@
 #include <aos/aos.h>
 #include <spawn/spawn.h>
 
+// how long bsp init waits for the application cores
+#define SPAWN_CORES_TIMEOUT_US 2000000
+
 errval_t spawn_new_core(coreid_t core);
+errval_t spawn_app_cores(coreid_t n_cores);
+void spawn_core_ready(coreid_t core);
+errval_t spawn_wait_cores_ready(uint64_t timeout_us);
 errval_t spawn_new_domain(const char *mod_name, int argc, char **argv, domainid_t *new_pid,
                           struct capref spawner_ep_cap, struct capref child_stdout_cap, struct capref child_stdin_cap, struct spawninfo **ret_si);
+errval_t spawn_clone_domain(const char *cmdline, struct capref state, domainid_t *new_pid);
 
 errval_t spawn_lpuart_driver(const char *mod_name, struct spawninfo **ret_si, struct capref in, struct capref out);
 errval_t spawn_enet_driver(const char *mod_name, struct spawninfo **ret_si);
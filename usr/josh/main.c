@@ -20,39 +20,74 @@ enum shell_state current_state;
 struct josh_line *parsed_line;
 
 
-static errval_t setup_ump_channels(struct running_program *prog)
+/**
+ * \brief allocate and map a frame holding a datachan pipe
+ */
+static errval_t alloc_pipe_frame(struct capref *frame, void **addr)
 {
     errval_t err;
-    bool has_foreign_out = true;
-    bool has_foreign_in = true;
-
-    if (capref_is_null(prog->out_cap)) {
-        frame_alloc(&prog->out_cap, BASE_PAGE_SIZE, NULL);
-        has_foreign_out = false;
+    err = frame_alloc(frame, AOS_DC_PIPE_FRAME_SIZE, NULL);
+    ON_ERR_RETURN(err);
+    err = paging_map_frame_complete(get_current_paging_state(), addr, *frame, NULL, NULL);
+    if (err_is_fail(err)) {
+        cap_destroy(*frame);
+        return err;
     }
+    aos_dc_pipe_format((lvaddr_t) *addr, AOS_DC_PIPE_FRAME_SIZE);
+    return SYS_ERR_OK;
+}
 
-    if (capref_is_null(prog->in_cap)) {
-        frame_alloc(&prog->in_cap, BASE_PAGE_SIZE, NULL);
-        has_foreign_in = false;
+
+/**
+ * \brief unmap and destroy the pipe frames of a pipeline
+ *
+ * Frames that were never allocated are null and skipped. Program i reads from
+ * the frame program i - 1 writes to, so only the input of the first program
+ * is not also the output of another one.
+ */
+static void free_pipe_frames(struct running_program *programs, size_t n_programs)
+{
+    errval_t err;
+    for (size_t i = 0; i <= n_programs; i++) {
+        struct capref frame = i == 0 ? programs[0].in_cap : programs[i - 1].out_cap;
+        void *addr = i == 0 ? programs[0].in_addr : programs[i - 1].out_addr;
+        if (capref_is_null(frame)) {
+            continue;
+        }
+        err = paging_unmap_frame(get_current_paging_state(), addr, AOS_DC_PIPE_FRAME_SIZE);
+        if (err_is_fail(err)) {
+            // the frame stays, it is still mapped
+            DEBUG_ERR(err, "unmapping pipe frame");
+            continue;
+        }
+        err = cap_destroy(frame);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "destroying pipe frame");
+        }
     }
+}
+
+
+static errval_t setup_pipe_channels(struct running_program *prog)
+{
+    errval_t err;
 
-    if (!has_foreign_in || true) {
-        void *stdin_addr;
-        err = paging_map_frame_complete(get_current_paging_state(), &stdin_addr, prog->out_cap, NULL, NULL);
-        err = aos_dc_init_ump(&prog->process_out, 64, (lvaddr_t) stdin_addr, BASE_PAGE_SIZE, 1);
+    if (capref_is_null(prog->out_cap)) {
+        err = alloc_pipe_frame(&prog->out_cap, &prog->out_addr);
         ON_ERR_RETURN(err);
     }
-    else {
-        debug_printf("has fi\n");
-    }
 
-    if (!has_foreign_out || true) {
-        void *stdout_addr;
-        err = paging_map_frame_complete(get_current_paging_state(), &stdout_addr, prog->in_cap, NULL, NULL);
-        err = aos_dc_init_ump(&prog->process_in, 64, (lvaddr_t) stdout_addr, BASE_PAGE_SIZE, 0);
+    if (capref_is_null(prog->in_cap)) {
+        err = alloc_pipe_frame(&prog->in_cap, &prog->in_addr);
         ON_ERR_RETURN(err);
     }
 
+    err = aos_dc_init_pipe(&prog->process_out, (lvaddr_t) prog->out_addr, AOS_DC_PIPE_FRAME_SIZE, 1);
+    ON_ERR_RETURN(err);
+
+    err = aos_dc_init_pipe(&prog->process_in, (lvaddr_t) prog->in_addr, AOS_DC_PIPE_FRAME_SIZE, 0);
+    ON_ERR_RETURN(err);
+
     return SYS_ERR_OK;
 }
 
@@ -112,7 +147,8 @@ static errval_t call_spawn_request(const char *name, coreid_t core, size_t argc,
     ON_ERR_RETURN(err);
     aos_rpc_set_interface(&prog->process_disprpc, get_dispatcher_interface(), DISP_IFACE_N_FUNCTIONS, malloc(DISP_IFACE_N_FUNCTIONS * sizeof (void *)));
     
-    setup_ump_channels(prog);
+    err = setup_pipe_channels(prog);
+    ON_ERR_RETURN(err);
 
     err = aos_rpc_call(init_rpc, INIT_IFACE_SPAWN_EXTENDED, bytes, core, rpc_frame, prog->out_cap, prog->in_cap, &pid);
     free(data); // not needed anymore
@@ -191,16 +227,13 @@ static int builtin_threadentry(void *arg)
     struct aos_datachan builtin_in;
     struct aos_datachan builtin_out;
 
-    if (!capref_is_null(prog->in_cap)) {
-        void *page;
-        paging_map_frame_complete(get_current_paging_state(), &page,  prog->in_cap, NULL, NULL);
-        aos_dc_init_ump(&builtin_in, 64, (lvaddr_t) page, BASE_PAGE_SIZE, 1);
+    // the other ends of josh's process_in and process_out
+    if (prog->in_addr != NULL) {
+        aos_dc_init_pipe(&builtin_in, (lvaddr_t) prog->in_addr, AOS_DC_PIPE_FRAME_SIZE, 1);
     }
 
-    if (!capref_is_null(prog->out_cap)) {
-        void *page;
-        paging_map_frame_complete(get_current_paging_state(), &page,  prog->out_cap, NULL, NULL);
-        aos_dc_init_ump(&builtin_out, 64, (lvaddr_t) page, BASE_PAGE_SIZE, 0);
+    if (prog->out_addr != NULL) {
+        aos_dc_init_pipe(&builtin_out, (lvaddr_t) prog->out_addr, AOS_DC_PIPE_FRAME_SIZE, 0);
     }
 
     run_builtin(prog->cmd, prog->argc, (const char **) prog->argv, &builtin_out);
@@ -217,7 +250,8 @@ static errval_t setup_builtin(const char *cmd, size_t argc, const char **argv, s
     prog->argc = argc;
     prog->argv = malloc(argc * sizeof(char *));
     memcpy(prog->argv, argv, argc * sizeof(char *));
-    setup_ump_channels(prog);
+    errval_t err = setup_pipe_channels(prog);
+    ON_ERR_RETURN(err);
 
     prog->builtin_thread = thread_create(builtin_threadentry, prog);
 
@@ -257,17 +291,26 @@ static void execute_command(struct josh_command *command)
     struct running_program *programs = malloc(n_programs * sizeof(struct running_program));
     memset(programs, 0, n_programs * sizeof(struct running_program));
 
-    struct capref out_before;
-    err = frame_alloc(&out_before, BASE_PAGE_SIZE, NULL);
+    // program i writes straight into the pipe program i + 1 reads from
+    err = alloc_pipe_frame(&programs[0].in_cap, &programs[0].in_addr);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "allocating pipe frame");
+        free(programs);
+        return;
+    }
     for (size_t i = 0; i < n_programs; i++) {
-        struct capref frame;
-        err = frame_alloc(&frame, BASE_PAGE_SIZE, NULL);
-        ON_ERR_NO_RETURN(err);
-        programs[i].out_cap = frame;
-        if (!capref_is_null(out_before)) {
-            programs[i].in_cap = out_before;
+        err = alloc_pipe_frame(&programs[i].out_cap, &programs[i].out_addr);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "allocating pipe frame");
+            programs[i].out_cap = NULL_CAP;
+            free_pipe_frames(programs, i + 1);
+            free(programs);
+            return;
+        }
+        if (i + 1 < n_programs) {
+            programs[i + 1].in_cap = programs[i].out_cap;
+            programs[i + 1].in_addr = programs[i].out_addr;
         }
-        out_before = frame;
     }
 
 
@@ -334,9 +377,10 @@ static void execute_command(struct josh_command *command)
             aos_dc_free(&programs[i].process_out);
             aos_rpc_free(&programs[i].process_disprpc);
         }
-        //cap_destroy(programs[i].in_cap);
-        //cap_destroy(programs[i].out_cap);
     }
+    // the programs map their own copies of the frames
+    free_pipe_frames(programs, n_programs);
+    free(programs);
     printf("\n");
 }
 
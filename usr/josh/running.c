@@ -8,14 +8,10 @@ void on_process_input(void *arg) {
     struct aos_datachan *chan = arg;
     errval_t err;
 
-    char buffer[1024];
-    size_t recvd;
+    size_t forwarded;
     do {
-        err = aos_dc_receive_available(chan, sizeof buffer, buffer, &recvd);
-        if (recvd > 0) {
-            err = aos_dc_send(&stdout_chan, recvd, buffer);
-        }
-    } while(recvd > 0);
+        err = aos_dc_forward(&stdout_chan, chan, SIZE_MAX, &forwarded);
+    } while(err_is_ok(err) && forwarded > 0);
 
     if (aos_dc_is_closed(chan)) {
         return;
@@ -22,9 +22,11 @@ struct running_program
     char **argv;
 
     struct capref out_cap;
+    void *out_addr;
     struct aos_datachan process_out;
 
     struct capref in_cap;
+    void *in_addr;
     struct aos_datachan process_in;
 
     struct aos_rpc process_disprpc;
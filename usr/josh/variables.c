@@ -22,9 +22,9 @@ void set_variable(const char *name, const char *value)
 
     char *existing = get_variable(name);
     if (existing != NULL) {
+        shell_variables->d.remove(&shell_variables->d, name, strlen(name));
         free(existing);
         existing = NULL;
-        shell_variables->d.remove(&shell_variables->d, name, strlen(name));
     }
 
     // copy string to take ownership kinda complicated
@@ -15,6 +15,7 @@
 #include <aos/default_interfaces.h>
 
 #include "../mandel_server/interface.h"
+#include "../mandel_server/farm.h"
 
 struct aos_rpc calc_connection;
 __unused
@@ -44,10 +45,204 @@ static void local_ipi(struct capref *ipi_ep)
 }
 
 
+/// how long a farm worker may take to register with the nameserver
+#define FARM_LOOKUP_TIMEOUT_US 5000000
+
+struct farm_worker {
+    struct aos_rpc rpc;
+    size_t index;
+    uintptr_t tiles_done;
+    errval_t err;
+};
+
+
+/**
+ * \brief spawn a mandel_server on core and connect to it over its own channel
+ */
+static errval_t farm_worker_start(struct farm_worker *w, coreid_t core,
+                                  struct capref farm_frame)
+{
+    errval_t err;
+    char cmdline[64];
+    char name[64];
+    snprintf(cmdline, sizeof cmdline, "mandel_server farm%d", core);
+    snprintf(name, sizeof name, "/mandelfarm%d", core);
+
+    domainid_t pid;
+    err = aos_rpc_process_spawn(aos_rpc_get_process_channel(), cmdline, core, &pid);
+    ON_ERR_RETURN(err);
+
+    // the server registers itself once it is up
+    nameservice_chan_t chan;
+    systime_t start = systime_now();
+    do {
+        thread_yield();
+        err = nameservice_lookup(name, &chan);
+    } while (err_is_fail(err)
+             && systime_to_us(systime_now() - start) < FARM_LOOKUP_TIMEOUT_US);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "%s did not register", name);
+        return err;
+    }
+
+    struct capref frame;
+    void *shared;
+    err = frame_alloc(&frame, BASE_PAGE_SIZE, NULL);
+    ON_ERR_RETURN(err);
+    err = paging_map_frame_complete(get_current_paging_state(), &shared, frame, NULL, NULL);
+    ON_ERR_RETURN(err);
+    err = aos_rpc_init_ump_default(&w->rpc, (lvaddr_t) shared, get_phys_size(frame), 0);
+    ON_ERR_RETURN(err);
+    aos_rpc_set_interface(&w->rpc, get_ms_interface(), MS_IFACE_N_FUNCTIONS, malloc(MS_IFACE_N_FUNCTIONS * sizeof(void *)));
+
+    void *buf; size_t buf_size;
+    const char cmd1[] = "set_connection";
+    err = nameservice_rpc(chan, (void *) cmd1, sizeof cmd1, &buf, &buf_size, frame, NULL_CAP);
+    ON_ERR_RETURN(err);
+    const char cmd2[] = "set_farm";
+    err = nameservice_rpc(chan, (void *) cmd2, sizeof cmd2, &buf, &buf_size, farm_frame, NULL_CAP);
+    ON_ERR_RETURN(err);
+
+    return SYS_ERR_OK;
+}
+
+
+static int farm_worker_run(void *arg)
+{
+    struct farm_worker *w = arg;
+    w->err = aos_rpc_call(&w->rpc, MS_IFACE_FARM_RUN, w->index, &w->tiles_done);
+    return 0;
+}
+
+
+/**
+ * \brief deal the tiles of the image round robin into the queues of n workers
+ */
+static void farm_deal(struct farm_header *fh, size_t n_workers)
+{
+    size_t n_tiles = fh->tiles_x * fh->tiles_y;
+    size_t pos = 0;
+
+    fh->n_workers = n_workers;
+    for (size_t q = 0; q < n_workers; q++) {
+        fh->queues[q].head = pos;
+        for (size_t t = q; t < n_tiles; t += n_workers) {
+            fh->tiles[pos++] = t;
+        }
+        fh->queues[q].tail = pos;
+        fh->queues[q].taken = 0;
+        fh->queues[q].stolen = 0;
+    }
+}
+
+
+/**
+ * \brief render the image with 1 to n_cores servers and report the scaling
+ */
+static errval_t farm_benchmark(coreid_t n_cores, int width, int height)
+{
+    errval_t err;
+
+    if (n_cores == 0 || n_cores > FARM_MAX_WORKERS) {
+        return ERR_INVALID_ARGS;
+    }
+
+    struct capref farm_frame;
+    struct farm_header *fh;
+    err = frame_alloc(&farm_frame, farm_frame_size(width, height), NULL);
+    ON_ERR_RETURN(err);
+    err = paging_map_frame_complete(get_current_paging_state(), (void **) &fh, farm_frame, NULL, NULL);
+    ON_ERR_RETURN(err);
+
+    fh->image.max_iterations = 1000;
+    fh->image.x = -2.2;
+    fh->image.y = -1.5;
+    fh->image.w = 3;
+    fh->image.h = 3;
+    fh->image.width = width;
+    fh->image.height = height;
+    fh->tile_width = FARM_TILE_WIDTH;
+    fh->tile_height = FARM_TILE_HEIGHT;
+    fh->tiles_x = (width + FARM_TILE_WIDTH - 1) / FARM_TILE_WIDTH;
+    fh->tiles_y = (height + FARM_TILE_HEIGHT - 1) / FARM_TILE_HEIGHT;
+    if (fh->tiles_x * fh->tiles_y > FARM_MAX_TILES) {
+        return ERR_INVALID_ARGS;
+    }
+
+    struct farm_worker *workers = calloc(n_cores, sizeof(struct farm_worker));
+    struct thread **threads = calloc(n_cores, sizeof(struct thread *));
+    if (workers == NULL || threads == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    for (coreid_t c = 0; c < n_cores; c++) {
+        workers[c].index = c;
+        err = farm_worker_start(&workers[c], c, farm_frame);
+        ON_ERR_RETURN(err);
+    }
+
+    printf("farm: %dx%d pixels, %d tiles of %dx%d\n", width, height,
+           fh->tiles_x * fh->tiles_y, fh->tile_width, fh->tile_height);
+
+    uint64_t base_ns = 0;
+    uint64_t base_sum = 0;
+    for (coreid_t n = 1; n <= n_cores; n++) {
+        farm_deal(fh, n);
+
+        systime_t beg = systime_now();
+        for (coreid_t c = 0; c < n; c++) {
+            threads[c] = thread_create(farm_worker_run, &workers[c]);
+        }
+        for (coreid_t c = 0; c < n; c++) {
+            thread_join(threads[c], NULL);
+        }
+        uint64_t ns = systime_to_ns(systime_now() - beg);
+
+        uint64_t sum = 0;
+        int *image = farm_image(fh);
+        for (int i = 0; i < width * height; i++) {
+            sum += image[i];
+        }
+        if (n == 1) {
+            base_ns = ns;
+            base_sum = sum;
+        }
+
+        printf("farm: %2d cores %8lu us  speedup %3lu.%02lu%s\n", n, ns / 1000,
+               base_ns / ns, (base_ns * 100 / ns) % 100,
+               sum == base_sum ? "" : "  (image differs!)");
+        for (coreid_t c = 0; c < n; c++) {
+            if (err_is_fail(workers[c].err)) {
+                DEBUG_ERR(workers[c].err, "farm worker %d", c);
+            }
+            printf("farm:    core %2d: %4lu tiles, %4d stolen\n", c,
+                   workers[c].tiles_done, fh->queues[c].stolen);
+        }
+        memset(image, 0, width * height * sizeof(int));
+    }
+
+    free(threads);
+    free(workers);
+    return SYS_ERR_OK;
+}
+
+
 int main(int argc, char *argv[])
 {
     errval_t err;
 
+    // mandel_client farm <cores> [<width> <height>]
+    if (argc >= 3 && strcmp(argv[1], "farm") == 0) {
+        coreid_t n_cores = atoi(argv[2]);
+        int width = argc >= 5 ? atoi(argv[3]) : 1024;
+        int height = argc >= 5 ? atoi(argv[4]) : 1024;
+        err = farm_benchmark(n_cores, width, height);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "farm benchmark failed");
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
     const int n_bufnames = 64;
     char **servicenames = malloc(n_bufnames * sizeof(char *));
     size_t n_services;
@@ -1,50 +1,206 @@
 #include "calculate.h"
 
+#include <stdint.h>
+#include <string.h>
+
 #include "arm_neon.h"
 
+/*
+ * The vector kernels keep several independent vectors in flight per loop so
+ * the latency of one FMA is hidden behind the others. Every lane keeps an
+ * active mask, its counter only advances while it has not escaped, and a
+ * block is left as soon as no lane of any vector is active.
+ */
 
-void calculate(const struct calc_request *cr, int *ret)
+#define CALC_F64_VECTORS 4
+#define CALC_F32_VECTORS 4
+
+#define CALC_F64_BLOCK (2 * CALC_F64_VECTORS)
+#define CALC_F32_BLOCK (4 * CALC_F32_VECTORS)
+
+typedef void (*calc_kernel_fn)(const struct calc_request *cr, int *ret);
+
+
+static void calculate_scalar(const struct calc_request *cr, int *ret)
+{
+    double dx = cr->w / cr->width;
+    double dy = cr->h / cr->height;
+
+    for (long j = 0; j < cr->height; j++) {
+        double y0 = cr->y + j * dy;
+        for (long i = 0; i < cr->width; i++) {
+            double x0 = cr->x + i * dx;
+            double x = x0;
+            double y = y0;
+            int k;
+            for (k = 0; k < cr->max_iterations; k++) {
+                double xsq = x * x;
+                double ysq = y * y;
+                if (xsq + ysq > 4) {
+                    break;
+                }
+                y = 2 * x * y + y0;
+                x = xsq - ysq + x0;
+            }
+            ret[i + j * cr->width] = k;
+        }
+    }
+}
+
+
+/**
+ * \brief copy a block of counters into the row, cut off at the image border
+ */
+static inline void store_block(int *row, long i, long width, const uint32_t *counts,
+                               long block)
 {
+    long n = width - i < block ? width - i : block;
+    memcpy(row + i, counts, n * sizeof(int));
+}
+
+
+static void calculate_f64(const struct calc_request *cr, int *ret)
+{
+    const float64_t dx = cr->w / cr->width;
+    const float64_t dy = cr->h / cr->height;
+    const float64x2_t four = vdupq_n_f64(4);
+
     for (long j = 0; j < cr->height; j++) {
-        float64_t yv = (float64_t) (cr->y) + (float64_t)(j) * (float64_t)(cr->h / cr->height);
-        for (long i = 0; i < cr->width; i += 2) {
-            float64_t xv[] = {
-                (float64_t) (cr->x + (float64_t) (i) * cr->w / cr->width),
-                (float64_t) (cr->x + (float64_t) (i + 1) * cr->w / cr->width),
-            };
-            float64x2_t x0 = vld1q_f64(xv);
-            float64x2_t y0 = vmovq_n_f64(yv);
-
-            uint64x2_t increments = vmovq_n_u64(1);
-            uint64x2_t counter = vmovq_n_u64(0);
-            float64x2_t threshold = vmovq_n_f64(4);
-
-            float64x2_t x = x0;
-            float64x2_t y = y0;
+        const float64x2_t y0 = vdupq_n_f64(cr->y + j * dy);
+        int *row = ret + j * cr->width;
+
+        for (long i = 0; i < cr->width; i += CALC_F64_BLOCK) {
+            float64_t xs[CALC_F64_BLOCK];
+            for (long l = 0; l < CALC_F64_BLOCK; l++) {
+                xs[l] = cr->x + (i + l) * dx;
+            }
+
+            float64x2_t x0[CALC_F64_VECTORS], x[CALC_F64_VECTORS], y[CALC_F64_VECTORS];
+            uint64x2_t active[CALC_F64_VECTORS], count[CALC_F64_VECTORS];
+            for (int v = 0; v < CALC_F64_VECTORS; v++) {
+                x0[v] = vld1q_f64(xs + 2 * v);
+                x[v] = x0[v];
+                y[v] = y0;
+                active[v] = vdupq_n_u64(UINT64_MAX);
+                count[v] = vdupq_n_u64(0);
+            }
 
             for (int k = 0; k < cr->max_iterations; k++) {
-                float64x2_t xsq = vmulq_f64(x, x);
-                float64x2_t ysq = vmulq_f64(y, y);
-                float64x2_t xy = vmulq_f64(x, y);
-                float64x2_t two_xy = vaddq_f64(xy, xy);
+                uint64x2_t any = vdupq_n_u64(0);
+                for (int v = 0; v < CALC_F64_VECTORS; v++) {
+                    float64x2_t xsq = vmulq_f64(x[v], x[v]);
+                    float64x2_t ysq = vmulq_f64(y[v], y[v]);
+                    active[v] = vandq_u64(active[v], vcleq_f64(vaddq_f64(xsq, ysq), four));
+                    // an active lane is all ones, minus one is plus one
+                    count[v] = vsubq_u64(count[v], active[v]);
+                    any = vorrq_u64(any, active[v]);
 
-                uint64x2_t not_escaped = vcleq_f64(vaddq_f64(xsq, ysq), threshold);
-                if (k % 16 == 0 && vaddvq_u64(not_escaped) == 0) {
+                    y[v] = vfmaq_f64(y0, vaddq_f64(x[v], x[v]), y[v]);
+                    x[v] = vaddq_f64(vsubq_f64(xsq, ysq), x0[v]);
+                }
+                if (vmaxvq_u32(vreinterpretq_u32_u64(any)) == 0) {
                     break;
                 }
+            }
+
+            uint32_t counts[CALC_F64_BLOCK];
+            for (int v = 0; v < CALC_F64_VECTORS; v++) {
+                vst1_u32(counts + 2 * v, vmovn_u64(count[v]));
+            }
+            store_block(row, i, cr->width, counts, CALC_F64_BLOCK);
+        }
+    }
+}
+
 
-                increments = vandq_u64(increments, not_escaped);
-                counter = vaddq_u64(counter, increments);
+static void calculate_f32(const struct calc_request *cr, int *ret)
+{
+    const double dx = cr->w / cr->width;
+    const double dy = cr->h / cr->height;
+    const float32x4_t four = vdupq_n_f32(4);
+
+    for (long j = 0; j < cr->height; j++) {
+        const float32x4_t y0 = vdupq_n_f32((float32_t) (cr->y + j * dy));
+        int *row = ret + j * cr->width;
+
+        for (long i = 0; i < cr->width; i += CALC_F32_BLOCK) {
+            float32_t xs[CALC_F32_BLOCK];
+            for (long l = 0; l < CALC_F32_BLOCK; l++) {
+                xs[l] = (float32_t) (cr->x + (i + l) * dx);
+            }
 
-                x = vaddq_f64(vsubq_f64(xsq, ysq), x0);
-                y = vaddq_f64(two_xy, y0);
+            float32x4_t x0[CALC_F32_VECTORS], x[CALC_F32_VECTORS], y[CALC_F32_VECTORS];
+            uint32x4_t active[CALC_F32_VECTORS], count[CALC_F32_VECTORS];
+            for (int v = 0; v < CALC_F32_VECTORS; v++) {
+                x0[v] = vld1q_f32(xs + 4 * v);
+                x[v] = x0[v];
+                y[v] = y0;
+                active[v] = vdupq_n_u32(UINT32_MAX);
+                count[v] = vdupq_n_u32(0);
             }
-            
-            uint64_t result_iters[2];
-            vst1q_u64(result_iters, counter);
 
-            ret[i + j * cr->width] = result_iters[0];
-            ret[i + j * cr->width + 1] = result_iters[1];
+            for (int k = 0; k < cr->max_iterations; k++) {
+                uint32x4_t any = vdupq_n_u32(0);
+                for (int v = 0; v < CALC_F32_VECTORS; v++) {
+                    float32x4_t xsq = vmulq_f32(x[v], x[v]);
+                    float32x4_t ysq = vmulq_f32(y[v], y[v]);
+                    active[v] = vandq_u32(active[v], vcleq_f32(vaddq_f32(xsq, ysq), four));
+                    count[v] = vsubq_u32(count[v], active[v]);
+                    any = vorrq_u32(any, active[v]);
+
+                    y[v] = vfmaq_f32(y0, vaddq_f32(x[v], x[v]), y[v]);
+                    x[v] = vaddq_f32(vsubq_f32(xsq, ysq), x0[v]);
+                }
+                if (vmaxvq_u32(any) == 0) {
+                    break;
+                }
+            }
+
+            uint32_t counts[CALC_F32_BLOCK];
+            for (int v = 0; v < CALC_F32_VECTORS; v++) {
+                vst1q_u32(counts + 4 * v, count[v]);
+            }
+            store_block(row, i, cr->width, counts, CALC_F32_BLOCK);
         }
     }
 }
+
+
+static const struct {
+    const char *name;
+    calc_kernel_fn fn;
+} kernels[CALC_KERNEL_N] = {
+    [CALC_KERNEL_SCALAR] = { "scalar", calculate_scalar },
+    [CALC_KERNEL_F64]    = { "f64x2", calculate_f64 },
+    [CALC_KERNEL_F32]    = { "f32x4", calculate_f32 },
+};
+
+static enum calc_kernel current_kernel = CALC_KERNEL_F64;
+
+
+void calculate(const struct calc_request *cr, int *ret)
+{
+    kernels[current_kernel].fn(cr, ret);
+}
+
+void calculate_with(enum calc_kernel kernel, const struct calc_request *cr, int *ret)
+{
+    kernels[kernel].fn(cr, ret);
+}
+
+void calculate_set_kernel(enum calc_kernel kernel)
+{
+    if (kernel < CALC_KERNEL_N) {
+        current_kernel = kernel;
+    }
+}
+
+enum calc_kernel calculate_get_kernel(void)
+{
+    return current_kernel;
+}
+
+const char *calculate_kernel_name(enum calc_kernel kernel)
+{
+    return kernel < CALC_KERNEL_N ? kernels[kernel].name : "unknown";
+}
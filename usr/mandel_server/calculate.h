@@ -7,8 +7,26 @@ struct calc_request {
     int width, height;
 };
 
+enum calc_kernel {
+    CALC_KERNEL_SCALAR, ///< plain double loop, the reference
+    CALC_KERNEL_F64,    ///< float64x2, several vectors per loop
+    CALC_KERNEL_F32,    ///< float32x4, several vectors per loop, less precise
+    CALC_KERNEL_N,      // <- count -- must be last
+};
 
 
+/**
+ * \brief iteration counts of all pixels of cr, row major, with the current kernel
+ */
 void calculate(const struct calc_request *cr, int *ret);
 
+/**
+ * \brief same as calculate(), with the given kernel
+ */
+void calculate_with(enum calc_kernel kernel, const struct calc_request *cr, int *ret);
+
+void calculate_set_kernel(enum calc_kernel kernel);
+enum calc_kernel calculate_get_kernel(void);
+const char *calculate_kernel_name(enum calc_kernel kernel);
+
 #endif // CALCULATE_H
@@ -0,0 +1,81 @@
+#include "farm.h"
+
+#include <string.h>
+
+
+/**
+ * \brief take the next tile from the head of q
+ *
+ * Owner and thieves both take from the head, a failed CAS just means somebody
+ * else got that tile first.
+ */
+static bool farm_take(struct farm_header *fh, struct farm_queue *q, uint32_t *tile)
+{
+    uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    while (head < q->tail) {
+        if (__atomic_compare_exchange_n(&q->head, &head, head + 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *tile = fh->tiles[head];
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static void farm_tile(struct farm_header *fh, uint32_t tile)
+{
+    static int pixels[FARM_TILE_WIDTH * FARM_TILE_HEIGHT];
+
+    const struct calc_request *img = &fh->image;
+    int px = (tile % fh->tiles_x) * fh->tile_width;
+    int py = (tile / fh->tiles_x) * fh->tile_height;
+
+    struct calc_request cr;
+    cr.width = img->width - px < fh->tile_width ? img->width - px : fh->tile_width;
+    cr.height = img->height - py < fh->tile_height ? img->height - py : fh->tile_height;
+    cr.x = img->x + px * img->w / img->width;
+    cr.y = img->y + py * img->h / img->height;
+    cr.w = cr.width * img->w / img->width;
+    cr.h = cr.height * img->h / img->height;
+    cr.max_iterations = img->max_iterations;
+
+    calculate(&cr, pixels);
+
+    int *out = farm_image(fh) + py * img->width + px;
+    for (int j = 0; j < cr.height; j++) {
+        memcpy(out + j * img->width, pixels + j * cr.width, cr.width * sizeof(int));
+    }
+}
+
+
+size_t farm_work(struct farm_header *fh, size_t worker)
+{
+    assert(worker < fh->n_workers);
+    assert(fh->tile_width <= FARM_TILE_WIDTH && fh->tile_height <= FARM_TILE_HEIGHT);
+
+    struct farm_queue *own = &fh->queues[worker];
+    size_t taken = 0, stolen = 0;
+    uint32_t tile;
+
+    while (farm_take(fh, own, &tile)) {
+        farm_tile(fh, tile);
+        taken++;
+    }
+
+    // own queue is empty, help the others starting with the next worker
+    for (size_t i = 1; i < fh->n_workers; i++) {
+        struct farm_queue *victim = &fh->queues[(worker + i) % fh->n_workers];
+        while (farm_take(fh, victim, &tile)) {
+            farm_tile(fh, tile);
+            taken++;
+            stolen++;
+        }
+    }
+
+    own->taken = taken;
+    own->stolen = stolen;
+    // the pixels must be visible before the reply is
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return taken;
+}
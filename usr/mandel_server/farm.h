@@ -0,0 +1,63 @@
+#ifndef MANDEL_SERVER_FARM_H
+#define MANDEL_SERVER_FARM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <bitmacros.h>
+#include <aos/aos.h>
+
+#include "calculate.h"
+
+/*
+ * Work farm over a frame shared by the client and one server per core.
+ *
+ * The client splits the image into tiles and deals them round robin into one
+ * queue per server, so every queue gets a share of the expensive regions.
+ * A server takes tiles from the head of its own queue and, once that is
+ * empty, steals from the heads of the other queues. The pixels of a tile are
+ * written straight into the image behind the header, nothing is copied back
+ * over the channel.
+ */
+
+#define FARM_MAX_WORKERS    16
+#define FARM_MAX_TILES      4096
+#define FARM_TILE_WIDTH     32
+#define FARM_TILE_HEIGHT    32
+#define FARM_CACHE_LINE     64
+
+struct farm_queue {
+    uint32_t head;      ///< next entry of farm_header.tiles, taken with a CAS
+    uint32_t tail;      ///< one past the last entry of this queue
+    uint32_t taken;     ///< tiles the owner processed, written by the owner
+    uint32_t stolen;    ///< of those, tiles taken from other queues
+} __attribute__((aligned(FARM_CACHE_LINE)));
+
+struct farm_header {
+    struct calc_request image;
+    uint32_t tile_width, tile_height;
+    uint32_t tiles_x, tiles_y;
+    uint32_t n_workers;
+    struct farm_queue queues[FARM_MAX_WORKERS];
+    uint16_t tiles[FARM_MAX_TILES];     ///< tile numbers, row major
+};
+
+#define FARM_IMAGE_OFFSET  ROUND_UP(sizeof(struct farm_header), BASE_PAGE_SIZE)
+
+static inline int *farm_image(struct farm_header *fh)
+{
+    return (int *) ((char *) fh + FARM_IMAGE_OFFSET);
+}
+
+static inline size_t farm_frame_size(int width, int height)
+{
+    return ROUND_UP(FARM_IMAGE_OFFSET + (size_t) width * height * sizeof(int),
+                    BASE_PAGE_SIZE);
+}
+
+/**
+ * \brief work through the tiles of the farm as worker number worker
+ * \return the number of tiles this worker computed
+ */
+size_t farm_work(struct farm_header *fh, size_t worker);
+
+#endif // MANDEL_SERVER_FARM_H
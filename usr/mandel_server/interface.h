@@ -6,6 +6,7 @@
 
 enum {
     MS_IFACE_CALC = AOS_RPC_MSG_TYPE_START,
+    MS_IFACE_FARM_RUN,  ///< work as the given worker of the farm set with "set_farm"
     MS_IFACE_N_FUNCTIONS, // <- count -- must be last
 };
 
@@ -24,6 +25,9 @@ static struct aos_rpc_interface *get_ms_interface(void)
 
         aos_rpc_initialize_binding(&ms_interface, "calc", MS_IFACE_CALC,
                                 1, 1, AOS_RPC_VARBYTES, AOS_RPC_VARBYTES);
+
+        aos_rpc_initialize_binding(&ms_interface, "farm_run", MS_IFACE_FARM_RUN,
+                                1, 1, AOS_RPC_WORD, AOS_RPC_WORD);
     }
     return &ms_interface;
 }
@@ -8,9 +8,11 @@
 #include <aos/nameserver.h>
 #include <aos/waitset.h>
 #include <aos/default_interfaces.h>
+#include <aos/systime.h>
 
 #include "calculate.h"
 #include "interface.h"
+#include "farm.h"
 
 
 #define PANIC_IF_FAIL(err, msg)    \
@@ -25,6 +27,7 @@ struct capref connection_frame;
 struct capref ipi_notifier;
 
 struct aos_rpc calc_connection;
+struct farm_header *farm;
 
 
 void handle_calc(struct aos_rpc *rpc, struct aos_rpc_varbytes ci, struct aos_rpc_varbytes *out)
@@ -42,6 +45,16 @@ void handle_calc(struct aos_rpc *rpc, struct aos_rpc_varbytes ci, struct aos_rpc
 }
 
 
+void handle_farm_run(struct aos_rpc *rpc, uintptr_t worker, uintptr_t *tiles_done)
+{
+    if (farm == NULL || worker >= farm->n_workers) {
+        *tiles_done = 0;
+        return;
+    }
+    *tiles_done = farm_work(farm, worker);
+}
+
+
 static void setup_calc_connection(struct capref frame)
 {
     errval_t err;
@@ -56,6 +69,20 @@ static void setup_calc_connection(struct capref frame)
     void handle_roundtrip(struct aos_rpc *rpc) { return; }
     aos_rpc_register_handler(&calc_connection, AOS_RPC_ROUNDTRIP, &handle_roundtrip);
     aos_rpc_register_handler(&calc_connection, MS_IFACE_CALC, &handle_calc);
+    aos_rpc_register_handler(&calc_connection, MS_IFACE_FARM_RUN, &handle_farm_run);
+}
+
+
+static void setup_farm(struct capref frame)
+{
+    errval_t err;
+    void *shared;
+    err = paging_map_frame_complete(get_current_paging_state(), &shared, frame, NULL, NULL);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "failed to map the farm frame");
+        return;
+    }
+    farm = shared;
 }
 
 
@@ -86,6 +113,9 @@ static void server_recv_handler(void *st, void *message,
     if (strcmp(message, "set_connection") == 0) {
         setup_calc_connection(rx_cap);
     }
+    else if (strcmp(message, "set_farm") == 0) {
+        setup_farm(rx_cap);
+    }
     else if (strcmp(message, "set_ipi") == 0) {
         remote_ipi(rx_cap);
         local_ipi(tx_cap);
@@ -98,6 +128,51 @@ static void server_recv_handler(void *st, void *message,
 
 
 
+/**
+ * \brief compare every kernel against the scalar reference and time it
+ */
+static void verify_kernels(void)
+{
+    struct calc_request cr = {
+        .x = -2.2, .y = -1.5, .w = 3, .h = 3,
+        .max_iterations = 1000,
+        // not a multiple of any block, to cover the image border
+        .width = 250, .height = 250,
+    };
+    size_t n = cr.width * cr.height;
+    int *ref = malloc(n * sizeof(int));
+    int *out = malloc(n * sizeof(int));
+    assert(ref != NULL && out != NULL);
+
+    uint64_t ref_ns = 0;
+    for (enum calc_kernel k = 0; k < CALC_KERNEL_N; k++) {
+        int *dst = k == CALC_KERNEL_SCALAR ? ref : out;
+        systime_t beg = systime_now();
+        calculate_with(k, &cr, dst);
+        uint64_t ns = systime_to_ns(systime_now() - beg) + 1;
+        if (k == CALC_KERNEL_SCALAR) {
+            ref_ns = ns;
+        }
+
+        size_t differ = 0;
+        int max_diff = 0;
+        for (size_t i = 0; i < n; i++) {
+            int diff = dst[i] > ref[i] ? dst[i] - ref[i] : ref[i] - dst[i];
+            if (diff != 0) {
+                differ++;
+                max_diff = diff > max_diff ? diff : max_diff;
+            }
+        }
+        printf("%-8s %8lu us  speedup %3lu.%02lu  %6zu of %zu pixels differ, by at most %d\n",
+               calculate_kernel_name(k), ns / 1000, ref_ns / ns, (ref_ns * 100 / ns) % 100,
+               differ, n, max_diff);
+    }
+
+    free(ref);
+    free(out);
+}
+
+
 int main(int argc, char *argv[])
 {
     if (argc < 2) {
@@ -105,6 +180,18 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (strcmp(argv[1], "verify") == 0) {
+        verify_kernels();
+        return EXIT_SUCCESS;
+    }
+
+    // optional second argument selects the kernel
+    for (enum calc_kernel k = 0; argc >= 3 && k < CALC_KERNEL_N; k++) {
+        if (strcmp(argv[2], calculate_kernel_name(k)) == 0) {
+            calculate_set_kernel(k);
+        }
+    }
+
     errval_t err;
     char buffer[64];
     strcpy(buffer, SERVICE_NAME);
@@ -116,6 +116,7 @@ int main(int argc, char **argv) {
     // wait for first message
     struct udp_msg *in = malloc(sizeof(struct udp_msg) + 2048 * sizeof(char));
     do {
+        aos_socket_rx_wait(&sock);
         err = aos_socket_receive(&sock, in);
         /* err = forward_in(in, &sock); */
     } while (err_is_fail(err));
@@ -37,9 +37,11 @@ int main(int argc, char *argv[])
     n_servers = 0;
     errval_t err;
 
-    pl.head = NULL;
-    pl.tail = NULL;
-    pl.size = 0;
+    err = process_list_init();
+    if(err_is_fail(err)){
+        DEBUG_ERR(err,"Failed to initialize process list!\n");
+        abort();
+    }
 
     server_ht = create_hashtable();
     
@@ -2,6 +2,16 @@
 
 #include <aos/aos.h>
 #include <aos/aos_rpc.h>
+#include <collections/hash_table.h>
+
+/*
+ * Processes are indexed by pid and by the rpc channel they registered over,
+ * each in a collections hash table. Lookups, registration and
+ * deregistration cost the same with thousands of live domains. The pid list
+ * for ps is kept serialized and only rebuilt after a removal.
+ */
+
+static struct process_list pl;
 
 
 static char* strcopy(const char* str){
@@ -11,85 +21,162 @@ static char* strcopy(const char* str){
     return new_str;
 }
 
+/**
+ * \brief append pid to the snapshot, if the snapshot is current and has room
+ */
+static void snapshot_append(domainid_t pid){
+    if(pl.snapshot_dirty){
+        return;
+    }
+    int n = snprintf(pl.snapshot + pl.snapshot_len,
+                     PROC_LIST_SNAPSHOT_SIZE - pl.snapshot_len, "%d,", pid);
+    if(n < 0 || pl.snapshot_len + n >= PROC_LIST_SNAPSHOT_SIZE){
+        // only whole entries, readers parse up to the last comma
+        pl.snapshot[pl.snapshot_len] = '\0';
+        return;
+    }
+    pl.snapshot_len += n;
+    pl.snapshot_count++;
+}
+
+static void snapshot_rebuild(void){
+    pl.snapshot_dirty = false;
+    pl.snapshot_len = 0;
+    pl.snapshot_count = 0;
+    pl.snapshot[0] = '\0';
+    for(size_t i = 0; i < pl.size; ++i){
+        snapshot_append(pl.procs[i] -> pid);
+    }
+    if(pl.snapshot_count < pl.size){
+        debug_printf("Buffer in channels is not large enough to sned full pid list!\n");
+    }
+}
+
+errval_t process_list_init(void){
+    memset(&pl, 0, sizeof(pl));
+    collections_hash_create(&pl.by_pid, NULL);
+    collections_hash_create(&pl.by_rpc, NULL);
+
+    pl.capacity = PROC_TABLE_MIN_SLOTS;
+    pl.procs = malloc(pl.capacity * sizeof(struct process *));
+    if(pl.procs == NULL){
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    return SYS_ERR_OK;
+}
+
 errval_t add_process(coreid_t core_id,const char* name,domainid_t pid,struct aos_rpc* rpc ){
-    
+    if(collections_hash_find(pl.by_pid, pid) != NULL){
+        return PROC_MGMT_ERR_DOMAIN_EXISTS;
+    }
+    if(rpc != NULL && collections_hash_find(pl.by_rpc, (uintptr_t) rpc) != NULL){
+        return PROC_MGMT_ERR_DOMAIN_EXISTS;
+    }
+
+    if(pl.size == pl.capacity){
+        size_t cap = pl.capacity * 2;
+        struct process **procs = realloc(pl.procs, cap * sizeof(struct process *));
+        if(procs == NULL){
+            return LIB_ERR_MALLOC_FAIL;
+        }
+        pl.procs = procs;
+        pl.capacity = cap;
+    }
 
     struct process * p = (struct process * ) malloc(sizeof(struct process));
-    p -> next = NULL,
+    if(p == NULL){
+        return LIB_ERR_MALLOC_FAIL;
+    }
     p -> pid = pid;
     p -> core_id = core_id;
     p -> name = strcopy(name);
     p -> rpc  = rpc;
 
-    if(pl.head == NULL){
-        pl.head = p;
-        pl.tail = p;
-    }else{
-        pl.tail -> next = p;
-        pl.tail = p;
+    collections_hash_insert(pl.by_pid, pid, p);
+    if(rpc != NULL){
+        collections_hash_insert(pl.by_rpc, (uintptr_t) rpc, p);
     }
+
+    p -> snap_idx = pl.size;
+    pl.procs[pl.size] = p;
     pl.size++;
+    snapshot_append(pid);
 
     return SYS_ERR_OK;
 };
 
 
 errval_t get_core_id(domainid_t pid, coreid_t *core_id){
-    struct process  * curr = pl.head;
-    for(;curr != NULL; curr = curr -> next){
-        if(curr -> pid == pid){
-            *core_id = curr -> core_id;
-            return SYS_ERR_OK;
-        }
+    struct process * p = collections_hash_find(pl.by_pid, pid);
+    if(p == NULL){
+        return PROC_MGMT_ERR_DOMAIN_NOT_RUNNING;
     }
-    return PROC_MGMT_ERR_DOMAIN_NOT_RUNNING;
+    *core_id = p -> core_id;
+    return SYS_ERR_OK;
+}
+
+
+/**
+ * \brief name of a running process, NULL if pid is not running
+ */
+const char *get_process_name(domainid_t pid){
+    struct process * p = collections_hash_find(pl.by_pid, pid);
+    return p == NULL ? NULL : p -> name;
 }
 
 
 errval_t find_process_by_rpc(struct aos_rpc *rpc,domainid_t * res_pid){
-    struct process  * curr = pl.head;
-    for(;curr != NULL; curr = curr -> next){
-        if(curr -> rpc == rpc){
-            *res_pid = curr -> pid;
-            return SYS_ERR_OK;
-        }
+    struct process * p = rpc == NULL ? NULL : collections_hash_find(pl.by_rpc, (uintptr_t) rpc);
+    if(p == NULL){
+        *res_pid = -1;
+        return PROC_MGMT_ERR_DOMAIN_NOT_RUNNING;
+    }
+    *res_pid = p -> pid;
+    return SYS_ERR_OK;
+}
+
+
+/**
+ * \brief comma terminated list of running pids, as sent to clients
+ * \param count set to the number of pids in the list
+ */
+const char *get_process_snapshot(size_t *count){
+    if(pl.snapshot_dirty){
+        snapshot_rebuild();
     }
-    *res_pid = -1;
-    return PROC_MGMT_ERR_DOMAIN_NOT_RUNNING;
+    *count = pl.snapshot_count;
+    return pl.snapshot;
 }
 
 
 void print_process_list(void){
     debug_printf("================ Processes ============================\n");
-    for(struct process* curr = pl.head; curr != NULL; curr = curr -> next){
+    for(size_t i = 0; i < pl.size; ++i){
+        struct process * curr = pl.procs[i];
         debug_printf("|| Pid:   %d  Core:   %d  Name:  %s         \n",curr -> pid, curr -> core_id, curr -> name);
     }
     debug_printf("========================================================\n");
 }
 
 errval_t remove_process_by_pid(struct aos_rpc* rpc, domainid_t pid){
-    assert(pl.head != NULL && "PL head is NULL (can never be true)");
-    struct process * temp;
-    if(pl.head -> pid == pid && rpc == pl.head -> rpc){
-        temp = pl.head;
-        pl.head = pl.head -> next;
-        pl.size--;
-        free(temp);
-        return SYS_ERR_OK;
-    }
-    struct process * curr;
-    for(curr = pl.head; curr -> next != NULL;curr = curr -> next){
-        if(curr->next->pid == pid  && rpc == curr -> next -> rpc){
-            temp = curr -> next;
-            curr -> next = curr -> next -> next;
-            if(temp == pl.tail){
-                pl.tail = curr;
-            }
-            pl.size--;
-            free(temp);
-            return SYS_ERR_OK;
-        }
+    struct process * p = collections_hash_find(pl.by_pid, pid);
+    if(p == NULL || p -> rpc != rpc){
+        return LIB_ERR_PROC_MNGMT_INVALID_DEREG;
+    }
+
+    collections_hash_delete(pl.by_pid, pid);
+    if(rpc != NULL){
+        collections_hash_delete(pl.by_rpc, (uintptr_t) rpc);
     }
-    return LIB_ERR_PROC_MNGMT_INVALID_DEREG;
-   
-}
\ No newline at end of file
+
+    // swap the last process into the hole
+    size_t last = pl.size - 1;
+    pl.procs[p -> snap_idx] = pl.procs[last];
+    pl.procs[p -> snap_idx] -> snap_idx = p -> snap_idx;
+    pl.size--;
+    pl.snapshot_dirty = true;
+
+    free(p -> name);
+    free(p);
+    return SYS_ERR_OK;
+}
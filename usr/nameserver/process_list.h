@@ -4,32 +4,46 @@
 #include <stdlib.h>
 #include <aos/aos.h>
 #include <aos/aos_rpc.h>
+#include <collections/hash_table.h>
 
 
-struct process_list pl;
 domainid_t process;
 
+// initial capacity of process_list.procs
+#define PROC_TABLE_MIN_SLOTS 64
+// size of the pid list sent over the channel, including the terminator
+#define PROC_LIST_SNAPSHOT_SIZE 1024
+
 struct process {
-    struct process * next;
     domainid_t pid;
     coreid_t core_id;
     char* name;
     struct aos_rpc* rpc;
+    size_t snap_idx;            ///< position in process_list.procs
 };
 
-
 struct process_list{
-    struct process *head;
-    struct process *tail;
+    collections_hash_table *by_pid;
+    collections_hash_table *by_rpc;
+
+    struct process ** procs;        ///< dense, in no particular order
     size_t size;
-};
+    size_t capacity;
 
+    char snapshot[PROC_LIST_SNAPSHOT_SIZE];  ///< "pid,pid,...," of pids
+    size_t snapshot_len;
+    size_t snapshot_count;
+    bool snapshot_dirty;
+};
 
 
+errval_t process_list_init(void);
 errval_t add_process(coreid_t core_id,const char* name,domainid_t pid,struct aos_rpc* rpc );
 errval_t remove_process_by_pid(struct aos_rpc* rpc, domainid_t pid);
 errval_t find_process_by_rpc(struct aos_rpc *rpc,domainid_t * res_pid);
 errval_t get_core_id(domainid_t pid, coreid_t *core_id);
+const char *get_process_name(domainid_t pid);
+const char *get_process_snapshot(size_t *count);
 
 void print_process_list(void);
-#endif 
\ No newline at end of file
+#endif
@@ -60,17 +60,13 @@ void handle_reg_proc(struct aos_rpc *rpc,uintptr_t core_id,const char* name,stru
 
 
 void handle_get_proc_name(struct aos_rpc *rpc, uintptr_t pid,char* name){
-    for(struct process * curr = pl.head; curr != NULL; curr = curr -> next){
-        if(curr -> pid == pid){
-            size_t n = strlen(curr -> name) + 1;
-            for(int i = 0; i < n;++i ){
-                name[i] = curr -> name[i];
-            }
-            // debug_printf("sending: %s\n",name);
-            return;
-        }
+    const char * pname = get_process_name(pid);
+    if(pname == NULL){
+        debug_printf("could not resolve pid name lookup!\n");
+        *name = '\0';
+        return;
     }
-    debug_printf("could not resolve pid name lookup!\n");
+    strcpy(name, pname);
 }
 
 
@@ -89,29 +85,10 @@ void handle_get_proc_core(struct aos_rpc* rpc, uintptr_t pid,uintptr_t *core){
 void handle_get_proc_list(struct aos_rpc *rpc, uintptr_t *size,char * pids){
     // debug_printf("Handle get list of processes\n");
     grading_rpc_handler_process_get_all_pids();
-    *size = pl.size;
-    char buffer[12]; 
-    size_t index = 0;
-    for(struct process * curr = pl.head; curr != NULL; curr = curr -> next){
-        sprintf(buffer,"%d",curr -> pid);
-        // debug_printf("here is buf %s", buffer);
-        char * b_ptr = buffer;
-        while(*b_ptr != '\0'){
-            pids[index] =  *b_ptr;
-            index++;
-            b_ptr++;
-            if(index > 1021){
-                debug_printf("Buffer in channels is not large enough to sned full pid list!\n");
-                pids[index] = '\0';
-                return;
-            }
-        }
-
-        pids[index] = ',';
-        index++;
-    }
-
-    pids[index] = '\0';
+    size_t count;
+    const char * snapshot = get_process_snapshot(&count);
+    *size = count;
+    strcpy(pids, snapshot);
     // debug_printf("%s\n",pids);
 }
 
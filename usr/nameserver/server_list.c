@@ -57,8 +57,8 @@ errval_t find_server_by_name(char * name, struct server_list ** ret_serv){
 void remove_server(struct server_list* del_server){
     if(servers == del_server){
         servers = del_server -> next;
-        free_server(del_server); 
         server_ht -> d.remove(&server_ht -> d, del_server -> name, strlen(del_server -> name));  
+        free_server(del_server); 
         return;
     }
     struct server_list* curr = servers;
@@ -0,0 +1,465 @@
+/**
+ * \file
+ * \brief Packet generator for the software NIC of the enet driver
+ *
+ * Attaches to the tap of an enet driver started as `enet soft` and plays the
+ * network: it resolves the driver's MAC with ARP and then sends ARP requests,
+ * ICMP echo requests or UDP datagrams (to be echoed by the echoserver) with
+ * up to a window of them in flight. Reports throughput and round-trip
+ * latency of the driver's protocol handlers.
+ *
+ * Usage: netgen [-m arp|icmp|udp] [-n count] [-s payload] [-p port] [-w window]
+ *               [-a own ip] [-d driver ip]
+ */
+
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aos/aos.h>
+#include <aos/nameserver.h>
+#include <aos/net_tap.h>
+#include <aos/systime.h>
+#include <netutil/etharp.h>
+#include <netutil/htons.h>
+#include <netutil/ip.h>
+#include <netutil/icmp.h>
+#include <netutil/udp.h>
+#include <netutil/checksum.h>
+
+#define NETGEN_IP           0x0a000202  // 10.0.2.2, default of -a
+#define NETGEN_NIC_IP       0x0a000201  // STATIC_ENET_IP of the driver, default of -d
+#define NETGEN_SRC_PORT     4000
+#define NETGEN_ICMP_ID      0x6e67
+#define NETGEN_TIMEOUT_US   1000000
+
+// locally administered, 02:00:00:00:02:02
+static const struct eth_addr netgen_mac = { { 0x02, 0x00, 0x00, 0x00, 0x02, 0x02 } };
+static const struct eth_addr bcast_mac = { { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff } };
+
+enum netgen_mode {
+    NETGEN_ARP,
+    NETGEN_ICMP,
+    NETGEN_UDP
+};
+
+/// Payload of ICMP and UDP packets, to match the reply and time it
+struct netgen_stamp {
+    uint64_t sent;
+    uint32_t seq;
+} __attribute__((__packed__));
+
+struct netgen {
+    struct net_tap_shm *tap;
+    nameservice_chan_t chan;
+    struct eth_addr nic_mac;
+    uint32_t ip;        ///< our address, host byte order
+    uint32_t nic_ip;    ///< address of the driver, host byte order
+
+    enum netgen_mode mode;
+    size_t size;        ///< payload bytes of ICMP and UDP packets
+    uint16_t port;      ///< UDP destination port
+
+    systime_t last_sent;
+    uint64_t received;
+    uint64_t lat_sum, lat_min, lat_max;     ///< in us
+};
+
+static char *tap_tx_buf(struct netgen *ng)
+{
+    struct net_tap_ring *r = &ng->tap->to_nic;
+    if (r->head - r->tail >= NET_TAP_SLOTS) {
+        return NULL;
+    }
+    return net_tap_to_nic_buf(ng->tap, r->head);
+}
+
+static void tap_tx_put(struct netgen *ng, size_t len)
+{
+    struct net_tap_ring *r = &ng->tap->to_nic;
+    r->len[r->head % NET_TAP_SLOTS] = len;
+    dmb();
+    r->head = r->head + 1;
+}
+
+static char *tap_rx(struct netgen *ng, size_t *len)
+{
+    struct net_tap_ring *r = &ng->tap->from_nic;
+    if (r->tail == r->head) {
+        return NULL;
+    }
+    dmb();
+    *len = r->len[r->tail % NET_TAP_SLOTS];
+    return net_tap_from_nic_buf(ng->tap, r->tail);
+}
+
+static void tap_rx_release(struct netgen *ng)
+{
+    struct net_tap_ring *r = &ng->tap->from_nic;
+    dmb();
+    r->tail = r->tail + 1;
+}
+
+static errval_t tap_attach(struct netgen *ng)
+{
+    errval_t err;
+    struct capref frame;
+    size_t bytes;
+    void *buf;
+
+    err = frame_alloc_and_map(&frame, NET_TAP_SIZE, &bytes, &buf);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    memset(buf, 0, sizeof(struct net_tap_shm));
+    ng->tap = buf;
+
+    err = nameservice_lookup(NET_TAP_SERVICE_NAME, &ng->chan);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    enum net_tap_cmd cmd = NET_TAP_ATTACH;
+    errval_t *reply;
+    size_t reply_bytes;
+    err = nameservice_rpc(ng->chan, &cmd, sizeof(cmd), (void **) &reply,
+                          &reply_bytes, frame, NULL_CAP);
+    if (err_is_ok(err)) {
+        err = *reply;
+        free(reply);
+    }
+    return err;
+}
+
+static void tap_detach(struct netgen *ng)
+{
+    enum net_tap_cmd cmd = NET_TAP_DETACH;
+    void *reply;
+    size_t reply_bytes;
+    errval_t err = nameservice_rpc(ng->chan, &cmd, sizeof(cmd), &reply,
+                                   &reply_bytes, NULL_CAP, NULL_CAP);
+    if (err_is_ok(err)) {
+        free(reply);
+    }
+}
+
+static struct ip_hdr *build_ip(struct netgen *ng, char *frame, uint8_t proto,
+                               size_t len, uint16_t id)
+{
+    struct eth_hdr *eh = (struct eth_hdr *) frame;
+    eh->dst = ng->nic_mac;
+    eh->src = netgen_mac;
+    eh->type = htons(ETH_TYPE_IP);
+
+    struct ip_hdr *ih = (struct ip_hdr *) (frame + ETH_HLEN);
+    IPH_VHL_SET(ih, 4, 5);
+    ih->tos = 0;
+    ih->len = htons(IP_HLEN + len);
+    ih->id = htons(id);
+    ih->offset = htons(0x4000);
+    ih->ttl = 64;
+    ih->proto = proto;
+    ih->src = htonl(ng->ip);
+    ih->dest = htonl(ng->nic_ip);
+    ih->chksum = 0;
+    ih->chksum = inet_checksum(ih, IP_HLEN);
+    return ih;
+}
+
+/**
+ * \brief write the next request into frame
+ * \return length of the frame
+ */
+static size_t build_request(struct netgen *ng, char *frame, uint32_t seq)
+{
+    struct netgen_stamp stamp = {
+        .sent = systime_now(),
+        .seq = seq,
+    };
+    size_t size = ng->size < sizeof(stamp) ? sizeof(stamp) : ng->size;
+
+    switch (ng->mode) {
+    case NETGEN_ARP: {
+        struct eth_hdr *eh = (struct eth_hdr *) frame;
+        eh->dst = bcast_mac;
+        eh->src = netgen_mac;
+        eh->type = htons(ETH_TYPE_ARP);
+
+        struct arp_hdr *ah = (struct arp_hdr *) (frame + ETH_HLEN);
+        ah->hwtype = htons(ARP_HW_TYPE_ETH);
+        ah->proto = htons(ARP_PROT_IP);
+        ah->hwlen = ETH_ADDR_LEN;
+        ah->protolen = 4;
+        ah->opcode = htons(ARP_OP_REQ);
+        ah->eth_src = netgen_mac;
+        ah->ip_src = htonl(ng->ip);
+        memset(&ah->eth_dst, 0, ETH_ADDR_LEN);
+        ah->ip_dst = htonl(ng->nic_ip);
+        return ETH_HLEN + ARP_HLEN;
+    }
+    case NETGEN_ICMP: {
+        struct ip_hdr *ih = build_ip(ng, frame, IP_PROTO_ICMP, ICMP_HLEN + size, seq);
+        struct icmp_echo_hdr *ch = (struct icmp_echo_hdr *) ((char *) ih + IP_HLEN);
+        ch->type = ICMP_ECHO;
+        ch->code = 0;
+        ch->id = htons(NETGEN_ICMP_ID);
+        ch->seqno = htons(seq);
+        memset((char *) ch + ICMP_HLEN, 0x5a, size);
+        memcpy((char *) ch + ICMP_HLEN, &stamp, sizeof(stamp));
+        ch->chksum = 0;
+        ch->chksum = inet_checksum(ch, ICMP_HLEN + size);
+        return ETH_HLEN + IP_HLEN + ICMP_HLEN + size;
+    }
+    case NETGEN_UDP: {
+        struct ip_hdr *ih = build_ip(ng, frame, IP_PROTO_UDP, UDP_HLEN + size, seq);
+        struct udp_hdr *uh = (struct udp_hdr *) ((char *) ih + IP_HLEN);
+        uh->src = htons(NETGEN_SRC_PORT);
+        uh->dest = htons(ng->port);
+        uh->len = htons(UDP_HLEN + size);
+        uh->chksum = 0;
+        memset((char *) uh + UDP_HLEN, 0x5a, size);
+        memcpy((char *) uh + UDP_HLEN, &stamp, sizeof(stamp));
+        // full checksum, so the driver verifies it
+        uint32_t sum = inet_pseudo_sum(ih->src, ih->dest, IP_PROTO_UDP,
+                                       UDP_HLEN + size);
+        uh->chksum = inet_checksum_fold(inet_checksum_partial(uh, UDP_HLEN + size, sum));
+        if (uh->chksum == 0) {
+            uh->chksum = 0xffff;
+        }
+        return ETH_HLEN + IP_HLEN + UDP_HLEN + size;
+    }
+    }
+    return 0;
+}
+
+/**
+ * \brief check whether frame is a reply to one of our requests
+ * \param sent returns when the request was sent
+ */
+static bool match_reply(struct netgen *ng, char *frame, size_t len, systime_t *sent)
+{
+    struct eth_hdr *eh = (struct eth_hdr *) frame;
+    struct netgen_stamp stamp;
+
+    if (ntohs(eh->type) == ETH_TYPE_ARP) {
+        struct arp_hdr *ah = (struct arp_hdr *) (frame + ETH_HLEN);
+        if (ntohs(ah->opcode) != ARP_OP_REP || ntohl(ah->ip_src) != ng->nic_ip) {
+            return false;
+        }
+        ng->nic_mac = ah->eth_src;
+        *sent = ng->last_sent;
+        return ng->mode == NETGEN_ARP;
+    }
+
+    if (ntohs(eh->type) != ETH_TYPE_IP) {
+        return false;
+    }
+    struct ip_hdr *ih = (struct ip_hdr *) (frame + ETH_HLEN);
+    char *l4 = (char *) ih + IP_HLEN;
+    if (ng->mode == NETGEN_ICMP && ih->proto == IP_PROTO_ICMP) {
+        struct icmp_echo_hdr *ch = (struct icmp_echo_hdr *) l4;
+        if (ch->type != ICMP_ER || ntohs(ch->id) != NETGEN_ICMP_ID) {
+            return false;
+        }
+        memcpy(&stamp, l4 + ICMP_HLEN, sizeof(stamp));
+    } else if (ng->mode == NETGEN_UDP && ih->proto == IP_PROTO_UDP) {
+        struct udp_hdr *uh = (struct udp_hdr *) l4;
+        if (ntohs(uh->dest) != NETGEN_SRC_PORT ||
+            ntohs(uh->len) < UDP_HLEN + sizeof(stamp)) {
+            return false;
+        }
+        memcpy(&stamp, l4 + UDP_HLEN, sizeof(stamp));
+    } else {
+        return false;
+    }
+
+    *sent = stamp.sent;
+    return true;
+}
+
+/**
+ * \brief handle all frames the driver has sent
+ * \return number of replies
+ */
+static size_t poll_replies(struct netgen *ng)
+{
+    size_t n = 0;
+    size_t len;
+    char *frame;
+
+    while ((frame = tap_rx(ng, &len)) != NULL) {
+        systime_t sent;
+        if (match_reply(ng, frame, len, &sent)) {
+            uint64_t lat = systime_to_us(systime_now() - sent);
+            ng->lat_sum += lat;
+            ng->lat_min = lat < ng->lat_min ? lat : ng->lat_min;
+            ng->lat_max = lat > ng->lat_max ? lat : ng->lat_max;
+            ng->received++;
+            n++;
+        }
+        tap_rx_release(ng);
+    }
+    return n;
+}
+
+/**
+ * \brief send count requests with up to window in flight and wait for the
+ * replies, gives up after NETGEN_TIMEOUT_US without a reply
+ */
+static void run(struct netgen *ng, uint64_t count, size_t window)
+{
+    uint64_t sent = 0;
+
+    ng->received = 0;
+    ng->lat_sum = 0;
+    ng->lat_min = UINT64_MAX;
+    ng->lat_max = 0;
+
+    systime_t start = systime_now();
+    systime_t last_reply = start;
+    while (ng->received < count) {
+        bool progress = false;
+        while (sent < count && sent - ng->received < window) {
+            char *frame = tap_tx_buf(ng);
+            if (frame == NULL) {
+                break;
+            }
+            ng->last_sent = systime_now();
+            tap_tx_put(ng, build_request(ng, frame, sent));
+            sent++;
+            progress = true;
+        }
+
+        systime_t now = systime_now();
+        if (poll_replies(ng) > 0) {
+            last_reply = now;
+            progress = true;
+        } else if (systime_to_us(now - last_reply) > NETGEN_TIMEOUT_US) {
+            break;
+        }
+
+        if (!progress) {
+            thread_yield();
+        }
+    }
+    uint64_t us = systime_to_us(systime_now() - start);
+
+    static const char *names[] = { "arp", "icmp", "udp" };
+    printf("netgen: %s %" PRIu64 "/%" PRIu64 " replies in %" PRIu64 " us, %" PRIu64
+           " pkt/s, tap dropped %u/%u\n", names[ng->mode], ng->received, sent, us,
+           us ? ng->received * 1000000 / us : 0, ng->tap->to_nic.dropped,
+           ng->tap->from_nic.dropped);
+    if (ng->received > 0) {
+        printf("netgen: latency avg %" PRIu64 " us, min %" PRIu64 " us, max %"
+               PRIu64 " us\n", ng->lat_sum / ng->received, ng->lat_min, ng->lat_max);
+    }
+}
+
+static void usage(const char *name)
+{
+    printf("usage: %s [-m arp|icmp|udp] [-n count] [-s payload] [-p port] [-w window]\n"
+           "       [-a own ip] [-d driver ip]\n", name);
+}
+
+/**
+ * \brief parse a dotted quad into ip, in host byte order
+ */
+static bool parse_ip(const char *str, uint32_t *ip)
+{
+    unsigned int a, b, c, d;
+    char end;
+    if (sscanf(str, "%u.%u.%u.%u%c", &a, &b, &c, &d, &end) != 4
+        || a > 255 || b > 255 || c > 255 || d > 255) {
+        return false;
+    }
+    *ip = (a << 24) | (b << 16) | (c << 8) | d;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    errval_t err;
+    struct netgen ng;
+    uint64_t count = 10000;
+    size_t window = 32;
+
+    memset(&ng, 0, sizeof(ng));
+    ng.mode = NETGEN_UDP;
+    ng.size = 64;
+    ng.port = 2521;
+    ng.ip = NETGEN_IP;
+    ng.nic_ip = NETGEN_NIC_IP;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "-m") == 0) {
+            i++;
+            if (strcmp(argv[i], "arp") == 0) {
+                ng.mode = NETGEN_ARP;
+            } else if (strcmp(argv[i], "icmp") == 0) {
+                ng.mode = NETGEN_ICMP;
+            } else if (strcmp(argv[i], "udp") == 0) {
+                ng.mode = NETGEN_UDP;
+            } else {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+            count = strtoull(argv[++i], NULL, 0);
+        } else if (i + 1 < argc && strcmp(argv[i], "-s") == 0) {
+            ng.size = strtoul(argv[++i], NULL, 0);
+        } else if (i + 1 < argc && strcmp(argv[i], "-p") == 0) {
+            ng.port = strtoul(argv[++i], NULL, 0);
+        } else if (i + 1 < argc && strcmp(argv[i], "-w") == 0) {
+            window = strtoul(argv[++i], NULL, 0);
+        } else if (i + 1 < argc && strcmp(argv[i], "-a") == 0
+                   && parse_ip(argv[i + 1], &ng.ip)) {
+            i++;
+        } else if (i + 1 < argc && strcmp(argv[i], "-d") == 0
+                   && parse_ip(argv[i + 1], &ng.nic_ip)) {
+            i++;
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t max = NET_TAP_SLOT_SIZE - ETH_HLEN - IP_HLEN - UDP_HLEN;
+    if (ng.size > max) {
+        ng.size = max;
+    }
+    if (window == 0 || window > NET_TAP_SLOTS) {
+        window = NET_TAP_SLOTS;
+    }
+
+    err = tap_attach(&ng);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "attaching to the software NIC, is `enet soft` running?");
+        return EXIT_FAILURE;
+    }
+
+    // resolve the driver's MAC, which also puts us into its ARP table
+    enum netgen_mode mode = ng.mode;
+    ng.mode = NETGEN_ARP;
+    run(&ng, 1, 1);
+    if (ng.received == 0) {
+        printf("netgen: no ARP reply from the driver\n");
+        tap_detach(&ng);
+        return EXIT_FAILURE;
+    }
+
+    ng.mode = mode;
+    // ARP requests are told apart by the time they were sent only
+    run(&ng, count, mode == NETGEN_ARP ? 1 : window);
+
+    tap_detach(&ng);
+    return EXIT_SUCCESS;
+}
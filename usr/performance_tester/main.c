@@ -4,15 +4,27 @@
 #include <aos/systime.h>
 #include <aos/aos_rpc.h>
 #include <aos/default_interfaces.h>
+#include <aos/lmp_chan.h>
+#include <aos/aos_datachan.h>
+#include <aos/paging.h>
+#include <aos/frame_pool.h>
 
 
 void benchmark_rpc(void);
+void benchmark_lmp_stream(void);
+void test_stdin_datachan(void);
+void benchmark_first_touch(void);
+void benchmark_copy_on_write(void);
 
 int main(int argc, char *argv[])
 {
     printf("Starting performance measurments\n");
 
     benchmark_rpc();
+    benchmark_lmp_stream();
+    test_stdin_datachan();
+    benchmark_first_touch();
+    benchmark_copy_on_write();
 
     return 0;
 }
@@ -25,17 +37,25 @@ void benchmark_rpc(void)
     debug_printf("Testing round-trip-time\n");
 
     struct aos_rpc *rpc = get_init_rpc();
-    for (int i = 0; i < n_measures; i++) {
-        uint64_t start = systime_now();
+
+    // warm up, the first calls fault in the buffers of both sides
+    for (int i = 0; i < 10; i++) {
         aos_rpc_call(rpc, AOS_RPC_ROUNDTRIP);
-        uint64_t end = systime_now();
-        times[i] = end - start;
     }
 
-    uint64_t avg = 0;
-    for (int i = 0; i < n_measures; i++) avg += times[i];
-    avg /= n_measures;
-    debug_printf("Average round-trip-time over %d measurements: %ld [ns]\n", n_measures, systime_to_ns(avg));
+    const int n_roundtrips = 1000;
+    uint64_t rt_min = UINT64_MAX, rt_max = 0, rt_sum = 0;
+    for (int i = 0; i < n_roundtrips; i++) {
+        uint64_t start = systime_now();
+        aos_rpc_call(rpc, AOS_RPC_ROUNDTRIP);
+        uint64_t time = systime_now() - start;
+        rt_sum += time;
+        if (time < rt_min) rt_min = time;
+        if (time > rt_max) rt_max = time;
+    }
+    debug_printf("Round-trip-time over %d measurements: avg %ld, min %ld, max %ld [ns]\n",
+                 n_roundtrips, systime_to_ns(rt_sum / n_roundtrips),
+                 systime_to_ns(rt_min), systime_to_ns(rt_max));
 
 
     debug_printf("Testing requesting ram\n");
@@ -50,8 +70,393 @@ void benchmark_rpc(void)
         cap_destroy(frame);
     }
 
-    avg = 0;
+    uint64_t avg = 0;
     for (int i = 0; i < n_measures; i++) avg += times[i];
     avg /= n_measures;
     debug_printf("Average time to request frame of size 4096 over %d measurements: %ld [ns]\n", n_measures, systime_to_ns(avg));
 }
+
+
+struct lmp_stream {
+    struct lmp_chan rx;
+    size_t n_msgs;
+    bool fc;
+};
+
+static int lmp_stream_receiver(void *arg)
+{
+    struct lmp_stream *st = arg;
+    size_t received = 0;
+    while (received < st->n_msgs) {
+        struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+        struct capref cap;
+        errval_t err = lmp_chan_recv(&st->rx, &msg, &cap);
+        if (err_no(err) == LIB_ERR_NO_LMP_MSG) {
+            thread_yield();
+            continue;
+        }
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "stream receive\n");
+            return 1;
+        }
+        received++;
+        if (!st->fc) {
+            continue;
+        }
+        if (!capref_is_null(cap)) {
+            lmp_chan_alloc_recv_slot(&st->rx);
+            err = lmp_chan_fc_grant(&st->rx, cap);
+        } else {
+            err = lmp_chan_fc_consumed(&st->rx);
+        }
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "stream credits\n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * \brief Stream n_msgs messages between two threads over an endpoint of depth
+ *
+ * Without flow control the sender retries against the full buffer, as the
+ * channels did before, with it the sender sleeps on its credits.
+ */
+static errval_t lmp_stream_run(size_t depth, bool fc, size_t n_msgs,
+                               uint64_t *time)
+{
+    errval_t err;
+    struct lmp_stream st = { .n_msgs = n_msgs, .fc = fc };
+    struct lmp_chan tx;
+    struct lmp_endpoint *ep;
+    struct capref rx_cap, tx_cap = NULL_CAP;
+
+    lmp_chan_init(&st.rx);
+    err = endpoint_create(LMP_BUF_WORDS(depth), &rx_cap, &ep);
+    ON_ERR_PUSH_RETURN(err, LIB_ERR_ENDPOINT_CREATE);
+    st.rx.endpoint = ep;
+    st.rx.local_cap = rx_cap;
+    st.rx.buflen_words = LMP_BUF_WORDS(depth);
+    err = lmp_chan_alloc_recv_slot(&st.rx);
+    ON_ERR_PUSH_RETURN(err, LIB_ERR_LMP_ALLOC_RECV_SLOT);
+
+    lmp_chan_init(&tx);
+    tx.remote_cap = rx_cap;
+    if (fc) {
+        lmp_chan_fc_init(&st.rx, depth);
+        err = endpoint_create(LMP_BUF_WORDS(AOS_DC_LMP_CREDIT_DEPTH), &tx_cap, &ep);
+        ON_ERR_PUSH_RETURN(err, LIB_ERR_ENDPOINT_CREATE);
+        tx.endpoint = ep;
+        tx.local_cap = tx_cap;
+        tx.buflen_words = LMP_BUF_WORDS(AOS_DC_LMP_CREDIT_DEPTH);
+        lmp_chan_fc_init(&tx, 0);
+    }
+
+    struct thread *receiver = thread_create(lmp_stream_receiver, &st);
+    if (receiver == NULL) {
+        return LIB_ERR_THREAD_CREATE;
+    }
+
+    uint64_t start = systime_now();
+    for (size_t i = 0; i < n_msgs; i++) {
+        if (fc) {
+            err = lmp_chan_fc_send(&tx, 0, i == 0 ? tx_cap : NULL_CAP, i, 0, 0, 0);
+        } else {
+            do {
+                err = lmp_chan_send4(&tx, 0, NULL_CAP, i, 0, 0, 0);
+                if (lmp_err_is_transient(err)) {
+                    thread_yield();
+                }
+            } while (lmp_err_is_transient(err));
+        }
+        ON_ERR_RETURN(err);
+    }
+    int ret;
+    err = thread_join(receiver, &ret);
+    *time = systime_now() - start;
+    ON_ERR_RETURN(err);
+
+    lmp_chan_destroy(&st.rx);
+    if (fc) {
+        lmp_chan_destroy(&tx);
+    }
+    return ret == 0 ? SYS_ERR_OK : LIB_ERR_LMP_CHAN_RECV;
+}
+
+void benchmark_lmp_stream(void)
+{
+    const size_t n_msgs = 10000;
+    const size_t depths[] = { 4, 16, 64 };
+    uint64_t time;
+    errval_t err;
+
+    debug_printf("Testing lmp streaming throughput\n");
+
+    // what the endpoints used to hold
+    err = lmp_stream_run(2, false, n_msgs, &time);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "lmp stream\n");
+        return;
+    }
+    debug_printf("depth  2, retrying:      %zu messages in %ld [ns], %ld [ns/msg]\n",
+                 n_msgs, systime_to_ns(time), systime_to_ns(time) / n_msgs);
+
+    for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+        err = lmp_stream_run(depths[i], true, n_msgs, &time);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "lmp stream\n");
+            return;
+        }
+        debug_printf("depth %2zu, flow control: %zu messages in %ld [ns], %ld [ns/msg]\n",
+                     depths[i], n_msgs, systime_to_ns(time), systime_to_ns(time) / n_msgs);
+    }
+}
+
+
+struct stdin_sender {
+    struct aos_datachan tx;
+    size_t bytes;
+    errval_t err;
+    volatile bool done;
+};
+
+static int stdin_sender_run(void *arg)
+{
+    struct stdin_sender *s = arg;
+    char chunk[100];
+    s->err = SYS_ERR_OK;
+    for (size_t sent = 0; sent < s->bytes && err_is_ok(s->err); sent += sizeof(chunk)) {
+        size_t n = min(sizeof(chunk), s->bytes - sent);
+        for (size_t i = 0; i < n; i++) {
+            chunk[i] = (char) (sent + i);
+        }
+        s->err = aos_dc_send(&s->tx, n, chunk);
+    }
+    s->done = true;
+    return 0;
+}
+
+/**
+ * \brief start a thread that writes a counting pattern into stdin_ep
+ *
+ * The channel is set up the way handle_set_stdout() sets up stdout.
+ */
+static struct thread *stdin_sender_start(struct stdin_sender *s, struct capref stdin_ep,
+                                         size_t bytes)
+{
+    memset(s, 0, sizeof(*s));
+    aos_dc_init_lmp(&s->tx, 64);
+    s->tx.channel.lmp.remote_cap = stdin_ep;
+    s->bytes = bytes;
+    return thread_create(stdin_sender_run, s);
+}
+
+/**
+ * \brief Stream into a flow controlled LMP datachan set up like stdin
+ *
+ * The receiving end is the one init_dispatcher_rpcs() creates for stdin and
+ * DISP_IFACE_GET_STDIN hands out. A second sender binding to it has to be
+ * turned away without disturbing the first.
+ */
+void test_stdin_datachan(void)
+{
+    const size_t n_bytes = 64 * 1024;
+    struct aos_datachan rx;
+    struct capref stdin_ep;
+    struct stdin_sender first, second;
+    errval_t err;
+
+    debug_printf("Testing the stdin datachan\n");
+
+    err = aos_dc_init_lmp(&rx, 1024);
+    if (err_is_ok(err)) {
+        err = aos_dc_create_lmp_endpoint(&rx, AOS_DC_LMP_DEPTH, &stdin_ep);
+    }
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "creating the stdin endpoint\n");
+        return;
+    }
+
+    uint64_t start = systime_now();
+    struct thread *t = stdin_sender_start(&first, stdin_ep, n_bytes);
+    size_t received = 0;
+    bool intact = true;
+    while (received < n_bytes && err_is_ok(err)) {
+        char buf[256];
+        size_t n;
+        err = aos_dc_receive(&rx, min(sizeof(buf), n_bytes - received), buf, &n);
+        for (size_t i = 0; i < n; i++) {
+            intact &= buf[i] == (char) (received + i);
+        }
+        received += n;
+    }
+    uint64_t time = systime_now() - start;
+    thread_join(t, NULL);
+    if (err_is_fail(err) || err_is_fail(first.err) || !intact) {
+        DEBUG_ERR(err_is_fail(err) ? err : first.err, "stdin stream of %zu bytes %s\n",
+                  received, intact ? "failed" : "corrupted");
+        return;
+    }
+    debug_printf("stdin datachan: %zu bytes in %ld [ns]\n", n_bytes, systime_to_ns(time));
+
+    // the second sender's first message is dropped and it learns why
+    t = stdin_sender_start(&second, stdin_ep, 8);
+    received = 0;
+    while (!second.done) {
+        char buf[8];
+        size_t n = 0;
+        aos_dc_receive_available(&rx, sizeof(buf), buf, &n);
+        received += n;
+        thread_yield();
+    }
+    thread_join(t, NULL);
+    if (received != 0 || err_no(err_pop(second.err)) != LIB_ERR_LMP_FC_BOUND) {
+        DEBUG_ERR(second.err, "second stdin sender: %zu bytes got through\n", received);
+        return;
+    }
+    debug_printf("stdin datachan: second sender turned away\n");
+}
+
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * \brief fault in n_pages pages of a fresh lazily mapped region, one by one
+ */
+static errval_t first_touch_run(size_t n_pages, uint64_t *times)
+{
+    errval_t err;
+    // regions are never handed back, every run faults fresh pages
+    struct paging_region *pr = calloc(1, sizeof(struct paging_region));
+    if (pr == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    err = paging_region_init(get_current_paging_state(), pr, n_pages * BASE_PAGE_SIZE,
+                             VREGION_FLAGS_READ_WRITE);
+    ON_ERR_RETURN(err);
+    pr->type = PAGING_REGION_OTHER;
+    strncpy(pr->region_name, "first touch bench", sizeof pr->region_name);
+
+    volatile char *base = (volatile char *) pr->base_addr;
+    for (size_t i = 0; i < n_pages; i++) {
+        uint64_t start = systime_now();
+        base[i * BASE_PAGE_SIZE] = 1;
+        times[i] = systime_now() - start;
+    }
+    return SYS_ERR_OK;
+}
+
+void benchmark_first_touch(void)
+{
+    errval_t err;
+    const size_t n_pages = 64;
+    uint64_t times[n_pages];
+    struct frame_pool_tunables defaults, off = { .target = 0, .low_water = 0, .batch = 1 };
+
+    debug_printf("Testing first touch page faults\n");
+    frame_pool_get_tunables(&defaults);
+
+    for (int pooled = 0; pooled <= 1; pooled++) {
+        frame_pool_set_tunables(pooled ? &defaults : &off);
+        // let the refill thread catch up
+        for (int i = 0; i < 1000 && frame_pool_count() < (pooled ? defaults.target : 0); i++) {
+            thread_yield();
+        }
+
+        err = first_touch_run(n_pages, times);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "first touch benchmark");
+            return;
+        }
+        qsort(times, n_pages, sizeof(uint64_t), compare_u64);
+        debug_printf("%s: %zu faults, p50 %ld, p99 %ld, max %ld [ns]\n",
+                     pooled ? "frame pool" : "no pool   ", n_pages,
+                     systime_to_ns(times[n_pages / 2]),
+                     systime_to_ns(times[n_pages * 99 / 100]),
+                     systime_to_ns(times[n_pages - 1]));
+    }
+    frame_pool_set_tunables(&defaults);
+}
+
+
+/**
+ * \brief compare copying a state frame with mapping it copy-on-write
+ *
+ * The copy-on-write view is set up like a clone maps its state, the first
+ * writes to its pages are timed one by one.
+ */
+void benchmark_copy_on_write(void)
+{
+    errval_t err;
+    const size_t bytes = 1024 * 1024;
+    const size_t n_pages = 64;
+    uint64_t times[n_pages];
+    struct paging_state *st = get_current_paging_state();
+
+    debug_printf("Testing copy-on-write\n");
+
+    struct capref state;
+    size_t state_bytes;
+    char *orig;
+    err = frame_alloc_and_map(&state, bytes, &state_bytes, (void **) &orig);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "allocating state frame");
+        return;
+    }
+    for (size_t i = 0; i < state_bytes; i++) {
+        orig[i] = (char) i;
+    }
+
+    uint64_t start = systime_now();
+    struct capref copy;
+    size_t copy_bytes;
+    char *eager;
+    err = frame_alloc_and_map(&copy, state_bytes, &copy_bytes, (void **) &eager);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "allocating copy");
+        return;
+    }
+    memcpy(eager, orig, state_bytes);
+    uint64_t eager_time = systime_now() - start;
+
+    start = systime_now();
+    struct capref shared;
+    err = slot_alloc(&shared);
+    if (err_is_ok(err)) {
+        err = cap_copy(shared, state);
+    }
+    char *lazy;
+    if (err_is_ok(err)) {
+        err = paging_map_frame_cow(st, (void **) &lazy, state_bytes, shared);
+    }
+    uint64_t map_time = systime_now() - start;
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "mapping state copy-on-write");
+        return;
+    }
+
+    for (size_t i = 0; i < n_pages; i++) {
+        start = systime_now();
+        lazy[i * BASE_PAGE_SIZE] = -1;
+        times[i] = systime_now() - start;
+    }
+
+    bool intact = true;
+    for (size_t i = 0; i < n_pages; i++) {
+        intact &= orig[i * BASE_PAGE_SIZE] == (char) (i * BASE_PAGE_SIZE)
+                  && lazy[i * BASE_PAGE_SIZE + 1] == orig[i * BASE_PAGE_SIZE + 1];
+    }
+
+    qsort(times, n_pages, sizeof(uint64_t), compare_u64);
+    debug_printf("%zu KiB state: copy %ld, cow map %ld [ns]\n", state_bytes / 1024,
+                 systime_to_ns(eager_time), systime_to_ns(map_time));
+    debug_printf("first writes: %zu faults, p50 %ld, p99 %ld, max %ld [ns], original %s\n",
+                 n_pages, systime_to_ns(times[n_pages / 2]),
+                 systime_to_ns(times[n_pages * 99 / 100]),
+                 systime_to_ns(times[n_pages - 1]), intact ? "intact" : "CHANGED");
+}
@@ -5,6 +5,10 @@
  * This file contains code to test recursive spawning (a child
  * spawning another child. Note that you need to have implemented
  * aos_rpc_process_spawn for it to work.)
+ *
+ * Invoked as `spawnTester bench [binary] [n]` it instead measures the
+ * latency of spawning `binary` n times. The first spawn of a binary is
+ * cold (init has no spawn template for it yet), all later ones are warm.
  */
 
 /*
@@ -21,6 +25,11 @@
 #include <aos/aos.h>
 #include <spawn/spawn.h>
 #include <aos/aos_rpc.h>
+#include <aos/systime.h>
+#include <aos/deferred.h>
+
+/// pause between two spawns of the benchmark
+#define SPAWN_BENCH_GAP_US 20000
 
 struct aos_rpc *proc_rpc;
 coreid_t my_core_id;
@@ -45,6 +54,49 @@ static char * utostr(uint8_t i) {
     return ret;
 } 
 
+/**
+ * \brief Spawn 'binary' n_spawns times and print cold and warm spawn latency.
+ */
+static int benchmark_spawn(char *binary, int n_spawns) {
+    errval_t err;
+    uint64_t cold = 0;
+    uint64_t warm_sum = 0;
+    uint64_t warm_min = UINT64_MAX;
+    uint64_t warm_max = 0;
+
+    debug_printf("spawn benchmark: spawning '%s' %d times\n", binary, n_spawns);
+    for (int i = 0; i < n_spawns; i++) {
+        domainid_t pid;
+        uint64_t start = systime_now();
+        err = aos_rpc_process_spawn(proc_rpc, binary, my_core_id, &pid);
+        uint64_t end = systime_now();
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "spawning %s failed", binary);
+            return EXIT_FAILURE;
+        }
+
+        // init builds the spare cspace for the next spawn after it replied,
+        // give it the idle time a real workload would have between spawns
+        barrelfish_usleep(SPAWN_BENCH_GAP_US);
+
+        uint64_t ns = systime_to_ns(end - start);
+        if (i == 0) {
+            cold = ns;
+            continue;
+        }
+        warm_sum += ns;
+        if (ns < warm_min) warm_min = ns;
+        if (ns > warm_max) warm_max = ns;
+    }
+
+    debug_printf("cold spawn: %lu [ns]\n", cold);
+    if (n_spawns > 1) {
+        debug_printf("warm spawn over %d measurements: avg %lu, min %lu, max %lu [ns]\n",
+                     n_spawns - 1, warm_sum / (n_spawns - 1), warm_min, warm_max);
+    }
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[]) {
     
     // get a channel to init
@@ -55,6 +107,12 @@ int main(int argc, char *argv[]) {
     }
     my_core_id = disp_get_current_core_id();
 
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        char *binary = argc >= 3 ? argv[2] : "hello";
+        int n_spawns = argc >= 4 ? strtol(argv[3], NULL, 10) : 20;
+        return benchmark_spawn(binary, n_spawns);
+    }
+
     if (argc < 2) {
         DEBUG_PRINTF("spawnTester with level 0 is running.\n");
         return EXIT_SUCCESS;
@@ -0,0 +1,198 @@
+/**
+ * \file
+ * \brief Streams the trace buffer of this core over serial or into a file
+ *
+ * Maps the trace buffer read-only and follows the writers with its own
+ * position in the ring. Events that were overwritten before we got to them
+ * are reported as lost. Every event is printed as one line
+ *
+ *     <ns since trace start> <subsystem> <event> <argument>
+ *
+ * with the numbers of trace_definitions/trace_defs.pleco, the names can be
+ * looked up in the generated trace_defs.json.
+ *
+ * Usage: tracer [-f file] [-n events] [-p poll_ms]
+ *
+ * Without -f, the events are streamed to stdout until -n events were printed
+ * (forever by default). With -f, -n events (default 4096) are collected and
+ * then written to the file.
+ */
+
+/*
+ * Copyright (c) 2020, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aos/aos.h>
+#include <aos/deferred.h>
+#include <aos/systime.h>
+#include <aos/fs_service.h>
+#include <trace/trace.h>
+
+#define TRACER_LINE_MAX         64
+#define TRACER_FILE_EVENTS      4096
+#define TRACER_POLL_MS          10
+
+struct tracer_state {
+    struct trace_buffer *tb;
+    uintptr_t pos;              ///< next event to read, in head_index units
+    uint64_t printed;
+    uint64_t lost;
+
+    char *out;                  ///< file contents, NULL when streaming
+    size_t out_len;
+    size_t out_size;
+};
+
+static void tracer_emit(struct tracer_state *ts, const char *line)
+{
+    if (ts->out == NULL) {
+        fputs(line, stdout);
+        return;
+    }
+
+    size_t len = strlen(line);
+    if (ts->out_len + len + 1 > ts->out_size) {
+        return;
+    }
+    memcpy(ts->out + ts->out_len, line, len + 1);
+    ts->out_len += len;
+}
+
+static void tracer_emit_event(struct tracer_state *ts, struct trace_event *ev)
+{
+    char line[TRACER_LINE_MAX];
+    uint64_t t0 = ts->tb->t0;
+    uint64_t ns = ev->timestamp > t0 ? systime_to_ns(ev->timestamp - t0) : 0;
+
+    snprintf(line, sizeof line, "%" PRIu64 " %u %u 0x%08x\n", ns,
+             ev->u.ev.subsystem, ev->u.ev.event, ev->u.ev.arg);
+    tracer_emit(ts, line);
+    ts->printed++;
+}
+
+/**
+ * \brief Reads all events the writers have produced since the last call
+ *
+ * \param limit Stop after this many events in total, 0 for no limit.
+ */
+static void tracer_drain(struct tracer_state *ts, uint64_t limit)
+{
+    struct trace_buffer *tb = ts->tb;
+    uintptr_t head = tb->head_index;
+
+    if (head - ts->pos > TRACE_MAX_EVENTS) {
+        ts->lost += head - ts->pos - TRACE_MAX_EVENTS;
+        ts->pos = head - TRACE_MAX_EVENTS;
+    }
+
+    for (; ts->pos != head; ts->pos++) {
+        if (limit != 0 && ts->printed >= limit) {
+            return;
+        }
+
+        struct trace_event ev;
+        enum trace_slot_state state = trace_read_slot(tb, ts->pos, &ev);
+        if (state == TRACE_SLOT_PENDING) {
+            // a writer claimed the slot but has not filled it yet, continue
+            // from here on the next poll
+            return;
+        }
+        if (state == TRACE_SLOT_LOST) {
+            // the writers lapped us
+            ts->lost++;
+            continue;
+        }
+        tracer_emit_event(ts, &ev);
+    }
+}
+
+static void usage(const char *name)
+{
+    printf("usage: %s [-f file] [-n events] [-p poll_ms]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    errval_t err;
+    char *path = NULL;
+    uint64_t limit = 0;
+    delayus_t poll = TRACER_POLL_MS * 1000;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "-f") == 0) {
+            path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+            limit = strtoull(argv[++i], NULL, 0);
+        } else if (i + 1 < argc && strcmp(argv[i], "-p") == 0) {
+            poll = strtoull(argv[++i], NULL, 0) * 1000;
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct tracer_state ts;
+    memset(&ts, 0, sizeof ts);
+
+    err = trace_map_readonly(&ts.tb);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "no trace buffer, is the tree built with trace = True?");
+        return EXIT_FAILURE;
+    }
+
+    // our own output goes through RPCs, which must not show up in the trace
+    trace_disable_domain();
+
+    if (path != NULL) {
+        if (limit == 0) {
+            limit = TRACER_FILE_EVENTS;
+        }
+        ts.out_size = limit * TRACER_LINE_MAX + TRACER_LINE_MAX;
+        ts.out = malloc(ts.out_size);
+        if (ts.out == NULL) {
+            DEBUG_ERR(LIB_ERR_MALLOC_FAIL, "allocating the output buffer");
+            return EXIT_FAILURE;
+        }
+        ts.out[0] = '\0';
+    }
+
+    // start with the oldest event that is still in the ring
+    uintptr_t head = ts.tb->head_index;
+    ts.pos = head > TRACE_MAX_EVENTS ? head - TRACE_MAX_EVENTS : 0;
+
+    tracer_emit(&ts, "# ns subsys event arg\n");
+    while (limit == 0 || ts.printed < limit) {
+        uint64_t lost = ts.lost;
+        tracer_drain(&ts, limit);
+        if (ts.lost != lost) {
+            char line[TRACER_LINE_MAX];
+            snprintf(line, sizeof line, "# lost %" PRIu64 " events\n",
+                     ts.lost - lost);
+            tracer_emit(&ts, line);
+        }
+        if (path == NULL) {
+            fflush(stdout);
+        }
+        if (limit == 0 || ts.printed < limit) {
+            barrelfish_usleep(poll);
+        }
+    }
+
+    if (path != NULL) {
+        write_file(path, ts.out);
+        printf("tracer: wrote %" PRIu64 " events to %s (%" PRIu64 " lost)\n",
+               ts.printed, path, ts.lost);
+        free(ts.out);
+    }
+
+    return EXIT_SUCCESS;
+}